@@ -3,6 +3,7 @@ SET(LIBNFC_DRIVER_ACR122_PCSC ON CACHE BOOL "Enable ACR122 support (Depends on P
 SET(LIBNFC_DRIVER_PN53X_USB ON CACHE BOOL "Enable PN531 and PN531 USB support (Depends on libusb)")
 SET(LIBNFC_DRIVER_ARYGON ON CACHE BOOL "Enable ARYGON support (Use serial port)")
 SET(LIBNFC_DRIVER_PN532_UART OFF CACHE BOOL "Enable PN532 UART support (Use serial port)")
+SET(LIBNFC_DRIVER_PN53X_SIM OFF CACHE BOOL "Enable PN53x simulator support (No hardware, for tests and benchmarks)")
 
 IF(LIBNFC_DRIVER_ACR122_PCSC)
   FIND_PACKAGE(PCSC REQUIRED)
@@ -26,5 +27,10 @@ IF(LIBNFC_DRIVER_PN532_UART)
   SET(DRIVERS_SOURCES ${DRIVERS_SOURCES} "drivers/pn532_uart")
 ENDIF(LIBNFC_DRIVER_PN532_UART)
 
+IF(LIBNFC_DRIVER_PN53X_SIM)
+  ADD_DEFINITIONS("-DDRIVER_PN53X_SIM_ENABLED")
+  SET(DRIVERS_SOURCES ${DRIVERS_SOURCES} "drivers/pn53x_sim")
+ENDIF(LIBNFC_DRIVER_PN53X_SIM)
+
 INCLUDE_DIRECTORIES(${CMAKE_CURRENT_SOURCE_DIR}/drivers)
 
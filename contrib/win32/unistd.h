@@ -30,6 +30,7 @@
 // Needed by Sleep() under Windows
 #  include <winbase.h>
 #  define sleep(X) Sleep( X * 1000)
+#  define usleep(X) Sleep( (X) / 1000)
 
 // With MinGW, getopt(3) is provided as separate header
 #if defined(WIN32) && defined(__GNUC__) /* mingw compiler */
@@ -0,0 +1,144 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library examples
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *  1) Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  2 )Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Note that this license only applies on the examples, NFC library itself is under LGPL
+ *
+ */
+
+/**
+ * @file pn53x-bench.c
+ * @brief Measure how many PN53x commands per second a device can go through
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <nfc/nfc.h>
+
+#include "utils/nfc-utils.h"
+#include "libnfc/chips/pn53x.h"
+
+#define DEFAULT_COUNT 1000
+#define DEFAULT_SIZE  16
+
+static void
+print_usage(const char *progname)
+{
+  printf("usage: %s [-n COUNT] [-s SIZE] [CONNSTRING]\n", progname);
+  printf("  -n COUNT  Number of commands to send (default: %d)\n", DEFAULT_COUNT);
+  printf("  -s SIZE   Payload size of each command, in bytes (default: %d)\n", DEFAULT_SIZE);
+  printf("  CONNSTRING  Device to use, the first one found otherwise\n");
+}
+
+static double
+elapsed_us(const struct timeval *start, const struct timeval *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_usec - start->tv_usec);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  long count = DEFAULT_COUNT;
+  long size = DEFAULT_SIZE;
+  const char *connstring = NULL;
+
+  for (int arg = 1; arg < argc; arg++) {
+    if ((0 == strcmp(argv[arg], "-n")) && (arg + 1 < argc)) {
+      count = strtol(argv[++arg], NULL, 10);
+    } else if ((0 == strcmp(argv[arg], "-s")) && (arg + 1 < argc)) {
+      size = strtol(argv[++arg], NULL, 10);
+    } else if ((argv[arg][0] != '-') && !connstring) {
+      connstring = argv[arg];
+    } else {
+      print_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  // Diagnose command code, NumTst and the payload have to fit in a frame
+  if ((count < 1) || (size < 0) || (size > PN53x_EXTENDED_FRAME__DATA_MAX_LEN - 2)) {
+    print_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  nfc_context *context;
+  nfc_init(&context);
+  if (context == NULL) {
+    ERR("Unable to init libnfc (malloc)");
+    exit(EXIT_FAILURE);
+  }
+
+  nfc_device *pnd = nfc_open(context, connstring);
+  if (pnd == NULL) {
+    ERR("%s", "Unable to open NFC device.");
+    nfc_exit(context);
+    exit(EXIT_FAILURE);
+  }
+  printf("NFC device [%s] opened.\n", nfc_device_get_name(pnd));
+
+  // Communication line test: the PN53x echoes the payload back
+  uint8_t abtCmd[PN53x_EXTENDED_FRAME__DATA_MAX_LEN] = { Diagnose, 0x00 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  for (long n = 0; n < size; n++)
+    abtCmd[2 + n] = (uint8_t) n;
+
+  double min_us = 0, max_us = 0;
+  long failures = 0;
+  struct timeval start, end, cmd_start, cmd_end;
+  gettimeofday(&start, NULL);
+  for (long i = 0; i < count; i++) {
+    gettimeofday(&cmd_start, NULL);
+    int res = pn53x_transceive(pnd, abtCmd, 2 + size, abtRx, sizeof(abtRx), -1);
+    gettimeofday(&cmd_end, NULL);
+    // Result of Diagnose ping for RC-S360 doesn't contain status byte so we've to handle both cases
+    if ((res < 0) ||
+        ((memcmp(abtCmd + 1, abtRx, 1 + size) != 0) && (memcmp(abtCmd + 2, abtRx, size) != 0))) {
+      failures++;
+      continue;
+    }
+    double us = elapsed_us(&cmd_start, &cmd_end);
+    if ((min_us == 0) || (us < min_us))
+      min_us = us;
+    if (us > max_us)
+      max_us = us;
+  }
+  gettimeofday(&end, NULL);
+
+  double total_us = elapsed_us(&start, &end);
+  printf("%ld commands with %ld bytes payload in %.3f s\n", count, size, total_us / 1e6);
+  printf(" Throughput: %.1f commands/s\n", count * 1e6 / total_us);
+  printf(" Latency: %.1f us mean, %.1f us min, %.1f us max\n", total_us / count, min_us, max_us);
+  if (failures)
+    printf(" Failures: %ld\n", failures);
+
+  nfc_close(pnd);
+  nfc_exit(context);
+  exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
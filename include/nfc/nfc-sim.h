@@ -0,0 +1,65 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-sim.h
+ * @brief Virtual targets and initiators of the pn53x_sim driver
+ *
+ * The pn53x_sim driver simulates a PN532 and the RF field around it, no
+ * hardware is needed. Targets put in the field and the initiator which
+ * activates the chip as target are \a nfc_emulator: their \a target gives
+ * the modulation and what anticollision reports, their state machine
+ * answers the frames they get.
+ */
+
+#ifndef __NFC_SIM_H__
+#define __NFC_SIM_H__
+
+#include <sys/types.h>
+#include <nfc/nfc.h>
+#include <nfc/nfc-emulation.h>
+
+#ifdef __cplusplus
+extern  "C" {
+#endif /* __cplusplus */
+
+  /**
+   * @struct nfc_sim_memory
+   * @brief Memory of a virtual MIFARE Classic, MIFARE Ultralight or FeliCa target
+   *
+   * Set by nfc_sim_memory_init(), \a data is read and written in place.
+   */
+  struct nfc_sim_memory {
+    struct nfc_emulation_state_machine state_machine;
+    uint8_t *data;
+    size_t data_len;
+    /** MIFARE Classic sector the last authentication was done on, -1 if none */
+    int sector;
+  };
+
+  NFC_EXPORT int nfc_sim_add_target(nfc_device *pnd, struct nfc_emulator *emulator);
+  NFC_EXPORT int nfc_sim_remove_target(nfc_device *pnd, const struct nfc_emulator *emulator);
+  NFC_EXPORT int nfc_sim_set_initiator(nfc_device *pnd, struct nfc_emulator *emulator);
+  NFC_EXPORT int nfc_sim_set_latency(nfc_device *pnd, const uint32_t wire_speed, const bool rf);
+  NFC_EXPORT int nfc_sim_memory_init(struct nfc_emulator *emulator, struct nfc_sim_memory *memory, nfc_target *pnt,
+                                     uint8_t *data, const size_t data_len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __NFC_SIM_H__ */
@@ -134,6 +134,12 @@ typedef enum {
   NP_FORCE_ISO14443_B,
   /** Force the chip to run at 106 kbps */
   NP_FORCE_SPEED_106,
+  /** Once an ISO14443-4A target is activated, switch to the highest bit rate
+   * both the device and the target handle (PPS), as told by TA(1) in the ATS.
+   * A rate above 106 kbps asked in the modulation used for selection caps it.
+   * The rate in use is reported in the nfc_target. Needs NP_AUTO_ISO14443_4,
+   * nfc_initiator_init() turns it off. */
+  NP_AUTO_PPS,
 } nfc_property;
 
 // Compiler directive, set struct alignment to 1 uint8_t for compatibility
@@ -325,6 +331,156 @@ typedef struct {
   nfc_modulation nm;
 } nfc_target;
 
+/**
+ * @struct nfc_iovec
+ * @brief Part of a frame, consecutive parts are sent as one frame
+ */
+typedef struct {
+  const uint8_t *pbtData;
+  size_t szData;
+} nfc_iovec;
+
+/**
+ * @struct nfc_completion
+ * @brief Outcome of an asynchronous request
+ */
+typedef struct {
+  /** What the blocking function would have returned */
+  int res;
+  /** Receiving buffer given with the request */
+  uint8_t *pbtRx;
+  /** User data given with the request */
+  void *user_data;
+} nfc_completion;
+
+/**
+ * @brief Function called when an asynchronous request is completed, from the I/O thread of the device or nfc_device_process_events()
+ */
+typedef void (*nfc_completion_cb)(nfc_device *pnd, const nfc_completion *pc);
+
+/**
+ * @enum nfc_presence_event
+ * @brief What the presence monitor saw happen to a target
+ */
+typedef enum {
+  NFC_TARGET_ARRIVED,
+  NFC_TARGET_REMOVED,
+} nfc_presence_event;
+
+/**
+ * @brief Function called by the presence monitor, from its thread
+ */
+typedef void (*nfc_presence_cb)(nfc_device *pnd, nfc_presence_event event, const nfc_target *pnt, void *user_data);
+
+/** Bytes of a frame kept by the trace, enough for any PN53x frame */
+#define NFC_TRACE_SNAPLEN 280
+
+/**
+ * @enum nfc_trace_layer
+ * @brief Where a traced frame was seen
+ */
+typedef enum {
+  /** As written to or read from the serial port, USB endpoint or PC/SC reader */
+  NFC_TRACE_BUS,
+  /** PN53x command or response, without its frame */
+  NFC_TRACE_CHIP,
+} nfc_trace_layer;
+
+/**
+ * @enum nfc_trace_direction
+ * @brief Traced frame direction, from the host point of view
+ */
+typedef enum {
+  NFC_TRACE_TX,
+  NFC_TRACE_RX,
+} nfc_trace_direction;
+
+/**
+ * @struct nfc_trace_record
+ * @brief Frame kept by the trace of a device
+ */
+typedef struct {
+  /** CLOCK_MONOTONIC time the frame was seen at, in nanoseconds */
+  uint64_t timestamp;
+  nfc_trace_layer layer;
+  nfc_trace_direction direction;
+  /** PN53x command the frame belongs to */
+  uint8_t btCommand;
+  /** Frame length */
+  size_t szFrame;
+  /** Bytes of the frame in abtData, at most NFC_TRACE_SNAPLEN */
+  size_t szData;
+  uint8_t abtData[NFC_TRACE_SNAPLEN];
+} nfc_trace_record;
+
+/**
+ * Buckets of a latency histogram. Below 8 us each bucket is 1 us wide, then
+ * every power of two is split in 8 buckets, up to 2^24 us (about 16 s).
+ * Bucket n >= 8 starts at (8 + n % 8) << (n / 8 - 1) us.
+ */
+#define NFC_STATS_BUCKETS 176
+/** PN53x commands followed by the statistics of a device */
+#define NFC_STATS_COMMANDS 48
+/** PN53x status bytes, the error codes are 6 bits long */
+#define NFC_STATS_STATUS_LEN 64
+
+/**
+ * @struct nfc_latency_stats
+ * @brief Latency histogram, the percentiles are accurate to 12.5%
+ */
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t buckets[NFC_STATS_BUCKETS];
+} nfc_latency_stats;
+
+/**
+ * @struct nfc_command_stats
+ * @brief Statistics of one PN53x command
+ */
+typedef struct {
+  /** PN53x command code */
+  uint8_t btCommand;
+  /** Answers with an error status */
+  uint32_t errors;
+  /** Answers which did not come in time */
+  uint32_t timeouts;
+  /** From the command sent to its answer received, errors included */
+  nfc_latency_stats latency;
+} nfc_command_stats;
+
+/**
+ * @struct nfc_device_stats
+ * @brief Statistics of a device since it was opened or they were reset
+ */
+typedef struct {
+  /** Commands sent to the chip */
+  uint32_t commands;
+  /** Commands without answer in time, NFC_ETIMEOUT */
+  uint32_t timeouts;
+  /** Commands lost to another I/O error */
+  uint32_t io_errors;
+  /** Answers by error status byte, status_errors[0] is unused */
+  uint32_t status_errors[NFC_STATS_STATUS_LEN];
+  /** Bytes on the bus, frames included */
+  uint64_t wire_tx_bytes;
+  uint64_t wire_rx_bytes;
+  /** Bytes of the PN53x commands and responses */
+  uint64_t payload_tx_bytes;
+  uint64_t payload_rx_bytes;
+  /** From a command sent to the chip to its ACK frame */
+  nfc_latency_stats ack_wait;
+  /** Number of entries in command_stats */
+  size_t szCommands;
+  /** Commands in the order they were first sent */
+  nfc_command_stats command_stats[NFC_STATS_COMMANDS];
+} nfc_device_stats;
+
 // Reset struct alignment to default
 #  pragma pack()
 
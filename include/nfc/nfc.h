@@ -80,6 +80,7 @@ extern  "C" {
   NFC_EXPORT void nfc_init(nfc_context **context) ATTRIBUTE_NONNULL(1);
   NFC_EXPORT void nfc_exit(nfc_context *context) ATTRIBUTE_NONNULL(1);
   NFC_EXPORT int nfc_register_driver(const nfc_driver *driver);
+  NFC_EXPORT int nfc_context_register_driver(nfc_context *context, const nfc_driver *driver);
 
   /* NFC Device/Hardware manipulation */
   NFC_EXPORT nfc_device *nfc_open(nfc_context *context, const nfc_connstring connstring) ATTRIBUTE_NONNULL(1);
@@ -98,10 +99,35 @@ extern  "C" {
   NFC_EXPORT int nfc_initiator_poll_dep_target(nfc_device *pnd, const nfc_dep_mode ndm, const nfc_baud_rate nbr, const nfc_dep_info *pndiInitiator, nfc_target *pnt, const int timeout);
   NFC_EXPORT int nfc_initiator_deselect_target(nfc_device *pnd);
   NFC_EXPORT int nfc_initiator_transceive_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout);
+  NFC_EXPORT int nfc_initiator_transceive_apdu(nfc_device *pnd, const nfc_target *pnt, const nfc_iovec aiovTx[], const size_t szIovTx, uint8_t *pbtRx, const size_t szRx, int timeout);
   NFC_EXPORT int nfc_initiator_transceive_bits(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTxBits, const uint8_t *pbtTxPar, uint8_t *pbtRx, const size_t szRx, uint8_t *pbtRxPar);
   NFC_EXPORT int nfc_initiator_transceive_bytes_timed(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, uint32_t *cycles);
   NFC_EXPORT int nfc_initiator_transceive_bits_timed(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTxBits, const uint8_t *pbtTxPar, uint8_t *pbtRx, const size_t szRx, uint8_t *pbtRxPar, uint32_t *cycles);
   NFC_EXPORT int nfc_initiator_target_is_present(nfc_device *pnd, const nfc_target nt);
+  NFC_EXPORT int nfc_initiator_target_transceive_bytes(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout);
+  NFC_EXPORT int nfc_initiator_target_deselect(nfc_device *pnd, const nfc_target *pnt);
+  NFC_EXPORT int nfc_initiator_target_release(nfc_device *pnd, const nfc_target *pnt);
+
+  /* Asynchronous requests, run by an I/O thread of the device or from the caller's event loop */
+  NFC_EXPORT int nfc_initiator_transceive_bytes_async(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data);
+  NFC_EXPORT int nfc_initiator_target_transceive_bytes_async(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data);
+  NFC_EXPORT int nfc_device_submit(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data);
+  NFC_EXPORT int nfc_device_get_completion(nfc_device *pnd, nfc_completion *pc, int timeout);
+  NFC_EXPORT int nfc_device_get_pollfd(nfc_device *pnd);
+  NFC_EXPORT int nfc_device_get_event_timeout(nfc_device *pnd);
+  NFC_EXPORT int nfc_device_process_events(nfc_device *pnd, nfc_completion_cb cb);
+
+  /* Presence monitor, run by a thread of the device */
+  NFC_EXPORT int nfc_initiator_monitor_start(nfc_device *pnd, const nfc_modulation *pnmModulations, const size_t szModulations, const int period, nfc_presence_cb cb, void *user_data);
+  NFC_EXPORT int nfc_initiator_monitor_stop(nfc_device *pnd);
+
+  /* Frame trace, kept by each device */
+  NFC_EXPORT size_t nfc_device_get_trace(nfc_device *pnd, nfc_trace_record records[], const size_t records_len);
+  NFC_EXPORT int nfc_trace_write_pcapng(FILE *stream, const nfc_trace_record records[], const size_t records_count);
+
+  /* Statistics, kept by each device */
+  NFC_EXPORT void nfc_device_get_stats(nfc_device *pnd, nfc_device_stats *stats);
+  NFC_EXPORT void nfc_device_reset_stats(nfc_device *pnd);
 
   /* NFC target: act as tag (i.e. MIFARE Classic) or NFC target device. */
   NFC_EXPORT int nfc_target_init(nfc_device *pnd, nfc_target *pnt, uint8_t *pbtRx, const size_t szRx, int timeout);
@@ -33,6 +33,13 @@
 #include <nfc/nfc.h>
 #include "nfc-internal.h"
 
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <time.h>
+#else
+#  include <windows.h>
+#endif
+
 // Test if we are dealing with unix operating systems
 #ifndef _WIN32
 // The POSIX serial port implementation
@@ -41,3 +48,280 @@
 // The windows serial port implementation
 #  include "uart_win32.c"
 #endif /* _WIN32 */
+
+char **
+uart_list_ports(void)
+{
+  size_t count = 0;
+  struct uart_port_info *ports = uart_list_ports_info(&count);
+  char **res = malloc((count + 1) * sizeof(char *));
+  if (!res) {
+    free(ports);
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++)
+    res[i] = strdup(ports[i].port);
+  res[count] = NULL;
+  free(ports);
+  return res;
+}
+
+// Count of ports probed at the same time
+#define UART_SCAN_MAX_THREADS 32
+// Ports not yet probed when this delay is elapsed are skipped
+#define UART_SCAN_DEADLINE_MS 3000
+// Count of remembered probe results and how long they are trusted
+#define UART_SCAN_CACHE_LEN 64
+#define UART_SCAN_CACHE_TTL_MS 60000
+
+static uint32_t
+uart_scan_now_ms(void)
+{
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+  return GetTickCount();
+#endif
+}
+
+/*
+ * Probe results of the ports which physical location is known. A port found
+ * by a driver is skipped by the others, a port where a driver found nothing
+ * is skipped by this driver. USB ports are told apart by their device address
+ * and serial number so that a plugged again adapter is probed again. Nothing
+ * tells when a reader is plugged to another port, so only USB ports are
+ * remembered as empty.
+ */
+struct uart_scan_cache_entry {
+  char port_id[sizeof(((struct uart_port_info *)0)->sysfs_path) + 8 + sizeof(((struct uart_port_info *)0)->serial)];
+  const char *driver_name;
+  bool found;
+  uint32_t timestamp;
+};
+
+static struct uart_scan_cache_entry uart_scan_cache[UART_SCAN_CACHE_LEN];
+static size_t uart_scan_cache_next = 0;
+#ifndef _WIN32
+static pthread_mutex_t uart_scan_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define uart_scan_cache_lock() pthread_mutex_lock(&uart_scan_cache_mutex)
+#  define uart_scan_cache_unlock() pthread_mutex_unlock(&uart_scan_cache_mutex)
+#else
+#  define uart_scan_cache_lock()
+#  define uart_scan_cache_unlock()
+#endif
+
+static bool
+uart_scan_cache_is_fresh(const struct uart_scan_cache_entry *entry, const char *port_id)
+{
+  return entry->driver_name && (strcmp(entry->port_id, port_id) == 0) &&
+         ((uint32_t)(uart_scan_now_ms() - entry->timestamp) < UART_SCAN_CACHE_TTL_MS);
+}
+
+static bool
+uart_scan_cache_skip(const char *port_id, const char *driver_name)
+{
+  bool skip = false;
+  uart_scan_cache_lock();
+  for (size_t i = 0; i < UART_SCAN_CACHE_LEN; i++) {
+    const struct uart_scan_cache_entry *entry = &uart_scan_cache[i];
+    if (!uart_scan_cache_is_fresh(entry, port_id))
+      continue;
+    if ((strcmp(entry->driver_name, driver_name) == 0) ? !entry->found : entry->found) {
+      skip = true;
+      break;
+    }
+  }
+  uart_scan_cache_unlock();
+  return skip;
+}
+
+static void
+uart_scan_cache_put(const char *port_id, const char *driver_name, const bool found)
+{
+  uart_scan_cache_lock();
+  struct uart_scan_cache_entry *slot = NULL;
+  for (size_t i = 0; i < UART_SCAN_CACHE_LEN; i++) {
+    struct uart_scan_cache_entry *entry = &uart_scan_cache[i];
+    if (!entry->driver_name || (strcmp(entry->port_id, port_id) != 0))
+      continue;
+    if (strcmp(entry->driver_name, driver_name) == 0) {
+      slot = entry;
+    } else if (found) {
+      // Whatever other drivers did see there is outdated
+      entry->driver_name = NULL;
+    }
+  }
+  if (!slot) {
+    slot = &uart_scan_cache[uart_scan_cache_next];
+    uart_scan_cache_next = (uart_scan_cache_next + 1) % UART_SCAN_CACHE_LEN;
+  }
+  snprintf(slot->port_id, sizeof(slot->port_id), "%s", port_id);
+  slot->driver_name = driver_name;
+  slot->found = found;
+  slot->timestamp = uart_scan_now_ms();
+  uart_scan_cache_unlock();
+}
+
+static bool
+uart_adapter_match(const struct uart_port_info *info, const struct uart_adapter adapters[], const size_t adapters_len)
+{
+  // Nothing known about the port, it has to be probed
+  if (!adapters || !info->driver[0])
+    return true;
+  for (size_t i = 0; i < adapters_len; i++) {
+    if (adapters[i].vid != info->vid)
+      continue;
+    if (adapters[i].pid && (adapters[i].pid != info->pid))
+      continue;
+    if (adapters[i].driver && (strcmp(adapters[i].driver, info->driver) != 0))
+      continue;
+    return true;
+  }
+  return false;
+}
+
+struct uart_scan {
+  const nfc_context *context;
+  const char *driver_name;
+  uart_probe probe;
+  struct uart_port_info *ports;
+  bool *usb;
+  char (*port_ids)[sizeof(((struct uart_scan_cache_entry *)0)->port_id)];
+  size_t port_count;
+  size_t next_port;
+  uint32_t deadline;
+  bool *found;
+  nfc_connstring *connstrings;
+#ifndef _WIN32
+  pthread_mutex_t mutex;
+#endif
+};
+
+static void *
+uart_scan_worker(void *arg)
+{
+  struct uart_scan *scan = arg;
+  for (;;) {
+#ifndef _WIN32
+    pthread_mutex_lock(&scan->mutex);
+#endif
+    size_t port = scan->next_port;
+    if ((port < scan->port_count) && ((int32_t)(uart_scan_now_ms() - scan->deadline) < 0)) {
+      scan->next_port++;
+    } else {
+      port = scan->port_count;
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&scan->mutex);
+#endif
+    if (port == scan->port_count)
+      break;
+    // Each port has its own slot, no need to lock for the probe itself
+    int res = scan->probe(scan->context, scan->ports[port].port, scan->connstrings[port]);
+    scan->found[port] = (res > 0);
+    if ((res >= 0) && scan->port_ids[port][0] && ((res > 0) || scan->usb[port]))
+      uart_scan_cache_put(scan->port_ids[port], scan->driver_name, (res > 0));
+  }
+  return NULL;
+}
+
+/**
+ * @brief Probe the serial ports of the system with \a probe
+ *
+ * Ports behind one of the \a adapters are probed first, then the other USB
+ * ports, when that can be told. Other ports are skipped, as are the USB ports
+ * recently probed without success.
+ * Ports are probed concurrently by a bounded pool of threads, so the scan
+ * lasts about as long as the slowest port instead of the sum of all ports.
+ * Ports not yet probed once the scan deadline is reached are skipped.
+ * Found devices are returned in probing order.
+ */
+size_t
+uart_scan_ports(const nfc_context *context, const char *driver_name, const struct uart_adapter adapters[], const size_t adapters_len, uart_probe probe, nfc_connstring connstrings[], const size_t connstrings_len)
+{
+  struct uart_scan scan = {
+    .context = context,
+    .driver_name = driver_name,
+    .probe = probe,
+    .port_count = 0,
+    .next_port = 0,
+    .deadline = uart_scan_now_ms() + UART_SCAN_DEADLINE_MS,
+  };
+  size_t device_found = 0;
+  size_t count = 0;
+
+  struct uart_port_info *ports = uart_list_ports_info(&count);
+  scan.ports = calloc(count ? count : 1, sizeof(struct uart_port_info));
+  scan.usb = calloc(count ? count : 1, sizeof(bool));
+  scan.port_ids = calloc(count ? count : 1, sizeof(*scan.port_ids));
+  scan.found = calloc(count ? count : 1, sizeof(bool));
+  scan.connstrings = calloc(count ? count : 1, sizeof(nfc_connstring));
+  if ((count == 0) || !ports || !scan.ports || !scan.usb || !scan.port_ids || !scan.found || !scan.connstrings)
+    goto out;
+
+  // Keep only the ports worth probing, the plausible adapters first
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < count; i++) {
+      const struct uart_port_info *info = &ports[i];
+      if (uart_adapter_match(info, adapters, adapters_len) != (pass == 0))
+        continue;
+      if ((pass == 1) && !info->vid) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Skipping serial port %s (driver %s) for %s.", info->port, info->driver, driver_name);
+        continue;
+      }
+      char port_id[sizeof(*scan.port_ids)] = "";
+      if (info->sysfs_path[0])
+        snprintf(port_id, sizeof(port_id), "%s#%u#%s", info->sysfs_path, info->devnum, info->serial);
+      if (port_id[0] && uart_scan_cache_skip(port_id, driver_name)) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Skipping serial port %s for %s, as recently probed.", info->port, driver_name);
+        continue;
+      }
+      memcpy(&scan.ports[scan.port_count], info, sizeof(struct uart_port_info));
+      memcpy(scan.port_ids[scan.port_count], port_id, sizeof(port_id));
+      scan.usb[scan.port_count] = (info->vid != 0);
+      scan.port_count++;
+    }
+  }
+  if (scan.port_count == 0)
+    goto out;
+
+#ifndef _WIN32
+  pthread_t threads[UART_SCAN_MAX_THREADS];
+  size_t thread_count = 0;
+  pthread_mutex_init(&scan.mutex, NULL);
+  while ((thread_count < UART_SCAN_MAX_THREADS) && (thread_count < scan.port_count)) {
+    if (pthread_create(&threads[thread_count], NULL, uart_scan_worker, &scan) != 0)
+      break;
+    thread_count++;
+  }
+  // Without any thread, probe from here
+  if (thread_count == 0)
+    uart_scan_worker(&scan);
+  for (size_t i = 0; i < thread_count; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&scan.mutex);
+#else
+  uart_scan_worker(&scan);
+#endif
+
+  if (scan.next_port < scan.port_count)
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Scan deadline reached, %d serial port(s) not probed.", (int)(scan.port_count - scan.next_port));
+
+  for (size_t i = 0; (i < scan.port_count) && (device_found < connstrings_len); i++) {
+    if (scan.found[i]) {
+      memcpy(connstrings[device_found], scan.connstrings[i], sizeof(nfc_connstring));
+      device_found++;
+    }
+  }
+
+out:
+  free(ports);
+  free(scan.ports);
+  free(scan.usb);
+  free(scan.port_ids);
+  free(scan.found);
+  free(scan.connstrings);
+  return device_found;
+}
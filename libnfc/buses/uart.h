@@ -46,12 +46,74 @@ serial_port uart_open(const char *pcPortName);
 void    uart_close(const serial_port sp);
 void    uart_flush_input(const serial_port sp);
 
-void    uart_set_speed(serial_port sp, const uint32_t uiPortSpeed);
+int     uart_set_speed(serial_port sp, const uint32_t uiPortSpeed);
 uint32_t uart_get_speed(const serial_port sp);
 
+// Bit rates without a B* constant, Linux only (see uart_termios2.c)
+int     uart_termios2_set_speed(const int fd, const uint32_t uiPortSpeed, uint32_t *puiSpeedSet);
+
 int     uart_receive(serial_port sp, uint8_t *pbtRx, const size_t szRx, void *abort_p, int timeout);
 int     uart_send(serial_port sp, const uint8_t *pbtTx, const size_t szTx, int timeout);
 
+/**
+ * @brief Frame length callback used by uart_receive_frame()
+ *
+ * Given the \a szFrame bytes received so far, it returns the whole frame
+ * length when it can be determined, otherwise the count of bytes needed to
+ * determine it (always greater than \a szFrame). A negative libnfc error
+ * code is returned when the received bytes can not be the start of a frame.
+ */
+typedef int (*uart_frame_length)(const uint8_t *pbtFrame, const size_t szFrame);
+
+int     uart_receive_frame(serial_port sp, uint8_t *pbtRx, const size_t szRx, uart_frame_length frame_length, void *abort_p, int timeout);
+int     uart_receive_frame_nonblock(serial_port sp, uint8_t *pbtRx, const size_t szRx, size_t *pszFrame, uart_frame_length frame_length);
+int     uart_get_fd(const serial_port sp);
+
+/**
+ * @struct uart_port_info
+ * @brief Serial port found on the system
+ *
+ * Everything but \a port is only known where the system tells it (ie. Linux
+ * sysfs), it is left empty or zeroed otherwise.
+ */
+struct uart_port_info {
+  char port[64];          // Device name to give to uart_open()
+  char sysfs_path[256];   // Physical location of the port
+  char driver[32];        // Kernel driver handling the port
+  uint16_t vid;           // USB vendor ID, 0 if not behind USB
+  uint16_t pid;           // USB product ID
+  uint16_t devnum;        // USB device address, changes each time it is plugged
+  char serial[64];        // USB serial number, empty if none
+};
+
+struct uart_port_info *uart_list_ports_info(size_t *count);
 char  **uart_list_ports(void);
 
+/**
+ * @struct uart_adapter
+ * @brief Serial adapter a driver's device can plausibly sit behind
+ *
+ * A null \a vid stands for UARTs not behind USB (on-board, PCI, etc.), a
+ * null \a pid or driver matches any of them. Ports behind these adapters are
+ * probed first, other USB ports after them.
+ */
+struct uart_adapter {
+  uint16_t vid;
+  uint16_t pid;
+  const char *driver;
+};
+
+/**
+ * @brief Port probe callback used by uart_scan_ports()
+ *
+ * Opens \a pcPortName, checks whether the driver's device answers on it and
+ * closes it again. When it does, \a connstring is filled and 1 returned, 0
+ * is returned when nothing answered and a negative libnfc error code when the
+ * port could not be probed at all (ie. it is already claimed).
+ * It may be called from several threads at once, one port per call.
+ */
+typedef int (*uart_probe)(const nfc_context *context, const char *pcPortName, nfc_connstring connstring);
+
+size_t  uart_scan_ports(const nfc_context *context, const char *driver_name, const struct uart_adapter adapters[], const size_t adapters_len, uart_probe probe, nfc_connstring connstrings[], const size_t connstrings_len);
+
 #endif // __NFC_BUS_UART_H__
@@ -26,21 +26,23 @@
  */
 
 #include <sys/ioctl.h>
-#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <termios.h>
 #include <unistd.h>
 
 #include "nfc-internal.h"
+#include "probes.h"
 
 #define LOG_GROUP    NFC_LOG_GROUP_COM
 #define LOG_CATEGORY "libnfc.bus.uart"
@@ -58,10 +60,17 @@ const char *serial_ports_device_radix[] = { "ttyUSB", "ttyS", "ttyACM", "ttyAMA"
 // Work-around to claim uart interface using the c_iflag (software input processing) from the termios struct
 #  define CCLAIMED 0x80000000
 
+// Size of the receive ring buffer, it must be a power of two
+#  define UART_RX_BUFFER_LEN 1024
+
 struct serial_port_unix {
   int 			fd; 			// Serial port file descriptor
   struct termios 	termios_backup; 	// Terminal info before using the port
   struct termios 	termios_new; 		// Terminal info during the transaction
+  uint8_t		rx_buffer[UART_RX_BUFFER_LEN];	// Receive ring buffer
+  size_t		rx_head;		// Offset of the first buffered byte
+  size_t		rx_count;		// Count of buffered bytes
+  uint32_t		custom_speed;		// Bit rate set without a B* constant, or 0
 };
 
 #define UART_DATA( X ) ((struct serial_port_unix *) X)
@@ -76,6 +85,9 @@ uart_open(const char *pcPortName)
   if (sp == 0)
     return INVALID_SERIAL_PORT;
 
+  sp->rx_head = 0;
+  sp->rx_count = 0;
+  sp->custom_speed = 0;
   sp->fd = open(pcPortName, O_RDWR | O_NOCTTY | O_NONBLOCK);
   if (sp->fd == -1) {
     uart_close_ext(sp, false);
@@ -112,6 +124,9 @@ uart_open(const char *pcPortName)
 void
 uart_flush_input(serial_port sp)
 {
+  // Drop what has already been buffered
+  UART_DATA(sp)->rx_head = 0;
+  UART_DATA(sp)->rx_count = 0;
   // This line seems to produce absolutely no effect on my system (GNU/Linux 2.6.35)
   tcflush(UART_DATA(sp)->fd, TCIFLUSH);
   // So, I wrote this byte-eater
@@ -132,7 +147,24 @@ uart_flush_input(serial_port sp)
   free(rx);
 }
 
-void
+// Set any bit rate the serial driver accepts, not only B* values
+static int
+uart_set_custom_speed(serial_port sp, const uint32_t uiPortSpeed)
+{
+  uint32_t uiSpeedSet = 0;
+  int res;
+
+  if ((res = uart_termios2_set_speed(UART_DATA(sp)->fd, uiPortSpeed, &uiSpeedSet)) < 0)
+    return res;
+  if (uiSpeedSet != uiPortSpeed) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Serial port driver rounded %d bauds to %d bauds.", uiPortSpeed, uiSpeedSet);
+    return NFC_EINVARG;
+  }
+  UART_DATA(sp)->custom_speed = uiPortSpeed;
+  return NFC_SUCCESS;
+}
+
+int
 uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
 {
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Serial port speed requested to be set to %d bauds.", uiPortSpeed);
@@ -169,11 +201,18 @@ uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
     case 460800:
       stPortSpeed = B460800;
       break;
+#  endif
+#  ifdef B921600
+    case 921600:
+      stPortSpeed = B921600;
+      break;
 #  endif
     default:
+      if (uart_set_custom_speed(sp, uiPortSpeed) == NFC_SUCCESS)
+        return NFC_SUCCESS;
       log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set serial port speed to %d bauds. Speed value must be one of those defined in termios(3).",
               uiPortSpeed);
-      return;
+      return NFC_EINVARG;
   };
 
   // Set port speed (Input and Output)
@@ -181,12 +220,18 @@ uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
   cfsetospeed(&(UART_DATA(sp)->termios_new), stPortSpeed);
   if (tcsetattr(UART_DATA(sp)->fd, TCSADRAIN, &(UART_DATA(sp)->termios_new)) == -1) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to apply new speed settings.");
+    return NFC_EIO;
   }
+  UART_DATA(sp)->custom_speed = 0;
+  return NFC_SUCCESS;
 }
 
 uint32_t
 uart_get_speed(serial_port sp)
 {
+  if (UART_DATA(sp)->custom_speed)
+    return UART_DATA(sp)->custom_speed;
+
   uint32_t uiPortSpeed = 0;
   switch (cfgetispeed(&UART_DATA(sp)->termios_new)) {
     case B9600:
@@ -217,6 +262,11 @@ uart_get_speed(serial_port sp)
     case B460800:
       uiPortSpeed = 460800;
       break;
+#  endif
+#  ifdef B921600
+    case B921600:
+      uiPortSpeed = 921600;
+      break;
 #  endif
   }
 
@@ -240,78 +290,211 @@ uart_close(const serial_port sp)
   uart_close_ext(sp, true);
 }
 
+static int uart_read_buffer(serial_port sp);
+
 /**
- * @brief Receive data from UART and copy data to \a pbtRx
+ * @internal
+ * @brief Wait for incoming data and drain everything available into the receive ring buffer
  *
  * @return 0 on success, otherwise driver error code
  */
-int
-uart_receive(serial_port sp, uint8_t *pbtRx, const size_t szRx, void *abort_p, int timeout)
+static int
+uart_fill_buffer(serial_port sp, void *abort_p, int timeout)
 {
   int iAbortFd = abort_p ? *((int *)abort_p) : 0;
-  int received_bytes_count = 0;
-  int available_bytes_count = 0;
-  const int expected_bytes_count = (int)szRx;
   int res;
-  fd_set rfds;
+  // poll() rather than select(): a process serving hundreds of readers has descriptors above FD_SETSIZE
+  struct pollfd apfd[2] = {
+    { .fd = UART_DATA(sp)->fd, .events = POLLIN },
+    { .fd = iAbortFd, .events = POLLIN },
+  };
   do {
-select:
-    // Reset file descriptor
-    FD_ZERO(&rfds);
-    FD_SET(UART_DATA(sp)->fd, &rfds);
+    res = poll(apfd, iAbortFd ? 2 : 1, timeout ? timeout : -1);
 
-    if (iAbortFd) {
-      FD_SET(iAbortFd, &rfds);
-    }
+    // The system call was interupted by a signal and a signal handler was
+    // run.  Restart the interupted system call.
+  } while ((res < 0) && (EINTR == errno));
+  PROBE2(uart__wakeup, res, timeout);
 
-    struct timeval timeout_tv;
-    if (timeout > 0) {
-      timeout_tv.tv_sec = (timeout / 1000);
-      timeout_tv.tv_usec = ((timeout % 1000) * 1000);
-    }
+  // Read error
+  if (res < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Error: %s", strerror(errno));
+    return NFC_EIO;
+  }
+  // Read time-out
+  if (res == 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Timeout!");
+    return NFC_ETIMEOUT;
+  }
 
-    res = select(MAX(UART_DATA(sp)->fd, iAbortFd) + 1, &rfds, NULL, NULL, timeout ? &timeout_tv : NULL);
+  if (iAbortFd && apfd[1].revents) {
+    // Abort requested
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Abort!");
+    close(iAbortFd);
+    return NFC_EOPABORTED;
+  }
 
-    if ((res < 0) && (EINTR == errno)) {
-      // The system call was interupted by a signal and a signal handler was
-      // run.  Restart the interupted system call.
-      goto select;
-    }
+  // Stop if the OS has some troubles reading the data
+  if (uart_read_buffer(sp) <= 0) {
+    return NFC_EIO;
+  }
+  return NFC_SUCCESS;
+}
 
-    // Read error
-    if (res < 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Error: %s", strerror(errno));
-      return NFC_EIO;
-    }
-    // Read time-out
-    if (res == 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Timeout!");
-      return NFC_ETIMEOUT;
+/**
+ * @internal
+ * @brief Drain what is available into the receive ring buffer, without waiting
+ *
+ * @return count of bytes read, 0 when none is available, otherwise driver error code
+ */
+static int
+uart_read_buffer(serial_port sp)
+{
+  // Read as much as the free part of the ring can hold, in one go (the free
+  // part wraps around at most once)
+  const size_t szTail = (UART_DATA(sp)->rx_head + UART_DATA(sp)->rx_count) & (UART_RX_BUFFER_LEN - 1);
+  const size_t szFree = UART_RX_BUFFER_LEN - UART_DATA(sp)->rx_count;
+  struct iovec iov[2];
+  int iovcnt = 1;
+  iov[0].iov_base = UART_DATA(sp)->rx_buffer + szTail;
+  iov[0].iov_len = MIN(szFree, UART_RX_BUFFER_LEN - szTail);
+  if (iov[0].iov_len < szFree) {
+    iov[1].iov_base = UART_DATA(sp)->rx_buffer;
+    iov[1].iov_len = szFree - iov[0].iov_len;
+    iovcnt = 2;
+  }
+  ssize_t szRead;
+  do {
+    szRead = readv(UART_DATA(sp)->fd, iov, iovcnt);
+  } while ((szRead < 0) && (EINTR == errno));
+  // Without VMIN, a terminal returns 0 bytes when nothing is available
+  if ((szRead == 0) || ((szRead < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno)))) {
+    return 0;
+  }
+  if (szRead < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Error: %s", strerror(errno));
+    return NFC_EIO;
+  }
+  UART_DATA(sp)->rx_count += (size_t) szRead;
+  PROBE2(uart__read, szRead, UART_DATA(sp)->rx_count);
+  return (int) szRead;
+}
+
+/**
+ * @internal
+ * @brief Move \a szRx bytes from the receive ring buffer to \a pbtRx
+ */
+static void
+uart_pull_buffer(serial_port sp, uint8_t *pbtRx, const size_t szRx)
+{
+  const size_t szFirst = MIN(szRx, UART_RX_BUFFER_LEN - UART_DATA(sp)->rx_head);
+  memcpy(pbtRx, UART_DATA(sp)->rx_buffer + UART_DATA(sp)->rx_head, szFirst);
+  memcpy(pbtRx + szFirst, UART_DATA(sp)->rx_buffer, szRx - szFirst);
+  UART_DATA(sp)->rx_head = (UART_DATA(sp)->rx_head + szRx) & (UART_RX_BUFFER_LEN - 1);
+  UART_DATA(sp)->rx_count -= szRx;
+}
+
+/**
+ * @brief Receive data from UART and copy data to \a pbtRx
+ *
+ * @return 0 on success, otherwise driver error code
+ */
+int
+uart_receive(serial_port sp, uint8_t *pbtRx, const size_t szRx, void *abort_p, int timeout)
+{
+  size_t received_bytes_count = 0;
+  int res;
+  while (received_bytes_count < szRx) {
+    if (UART_DATA(sp)->rx_count == 0) {
+      if ((res = uart_fill_buffer(sp, abort_p, timeout)) < 0) {
+        return res;
+      }
     }
+    const size_t szChunk = MIN(UART_DATA(sp)->rx_count, szRx - received_bytes_count);
+    uart_pull_buffer(sp, pbtRx + received_bytes_count, szChunk);
+    received_bytes_count += szChunk;
+  }
+  LOG_HEX(LOG_GROUP, "RX", pbtRx, szRx);
+  return NFC_SUCCESS;
+}
 
-    if (FD_ISSET(iAbortFd, &rfds)) {
-      // Abort requested
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Abort!");
-      close(iAbortFd);
-      return NFC_EOPABORTED;
+/**
+ * @brief Receive a whole frame from UART and copy it to \a pbtRx
+ *
+ * The frame boundaries are given by \a frame_length, bytes following the
+ * frame are kept buffered for the next reception.
+ *
+ * @return received frame length on success, otherwise driver error code
+ */
+int
+uart_receive_frame(serial_port sp, uint8_t *pbtRx, const size_t szRx, uart_frame_length frame_length, void *abort_p, int timeout)
+{
+  size_t szFrame = 0;
+  int res;
+  while ((res = frame_length(pbtRx, szFrame)) > (int) szFrame) {
+    const size_t szExpected = (size_t) res;
+    if (szExpected > szRx) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive frame: buffer too small. (szRx: %zu, expected: %zu)", szRx, szExpected);
+      return NFC_EOVFLOW;
     }
+    if (UART_DATA(sp)->rx_count == 0) {
+      if ((res = uart_fill_buffer(sp, abort_p, timeout)) < 0) {
+        return res;
+      }
+    }
+    const size_t szChunk = MIN(UART_DATA(sp)->rx_count, szExpected - szFrame);
+    uart_pull_buffer(sp, pbtRx + szFrame, szChunk);
+    szFrame += szChunk;
+  }
+  if (res < 0) {
+    return res;
+  }
+  LOG_HEX(LOG_GROUP, "RX", pbtRx, szFrame);
+  return (int) szFrame;
+}
 
-    // Retrieve the count of the incoming bytes
-    res = ioctl(UART_DATA(sp)->fd, FIONREAD, &available_bytes_count);
-    if (res != 0) {
-      return NFC_EIO;
+/**
+ * @brief Go on receiving a frame from UART, without waiting
+ *
+ * The \a *pszFrame bytes already in \a pbtRx are completed with what is
+ * available, as uart_receive_frame() would, then it returns: it is meant to
+ * be called each time the file descriptor given by uart_get_fd() is readable.
+ *
+ * @return frame length once it is whole, 0 while bytes are missing, otherwise driver error code
+ */
+int
+uart_receive_frame_nonblock(serial_port sp, uint8_t *pbtRx, const size_t szRx, size_t *pszFrame, uart_frame_length frame_length)
+{
+  int res;
+  while ((res = frame_length(pbtRx, *pszFrame)) > (int) *pszFrame) {
+    const size_t szExpected = (size_t) res;
+    if (szExpected > szRx) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive frame: buffer too small. (szRx: %zu, expected: %zu)", szRx, szExpected);
+      return NFC_EOVFLOW;
     }
-    // There is something available, read the data
-    res = read(UART_DATA(sp)->fd, pbtRx + received_bytes_count, MIN(available_bytes_count, (expected_bytes_count - received_bytes_count)));
-    // Stop if the OS has some troubles reading the data
-    if (res <= 0) {
-      return NFC_EIO;
+    if (UART_DATA(sp)->rx_count == 0) {
+      if ((res = uart_read_buffer(sp)) <= 0) {
+        return res;
+      }
     }
-    received_bytes_count += res;
+    const size_t szChunk = MIN(UART_DATA(sp)->rx_count, szExpected - *pszFrame);
+    uart_pull_buffer(sp, pbtRx + *pszFrame, szChunk);
+    *pszFrame += szChunk;
+  }
+  if (res < 0) {
+    return res;
+  }
+  LOG_HEX(LOG_GROUP, "RX", pbtRx, *pszFrame);
+  return (int) *pszFrame;
+}
 
-  } while (expected_bytes_count > received_bytes_count);
-  LOG_HEX(LOG_GROUP, "RX", pbtRx, szRx);
-  return NFC_SUCCESS;
+/**
+ * @brief File descriptor of the port, readable when uart_receive_frame_nonblock() may progress
+ */
+int
+uart_get_fd(const serial_port sp)
+{
+  return UART_DATA(sp)->fd;
 }
 
 /**
@@ -330,15 +513,28 @@ uart_send(serial_port sp, const uint8_t *pbtTx, const size_t szTx, int timeout)
     return NFC_EIO;
 }
 
-char **
-uart_list_ports(void)
+static bool
+uart_list_append(struct uart_port_info **ports, size_t *count, const struct uart_port_info *info)
 {
-  char **res = malloc(sizeof(char *));
-  size_t szRes = 1;
+  struct uart_port_info *res = realloc(*ports, (*count + 1) * sizeof(struct uart_port_info));
+  if (!res)
+    return false;
+  res[*count] = *info;
+  *ports = res;
+  (*count)++;
+  return true;
+}
 
-  res[0] = NULL;
+// Serial ports seen through their device node only
+static struct uart_port_info *
+uart_list_dev_ports(size_t *count)
+{
+  struct uart_port_info *res = NULL;
+  *count = 0;
 
   DIR *pdDir = opendir("/dev");
+  if (!pdDir)
+    return NULL;
   struct dirent *pdDirEnt;
   while ((pdDirEnt = readdir(pdDir)) != NULL) {
 #if !defined(__APPLE__)
@@ -348,24 +544,132 @@ uart_list_ports(void)
     const char **p = serial_ports_device_radix;
     while (*p) {
       if (!strncmp(pdDirEnt->d_name, *p, strlen(*p))) {
-        char **res2 = realloc(res, (szRes + 1) * sizeof(char *));
-        if (!res2)
+        struct uart_port_info info;
+        memset(&info, 0, sizeof(info));
+        if ((snprintf(info.port, sizeof(info.port), "/dev/%s", pdDirEnt->d_name) < (int) sizeof(info.port)) &&
+            !uart_list_append(&res, count, &info))
           goto oom;
+      }
+      p++;
+    }
+  }
+oom:
+  closedir(pdDir);
 
-        res = res2;
-        if (!(res[szRes - 1] = malloc(6 + strlen(pdDirEnt->d_name))))
-          goto oom;
+  return res;
+}
 
-        sprintf(res[szRes - 1], "/dev/%s", pdDirEnt->d_name);
+#  if defined (__linux__)
+static bool
+uart_sysfs_read(const char *dir, const char *attribute, char *value, const size_t szValue)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, attribute);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  bool res = (fgets(value, szValue, f) != NULL);
+  fclose(f);
+  if (res)
+    value[strcspn(value, "\n")] = '\0';
+  return res;
+}
 
-        szRes++;
-        res[szRes - 1] = NULL;
+/*
+ * Fill the driver and USB information of the tty device found at sysfs_path,
+ * walking up to the USB device it belongs to, if any.
+ */
+static void
+uart_sysfs_port_info(const char *sysfs_path, struct uart_port_info *info)
+{
+  char dir[PATH_MAX];
+  char value[PATH_MAX];
+
+  snprintf(dir, sizeof(dir), "%s", sysfs_path);
+  while (strncmp(dir, "/sys/devices/", strlen("/sys/devices/")) == 0) {
+    if (!info->driver[0]) {
+      char link[PATH_MAX];
+      ssize_t len = -1;
+      if (snprintf(link, sizeof(link), "%s/driver", dir) < (int) sizeof(link))
+        len = readlink(link, value, sizeof(value) - 1);
+      if (len > 0) {
+        value[len] = '\0';
+        // Skip serial core devices (Linux >= 6.5), the parent one is more telling
+        const char *name = strrchr(value, '/');
+        if (!strstr(value, "/serial-base/") && (strlen(name ? name + 1 : value) < sizeof(info->driver)))
+          strcpy(info->driver, name ? name + 1 : value);
       }
-      p++;
     }
+    if (uart_sysfs_read(dir, "idVendor", value, sizeof(value))) {
+      info->vid = strtol(value, NULL, 16);
+      if (uart_sysfs_read(dir, "idProduct", value, sizeof(value)))
+        info->pid = strtol(value, NULL, 16);
+      if (uart_sysfs_read(dir, "devnum", value, sizeof(value)))
+        info->devnum = strtol(value, NULL, 10);
+      if (uart_sysfs_read(dir, "serial", value, sizeof(value)) && (strlen(value) < sizeof(info->serial)))
+        strcpy(info->serial, value);
+      break;
+    }
+    char *slash = strrchr(dir, '/');
+    if (!slash)
+      break;
+    *slash = '\0';
+  }
+}
+
+// Serial ports backed by an actual device, according to sysfs
+static struct uart_port_info *
+uart_list_sysfs_ports(size_t *count)
+{
+  struct uart_port_info *res = NULL;
+  *count = 0;
+
+  DIR *pdDir = opendir("/sys/class/tty");
+  if (!pdDir)
+    return NULL;
+  struct dirent *pdDirEnt;
+  while ((pdDirEnt = readdir(pdDir)) != NULL) {
+    if (pdDirEnt->d_name[0] == '.')
+      continue;
+    char dir[PATH_MAX];
+    char device[PATH_MAX];
+    snprintf(dir, sizeof(dir), "/sys/class/tty/%s/device", pdDirEnt->d_name);
+    // Virtual terminals, ptys, etc. have no device
+    if (!realpath(dir, device))
+      continue;
+    snprintf(dir, sizeof(dir), "/sys/class/tty/%s", pdDirEnt->d_name);
+    // Legacy 8250 ports are all registered, even without any UART behind them
+    char type[16];
+    if (uart_sysfs_read(dir, "type", type, sizeof(type)) && (atoi(type) == 0))
+      continue;
+
+    struct uart_port_info info;
+    memset(&info, 0, sizeof(info));
+    if ((snprintf(info.port, sizeof(info.port), "/dev/%s", pdDirEnt->d_name) >= (int) sizeof(info.port)) ||
+        (strlen(device) >= sizeof(info.sysfs_path)))
+      continue;
+    // Some device names contain slashes, sysfs uses '!' instead
+    for (char *c = info.port; *c; c++)
+      if (*c == '!')
+        *c = '/';
+    strcpy(info.sysfs_path, device);
+    uart_sysfs_port_info(device, &info);
+    if (!uart_list_append(&res, count, &info))
+      break;
   }
-oom:
   closedir(pdDir);
 
   return res;
 }
+#  endif
+
+struct uart_port_info *
+uart_list_ports_info(size_t *count)
+{
+#  if defined (__linux__)
+  struct uart_port_info *res;
+  if ((res = uart_list_sysfs_ports(count)) || (access("/sys/class/tty", F_OK) == 0))
+    return res;
+#  endif
+  return uart_list_dev_ports(count);
+}
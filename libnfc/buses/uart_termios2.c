@@ -0,0 +1,75 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/**
+ * @file uart_termios2.c
+ * @brief Linux serial port bit rates without a B* constant
+ *
+ * struct termios2, CBAUD and BOTHER differ between architectures and only
+ * the kernel headers get them right. Those clash with the <termios.h> of the
+ * C library, so this file is kept apart from uart_posix.c and never includes
+ * it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <stdint.h>
+
+#include <nfc/nfc.h>
+
+#if defined(__linux__)
+#  include <sys/ioctl.h>
+#  include <asm/ioctls.h>
+#  include <asm/termbits.h>
+#endif
+
+#include "uart.h"
+
+/*
+ * Set any bit rate the serial driver accepts on the port, the rate the driver
+ * did choose is put in puiSpeedSet. Returns NFC_ENOTIMPL where the system has
+ * no BOTHER.
+ */
+int
+uart_termios2_set_speed(const int fd, const uint32_t uiPortSpeed, uint32_t *puiSpeedSet)
+{
+#if defined(__linux__) && defined(TCGETS2) && defined(TCSETSW2) && defined(BOTHER)
+  struct termios2 tio2;
+
+  if (ioctl(fd, TCGETS2, &tio2) == -1)
+    return NFC_EIO;
+  tio2.c_cflag &= ~CBAUD;
+  tio2.c_cflag |= BOTHER;
+  tio2.c_ispeed = uiPortSpeed;
+  tio2.c_ospeed = uiPortSpeed;
+  if (ioctl(fd, TCSETSW2, &tio2) == -1)
+    return NFC_EIO;
+  // Read back what the driver really did choose
+  if (ioctl(fd, TCGETS2, &tio2) == -1)
+    return NFC_EIO;
+  *puiSpeedSet = tio2.c_ospeed;
+  return NFC_SUCCESS;
+#else
+  (void) fd;
+  (void) uiPortSpeed;
+  (void) puiSpeedSet;
+  return NFC_ENOTIMPL;
+#endif
+}
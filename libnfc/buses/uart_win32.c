@@ -99,7 +99,7 @@ uart_flush_input(const serial_port sp)
   PurgeComm(((struct serial_port_windows *) sp)->hPort, PURGE_RXABORT | PURGE_RXCLEAR);
 }
 
-void
+int
 uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
 {
   struct serial_port_windows *spw;
@@ -114,10 +114,12 @@ uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
     case 115200:
     case 230400:
     case 460800:
+    case 921600:
+    case 1288000:
       break;
     default:
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set serial port speed to %d bauds. Speed value must be one of these constants: 9600 (default), 19200, 38400, 57600, 115200, 230400 or 460800.", uiPortSpeed);
-      return;
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set serial port speed to %d bauds. Speed value must be one of these constants: 9600 (default), 19200, 38400, 57600, 115200, 230400, 460800, 921600 or 1288000.", uiPortSpeed);
+      return NFC_EINVARG;
   };
   spw = (struct serial_port_windows *) sp;
 
@@ -125,9 +127,10 @@ uart_set_speed(serial_port sp, const uint32_t uiPortSpeed)
   spw->dcb.BaudRate = uiPortSpeed;
   if (!SetCommState(spw->hPort, &spw->dcb)) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to apply new speed settings.");
-    return;
+    return NFC_EIO;
   }
   PurgeComm(spw->hPort, PURGE_RXABORT | PURGE_RXCLEAR);
+  return NFC_SUCCESS;
 }
 
 uint32_t
@@ -195,6 +198,48 @@ uart_receive(serial_port sp, uint8_t *pbtRx, const size_t szRx, void *abort_p, i
   return (dwTotalBytesReceived == (DWORD) szRx) ? 0 : NFC_EIO;
 }
 
+int
+uart_receive_frame(serial_port sp, uint8_t *pbtRx, const size_t szRx, uart_frame_length frame_length, void *abort_p, int timeout)
+{
+  size_t szFrame = 0;
+  int res;
+  // The serial driver already buffers incoming bytes, ask for the missing ones only
+  while ((res = frame_length(pbtRx, szFrame)) > (int) szFrame) {
+    const size_t szExpected = (size_t) res;
+    if (szExpected > szRx) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive frame: buffer too small. (szRx: %zu, expected: %zu)", szRx, szExpected);
+      return NFC_EOVFLOW;
+    }
+    if ((res = uart_receive(sp, pbtRx + szFrame, szExpected - szFrame, abort_p, timeout)) < 0) {
+      return res;
+    }
+    szFrame = szExpected;
+  }
+  if (res < 0) {
+    return res;
+  }
+  return (int) szFrame;
+}
+
+// Overlapped I/O would be needed to poll the port, not implemented
+int
+uart_receive_frame_nonblock(serial_port sp, uint8_t *pbtRx, const size_t szRx, size_t *pszFrame, uart_frame_length frame_length)
+{
+  (void) sp;
+  (void) pbtRx;
+  (void) szRx;
+  (void) pszFrame;
+  (void) frame_length;
+  return NFC_ENOTIMPL;
+}
+
+int
+uart_get_fd(const serial_port sp)
+{
+  (void) sp;
+  return NFC_ENOTIMPL;
+}
+
 int
 uart_send(serial_port sp, const uint8_t *pbtTx, const size_t szTx, int timeout)
 {
@@ -237,21 +282,20 @@ BOOL is_port_available(int nPort)
 // Path to the serial port is OS-dependant.
 // Try to guess what we should use.
 #define MAX_SERIAL_PORT_WIN 255
-char **
-uart_list_ports(void)
+struct uart_port_info *
+uart_list_ports_info(size_t *count)
 {
-  char **availablePorts = malloc((1 + MAX_SERIAL_PORT_WIN) * sizeof(char *));
-  int curIndex = 0;
+  struct uart_port_info *availablePorts = calloc(MAX_SERIAL_PORT_WIN, sizeof(struct uart_port_info));
+  size_t curIndex = 0;
   int i;
-  for (i = 1; i <= MAX_SERIAL_PORT_WIN; i++) {
+  for (i = 1; availablePorts && (i <= MAX_SERIAL_PORT_WIN); i++) {
     if (is_port_available(i)) {
-      availablePorts[curIndex] = (char *)malloc(10);
-      sprintf(availablePorts[curIndex], "COM%d", i);
-      // printf("found candidate port: %s\n", availablePorts[curIndex]);
+      sprintf(availablePorts[curIndex].port, "COM%d", i);
+      // printf("found candidate port: %s\n", availablePorts[curIndex].port);
       curIndex++;
     }
   }
-  availablePorts[curIndex] = NULL;
+  *count = curIndex;
 
   return availablePorts;
 }
@@ -0,0 +1,672 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * Copyright (C) 2009 Roel Verdult
+ * Copyright (C) 2010, 2011 Romain Tartière
+ * Copyright (C) 2010, 2011, 2012 Romuald Conty
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/**
+ * @file usbbus.c
+ * @brief USB bulk transport on top of libusb-1.0 asynchronous API
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include "usbbus.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <pthread.h>
+#  include <time.h>
+#  include <unistd.h>
+#else
+#  include <windows.h>
+#endif
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+
+#define LOG_GROUP    NFC_LOG_GROUP_COM
+#define LOG_CATEGORY "libnfc.bus.usbbus"
+
+// Count of IN packets kept until they are read
+#define USBBUS_RX_QUEUE_LEN 4
+// How long to wait for the IN transfer to be given back when freeing the transport
+#define USBBUS_CANCEL_TIMEOUT_MS 1000
+// File descriptors libusb may ask to poll, in addition to the abort pipe
+#define USBBUS_MAX_POLLFDS 16
+// Longest wait when the abort pipe can not be polled along with libusb
+#define USBBUS_ABORT_CHECK_MS 200
+// libusb hotplug API comes with libusb 1.0.16
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+#  define USBBUS_HOTPLUG
+#endif
+
+#ifndef _WIN32
+#  define usbbus_mutex_t pthread_mutex_t
+#  define usbbus_mutex_init(m) pthread_mutex_init(m, NULL)
+#  define usbbus_mutex_destroy(m) pthread_mutex_destroy(m)
+#  define usbbus_mutex_lock(m) pthread_mutex_lock(m)
+#  define usbbus_mutex_unlock(m) pthread_mutex_unlock(m)
+#else
+#  define usbbus_mutex_t CRITICAL_SECTION
+#  define usbbus_mutex_init(m) InitializeCriticalSection(m)
+#  define usbbus_mutex_destroy(m) DeleteCriticalSection(m)
+#  define usbbus_mutex_lock(m) EnterCriticalSection(m)
+#  define usbbus_mutex_unlock(m) LeaveCriticalSection(m)
+#endif
+
+struct usbbus_transport {
+  libusb_context *ctx;
+  libusb_device_handle *handle;
+  uint8_t endpoint_in;
+  uint8_t endpoint_out;
+  uint16_t max_packet_size;
+
+  struct libusb_transfer *in_transfer;
+  bool in_pending;
+  int in_error;
+
+  // Received packets, oldest first
+  size_t szRxMax;
+  uint8_t *rx_buffers;
+  size_t rx_len[USBBUS_RX_QUEUE_LEN];
+  size_t rx_head;
+  size_t rx_count;
+
+#ifndef _WIN32
+  // pipe-based abort mecanism, polled along with libusb file descriptors
+  int abort_fds[2];
+#else
+  volatile bool abort_flag;
+#endif
+};
+
+static uint32_t
+usbbus_now_ms(void)
+{
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+  return GetTickCount();
+#endif
+}
+
+static int
+usbbus_error(const int libusb_res)
+{
+  switch (libusb_res) {
+    case LIBUSB_SUCCESS:
+      return NFC_SUCCESS;
+    case LIBUSB_ERROR_TIMEOUT:
+      return NFC_ETIMEOUT;
+    case LIBUSB_ERROR_NO_DEVICE:
+      return NFC_ENOTSUCHDEV;
+    default:
+      return NFC_EIO;
+  }
+}
+
+static void LIBUSB_CALL
+usbbus_in_callback(struct libusb_transfer *transfer)
+{
+  struct usbbus_transport *transport = transfer->user_data;
+
+  transport->in_pending = false;
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      if (transfer->actual_length > 0) {
+        if (transport->rx_count == USBBUS_RX_QUEUE_LEN) {
+          log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Receive queue full, oldest packet dropped");
+          transport->rx_head = (transport->rx_head + 1) % USBBUS_RX_QUEUE_LEN;
+          transport->rx_count--;
+        }
+        size_t slot = (transport->rx_head + transport->rx_count) % USBBUS_RX_QUEUE_LEN;
+        memcpy(transport->rx_buffers + slot * transport->szRxMax, transfer->buffer, transfer->actual_length);
+        transport->rx_len[slot] = transfer->actual_length;
+        transport->rx_count++;
+      }
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      transport->in_error = NFC_ENOTSUCHDEV;
+      return;
+    default:
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to read from USB (transfer status %d)", transfer->status);
+      transport->in_error = NFC_EIO;
+      return;
+  }
+
+  // Have the next packet received as soon as the device sends it
+  int res;
+  if ((res = libusb_submit_transfer(transfer)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to submit USB IN transfer (%s)", libusb_error_name(res));
+    transport->in_error = usbbus_error(res);
+    return;
+  }
+  transport->in_pending = true;
+}
+
+static int
+usbbus_submit_in(struct usbbus_transport *transport)
+{
+  int res;
+  if ((res = libusb_submit_transfer(transport->in_transfer)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to submit USB IN transfer (%s)", libusb_error_name(res));
+    return usbbus_error(res);
+  }
+  transport->in_pending = true;
+  return NFC_SUCCESS;
+}
+
+/**
+ * @brief Create a transport on a claimed interface and start receiving
+ *
+ * @param szRxMax largest packet the device is expected to send
+ * @return Returns the transport or NULL on failure
+ */
+struct usbbus_transport *
+usbbus_transport_new(libusb_context *ctx, libusb_device_handle *handle, const uint8_t endpoint_in, const uint8_t endpoint_out, const uint16_t max_packet_size, const size_t szRxMax)
+{
+  struct usbbus_transport *transport = calloc(1, sizeof(struct usbbus_transport));
+  if (!transport)
+    return NULL;
+
+  transport->ctx = ctx;
+  transport->handle = handle;
+  transport->endpoint_in = endpoint_in;
+  transport->endpoint_out = endpoint_out;
+  transport->max_packet_size = max_packet_size;
+  transport->szRxMax = szRxMax;
+#ifndef _WIN32
+  transport->abort_fds[0] = transport->abort_fds[1] = -1;
+  if (pipe(transport->abort_fds) < 0)
+    goto error;
+  // usbbus_abort() must never block, and the waiting side drains the pipe
+  fcntl(transport->abort_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(transport->abort_fds[1], F_SETFL, O_NONBLOCK);
+#endif
+
+  // One more buffer than queued packets, for the transfer itself
+  if (!(transport->rx_buffers = malloc((USBBUS_RX_QUEUE_LEN + 1) * szRxMax)))
+    goto error;
+  if (!(transport->in_transfer = libusb_alloc_transfer(0)))
+    goto error;
+  libusb_fill_bulk_transfer(transport->in_transfer, handle, endpoint_in, transport->rx_buffers + USBBUS_RX_QUEUE_LEN * szRxMax, szRxMax, usbbus_in_callback, transport, 0);
+
+  if (usbbus_submit_in(transport) < 0)
+    goto error;
+  return transport;
+
+error:
+  if (transport->in_transfer)
+    libusb_free_transfer(transport->in_transfer);
+#ifndef _WIN32
+  if (transport->abort_fds[0] >= 0) {
+    close(transport->abort_fds[0]);
+    close(transport->abort_fds[1]);
+  }
+#endif
+  free(transport->rx_buffers);
+  free(transport);
+  return NULL;
+}
+
+void
+usbbus_transport_free(struct usbbus_transport *transport)
+{
+  if (transport->in_pending) {
+    libusb_cancel_transfer(transport->in_transfer);
+    const uint32_t deadline = usbbus_now_ms() + USBBUS_CANCEL_TIMEOUT_MS;
+    while (transport->in_pending && ((int32_t)(deadline - usbbus_now_ms()) > 0)) {
+      struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+      libusb_handle_events_timeout_completed(transport->ctx, &tv, NULL);
+    }
+  }
+  if (transport->in_pending) {
+    // libusb still owns the transfer, leaking it is better than freeing it under its feet
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "USB IN transfer could not be cancelled");
+    return;
+  }
+  libusb_free_transfer(transport->in_transfer);
+#ifndef _WIN32
+  close(transport->abort_fds[0]);
+  close(transport->abort_fds[1]);
+#endif
+  free(transport->rx_buffers);
+  free(transport);
+}
+
+/**
+ * @brief Have the pending or next usbbus_read() return NFC_EOPABORTED
+ *
+ * On POSIX systems it only writes to a pipe, so it can be called from
+ * another thread or from a signal handler.
+ */
+int
+usbbus_abort(struct usbbus_transport *transport)
+{
+#ifndef _WIN32
+  const uint8_t b = 0;
+  // A full pipe already holds an abort request
+  if ((write(transport->abort_fds[1], &b, 1) < 0) && (errno != EAGAIN))
+    return NFC_ESOFT;
+#else
+  transport->abort_flag = true;
+  // Giving the IN transfer back makes the event loop return
+  libusb_cancel_transfer(transport->in_transfer);
+#endif
+  return NFC_SUCCESS;
+}
+
+static bool
+usbbus_test_abort(struct usbbus_transport *transport)
+{
+#ifndef _WIN32
+  uint8_t buf[16];
+  bool aborted = false;
+  while (read(transport->abort_fds[0], buf, sizeof(buf)) > 0)
+    aborted = true;
+  return aborted;
+#else
+  if (!transport->abort_flag)
+    return false;
+  transport->abort_flag = false;
+  return true;
+#endif
+}
+
+/*
+ * Wait for USB events or an abort request, then let libusb handle the events.
+ * timeout is in milliseconds, negative waits forever.
+ */
+static int
+usbbus_wait_events(struct usbbus_transport *transport, const int wait_timeout)
+{
+  int res;
+#ifndef _WIN32
+  const struct libusb_pollfd **usb_fds = libusb_get_pollfds(transport->ctx);
+  if (usb_fds) {
+    struct pollfd fds[USBBUS_MAX_POLLFDS + 1];
+    nfds_t nfds = 0;
+    fds[nfds].fd = transport->abort_fds[0];
+    fds[nfds].events = POLLIN;
+    nfds++;
+    for (size_t i = 0; usb_fds[i] && (i < USBBUS_MAX_POLLFDS); i++) {
+      fds[nfds].fd = usb_fds[i]->fd;
+      fds[nfds].events = usb_fds[i]->events;
+      nfds++;
+    }
+#  if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+    libusb_free_pollfds(usb_fds);
+#  else
+    free(usb_fds);
+#  endif
+
+    // libusb may have timeouts of its own to handle
+    int poll_timeout = wait_timeout;
+    struct timeval tv;
+    if (libusb_get_next_timeout(transport->ctx, &tv) == 1) {
+      const int next_timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+      if ((poll_timeout < 0) || (next_timeout < poll_timeout))
+        poll_timeout = next_timeout;
+    }
+
+    if ((res = poll(fds, nfds, poll_timeout)) < 0) {
+      if (errno == EINTR)
+        return NFC_SUCCESS;
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to poll USB events (%s)", strerror(errno));
+      return NFC_ESOFT;
+    }
+    if (usbbus_test_abort(transport))
+      return NFC_EOPABORTED;
+    tv.tv_sec = tv.tv_usec = 0;
+    res = libusb_handle_events_timeout_completed(transport->ctx, &tv, NULL);
+  } else
+#endif
+  {
+#ifndef _WIN32
+    // The abort pipe can not be watched, check it regularly instead
+    const int timeout = ((wait_timeout < 0) || (wait_timeout > USBBUS_ABORT_CHECK_MS)) ? USBBUS_ABORT_CHECK_MS : wait_timeout;
+#else
+    // An abort cancels the IN transfer, which makes the event loop return
+    const int timeout = wait_timeout;
+#endif
+    if (timeout < 0) {
+      res = libusb_handle_events_completed(transport->ctx, NULL);
+    } else {
+      struct timeval tv = { .tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000 };
+      res = libusb_handle_events_timeout_completed(transport->ctx, &tv, NULL);
+    }
+    if (usbbus_test_abort(transport))
+      return NFC_EOPABORTED;
+  }
+  if ((res < 0) && (res != LIBUSB_ERROR_INTERRUPTED)) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to handle USB events (%s)", libusb_error_name(res));
+    return usbbus_error(res);
+  }
+  return NFC_SUCCESS;
+}
+
+/**
+ * @brief Send \a pbtTx on the OUT endpoint
+ *
+ * @param timeout in milliseconds, 0 waits forever
+ * @return Returns count of written bytes on success, otherwise returns libnfc's error code (negative value)
+ */
+int
+usbbus_write(struct usbbus_transport *transport, const uint8_t *pbtTx, const size_t szTx, const int timeout)
+{
+  int transferred = 0;
+  LOG_HEX(NFC_LOG_GROUP_COM, "TX", pbtTx, szTx);
+  int res = libusb_bulk_transfer(transport->handle, transport->endpoint_out, (unsigned char *) pbtTx, szTx, &transferred, timeout);
+  if (res < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to write to USB (%s)", libusb_error_name(res));
+    return usbbus_error(res);
+  }
+  // HACK This little hack is a well know problem of USB, see http://www.libusb.org/ticket/6 for more details
+  if (transport->max_packet_size && ((transferred % transport->max_packet_size) == 0)) {
+    unsigned char zlp[1];
+    int zlp_transferred;
+    libusb_bulk_transfer(transport->handle, transport->endpoint_out, zlp, 0, &zlp_transferred, timeout);
+  }
+  return transferred;
+}
+
+/**
+ * @brief Hand out the oldest packet received on the IN endpoint
+ *
+ * Waits in the libusb event loop until one is received, the packet is
+ * returned right away when it already came in. The wait ends as soon as
+ * usbbus_abort() is called.
+ *
+ * @param timeout in milliseconds, 0 waits forever
+ * @return Returns the packet length on success, otherwise returns libnfc's error code (negative value), NFC_EOPABORTED when aborted
+ */
+int
+usbbus_read(struct usbbus_transport *transport, uint8_t *pbtRx, const size_t szRx, const int timeout)
+{
+  const uint32_t deadline = usbbus_now_ms() + timeout;
+  int res;
+
+  while (transport->rx_count == 0) {
+    if (transport->in_error < 0) {
+      res = transport->in_error;
+      transport->in_error = 0;
+      return res;
+    }
+    if (!transport->in_pending && ((res = usbbus_submit_in(transport)) < 0))
+      return res;
+
+    int32_t remaining = -1;
+    if (timeout != 0) {
+      remaining = (int32_t)(deadline - usbbus_now_ms());
+      if (remaining <= 0)
+        return NFC_ETIMEOUT;
+    }
+    if ((res = usbbus_wait_events(transport, remaining)) < 0)
+      return res;
+  }
+
+  const size_t slot = transport->rx_head;
+  const size_t len = transport->rx_len[slot];
+  transport->rx_head = (transport->rx_head + 1) % USBBUS_RX_QUEUE_LEN;
+  transport->rx_count--;
+
+  if (len > szRx) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to read from USB: buffer too small. (szRx: %zu, len: %zu)", szRx, len);
+    return NFC_EOVFLOW;
+  }
+  memcpy(pbtRx, transport->rx_buffers + slot * transport->szRxMax, len);
+  LOG_HEX(NFC_LOG_GROUP_COM, "RX", pbtRx, len);
+  return len;
+}
+
+/**
+ * @brief Drop the packets received but not read yet
+ */
+void
+usbbus_flush_input(struct usbbus_transport *transport)
+{
+  // Let the event loop queue what already came in
+  struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+  libusb_handle_events_timeout_completed(transport->ctx, &tv, NULL);
+  if (transport->rx_count) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%zu stale packet(s) dropped", transport->rx_count);
+  }
+  transport->rx_head = 0;
+  transport->rx_count = 0;
+}
+
+/**
+ * @brief Find bulk endpoints of the first interface of \a dev
+ *
+ * @return Returns NFC_SUCCESS when both a bulk IN and a bulk OUT endpoint are found, otherwise returns libnfc's error code (negative value)
+ */
+int
+usbbus_get_end_points(libusb_device *dev, uint8_t *endpoint_in, uint8_t *endpoint_out, uint16_t *max_packet_size)
+{
+  struct libusb_config_descriptor *config;
+  int res;
+  if ((res = libusb_get_active_config_descriptor(dev, &config)) < 0) {
+    // Not configured yet, the drivers set the first configuration anyway
+    if ((res = libusb_get_config_descriptor(dev, 0, &config)) < 0)
+      return usbbus_error(res);
+  }
+
+  bool in_found = false, out_found = false;
+  // with libusb-win32 we got some null pointers so be robust before looking at endpoints
+  if ((config->bNumInterfaces > 0) && config->interface && (config->interface[0].num_altsetting > 0)) {
+    const struct libusb_interface_descriptor *puid = config->interface[0].altsetting;
+
+    // 3 Endpoints maximum: Interrupt In, Bulk In, Bulk Out
+    for (uint8_t uiIndex = 0; uiIndex < puid->bNumEndpoints; uiIndex++) {
+      // Only accept bulk transfer endpoints (ignore interrupt endpoints)
+      if ((puid->endpoint[uiIndex].bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
+        continue;
+
+      const uint8_t uiEndPoint = puid->endpoint[uiIndex].bEndpointAddress;
+      if ((uiEndPoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+        *endpoint_in = uiEndPoint;
+        in_found = true;
+      } else {
+        *endpoint_out = uiEndPoint;
+        out_found = true;
+      }
+      *max_packet_size = puid->endpoint[uiIndex].wMaxPacketSize;
+    }
+  }
+  libusb_free_config_descriptor(config);
+
+  return (in_found && out_found) ? NFC_SUCCESS : NFC_ENOTSUCHDEV;
+}
+
+struct usbbus_registry {
+  usbbus_mutex_t mutex;
+  // Everything below is only touched with the mutex held
+  libusb_context *ctx;
+  bool hotplug;
+#ifdef USBBUS_HOTPLUG
+  libusb_hotplug_callback_handle hotplug_handle;
+#endif
+  struct usbbus_device devices[USBBUS_REGISTRY_LEN];
+  size_t device_count;
+};
+
+/**
+ * @brief Create an empty registry, devices are enumerated on first listing
+ */
+struct usbbus_registry *
+usbbus_registry_new(void)
+{
+  struct usbbus_registry *registry = calloc(1, sizeof(struct usbbus_registry));
+  if (!registry)
+    return NULL;
+  usbbus_mutex_init(&registry->mutex);
+  return registry;
+}
+
+void
+usbbus_registry_free(struct usbbus_registry *registry)
+{
+  if (registry->ctx) {
+#ifdef USBBUS_HOTPLUG
+    if (registry->hotplug)
+      libusb_hotplug_deregister_callback(registry->ctx, registry->hotplug_handle);
+#endif
+    libusb_exit(registry->ctx);
+  }
+  usbbus_mutex_destroy(&registry->mutex);
+  free(registry);
+}
+
+static void
+usbbus_registry_add(struct usbbus_registry *registry, libusb_device *dev)
+{
+  struct libusb_device_descriptor descriptor;
+  if (libusb_get_device_descriptor(dev, &descriptor) < 0)
+    return;
+  // Only devices the drivers could talk to are kept
+  uint8_t endpoint_in, endpoint_out;
+  uint16_t max_packet_size;
+  if (usbbus_get_end_points(dev, &endpoint_in, &endpoint_out, &max_packet_size) < 0)
+    return;
+  if (registry->device_count == USBBUS_REGISTRY_LEN) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Too many USB devices, some of them are ignored");
+    return;
+  }
+  struct usbbus_device *device = &registry->devices[registry->device_count++];
+  device->bus = libusb_get_bus_number(dev);
+  device->address = libusb_get_device_address(dev);
+  device->vendor_id = descriptor.idVendor;
+  device->product_id = descriptor.idProduct;
+  log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "USB device %04x:%04x added on bus %03d device %03d", device->vendor_id, device->product_id, device->bus, device->address);
+}
+
+#ifdef USBBUS_HOTPLUG
+static void
+usbbus_registry_remove(struct usbbus_registry *registry, libusb_device *dev)
+{
+  const uint8_t bus = libusb_get_bus_number(dev);
+  const uint8_t address = libusb_get_device_address(dev);
+  for (size_t i = 0; i < registry->device_count; i++) {
+    if ((registry->devices[i].bus == bus) && (registry->devices[i].address == address)) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "USB device removed from bus %03d device %03d", bus, address);
+      registry->devices[i] = registry->devices[--registry->device_count];
+      return;
+    }
+  }
+}
+
+// Only called from libusb calls made by the registry, with its mutex held
+static int LIBUSB_CALL
+usbbus_registry_hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *user_data)
+{
+  (void) ctx;
+  struct usbbus_registry *registry = user_data;
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+    usbbus_registry_add(registry, dev);
+  } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+    usbbus_registry_remove(registry, dev);
+  }
+  return 0;
+}
+#endif
+
+static void
+usbbus_registry_enumerate(struct usbbus_registry *registry)
+{
+  libusb_device **devices;
+  ssize_t devices_count = libusb_get_device_list(registry->ctx, &devices);
+  if (devices_count < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", libusb_error_name(devices_count));
+    return;
+  }
+  registry->device_count = 0;
+  for (ssize_t i = 0; i < devices_count; i++)
+    usbbus_registry_add(registry, devices[i]);
+  libusb_free_device_list(devices, 1);
+}
+
+static int
+usbbus_registry_start(struct usbbus_registry *registry)
+{
+  int res;
+  if ((res = libusb_init(&registry->ctx)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to initialize libusb (%s)", libusb_error_name(res));
+    registry->ctx = NULL;
+    return usbbus_error(res);
+  }
+#ifdef USBBUS_HOTPLUG
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    // Already plugged devices are reported right away
+    res = libusb_hotplug_register_callback(registry->ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                           LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                           usbbus_registry_hotplug_callback, registry, &registry->hotplug_handle);
+    if (res == LIBUSB_SUCCESS) {
+      registry->hotplug = true;
+    } else {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Unable to register USB hotplug callback (%s)", libusb_error_name(res));
+      registry->device_count = 0;
+    }
+  }
+#endif
+  return NFC_SUCCESS;
+}
+
+/**
+ * @brief Copy the USB devices having a pair of bulk endpoints
+ *
+ * The registry is filled on first call and then kept up to date by libusb
+ * hotplug notifications, where supported, so listing never opens a device nor
+ * walks the bus again. Without hotplug support the devices are enumerated on
+ * each call, still without opening them.
+ *
+ * @return Returns the count of devices copied to \a devices
+ */
+size_t
+usbbus_registry_list(struct usbbus_registry *registry, struct usbbus_device devices[], const size_t devices_len)
+{
+  usbbus_mutex_lock(&registry->mutex);
+  if (!registry->ctx && (usbbus_registry_start(registry) < 0)) {
+    usbbus_mutex_unlock(&registry->mutex);
+    return 0;
+  }
+  if (registry->hotplug) {
+    // Have pending hotplug notifications delivered, without waiting for more
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+    libusb_handle_events_timeout_completed(registry->ctx, &tv, NULL);
+  } else {
+    usbbus_registry_enumerate(registry);
+  }
+  size_t count = 0;
+  for (; (count < registry->device_count) && (count < devices_len); count++)
+    devices[count] = registry->devices[count];
+  usbbus_mutex_unlock(&registry->mutex);
+  return count;
+}
@@ -0,0 +1,84 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * Copyright (C) 2009 Roel Verdult
+ * Copyright (C) 2010, 2011 Romain Tartière
+ * Copyright (C) 2010, 2011, 2012 Romuald Conty
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/**
+ * @file usbbus.h
+ * @brief USB bulk transport header
+ */
+
+#ifndef __NFC_BUS_USBBUS_H__
+#  define __NFC_BUS_USBBUS_H__
+
+#  include <stdbool.h>
+#  include <stdint.h>
+#  include <stddef.h>
+
+#  include <libusb.h>
+
+#  include <nfc/nfc-types.h>
+
+/**
+ * @struct usbbus_transport
+ * @brief Bulk endpoints pair of a claimed USB interface
+ *
+ * An IN transfer is kept submitted for as long as the transport lives, what
+ * the device sends is queued by the libusb event loop as soon as it arrives
+ * and handed out by usbbus_read(). The transport does not own the libusb
+ * context nor the device handle.
+ */
+struct usbbus_transport;
+
+struct usbbus_transport *usbbus_transport_new(libusb_context *ctx, libusb_device_handle *handle, const uint8_t endpoint_in, const uint8_t endpoint_out, const uint16_t max_packet_size, const size_t szRxMax);
+void    usbbus_transport_free(struct usbbus_transport *transport);
+
+int     usbbus_write(struct usbbus_transport *transport, const uint8_t *pbtTx, const size_t szTx, const int timeout);
+int     usbbus_read(struct usbbus_transport *transport, uint8_t *pbtRx, const size_t szRx, const int timeout);
+void    usbbus_flush_input(struct usbbus_transport *transport);
+int     usbbus_abort(struct usbbus_transport *transport);
+
+int     usbbus_get_end_points(libusb_device *dev, uint8_t *endpoint_in, uint8_t *endpoint_out, uint16_t *max_packet_size);
+
+// Count of devices with a pair of bulk endpoints a registry can hold
+#  define USBBUS_REGISTRY_LEN 64
+
+/**
+ * @struct usbbus_device
+ * @brief USB device known to a registry
+ */
+struct usbbus_device {
+  uint8_t bus;
+  uint8_t address;
+  uint16_t vendor_id;
+  uint16_t product_id;
+};
+
+/**
+ * @struct usbbus_registry
+ * @brief USB devices plugged in, shared by the USB drivers of a context
+ */
+struct usbbus_registry;
+
+struct usbbus_registry *usbbus_registry_new(void);
+void    usbbus_registry_free(struct usbbus_registry *registry);
+size_t  usbbus_registry_list(struct usbbus_registry *registry, struct usbbus_device devices[], const size_t devices_len);
+
+#endif // __NFC_BUS_USBBUS_H__
@@ -329,6 +329,15 @@ typedef struct {
 #define EOVCURRENT	0x2d
 #define ENAD		0x2e
 
+/* PN53x status byte flags, next to the error code */
+#define PN53X_STATUS_NAD	0x80
+#define PN53X_STATUS_MI		0x40
+#define PN53X_STATUS_ERROR	0x3f
+
+/* Tg byte flags of InDataExchange, next to the target number */
+#define PN53X_TG_NAD		0x80
+#define PN53X_TG_MI		0x40
+
 #ifdef LOG
 static const pn53x_register pn53x_registers[] = {
   PNREG(PN53X_REG_CIU_Mode, "Defines general modes for transmitting and receiving"),
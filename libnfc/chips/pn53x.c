@@ -33,26 +33,71 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifndef _WIN32
+#  include <time.h>
+#else
+#  include <windows.h>
+#endif
+
 #include "nfc/nfc.h"
 #include "nfc-internal.h"
 #include "pn53x.h"
 #include "pn53x-internal.h"
+#include "iso14443-4.h"
+#include "probes.h"
 
 #include "mirror-subr.h"
 
 #define LOG_CATEGORY "libnfc.chip.pn53x"
 #define LOG_GROUP NFC_LOG_GROUP_CHIP
 
+#define PN53X_CACHE_REGISTER_BIT(reg) (UINT64_C(1) << ((reg) - PN53X_CACHE_REGISTER_MIN_ADDRESS))
+// CIU registers the chip changes by itself (or which trigger an action), they are never shadowed
+#define PN53X_CACHE_VOLATILE_REGISTERS ( \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_CRCResultMSB) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_CRCResultLSB) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TCounterVal_hi) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TCounterVal_lo) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TestPinValue) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TestBus) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TestADC) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_RFlevelDet) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Command) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_CommIrq) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_DivIrq) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Error) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Status1) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Status2) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_FIFOData) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_FIFOLevel) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Control) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_BitFraming) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_Coll))
+// CIU timer setup, loaded by the firmware for its own timeouts
+#define PN53X_CACHE_TIMER_REGISTERS ( \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TMode) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TPrescaler) | \
+  PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TReloadVal_hi) | PN53X_CACHE_REGISTER_BIT(PN53X_REG_CIU_TReloadVal_lo))
+
+#define SAK_ISO14443_4_COMPLIANT 0x20
+#define SAK_ISO18092_COMPLIANT   0x40
+
+// Presence probes get a few round trips of the previous ones, within these bounds (ms)
+#define PN53X_PRESENCE_TIMEOUT_MIN   20
+#define PN53X_PRESENCE_TIMEOUT_FIRST 100
+// Card Presence command can take more time than default one: when a card is
+// removed from the field, the PN53x took few hundred ms more to reply
+// correctly. (ie. 700 ms should be enough to detect all tested cases)
+#define PN53X_PRESENCE_TIMEOUT_MAX   700
+
 const uint8_t pn53x_ack_frame[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
 const uint8_t pn53x_nack_frame[] = { 0x00, 0x00, 0xff, 0xff, 0x00, 0x00 };
 static const uint8_t pn53x_error_frame[] = { 0x00, 0x00, 0xff, 0x01, 0xff, 0x7f, 0x81, 0x00 };
 const nfc_baud_rate pn53x_iso14443a_supported_baud_rates[] = { NBR_106, 0 };
+const nfc_baud_rate pn532_iso14443a_supported_baud_rates[] = { NBR_424, NBR_212, NBR_106, 0 };
+const nfc_baud_rate pn533_iso14443a_supported_baud_rates[] = { NBR_847, NBR_424, NBR_212, NBR_106, 0 };
 const nfc_baud_rate pn53x_felica_supported_baud_rates[] = { NBR_424, NBR_212, 0 };
 const nfc_baud_rate pn53x_dep_supported_baud_rates[] = { NBR_424, NBR_212, NBR_106, 0 };
 const nfc_baud_rate pn53x_jewel_supported_baud_rates[] = { NBR_106, 0 };
 const nfc_baud_rate pn532_iso14443b_supported_baud_rates[] = { NBR_106, 0 };
 const nfc_baud_rate pn533_iso14443b_supported_baud_rates[] = { NBR_847, NBR_424, NBR_212, NBR_106, 0 };
 const nfc_modulation_type pn53x_supported_modulation_as_target[] = {NMT_ISO14443A, NMT_FELICA, NMT_DEP, 0};
+// P3 and P7 are not there: their input pins change whatever libnfc does
+static const uint16_t pn53x_shadow_extra_registers[PN53X_SHADOW_EXTRA_REGISTERS_LEN] = {
+  PN53X_REG_Control_switch_rng,
+  PN53X_SFR_P3CFGA, PN53X_SFR_P3CFGB,
+  PN53X_SFR_P7CFGA, PN53X_SFR_P7CFGB,
+};
 
 /* prototypes */
 int pn53x_reset_settings(struct nfc_device *pnd);
@@ -65,8 +110,117 @@ pn53x_target_type pn53x_nm_to_ptt(const nfc_modulation nm);
 void pn53x_current_target_new(const struct nfc_device *pnd, const nfc_target *pnt);
 void pn53x_current_target_free(const struct nfc_device *pnd);
 bool pn53x_current_target_is(const struct nfc_device *pnd, const nfc_target *pnt);
+static void pn53x_second_target_new(const struct nfc_device *pnd, const nfc_target *pnt);
+static void pn53x_target_free(const struct nfc_device *pnd, const int tg);
+static int pn53x_response_status(struct nfc_device *pnd, const uint8_t *pbtTx, const uint8_t *pbtFrameRx, const size_t szRx);
 
 /* implementations */
+static int
+pn53x_shadow_extra_index(const uint16_t ui16RegisterAddress)
+{
+  for (int n = 0; n < PN53X_SHADOW_EXTRA_REGISTERS_LEN; n++) {
+    if (pn53x_shadow_extra_registers[n] == ui16RegisterAddress)
+      return n;
+  }
+  return -1;
+}
+
+static void
+pn53x_shadow_invalidate(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx)
+{
+  switch (pbtTx[0]) {
+    case ReadRegister:
+    case GetFirmwareVersion:
+    case GetGeneralStatus:
+    case ReadGPIO:
+    case WriteGPIO:
+    case SetParameters:
+      // These commands leave the CIU alone
+      break;
+    case InCommunicateThru:
+      // The frame is sent with the current CIU settings, only the timer is reloaded
+      CHIP_DATA(pnd)->shadow_valid &= ~PN53X_CACHE_TIMER_REGISTERS;
+      break;
+    case WriteRegister:
+      // Forget the registers written, whoever built the frame updates the shadow once it succeeded
+      for (size_t i = 1; i + 2 < szTx; i += 3) {
+        const uint16_t ui16RegisterAddress = (pbtTx[i] << 8) | pbtTx[i + 1];
+        if ((ui16RegisterAddress >= PN53X_CACHE_REGISTER_MIN_ADDRESS) && (ui16RegisterAddress <= PN53X_CACHE_REGISTER_MAX_ADDRESS))
+          CHIP_DATA(pnd)->shadow_valid &= ~PN53X_CACHE_REGISTER_BIT(ui16RegisterAddress);
+        const int n = pn53x_shadow_extra_index(ui16RegisterAddress);
+        if (n >= 0)
+          CHIP_DATA(pnd)->shadow_extra_valid &= ~(1 << n);
+      }
+      break;
+    default:
+      // Anything else lets the firmware reprogram the CIU
+      CHIP_DATA(pnd)->shadow_valid = 0;
+      break;
+  }
+  switch (pbtTx[0]) {
+    case InRelease:
+    case TgInitAsTarget:
+    case PowerDown:
+    case WriteGPIO:
+      // Firmware may reconfigure the ports and the power switches
+      CHIP_DATA(pnd)->shadow_extra_valid = 0;
+      break;
+    default:
+      break;
+  }
+  switch (pbtTx[0]) {
+    case TgInitAsTarget:
+    case PowerDown:
+      // RF settings are not kept in target mode or power down
+      CHIP_DATA(pnd)->property_known = 0;
+      break;
+    case InListPassiveTarget:
+    case InJumpForDEP:
+    case InJumpForPSL:
+    case InAutoPoll:
+      // Field is switched on when needed
+      CHIP_DATA(pnd)->property_known &= ~(1UL << NP_ACTIVATE_FIELD);
+      break;
+    case RFConfiguration:
+      // Forget the configured item, whoever sent it learns the new state once it succeeded
+      if (szTx > 1) {
+        switch (pbtTx[1]) {
+          case RFCI_FIELD:
+            CHIP_DATA(pnd)->property_known &= ~(1UL << NP_ACTIVATE_FIELD);
+            break;
+          case RFCI_TIMING:
+            CHIP_DATA(pnd)->property_known &= ~((1UL << NP_TIMEOUT_ATR) | (1UL << NP_TIMEOUT_COM));
+            break;
+          case RFCI_RETRY_SELECT:
+            CHIP_DATA(pnd)->property_known &= ~(1UL << NP_INFINITE_SELECT);
+            break;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static bool
+pn53x_property_is(const struct nfc_device *pnd, const nfc_property property, const bool bEnable)
+{
+  const uint32_t bit = 1UL << property;
+  return (CHIP_DATA(pnd)->property_known & bit) && (((CHIP_DATA(pnd)->property_enabled & bit) != 0) == bEnable);
+}
+
+static void
+pn53x_property_learn(struct nfc_device *pnd, const nfc_property property, const bool bEnable)
+{
+  const uint32_t bit = 1UL << property;
+  CHIP_DATA(pnd)->property_known |= bit;
+  if (bEnable) {
+    CHIP_DATA(pnd)->property_enabled |= bit;
+  } else {
+    CHIP_DATA(pnd)->property_enabled &= ~bit;
+  }
+}
+
 int
 pn53x_init(struct nfc_device *pnd)
 {
@@ -143,17 +297,25 @@ pn53x_reset_settings(struct nfc_device *pnd)
   return NFC_SUCCESS;
 }
 
-int
-pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRxLen, int timeout)
+/*
+ * Send the command at pbtTx, which has PN53X_FRAME_HEADROOM bytes before it
+ * and PN53X_FRAME_TAILROOM after it so the driver frames it in place. The
+ * response is copied to pbtRx when one is given, *ppbtRx is anyway pointed to
+ * the response in the receive frame, where it stays until the next command.
+ */
+static int
+pn53x_exchange_frame(struct nfc_device *pnd, uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRxLen,
+                     const uint8_t **ppbtRx, int timeout)
 {
   int res = 0;
-  if (CHIP_DATA(pnd)->wb_trigged) {
+  if (CHIP_DATA(pnd)->wb_dirty) {
     if ((res = pn53x_writeback_register(pnd)) < 0) {
       return res;
     }
   }
 
   PNCMD_TRACE(pbtTx[0]);
+  pn53x_shadow_invalidate(pnd, pbtTx, szTx);
   if (timeout > 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Timeout values: %d", timeout);
   } else if (timeout == 0) {
@@ -164,18 +326,15 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Invalid timeout value: %d", timeout);
   }
 
-  uint8_t  abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
-  size_t  szRx = sizeof(abtRx);
-
-  // Check if receiving buffers are available, if not, replace them
-  if (szRxLen == 0 || !pbtRx) {
-    pbtRx = abtRx;
-  } else {
-    szRx = szRxLen;
-  }
-
+  nfc_trace_frame(pnd, NFC_TRACE_CHIP, NFC_TRACE_TX, pbtTx, szTx);
+  CHIP_DATA(pnd)->command_start = nfc_trace_now();
+  PROBE3(pn53x__command__start, pbtTx[0], szTx, timeout);
   // Call the send/receice callback functions of the current driver
-  if ((res = CHIP_DATA(pnd)->io->send(pnd, pbtTx, szTx, timeout)) < 0) {
+  res = CHIP_DATA(pnd)->io->send(pnd, pbtTx, szTx, timeout);
+  PROBE4(driver__send, pnd->driver->name, pbtTx[0], res, timeout);
+  if (res < 0) {
+    nfc_stats_command(pnd, pbtTx[0], CHIP_DATA(pnd)->command_start, res, 0);
+    PROBE3(pn53x__command__done, pbtTx[0], res, 0);
     return res;
   }
 
@@ -187,15 +346,44 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
     CHIP_DATA(pnd)->power_mode = POWERDOWN;
   }
 
-  if ((res = CHIP_DATA(pnd)->io->receive(pnd, pbtRx, szRx, timeout)) < 0) {
+  const uint8_t *pbtFrameRx = CHIP_DATA(pnd)->abtRxFrame;
+  res = CHIP_DATA(pnd)->io->receive(pnd, CHIP_DATA(pnd)->abtRxFrame, sizeof(CHIP_DATA(pnd)->abtRxFrame), &pbtFrameRx, timeout);
+  PROBE4(driver__receive, pnd->driver->name, pbtTx[0], res, timeout);
+  if (res < 0) {
+    nfc_stats_command(pnd, pbtTx[0], CHIP_DATA(pnd)->command_start, res, 0);
+    PROBE3(pn53x__command__done, pbtTx[0], res, 0);
     return res;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_CHIP, NFC_TRACE_RX, pbtFrameRx, res);
 
   if ((CHIP_DATA(pnd)->type == PN532) && (TgInitAsTarget == pbtTx[0])) { // PN532 automatically wakeup on external RF field
     CHIP_DATA(pnd)->power_mode = NORMAL; // When TgInitAsTarget reply that means an external RF have waken up the chip
   }
 
-  szRx = (size_t) res;
+  const size_t szRx = (size_t) res;
+  if (pbtRx && szRxLen) {
+    if (szRx > szRxLen) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive data: buffer too small. (szDataLen: %zu, len: %zu)", szRxLen, szRx);
+      nfc_stats_command(pnd, pbtTx[0], CHIP_DATA(pnd)->command_start, (int) szRx, 0);
+      PROBE3(pn53x__command__done, pbtTx[0], NFC_EIO, 0);
+      pnd->last_error = NFC_EIO;
+      return pnd->last_error;
+    }
+    memcpy(pbtRx, pbtFrameRx, szRx);
+  }
+  *ppbtRx = pbtFrameRx;
+  return pn53x_response_status(pnd, pbtTx, pbtFrameRx, szRx);
+}
+
+/*
+ * Extract the status byte of the response pbtFrameRx (szRx bytes long) to the
+ * command pbtTx, then map it to a libnfc error code. szRx is returned when
+ * the chip reports no error.
+ */
+static int
+pn53x_response_status(struct nfc_device *pnd, const uint8_t *pbtTx, const uint8_t *pbtFrameRx, const size_t szRx)
+{
+  int res;
   switch (pbtTx[0]) {
     case PowerDown:
     case InDataExchange:
@@ -211,13 +399,18 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
     case TgResponseToInitiator:
     case TgSetGeneralBytes:
     case TgSetMetaData:
-      if (pbtRx[0] & 0x80) { abort(); } // NAD detected
-      if (pbtRx[0] & 0x40) { abort(); } // MI detected
-      CHIP_DATA(pnd)->last_status_byte = pbtRx[0] & 0x3f;
+      if (pbtFrameRx[0] & PN53X_STATUS_NAD) {
+        // libnfc never sends a NAD, none is expected back
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unexpected NAD in response");
+        pnd->last_error = NFC_ENOTIMPL;
+        return pnd->last_error;
+      }
+      // MI (more information) is left in pbtRx[0] for the caller to handle chaining
+      CHIP_DATA(pnd)->last_status_byte = pbtFrameRx[0] & PN53X_STATUS_ERROR;
       break;
     case Diagnose:
       if (pbtTx[1] == 0x06) { // Diagnose: Card presence detection
-        CHIP_DATA(pnd)->last_status_byte = pbtRx[0] & 0x3f;
+        CHIP_DATA(pnd)->last_status_byte = pbtFrameRx[0] & 0x3f;
       } else {
         CHIP_DATA(pnd)->last_status_byte = 0;
       };
@@ -230,13 +423,13 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
         CHIP_DATA(pnd)->last_status_byte = 0;
         break;
       }
-      CHIP_DATA(pnd)->last_status_byte = pbtRx[0] & 0x3f;
+      CHIP_DATA(pnd)->last_status_byte = pbtFrameRx[0] & 0x3f;
       break;
     case ReadRegister:
     case WriteRegister:
       if (CHIP_DATA(pnd)->type == PN533) {
         // PN533 prepends its answer by the status byte
-        CHIP_DATA(pnd)->last_status_byte = pbtRx[0] & 0x3f;
+        CHIP_DATA(pnd)->last_status_byte = pbtFrameRx[0] & 0x3f;
       } else {
         CHIP_DATA(pnd)->last_status_byte = 0;
       }
@@ -282,7 +475,11 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
     case ETGREL:
     case ECDISCARDED:
       res = NFC_ETGRELEASED;
-      pn53x_current_target_free(pnd);
+      // With two targets activated, only the one the data was for is gone
+      if ((pbtTx[0] == InDataExchange) && CHIP_DATA(pnd)->second_target)
+        pn53x_target_free(pnd, pbtTx[1] & ~PN53X_TG_MI);
+      else
+        pn53x_current_target_free(pnd);
       break;
     case EMFAUTH:
       // When a MIFARE Classic AUTH fails, the tag is automatically in HALT state
@@ -292,6 +489,8 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
       res = NFC_ECHIP;
       break;
   };
+  nfc_stats_command(pnd, pbtTx[0], CHIP_DATA(pnd)->command_start, (int) szRx, CHIP_DATA(pnd)->last_status_byte);
+  PROBE3(pn53x__command__done, pbtTx[0], res, CHIP_DATA(pnd)->last_status_byte);
 
   if (res < 0) {
     pnd->last_error = res;
@@ -302,6 +501,33 @@ pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx
   return res;
 }
 
+// One thread at a time exchanges frames with the device
+static int
+pn53x_transceive_frame(struct nfc_device *pnd, uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRxLen,
+                       const uint8_t **ppbtRx, int timeout)
+{
+  nfc_device_lock(pnd);
+  const int res = pn53x_exchange_frame(pnd, pbtTx, szTx, pbtRx, szRxLen, ppbtRx, timeout);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
+int
+pn53x_transceive(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRxLen, int timeout)
+{
+  uint8_t abtTx[PN53X_FRAME_BUFFER_LEN];
+  const uint8_t *pbtFrameRx;
+
+  if (szTx > PN53x_EXTENDED_FRAME__DATA_MAX_LEN) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "We can't send more than %d bytes in a raw (requested: %zd)", PN53x_EXTENDED_FRAME__DATA_MAX_LEN, szTx);
+    pnd->last_error = NFC_ECHIP;
+    return pnd->last_error;
+  }
+  // Small commands are copied where the driver has room to frame them
+  memcpy(abtTx + PN53X_FRAME_HEADROOM, pbtTx, szTx);
+  return pn53x_transceive_frame(pnd, abtTx + PN53X_FRAME_HEADROOM, szTx, pbtRx, szRxLen, &pbtFrameRx, timeout);
+}
+
 int
 pn53x_set_parameters(struct nfc_device *pnd, const uint8_t ui8Parameter, const bool bEnable)
 {
@@ -600,7 +826,35 @@ pn53x_ReadRegister(struct nfc_device *pnd, uint16_t ui16RegisterAddress, uint8_t
 
 int pn53x_read_register(struct nfc_device *pnd, uint16_t ui16RegisterAddress, uint8_t *ui8Value)
 {
-  return pn53x_ReadRegister(pnd, ui16RegisterAddress, ui8Value);
+  int res = 0;
+  if ((ui16RegisterAddress < PN53X_CACHE_REGISTER_MIN_ADDRESS) || (ui16RegisterAddress > PN53X_CACHE_REGISTER_MAX_ADDRESS)) {
+    const int n = pn53x_shadow_extra_index(ui16RegisterAddress);
+    if ((n >= 0) && (CHIP_DATA(pnd)->shadow_extra_valid & (1 << n))) {
+      *ui8Value = CHIP_DATA(pnd)->shadow_extra_data[n];
+      return NFC_SUCCESS;
+    }
+    if ((res = pn53x_ReadRegister(pnd, ui16RegisterAddress, ui8Value)) < 0)
+      return res;
+    if (n >= 0) {
+      CHIP_DATA(pnd)->shadow_extra_data[n] = *ui8Value;
+      CHIP_DATA(pnd)->shadow_extra_valid |= (1 << n);
+    }
+    return NFC_SUCCESS;
+  }
+  const int internal_address = ui16RegisterAddress - PN53X_CACHE_REGISTER_MIN_ADDRESS;
+  const uint64_t bit = PN53X_CACHE_REGISTER_BIT(ui16RegisterAddress);
+  if ((CHIP_DATA(pnd)->shadow_valid & bit) && !(CHIP_DATA(pnd)->wb_dirty & bit)) {
+    // Last known value is still in the register
+    *ui8Value = CHIP_DATA(pnd)->shadow_data[internal_address];
+    return NFC_SUCCESS;
+  }
+  if ((res = pn53x_ReadRegister(pnd, ui16RegisterAddress, ui8Value)) < 0)
+    return res;
+  if (!(PN53X_CACHE_VOLATILE_REGISTERS & bit)) {
+    CHIP_DATA(pnd)->shadow_data[internal_address] = *ui8Value;
+    CHIP_DATA(pnd)->shadow_valid |= bit;
+  }
+  return NFC_SUCCESS;
 }
 
 static int
@@ -617,23 +871,43 @@ pn53x_write_register(struct nfc_device *pnd, const uint16_t ui16RegisterAddress,
   int res = 0;
   if ((ui16RegisterAddress < PN53X_CACHE_REGISTER_MIN_ADDRESS) || (ui16RegisterAddress > PN53X_CACHE_REGISTER_MAX_ADDRESS)) {
     // Direct write
-    if (ui8SymbolMask != 0xff) {
+    const int n = pn53x_shadow_extra_index(ui16RegisterAddress);
+    uint8_t ui8NewValue = ui8Value;
+    if ((ui8SymbolMask != 0xff) || ((n >= 0) && (CHIP_DATA(pnd)->shadow_extra_valid & (1 << n)))) {
+      // Shadowed registers are only read when their value is unknown
       uint8_t ui8CurrentValue;
       if ((res = pn53x_read_register(pnd, ui16RegisterAddress, &ui8CurrentValue)) < 0)
         return res;
-      uint8_t ui8NewValue = ((ui8Value & ui8SymbolMask) | (ui8CurrentValue & (~ui8SymbolMask)));
-      if (ui8NewValue != ui8CurrentValue) {
-        return pn53x_WriteRegister(pnd, ui16RegisterAddress, ui8NewValue);
+      ui8NewValue = ((ui8Value & ui8SymbolMask) | (ui8CurrentValue & (~ui8SymbolMask)));
+      if (ui8NewValue == ui8CurrentValue) {
+        return NFC_SUCCESS;
       }
-    } else {
-      return pn53x_WriteRegister(pnd, ui16RegisterAddress, ui8Value);
+    }
+    if ((res = pn53x_WriteRegister(pnd, ui16RegisterAddress, ui8NewValue)) < 0)
+      return res;
+    if (n >= 0) {
+      CHIP_DATA(pnd)->shadow_extra_data[n] = ui8NewValue;
+      CHIP_DATA(pnd)->shadow_extra_valid |= (1 << n);
     }
   } else {
     // Write-back cache area
     const int internal_address = ui16RegisterAddress - PN53X_CACHE_REGISTER_MIN_ADDRESS;
+    const uint64_t bit = PN53X_CACHE_REGISTER_BIT(ui16RegisterAddress);
     CHIP_DATA(pnd)->wb_data[internal_address] = (CHIP_DATA(pnd)->wb_data[internal_address] & CHIP_DATA(pnd)->wb_mask[internal_address] & (~ui8SymbolMask)) | (ui8Value & ui8SymbolMask);
     CHIP_DATA(pnd)->wb_mask[internal_address] = CHIP_DATA(pnd)->wb_mask[internal_address] | ui8SymbolMask;
-    CHIP_DATA(pnd)->wb_trigged = true;
+    if (CHIP_DATA(pnd)->shadow_valid & bit) {
+      // Last known value completes the masked bits, no need to read the register back
+      const uint8_t ui8CurrentValue = CHIP_DATA(pnd)->shadow_data[internal_address];
+      CHIP_DATA(pnd)->wb_data[internal_address] = (CHIP_DATA(pnd)->wb_data[internal_address] & CHIP_DATA(pnd)->wb_mask[internal_address]) | (ui8CurrentValue & (~CHIP_DATA(pnd)->wb_mask[internal_address]));
+      if (CHIP_DATA(pnd)->wb_data[internal_address] == ui8CurrentValue) {
+        // Register already holds this value, drop the write
+        CHIP_DATA(pnd)->wb_mask[internal_address] = 0x00;
+        CHIP_DATA(pnd)->wb_dirty &= ~bit;
+        return NFC_SUCCESS;
+      }
+      CHIP_DATA(pnd)->wb_mask[internal_address] = 0xff;
+    }
+    CHIP_DATA(pnd)->wb_dirty |= bit;
   }
   return NFC_SUCCESS;
 }
@@ -647,10 +921,12 @@ pn53x_writeback_register(struct nfc_device *pnd)
   BUFFER_APPEND(abtReadRegisterCmd, ReadRegister);
 
   // First step, it looks for registers to be read before applying the requested mask
-  CHIP_DATA(pnd)->wb_trigged = false;
+  uint64_t dirty = CHIP_DATA(pnd)->wb_dirty;
+  CHIP_DATA(pnd)->wb_dirty = 0;
+  PROBE1(pn53x__writeback, dirty);
   for (size_t n = 0; n < PN53X_CACHE_REGISTER_SIZE; n++) {
-    if ((CHIP_DATA(pnd)->wb_mask[n]) && (CHIP_DATA(pnd)->wb_mask[n] != 0xff)) {
-      // This register needs to be read: mask is present but does not cover full data width (ie. mask != 0xff)
+    if ((dirty & (UINT64_C(1) << n)) && (CHIP_DATA(pnd)->wb_mask[n] != 0xff)) {
+      // This register needs to be read: mask does not cover full data width (ie. mask != 0xff) and value is unknown
       const uint16_t pn53x_register_address = PN53X_CACHE_REGISTER_MIN_ADDRESS + n;
       BUFFER_APPEND(abtReadRegisterCmd, pn53x_register_address  >> 8);
       BUFFER_APPEND(abtReadRegisterCmd, pn53x_register_address & 0xff);
@@ -671,13 +947,19 @@ pn53x_writeback_register(struct nfc_device *pnd)
       i = 1;
     }
     for (size_t n = 0; n < PN53X_CACHE_REGISTER_SIZE; n++) {
-      if ((CHIP_DATA(pnd)->wb_mask[n]) && (CHIP_DATA(pnd)->wb_mask[n] != 0xff)) {
+      const uint64_t bit = UINT64_C(1) << n;
+      if ((dirty & bit) && (CHIP_DATA(pnd)->wb_mask[n] != 0xff)) {
+        if (!(PN53X_CACHE_VOLATILE_REGISTERS & bit)) {
+          CHIP_DATA(pnd)->shadow_data[n] = abtRes[i];
+          CHIP_DATA(pnd)->shadow_valid |= bit;
+        }
         CHIP_DATA(pnd)->wb_data[n] = ((CHIP_DATA(pnd)->wb_data[n] & CHIP_DATA(pnd)->wb_mask[n]) | (abtRes[i] & (~CHIP_DATA(pnd)->wb_mask[n])));
         if (CHIP_DATA(pnd)->wb_data[n] != abtRes[i]) {
           // Requested value is different from read one
           CHIP_DATA(pnd)->wb_mask[n] = 0xff;  // We can now apply whole data bits
         } else {
           CHIP_DATA(pnd)->wb_mask[n] = 0x00;  // We already have the right value
+          dirty &= ~bit;
         }
         i++;
       }
@@ -687,7 +969,7 @@ pn53x_writeback_register(struct nfc_device *pnd)
   BUFFER_INIT(abtWriteRegisterCmd, PN53x_EXTENDED_FRAME__DATA_MAX_LEN);
   BUFFER_APPEND(abtWriteRegisterCmd, WriteRegister);
   for (size_t n = 0; n < PN53X_CACHE_REGISTER_SIZE; n++) {
-    if (CHIP_DATA(pnd)->wb_mask[n] == 0xff) {
+    if (dirty & (UINT64_C(1) << n)) {
       const uint16_t pn53x_register_address = PN53X_CACHE_REGISTER_MIN_ADDRESS + n;
       PNREG_TRACE(pn53x_register_address);
       BUFFER_APPEND(abtWriteRegisterCmd, pn53x_register_address  >> 8);
@@ -703,6 +985,14 @@ pn53x_writeback_register(struct nfc_device *pnd)
     if ((res = pn53x_transceive(pnd, abtWriteRegisterCmd, BUFFER_SIZE(abtWriteRegisterCmd), NULL, 0, -1)) < 0) {
       return res;
     }
+    // Written values are now the last known ones
+    for (size_t n = 0; n < PN53X_CACHE_REGISTER_SIZE; n++) {
+      const uint64_t bit = UINT64_C(1) << n;
+      if ((dirty & bit) && !(PN53X_CACHE_VOLATILE_REGISTERS & bit)) {
+        CHIP_DATA(pnd)->shadow_data[n] = CHIP_DATA(pnd)->wb_data[n];
+        CHIP_DATA(pnd)->shadow_valid |= bit;
+      }
+    }
   }
   return NFC_SUCCESS;
 }
@@ -775,6 +1065,18 @@ pn53x_int_to_timeout(const int ms)
   return res;
 }
 
+static int
+pn53x_set_timings(struct nfc_device *pnd)
+{
+  int res = 0;
+  if ((res = pn53x_RFConfiguration__Various_timings(pnd, pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_atr), pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_communication))) < 0)
+    return res;
+  // Both timeouts are set at once
+  pn53x_property_learn(pnd, NP_TIMEOUT_ATR, true);
+  pn53x_property_learn(pnd, NP_TIMEOUT_COM, true);
+  return NFC_SUCCESS;
+}
+
 int
 pn53x_set_property_int(struct nfc_device *pnd, const nfc_property property, const int value)
 {
@@ -783,12 +1085,20 @@ pn53x_set_property_int(struct nfc_device *pnd, const nfc_property property, cons
       CHIP_DATA(pnd)->timeout_command = value;
       break;
     case NP_TIMEOUT_ATR:
+      if ((value == CHIP_DATA(pnd)->timeout_atr) && pn53x_property_is(pnd, property, true)) {
+        // Nothing to do
+        return NFC_SUCCESS;
+      }
       CHIP_DATA(pnd)->timeout_atr = value;
-      return pn53x_RFConfiguration__Various_timings(pnd, pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_atr), pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_communication));
+      return pn53x_set_timings(pnd);
       break;
     case NP_TIMEOUT_COM:
+      if ((value == CHIP_DATA(pnd)->timeout_communication) && pn53x_property_is(pnd, property, true)) {
+        // Nothing to do
+        return NFC_SUCCESS;
+      }
       CHIP_DATA(pnd)->timeout_communication = value;
-      return pn53x_RFConfiguration__Various_timings(pnd, pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_atr), pn53x_int_to_timeout(CHIP_DATA(pnd)->timeout_communication));
+      return pn53x_set_timings(pnd);
       break;
       // Following properties are invalid (not integer)
     case NP_HANDLE_CRC:
@@ -803,6 +1113,7 @@ pn53x_set_property_int(struct nfc_device *pnd, const nfc_property property, cons
     case NP_FORCE_ISO14443_A:
     case NP_FORCE_ISO14443_B:
     case NP_FORCE_SPEED_106:
+    case NP_AUTO_PPS:
       return NFC_EINVARG;
   }
   return NFC_SUCCESS;
@@ -848,7 +1159,14 @@ pn53x_set_property_bool(struct nfc_device *pnd, const nfc_property property, con
       break;
 
     case NP_ACTIVATE_FIELD:
-      return pn53x_RFConfiguration__RF_field(pnd, bEnable);
+      if (pn53x_property_is(pnd, property, bEnable)) {
+        // Nothing to do
+        return NFC_SUCCESS;
+      }
+      if ((res = pn53x_RFConfiguration__RF_field(pnd, bEnable)) < 0)
+        return res;
+      pn53x_property_learn(pnd, property, bEnable);
+      return NFC_SUCCESS;
       break;
 
     case NP_ACTIVATE_CRYPTO1:
@@ -857,14 +1175,21 @@ pn53x_set_property_bool(struct nfc_device *pnd, const nfc_property property, con
       break;
 
     case NP_INFINITE_SELECT:
+      if (pn53x_property_is(pnd, property, bEnable)) {
+        // Nothing to do
+        return NFC_SUCCESS;
+      }
       // TODO Made some research around this point:
       // timings could be tweak better than this, and maybe we can tweak timings
       // to "gain" a sort-of hardware polling (ie. like PN532 does)
-      return pn53x_RFConfiguration__MaxRetries(pnd,
-                                               (bEnable) ? 0xff : 0x00,        // MxRtyATR, default: active = 0xff, passive = 0x02
-                                               (bEnable) ? 0xff : 0x01,        // MxRtyPSL, default: 0x01
-                                               (bEnable) ? 0xff : 0x02         // MxRtyPassiveActivation, default: 0xff (0x00 leads to problems with PN531)
-                                              );
+      if ((res = pn53x_RFConfiguration__MaxRetries(pnd,
+                                                   (bEnable) ? 0xff : 0x00,        // MxRtyATR, default: active = 0xff, passive = 0x02
+                                                   (bEnable) ? 0xff : 0x01,        // MxRtyPSL, default: 0x01
+                                                   (bEnable) ? 0xff : 0x02         // MxRtyPassiveActivation, default: 0xff (0x00 leads to problems with PN531)
+                                                  )) < 0)
+        return res;
+      pn53x_property_learn(pnd, property, bEnable);
+      return NFC_SUCCESS;
       break;
 
     case NP_ACCEPT_INVALID_FRAMES:
@@ -924,6 +1249,11 @@ pn53x_set_property_bool(struct nfc_device *pnd, const nfc_property property, con
       }
       return pn53x_write_register(pnd, PN53X_REG_CIU_RxMode, SYMBOL_RX_SPEED, 0x00);
       break;
+
+    case NP_AUTO_PPS:
+      pnd->bAutoPps = bEnable;
+      return NFC_SUCCESS;
+      break;
       // Following properties are invalid (not boolean)
     case NP_TIMEOUT_COMMAND:
     case NP_TIMEOUT_ATR:
@@ -1021,6 +1351,61 @@ pn532_initiator_init_secure_element(struct nfc_device *pnd)
   return pn532_SAMConfiguration(pnd, PSM_WIRED_CARD, -1);
 }
 
+// Highest bit rate the chip reaches with ISO14443-4A targets
+static nfc_baud_rate
+pn53x_iso14443a_max_baud_rate(const struct nfc_device *pnd)
+{
+  switch (CHIP_DATA(pnd)->type) {
+    case PN532:
+      return NBR_424;
+    case PN533:
+      return NBR_847;
+    default:
+      return NBR_106;
+  }
+}
+
+/*
+ * Switch a freshly activated ISO14443-4A target to the highest bit rate, not
+ * above nbrMax, both sides handle as told by TA(1) in its ATS. The same rate
+ * is used both ways. InPSL sends the PPS request, the CIU speed is then set
+ * accordingly. A target which does not answer the PPS stays at 106 kbps.
+ */
+static int
+pn53x_initiator_negotiate_pps(struct nfc_device *pnd, nfc_target *pnt, nfc_baud_rate nbrMax)
+{
+  const nfc_iso14443a_info *pnai = &(pnt->nti.nai);
+  int res = 0;
+
+  // TA(1) is present when T0 b5 is set
+  if ((pnai->szAtsLen < 2) || !(pnai->abtAts[0] & 0x10))
+    return NFC_SUCCESS;
+  const uint8_t btTa1 = pnai->abtAts[1];
+  nbrMax = MIN(nbrMax, pn53x_iso14443a_max_baud_rate(pnd));
+
+  // DS (PICC to PCD) in b7..b5 and DR (PCD to PICC) in b3..b1, for 847, 424 and 212 kbps
+  nfc_baud_rate nbr = nbrMax;
+  while ((nbr > NBR_106) && !((btTa1 >> 4) & btTa1 & (1 << (nbr - NBR_212))))
+    nbr--;
+  if (nbr == NBR_106)
+    return NFC_SUCCESS;
+
+  if ((res = pn53x_InPSL(pnd, 1, nbr, nbr)) < 0) {
+    if ((res != NFC_ERFTRANS) && (res != NFC_ETIMEOUT))
+      return res;
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "PPS to %s failed, target stays at 106 kbps", str_nfc_baud_rate(nbr));
+    return NFC_SUCCESS;
+  }
+  // The firmware may have set them already, the write-back cache then drops these
+  const uint8_t btSpeed = (nbr - NBR_106) << 4;
+  if ((res = pn53x_write_register(pnd, PN53X_REG_CIU_TxMode, SYMBOL_TX_SPEED, btSpeed)) < 0)
+    return res;
+  if ((res = pn53x_write_register(pnd, PN53X_REG_CIU_RxMode, SYMBOL_RX_SPEED, btSpeed)) < 0)
+    return res;
+  pnt->nm.nbr = nbr;
+  return NFC_SUCCESS;
+}
+
 static int
 pn53x_initiator_select_passive_target_ext(struct nfc_device *pnd,
                                           const nfc_modulation nm,
@@ -1115,13 +1500,24 @@ pn53x_initiator_select_passive_target_ext(struct nfc_device *pnd,
   if ((res = pn53x_InListPassiveTarget(pnd, pm, 1, pbtInitData, szInitData, abtTargetsData, &szTargetsData, timeout)) <= 0)
     return res;
 
+  nfc_target nt;
+  nt.nm = nm;
+  // Fill the tag info struct with the values corresponding to this init modulation
+  if ((res = pn53x_decode_target_data(abtTargetsData + 1, szTargetsData - 1, CHIP_DATA(pnd)->type, nm.nmt, &(nt.nti))) < 0) {
+    return res;
+  }
+  if (nm.nmt == NMT_ISO14443A) {
+    // Activation is always done at 106 kbps
+    nt.nm.nbr = NBR_106;
+    if (pnd->bAutoIso14443_4 && pnd->bAutoPps) {
+      if ((res = pn53x_initiator_negotiate_pps(pnd, &nt, (nm.nbr > NBR_106) ? nm.nbr : NBR_847)) < 0)
+        return res;
+    }
+  }
+
   // Is a tag info struct available
   if (pnt) {
-    pnt->nm = nm;
-    // Fill the tag info struct with the values corresponding to this init modulation
-    if ((res = pn53x_decode_target_data(abtTargetsData + 1, szTargetsData - 1, CHIP_DATA(pnd)->type, nm.nmt, &(pnt->nti))) < 0) {
-      return res;
-    }
+    *pnt = nt;
     pn53x_current_target_new(pnd, pnt);
   }
   return abtTargetsData[0];
@@ -1136,6 +1532,132 @@ pn53x_initiator_select_passive_target(struct nfc_device *pnd,
   return pn53x_initiator_select_passive_target_ext(pnd, nm, pbtInitData, szInitData, pnt, 0);
 }
 
+/*
+ * Length of the TargetData entry InListPassiveTarget returned for one target,
+ * 0 when it does not fit in szRawData. ISO14443A entries only carry an ATS
+ * when the target is ISO14443-4 compliant and the chip sent RATS.
+ */
+static size_t
+pn53x_target_data_len(const struct nfc_device *pnd, const uint8_t *pbtRawData, const size_t szRawData, const nfc_modulation_type nmt)
+{
+  size_t szLen;
+
+  switch (nmt) {
+    case NMT_ISO14443A:
+      // Tg, SENS_RES, SEL_RES, NFCIDLength, NFCID1 then the ATS with its length byte
+      if (szRawData < 5)
+        return 0;
+      szLen = 5 + pbtRawData[4];
+      if ((szLen < szRawData) && pnd->bAutoIso14443_4 && (pbtRawData[3] & SAK_ISO14443_4_COMPLIANT))
+        szLen += pbtRawData[szLen];
+      break;
+    case NMT_FELICA:
+      // Tg then POL_RES with its length byte
+      if (szRawData < 2)
+        return 0;
+      szLen = 1 + pbtRawData[1];
+      break;
+    case NMT_ISO14443B:
+      // Tg, ATQB then ATTRIB_RES with its length byte
+      if (szRawData < 14)
+        return 0;
+      szLen = 14 + pbtRawData[13];
+      break;
+    case NMT_JEWEL:
+      // Tg, SENS_RES, JEWELID
+      szLen = 7;
+      break;
+    default:
+      return 0;
+  }
+  return (szLen <= szRawData) ? szLen : 0;
+}
+
+/*
+ * List the targets in the field asking InListPassiveTarget for two of them at
+ * a time. Each round is deselected before the next one so the targets already
+ * listed keep quiet; a round with less targets than asked ends the listing.
+ * The targets of the last round are left activated as Tg 1 and Tg 2, Tg 1
+ * being the current target. Returns NFC_ENOTIMPL for modulations InListPassiveTarget
+ * does not handle.
+ */
+int
+pn53x_initiator_list_passive_targets(struct nfc_device *pnd,
+                                     const nfc_modulation nm,
+                                     const uint8_t *pbtInitData, const size_t szInitData,
+                                     nfc_target ant[], const size_t szTargets)
+{
+  uint8_t  abtTargetsData[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  size_t  szTargetFound = 0;
+  int res = 0;
+
+  const pn53x_modulation pm = pn53x_nm_to_pm(nm);
+  if (PM_UNDEFINED == pm)
+    return NFC_ENOTIMPL;
+
+  // Deselect has no effect on FeliCa and Jewel targets, only one round is done.
+  // The chip does not find more than one Jewel target
+  const bool bOneRound = (nm.nmt == NMT_FELICA) || (nm.nmt == NMT_JEWEL);
+  const size_t szRoundMax = (nm.nmt == NMT_JEWEL) ? 1 : 2;
+  bool bDone = false;
+
+  while (!bDone && (szTargetFound < szTargets)) {
+    size_t szTargetsData = sizeof(abtTargetsData);
+    const size_t szMaxTargets = MIN(szRoundMax, szTargets - szTargetFound);
+    if ((res = pn53x_InListPassiveTarget(pnd, pm, szMaxTargets, pbtInitData, szInitData, abtTargetsData, &szTargetsData, 0)) < 0)
+      return res;
+    if ((res == 0) || (szTargetsData < 2))
+      break;
+    const size_t szRoundTargets = MIN((size_t) res, szMaxTargets);
+    bDone = bOneRound || (szRoundTargets < szMaxTargets);
+
+    const uint8_t *pbtTargetData = abtTargetsData + 1;
+    size_t szLeft = szTargetsData - 1;
+    nfc_target antRound[2];
+    memset(antRound, 0, sizeof(antRound));
+    for (size_t n = 0; n < szRoundTargets; n++) {
+      const size_t szLen = (n + 1 == szRoundTargets) ? szLeft : pn53x_target_data_len(pnd, pbtTargetData, szLeft, nm.nmt);
+      if (szLen == 0) {
+        pnd->last_error = NFC_ECHIP;
+        return pnd->last_error;
+      }
+      nfc_target *pnt = &(antRound[n]);
+      pnt->nm = nm;
+      if ((res = pn53x_decode_target_data(pbtTargetData, szLen, CHIP_DATA(pnd)->type, nm.nmt, &(pnt->nti))) < 0)
+        return res;
+      if (nm.nmt == NMT_ISO14443A)
+        pnt->nm.nbr = NBR_106;
+      pbtTargetData += szLen;
+      szLeft -= szLen;
+
+      // A target found again means the field holds no new one
+      const uint32_t uiHash = target_uid_hash(pnt);
+      bool bSeen = false;
+      for (size_t i = 0; i < szTargetFound; i++) {
+        if (target_uid_hash(&(ant[i])) == uiHash)
+          bSeen = true;
+      }
+      if (bSeen) {
+        bDone = true;
+        continue;
+      }
+      memcpy(&(ant[szTargetFound++]), pnt, sizeof(nfc_target));
+    }
+
+    if (bDone || (szTargetFound == szTargets)) {
+      // The targets of this round stay activated, target 1 being the one libnfc talks to by default
+      pn53x_current_target_new(pnd, &(antRound[0]));
+      if (szRoundTargets == 2)
+        pn53x_second_target_new(pnd, &(antRound[1]));
+      break;
+    }
+    pn53x_current_target_free(pnd);
+    if ((res = pn53x_InDeselect(pnd, 0)) < 0)
+      return res;
+  }
+  return szTargetFound;
+}
+
 int
 pn53x_initiator_poll_target(struct nfc_device *pnd,
                             const nfc_modulation *pnmModulations, const size_t szModulations,
@@ -1294,75 +1816,477 @@ pn53x_initiator_transceive_bits(struct nfc_device *pnd, const uint8_t *pbtTx, co
   // Recover the real frame length in bits
   szFrameBits = ((szRx - 1 - ((ui8Bits == 0) ? 0 : 1)) * 8) + ui8Bits;
 
-  if (pbtRx != NULL) {
-    // Ignore the status byte from the PN53X here, it was checked earlier in pn53x_transceive()
-    // Check if we should recover the parity bits ourself
-    if (!pnd->bPar) {
-      // Unwrap the response frame
-      if ((res = pn53x_unwrap_frame(abtRx + 1, szFrameBits, pbtRx, pbtRxPar)) < 0)
-        return res;
-      szRxBits = res;
-    } else {
-      // Save the received bits
-      szRxBits = szFrameBits;
-      // Copy the received bytes
-      memcpy(pbtRx, abtRx + 1, szRx - 1);
-    }
+  if (pbtRx != NULL) {
+    // Ignore the status byte from the PN53X here, it was checked earlier in pn53x_transceive()
+    // Check if we should recover the parity bits ourself
+    if (!pnd->bPar) {
+      // Unwrap the response frame
+      if ((res = pn53x_unwrap_frame(abtRx + 1, szFrameBits, pbtRx, pbtRxPar)) < 0)
+        return res;
+      szRxBits = res;
+    } else {
+      // Save the received bits
+      szRxBits = szFrameBits;
+      // Copy the received bytes
+      memcpy(pbtRx, abtRx + 1, szRx - 1);
+    }
+  }
+  // Everything went successful
+  return szRxBits;
+}
+
+// Largest command (code included) the chip takes in one frame, PN531 only knows normal frames
+static size_t
+pn53x_frame_data_max_len(const struct nfc_device *pnd)
+{
+  return (CHIP_DATA(pnd)->type == PN531) ? PN53x_NORMAL_FRAME__DATA_MAX_LEN : PN53x_EXTENDED_FRAME__DATA_MAX_LEN;
+}
+
+/*
+ * Gather a response made of several frames: while the status byte of the last
+ * one has MI set, pbtCmd (szCmd bytes, with room to be framed) is sent again
+ * to get the next part. pbtFrameRx holds the first frame, res its length.
+ * Parts which do not fit in pbtRx are still fetched, so the chip is left
+ * ready, then NFC_EOVFLOW is returned.
+ */
+static int
+pn53x_receive_chained(struct nfc_device *pnd, uint8_t *pbtCmd, const size_t szCmd,
+                      const uint8_t *pbtFrameRx, int res, uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  size_t szReceived = 0;
+  bool bOverflow = false;
+  for (;;) {
+    const size_t szPart = (size_t) res - 1;
+    if (pbtRx != NULL) {
+      if (szReceived + szPart > szRx) {
+        bOverflow = true;
+      } else {
+        memcpy(pbtRx + szReceived, pbtFrameRx + 1, szPart);
+      }
+    }
+    szReceived += szPart;
+    if (!(pbtFrameRx[0] & PN53X_STATUS_MI))
+      break;
+    if ((res = pn53x_transceive_frame(pnd, pbtCmd, szCmd, NULL, 0, &pbtFrameRx, timeout)) < 0)
+      return res;
+  }
+  if (bOverflow) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Buffer size is too short: %zuo available(s), %zuo needed", szRx, szReceived);
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
+  }
+  return szReceived;
+}
+
+// Exchange data with the activated target ui8Target, the raw frames of NP_EASY_FRAMING = false go to any target
+static int
+pn53x_initiator_transceive_bytes_tg(struct nfc_device *pnd, const uint8_t ui8Target, const uint8_t *pbtTx, const size_t szTx,
+                                    uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  // The command is built where the driver can frame it, the response is read where it was received
+  uint8_t  abtTx[PN53X_FRAME_BUFFER_LEN];
+  uint8_t *pbtCmd = abtTx + PN53X_FRAME_HEADROOM;
+  const uint8_t *pbtFrameRx;
+  int res = 0;
+
+  // We can not just send bytes without parity if while the PN53X expects we handled them
+  if (!pnd->bPar) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+
+  // To transfer command frames bytes we can not have any leading bits, reset this to zero
+  if ((res = pn53x_set_tx_bits(pnd, 0)) < 0) {
+    pnd->last_error = res;
+    return pnd->last_error;
+  }
+
+  if (!pnd->bEasyFraming) {
+    // Raw frames can not be chained
+    if (szTx > pn53x_frame_data_max_len(pnd) - 1) {
+      pnd->last_error = NFC_EOVFLOW;
+      return pnd->last_error;
+    }
+    pbtCmd[0] = InCommunicateThru;
+    memcpy(pbtCmd + 1, pbtTx, szTx);
+    if ((res = pn53x_transceive_frame(pnd, pbtCmd, szTx + 1, NULL, 0, &pbtFrameRx, timeout)) < 0) {
+      pnd->last_error = res;
+      return pnd->last_error;
+    }
+    const size_t szRxLen = (size_t)res - 1;
+    if (pbtRx != NULL) {
+      if (szRxLen >  szRx) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Buffer size is too short: %zuo available(s), %zuo needed", szRx, szRxLen);
+        return NFC_EOVFLOW;
+      }
+      // Copy the received bytes
+      memcpy(pbtRx, pbtFrameRx + 1, szRxLen);
+    }
+    // Everything went successful, we return received bytes count
+    return szRxLen;
+  }
+
+  // Data which does not fit in one InDataExchange is chained: MI is set in Tg of all parts but the last one
+  const size_t szPartMax = pn53x_frame_data_max_len(pnd) - 2;
+  size_t szSent = 0;
+  pbtCmd[0] = InDataExchange;
+  do {
+    const size_t szPart = MIN(szTx - szSent, szPartMax);
+    pbtCmd[1] = ui8Target;
+    if (szSent + szPart < szTx)
+      pbtCmd[1] |= PN53X_TG_MI;
+    memcpy(pbtCmd + 2, pbtTx + szSent, szPart);
+    if ((res = pn53x_transceive_frame(pnd, pbtCmd, szPart + 2, NULL, 0, &pbtFrameRx, timeout)) < 0) {
+      pnd->last_error = res;
+      return pnd->last_error;
+    }
+    szSent += szPart;
+  } while (szSent < szTx);
+
+  // An InDataExchange without data asks the next part of a chained response
+  pbtCmd[1] = ui8Target;
+  return pn53x_receive_chained(pnd, pbtCmd, 2, pbtFrameRx, res, pbtRx, szRx, timeout);
+}
+
+int
+pn53x_initiator_transceive_bytes(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx,
+                                 const size_t szRx, int timeout)
+{
+  return pn53x_initiator_transceive_bytes_tg(pnd, 1, pbtTx, szTx, pbtRx, szRx, timeout);
+}
+
+// Logical number (Tg) of an activated target, NFC_ETGRELEASED when the chip does not hold it
+static int
+pn53x_target_number(const struct nfc_device *pnd, const nfc_target *pnt)
+{
+  if (pn53x_current_target_is(pnd, pnt))
+    return 1;
+  if (CHIP_DATA(pnd)->second_target && (0 == memcmp(pnt, CHIP_DATA(pnd)->second_target, sizeof(nfc_target))))
+    return 2;
+  return NFC_ETGRELEASED;
+}
+
+int
+pn53x_initiator_target_transceive_bytes(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                        uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  // Only InDataExchange tells the targets apart
+  if (!pnd->bEasyFraming) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  const int tg = pn53x_target_number(pnd, pnt);
+  if (tg < 0) {
+    pnd->last_error = tg;
+    return pnd->last_error;
+  }
+  return pn53x_initiator_transceive_bytes_tg(pnd, tg, pbtTx, szTx, pbtRx, szRx, timeout);
+}
+
+/*
+ * Transceive started by pn53x_initiator_transceive_bytes_submit() and driven
+ * by pn53x_process_events(): the command frames are sent one after the
+ * other, their ACK and response frames are gathered as their bytes come in,
+ * nothing waits for the chip.
+ */
+enum pn53x_submission_state {
+  PN53X_SUBMISSION_IDLE,
+  PN53X_SUBMISSION_ACK,
+  PN53X_SUBMISSION_RESPONSE,
+};
+
+struct pn53x_submission {
+  enum pn53x_submission_state state;
+  uint8_t ui8Target;
+  const uint8_t *pbtTx;
+  size_t szTx;
+  /** Bytes of pbtTx already sent, raw frames are sent at once, InDataExchange parts one after the other */
+  size_t szSent;
+  uint8_t *pbtRx;
+  size_t szRx;
+  size_t szReceived;
+  bool bOverflow;
+  int timeout;
+  /** When the running command times out, see nfc_trace_now(), 0 for never */
+  uint64_t deadline;
+  /** Running command, with room for the driver to frame it in place */
+  uint8_t abtCmd[PN53X_FRAME_BUFFER_LEN];
+  size_t szCmd;
+  /** ACK or response frame being received */
+  uint8_t abtFrame[PN53X_FRAME_BUFFER_LEN];
+  size_t szFrame;
+};
+
+// Send the next command of the submitted transceive, then its ACK is awaited
+static int
+pn53x_submission_send(struct nfc_device *pnd)
+{
+  struct pn53x_submission *ps = CHIP_DATA(pnd)->submission;
+  uint8_t *pbtCmd = ps->abtCmd + PN53X_FRAME_HEADROOM;
+  int res;
+
+  if (!pnd->bEasyFraming) {
+    pbtCmd[0] = InCommunicateThru;
+    memcpy(pbtCmd + 1, ps->pbtTx, ps->szTx);
+    ps->szCmd = ps->szTx + 1;
+    ps->szSent = ps->szTx;
+  } else {
+    // The parts of the data first, as pn53x_initiator_transceive_bytes_tg()
+    // does, then an empty part asks for the next one of a chained response
+    const size_t szPart = MIN(ps->szTx - ps->szSent, pn53x_frame_data_max_len(pnd) - 2);
+    pbtCmd[0] = InDataExchange;
+    pbtCmd[1] = ps->ui8Target;
+    if (ps->szSent + szPart < ps->szTx)
+      pbtCmd[1] |= PN53X_TG_MI;
+    memcpy(pbtCmd + 2, ps->pbtTx + ps->szSent, szPart);
+    ps->szCmd = szPart + 2;
+    ps->szSent += szPart;
   }
-  // Everything went successful
-  return szRxBits;
+
+  PNCMD_TRACE(pbtCmd[0]);
+  pn53x_shadow_invalidate(pnd, pbtCmd, ps->szCmd);
+  nfc_trace_frame(pnd, NFC_TRACE_CHIP, NFC_TRACE_TX, pbtCmd, ps->szCmd);
+  CHIP_DATA(pnd)->command_start = nfc_trace_now();
+  PROBE3(pn53x__command__start, pbtCmd[0], ps->szCmd, ps->timeout);
+  res = CHIP_DATA(pnd)->io->send_nonblock(pnd, pbtCmd, ps->szCmd);
+  PROBE4(driver__send, pnd->driver->name, pbtCmd[0], res, ps->timeout);
+  if (res < 0) {
+    nfc_stats_command(pnd, pbtCmd[0], CHIP_DATA(pnd)->command_start, res, 0);
+    PROBE3(pn53x__command__done, pbtCmd[0], res, 0);
+    return res;
+  }
+  CHIP_DATA(pnd)->last_command = pbtCmd[0];
+  ps->deadline = ps->timeout ? CHIP_DATA(pnd)->command_start + (uint64_t) ps->timeout * 1000000ULL : 0;
+  ps->state = PN53X_SUBMISSION_ACK;
+  ps->szFrame = 0;
+  return NFC_SUCCESS;
 }
 
+/*
+ * Start what pn53x_initiator_transceive_bytes(), or
+ * pn53x_initiator_target_transceive_bytes() when pnt is given, does, without
+ * waiting for the chip: pn53x_process_events() carries it on each time the
+ * file descriptor given by pn53x_get_pollfd() is readable. pbtTx has to stay
+ * available until then. Pending register writes are still done first, in
+ * the usual blocking way: they are only needed after a setting changed.
+ */
 int
-pn53x_initiator_transceive_bytes(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx,
-                                 const size_t szRx, int timeout)
+pn53x_initiator_transceive_bytes_submit(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                        uint8_t *pbtRx, const size_t szRx, int timeout)
 {
-  size_t  szExtraTxLen;
-  uint8_t  abtCmd[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
-  int res = 0;
+  const struct pn53x_io *io = CHIP_DATA(pnd)->io;
+  struct pn53x_submission *ps = CHIP_DATA(pnd)->submission;
+  uint8_t ui8Target = 1;
+  int res;
 
-  // We can not just send bytes without parity if while the PN53X expects we handled them
-  if (!pnd->bPar) {
+  if (!io->send_nonblock || !io->receive_nonblock) {
+    pnd->last_error = NFC_EDEVNOTSUPP;
+    return pnd->last_error;
+  }
+  // One transceive at a time, as the chip runs one command at a time
+  if ((ps && (ps->state != PN53X_SUBMISSION_IDLE)) || !pnd->bPar) {
     pnd->last_error = NFC_EINVARG;
     return pnd->last_error;
   }
-
-  // Copy the data into the command frame
-  if (pnd->bEasyFraming) {
-    abtCmd[0] = InDataExchange;
-    abtCmd[1] = 1;              /* target number */
-    memcpy(abtCmd + 2, pbtTx, szTx);
-    szExtraTxLen = 2;
-  } else {
-    abtCmd[0] = InCommunicateThru;
-    memcpy(abtCmd + 1, pbtTx, szTx);
-    szExtraTxLen = 1;
+  if (pnt) {
+    // Only InDataExchange tells the targets apart
+    if (!pnd->bEasyFraming) {
+      pnd->last_error = NFC_EINVARG;
+      return pnd->last_error;
+    }
+    if ((res = pn53x_target_number(pnd, pnt)) < 0) {
+      pnd->last_error = res;
+      return pnd->last_error;
+    }
+    ui8Target = (uint8_t) res;
+  }
+  if (!pnd->bEasyFraming && (szTx > pn53x_frame_data_max_len(pnd) - 1)) {
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
   }
 
-  // To transfer command frames bytes we can not have any leading bits, reset this to zero
   if ((res = pn53x_set_tx_bits(pnd, 0)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
+  if (CHIP_DATA(pnd)->wb_dirty && ((res = pn53x_writeback_register(pnd)) < 0)) {
+    pnd->last_error = res;
+    return pnd->last_error;
+  }
 
-  // Send the frame to the PN53X chip and get the answer
-  // We have to give the amount of bytes + (the two command bytes 0xD4, 0x42)
-  uint8_t  abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
-  if ((res = pn53x_transceive(pnd, abtCmd, szTx + szExtraTxLen, abtRx, sizeof(abtRx), timeout)) < 0) {
+  if (!ps) {
+    if (!(ps = malloc(sizeof(struct pn53x_submission)))) {
+      pnd->last_error = NFC_ESOFT;
+      return pnd->last_error;
+    }
+    CHIP_DATA(pnd)->submission = ps;
+  }
+  ps->ui8Target = ui8Target;
+  ps->pbtTx = pbtTx;
+  ps->szTx = szTx;
+  ps->szSent = 0;
+  ps->pbtRx = pbtRx;
+  ps->szRx = szRx;
+  ps->szReceived = 0;
+  ps->bOverflow = false;
+  ps->timeout = (timeout == -1) ? CHIP_DATA(pnd)->timeout_command : timeout;
+  if ((res = pn53x_submission_send(pnd)) < 0) {
+    ps->state = PN53X_SUBMISSION_IDLE;
     pnd->last_error = res;
     return pnd->last_error;
   }
-  const size_t szRxLen = (size_t)res - 1;
-  if (pbtRx != NULL) {
-    if (szRxLen >  szRx) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Buffer size is too short: %zuo available(s), %zuo needed", szRx, szRxLen);
-      return NFC_EOVFLOW;
+  return NFC_SUCCESS;
+}
+
+/*
+ * Carry the submitted transceive on with the bytes received so far. *pbDone
+ * is set once it is over, the received bytes count or a libnfc error code is
+ * then returned. With bAbort, the running command is aborted.
+ */
+int
+pn53x_process_events(struct nfc_device *pnd, const bool bAbort, bool *pbDone)
+{
+  struct pn53x_submission *ps = CHIP_DATA(pnd)->submission;
+  const uint8_t *pbtCmd;
+  const uint8_t *pbtFrameRx;
+  int res;
+
+  *pbDone = false;
+  if (!ps || (ps->state == PN53X_SUBMISSION_IDLE))
+    return NFC_SUCCESS;
+  pbtCmd = ps->abtCmd + PN53X_FRAME_HEADROOM;
+  for (;;) {
+    if (bAbort) {
+      res = NFC_EOPABORTED;
+      goto failed;
     }
-    // Copy the received bytes
-    memcpy(pbtRx, abtRx + 1, szRxLen);
+    res = CHIP_DATA(pnd)->io->receive_nonblock(pnd, ps->abtFrame, sizeof(ps->abtFrame), &(ps->szFrame));
+    if (res == 0) {
+      if (ps->deadline && (nfc_trace_now() >= ps->deadline)) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Timeout!");
+        res = NFC_ETIMEOUT;
+        goto failed;
+      }
+      return NFC_SUCCESS;
+    }
+    if (res < 0)
+      goto failed;
+    const size_t szFrame = (size_t) res;
+    ps->szFrame = 0;
+    nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, ps->abtFrame, szFrame);
+
+    if (ps->state == PN53X_SUBMISSION_ACK) {
+      if ((res = pn53x_check_ack_frame(pnd, ps->abtFrame, szFrame)) < 0)
+        goto failed;
+      // The PN53x is running the sent command
+      ps->state = PN53X_SUBMISSION_RESPONSE;
+      continue;
+    }
+
+    if ((res = pn53x_decode_frame(pnd, ps->abtFrame, szFrame, &pbtFrameRx)) < 0)
+      goto failed;
+    nfc_trace_frame(pnd, NFC_TRACE_CHIP, NFC_TRACE_RX, pbtFrameRx, res);
+    if ((res = pn53x_response_status(pnd, pbtCmd, pbtFrameRx, (size_t) res)) < 0)
+      goto done;
+    if (ps->szSent < ps->szTx) {
+      if ((res = pn53x_submission_send(pnd)) < 0)
+        goto done;
+      continue;
+    }
+    // A response too big for pbtRx is still received whole, as pn53x_receive_chained() does
+    const size_t szPart = (size_t) res - 1;
+    if (ps->pbtRx) {
+      if (ps->szReceived + szPart > ps->szRx) {
+        ps->bOverflow = true;
+      } else {
+        memcpy(ps->pbtRx + ps->szReceived, pbtFrameRx + 1, szPart);
+      }
+    }
+    ps->szReceived += szPart;
+    if (pnd->bEasyFraming && (pbtFrameRx[0] & PN53X_STATUS_MI)) {
+      if ((res = pn53x_submission_send(pnd)) < 0)
+        goto done;
+      continue;
+    }
+    if (ps->bOverflow) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Buffer size is too short: %zuo available(s), %zuo needed", ps->szRx, ps->szReceived);
+      res = NFC_EOVFLOW;
+    } else {
+      res = (int) ps->szReceived;
+    }
+    goto done;
   }
-  // Everything went successful, we return received bytes count
-  return szRxLen;
+
+failed:
+  nfc_stats_command(pnd, pbtCmd[0], CHIP_DATA(pnd)->command_start, res, 0);
+  PROBE3(pn53x__command__done, pbtCmd[0], res, 0);
+  // An ACK frame makes the chip drop the command, its late response would be taken for the next one's
+  if (((res == NFC_ETIMEOUT) || (res == NFC_EOPABORTED)) && CHIP_DATA(pnd)->io->ack)
+    CHIP_DATA(pnd)->io->ack(pnd);
+done:
+  ps->state = PN53X_SUBMISSION_IDLE;
+  if (res < 0)
+    pnd->last_error = res;
+  *pbDone = true;
+  return res;
+}
+
+// File descriptor which is readable when pn53x_process_events() may carry the submitted transceive on
+int
+pn53x_get_pollfd(struct nfc_device *pnd)
+{
+  if (!CHIP_DATA(pnd)->io->get_pollfd) {
+    pnd->last_error = NFC_EDEVNOTSUPP;
+    return pnd->last_error;
+  }
+  return CHIP_DATA(pnd)->io->get_pollfd(pnd);
+}
+
+// Milliseconds until the submitted transceive times out, -1 when it can not
+int
+pn53x_get_event_timeout(struct nfc_device *pnd)
+{
+  const struct pn53x_submission *ps = CHIP_DATA(pnd)->submission;
+  if (!ps || (ps->state == PN53X_SUBMISSION_IDLE) || !ps->deadline)
+    return -1;
+  const uint64_t now = nfc_trace_now();
+  if (now >= ps->deadline)
+    return 0;
+  return (int)((ps->deadline - now + 999999) / 1000000);
+}
+
+// Forget an activated target, the other one keeps its logical number
+static void
+pn53x_target_free(const struct nfc_device *pnd, const int tg)
+{
+  nfc_target **ppnt = (tg == 1) ? &(CHIP_DATA(pnd)->current_target) : &(CHIP_DATA(pnd)->second_target);
+  free(*ppnt);
+  *ppnt = NULL;
+}
+
+int
+pn53x_initiator_target_deselect(struct nfc_device *pnd, const nfc_target *pnt)
+{
+  const int tg = pn53x_target_number(pnd, pnt);
+  if (tg < 0) {
+    pnd->last_error = tg;
+    return pnd->last_error;
+  }
+  pn53x_target_free(pnd, tg);
+  const int res = pn53x_InDeselect(pnd, tg);
+  return (res >= 0) ? NFC_SUCCESS : res;
+}
+
+int
+pn53x_initiator_target_release(struct nfc_device *pnd, const nfc_target *pnt)
+{
+  const int tg = pn53x_target_number(pnd, pnt);
+  if (tg < 0) {
+    pnd->last_error = tg;
+    return pnd->last_error;
+  }
+  pn53x_target_free(pnd, tg);
+  return pn53x_InRelease(pnd, tg);
 }
 
 static void __pn53x_init_timer(struct nfc_device *pnd, const uint32_t max_cycles)
@@ -1663,38 +2587,139 @@ int
 pn53x_initiator_deselect_target(struct nfc_device *pnd)
 {
   pn53x_current_target_free(pnd);
-  return pn53x_InDeselect(pnd, 0);    // 0 mean deselect all selected targets
+  const int res = pn53x_InDeselect(pnd, 0);    // 0 mean deselect all selected targets
+  return (res >= 0) ? NFC_SUCCESS : res;
+}
+
+static uint32_t
+pn53x_now_ms(void)
+{
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#else
+  return GetTickCount();
+#endif
+}
+
+/*
+ * Ask the target ui8Target for something it answers without any change of
+ * state, the cheapest frame its type allows. Returns 0 when it answered.
+ * ISO14443-4 targets get a R(NAK) block, MIFARE Ultralight a READ of page 0
+ * and FeliCa a Request Response. The other ones, NFCIP-1 (DEP) included, go
+ * through the Card Presence test of the chip, which sends an ATN to DEP targets.
+ */
+static int
+pn53x_presence_probe(struct nfc_device *pnd, const uint8_t ui8Target, const nfc_target *pnt, int timeout)
+{
+  uint8_t abtCmd[11];
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  size_t szCmd = 0;
+  int res;
+
+  // Frames built here rely on the chip for CRC and parity
+  const bool bFrames = pnd->bCrc && pnd->bPar;
+  switch (pnt->nm.nmt) {
+    case NMT_ISO14443A:
+    case NMT_ISO14443B:
+      if (!bFrames)
+        break;
+      if ((pnt->nm.nmt == NMT_ISO14443B) || (pnt->nti.nai.btSak & SAK_ISO14443_4_COMPLIANT)) {
+        // Raw blocks reach every target in the field, only sent when there is one
+        if ((ui8Target != 1) || CHIP_DATA(pnd)->second_target)
+          break;
+        if ((res = pn53x_set_tx_bits(pnd, 0)) < 0)
+          return res;
+        abtCmd[0] = InCommunicateThru;
+        abtCmd[1] = ISO14443_4_PCB_R_NAK | pnd->btIso14443_4BlockNumber;
+        if ((res = pn53x_transceive(pnd, abtCmd, 2, abtRx, sizeof(abtRx), timeout)) < 0)
+          return res;
+        // The PICC answers with R(ACK) or its last I-block, anything else is not it
+        if ((res > 1) && (ISO14443_4_IS_R_ACK(abtRx[1]) || ISO14443_4_IS_I_BLOCK(abtRx[1])))
+          return NFC_SUCCESS;
+        pnd->last_error = NFC_ERFTRANS;
+        return pnd->last_error;
+      }
+      if ((pnt->nm.nmt == NMT_ISO14443A) && (pnt->nti.nai.btSak == 0x00)) {
+        // MIFARE Ultralight: READ page 0
+        abtCmd[szCmd++] = 0x30;
+        abtCmd[szCmd++] = 0x00;
+      }
+      break;
+    case NMT_FELICA:
+      if (!bFrames)
+        break;
+      // Request Response, with the IDm of the target
+      abtCmd[szCmd++] = 10;
+      abtCmd[szCmd++] = 0x04;
+      memcpy(abtCmd + szCmd, pnt->nti.nfi.abtId, 8);
+      szCmd += 8;
+      break;
+    default:
+      break;
+  }
+  if (szCmd) {
+    // Without easy framing the frame would not be for this target only
+    if ((ui8Target != 1) && !pnd->bEasyFraming) {
+      pnd->last_error = NFC_EDEVNOTSUPP;
+      return pnd->last_error;
+    }
+    if ((res = pn53x_initiator_transceive_bytes_tg(pnd, ui8Target, abtCmd, szCmd, abtRx, sizeof(abtRx), timeout)) < 0)
+      return res;
+    return (res > 0) ? NFC_SUCCESS : NFC_ERFTRANS;
+  }
+
+  // Card Presence command only knows about the current target
+  if (ui8Target != 1) {
+    pnd->last_error = NFC_EDEVNOTSUPP;
+    return pnd->last_error;
+  }
+  abtCmd[0] = Diagnose;
+  abtCmd[1] = 0x06;
+  if ((res = pn53x_transceive(pnd, abtCmd, 2, abtRx, 1, MAX(timeout, PN53X_PRESENCE_TIMEOUT_MAX))) < 0)
+    return res;
+  return (res == 1) ? NFC_SUCCESS : NFC_ERFTRANS;
 }
 
 int
 pn53x_initiator_target_is_present(struct nfc_device *pnd, const nfc_target nt)
 {
-  // Check if the argument target nt is equals to current saved target
-  if (!pn53x_current_target_is(pnd, &nt)) {
+  // Check if the argument target nt is one the chip holds
+  const int tg = pn53x_target_number(pnd, &nt);
+  if (tg < 0) {
     return NFC_ETGRELEASED;
   }
 
-  // Send Card Presence command
-  const uint8_t abtCmd[] = { Diagnose, 0x06 };
-  uint8_t abtRx[1];
+  // The timeout follows the round trip of the previous probes. When it was
+  // too short the target is asked once more with twice as long. Only an RF
+  // error reported by the chip tells the target is gone: a host which is
+  // slow to get the answer does not
+  const int rtt = CHIP_DATA(pnd)->presence_rtt;
+  int timeout = rtt ? MIN(MAX(4 * rtt, PN53X_PRESENCE_TIMEOUT_MIN), PN53X_PRESENCE_TIMEOUT_MAX) : PN53X_PRESENCE_TIMEOUT_FIRST;
   int res = 0;
-
-  // Card Presence command can take more time than default one: when a card is
-  // removed from the field, the PN53x took few hundred ms more to reply
-  // correctly. (ie. 700 ms should be enough to detect all tested cases)
-  if ((res = pn53x_transceive(pnd, abtCmd, sizeof(abtCmd), abtRx, sizeof(abtRx), 700)) < 0)
-    return res;
-  if (res == 1) {
-    return NFC_SUCCESS;
+  for (int attempt = 0; attempt < 2; attempt++, timeout *= 2) {
+    const uint32_t start = pn53x_now_ms();
+    res = pn53x_presence_probe(pnd, tg, &nt, timeout);
+    if (res == NFC_SUCCESS) {
+      const int elapsed = MAX((int)(pn53x_now_ms() - start), 1);
+      CHIP_DATA(pnd)->presence_rtt = rtt ? (3 * rtt + elapsed + 3) / 4 : elapsed;
+      return NFC_SUCCESS;
+    }
+    if (res != NFC_ETIMEOUT)
+      break;
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "No answer to presence probe within %d ms", timeout);
+  }
+  if (res != NFC_ERFTRANS) {
+    pnd->last_error = res;
+    return pnd->last_error;
   }
 
   // Target is not reachable anymore
-  pn53x_current_target_free(pnd);
+  pn53x_target_free(pnd, tg);
   return NFC_ETGRELEASED;
 }
 
-#define SAK_ISO14443_4_COMPLIANT 0x20
-#define SAK_ISO18092_COMPLIANT   0x40
 int
 pn53x_target_init(struct nfc_device *pnd, nfc_target *pnt, uint8_t *pbtRx, const size_t szRxLen, int timeout)
 {
@@ -1962,21 +2987,23 @@ pn53x_target_receive_bits(struct nfc_device *pnd, uint8_t *pbtRx, const size_t s
 int
 pn53x_target_receive_bytes(struct nfc_device *pnd, uint8_t *pbtRx, const size_t szRxLen, int timeout)
 {
-  uint8_t  abtCmd[1];
+  uint8_t  abtTx[PN53X_FRAME_HEADROOM + 1 + PN53X_FRAME_TAILROOM];
+  uint8_t *pbtCmd = abtTx + PN53X_FRAME_HEADROOM;
+  const uint8_t *pbtFrameRx;
 
   // XXX I think this is not a clean way to provide some kind of "EasyFraming"
   // but at the moment I have no more better than this
   if (pnd->bEasyFraming) {
     switch (CHIP_DATA(pnd)->current_target->nm.nmt) {
       case NMT_DEP:
-        abtCmd[0] = TgGetData;
+        pbtCmd[0] = TgGetData;
         break;
       case NMT_ISO14443A:
         if (CHIP_DATA(pnd)->current_target->nti.nai.btSak & SAK_ISO14443_4_COMPLIANT) {
           // We are dealing with a ISO/IEC 14443-4 compliant target
           if ((CHIP_DATA(pnd)->type == PN532) && (pnd->bAutoIso14443_4)) {
             // We are using ISO/IEC 14443-4 PICC emulation capability from the PN532
-            abtCmd[0] = TgGetData;
+            pbtCmd[0] = TgGetData;
             break;
           } else {
             // TODO Support EasyFraming for other cases by software
@@ -1991,31 +3018,23 @@ pn53x_target_receive_bytes(struct nfc_device *pnd, uint8_t *pbtRx, const size_t
       case NMT_ISO14443B2SR:
       case NMT_ISO14443B2CT:
       case NMT_FELICA:
-        abtCmd[0] = TgGetInitiatorCommand;
+        pbtCmd[0] = TgGetInitiatorCommand;
         break;
+      default:
+        pnd->last_error = NFC_EINVARG;
+        return pnd->last_error;
     }
   } else {
-    abtCmd[0] = TgGetInitiatorCommand;
+    pbtCmd[0] = TgGetInitiatorCommand;
   }
 
   // Try to gather a received frame from the reader
-  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
-  size_t szRx = sizeof(abtRx);
   int res = 0;
-  if ((res = pn53x_transceive(pnd, abtCmd, sizeof(abtCmd), abtRx, szRx, timeout)) < 0)
+  if ((res = pn53x_transceive_frame(pnd, pbtCmd, 1, NULL, 0, &pbtFrameRx, timeout)) < 0)
     return pnd->last_error;
-  szRx = (size_t) res;
-  // Save the received bytes count
-  szRx -= 1;
-
-  if (szRx > szRxLen)
-    return NFC_EOVFLOW;
 
-  // Copy the received bytes
-  memcpy(pbtRx, abtRx + 1, szRx);
-
-  // Everyting seems ok, return received bytes count
-  return szRx;
+  // Initiator chained its data: TgGetData again gets the next part
+  return pn53x_receive_chained(pnd, pbtCmd, 1, pbtFrameRx, res, pbtRx, szRxLen, timeout);
 }
 
 int
@@ -2062,7 +3081,9 @@ pn53x_target_send_bits(struct nfc_device *pnd, const uint8_t *pbtTx, const size_
 int
 pn53x_target_send_bytes(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, int timeout)
 {
-  uint8_t  abtCmd[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  uint8_t  abtTx[PN53X_FRAME_BUFFER_LEN];
+  uint8_t *pbtCmd = abtTx + PN53X_FRAME_HEADROOM;
+  const uint8_t *pbtFrameRx;
   int res = 0;
 
   // We can not just send bytes without parity if while the PN53X expects we handled them
@@ -2074,14 +3095,14 @@ pn53x_target_send_bytes(struct nfc_device *pnd, const uint8_t *pbtTx, const size
   if (pnd->bEasyFraming) {
     switch (CHIP_DATA(pnd)->current_target->nm.nmt) {
       case NMT_DEP:
-        abtCmd[0] = TgSetData;
+        pbtCmd[0] = TgSetData;
         break;
       case NMT_ISO14443A:
         if (CHIP_DATA(pnd)->current_target->nti.nai.btSak & SAK_ISO14443_4_COMPLIANT) {
           // We are dealing with a ISO/IEC 14443-4 compliant target
           if ((CHIP_DATA(pnd)->type == PN532) && (pnd->bAutoIso14443_4)) {
             // We are using ISO/IEC 14443-4 PICC emulation capability from the PN532
-            abtCmd[0] = TgSetData;
+            pbtCmd[0] = TgSetData;
             break;
           } else {
             // TODO Support EasyFraming for other cases by software
@@ -2096,19 +3117,36 @@ pn53x_target_send_bytes(struct nfc_device *pnd, const uint8_t *pbtTx, const size
       case NMT_ISO14443B2SR:
       case NMT_ISO14443B2CT:
       case NMT_FELICA:
-        abtCmd[0] = TgResponseToInitiator;
+        pbtCmd[0] = TgResponseToInitiator;
         break;
+      default:
+        pnd->last_error = NFC_EINVARG;
+        return pnd->last_error;
     }
   } else {
-    abtCmd[0] = TgResponseToInitiator;
+    pbtCmd[0] = TgResponseToInitiator;
   }
 
-  // Copy the data into the command frame
-  memcpy(abtCmd + 1, pbtTx, szTx);
-
-  // Try to send the bits to the reader
-  if ((res = pn53x_transceive(pnd, abtCmd, szTx + 1, NULL, 0, timeout)) < 0)
-    return res;
+  const size_t szPartMax = pn53x_frame_data_max_len(pnd) - 1;
+  if ((pbtCmd[0] != TgSetData) && (szTx > szPartMax)) {
+    // Only DEP and ISO/IEC 14443-4 data can be chained
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
+  }
+  // TgSetMetaData sends all parts but the last one, with MI set
+  const uint8_t btLastCmd = pbtCmd[0];
+  size_t szSent = 0;
+  do {
+    const size_t szPart = MIN(szTx - szSent, szPartMax);
+    pbtCmd[0] = (szSent + szPart < szTx) ? TgSetMetaData : btLastCmd;
+    // Copy the data into the command frame
+    memcpy(pbtCmd + 1, pbtTx + szSent, szPart);
+
+    // Try to send the bits to the reader
+    if ((res = pn53x_transceive_frame(pnd, pbtCmd, szPart + 1, NULL, 0, &pbtFrameRx, timeout)) < 0)
+      return res;
+    szSent += szPart;
+  } while (szSent < szTx);
 
   // Everyting seems ok, return sent byte count
   return szTx;
@@ -2339,6 +3377,14 @@ pn53x_InListPassiveTarget(struct nfc_device *pnd,
   return pbtTargetsData[0];
 }
 
+int
+pn53x_InPSL(struct nfc_device *pnd, const uint8_t ui8Target, const nfc_baud_rate nbrInitiatorToTarget, const nfc_baud_rate nbrTargetToInitiator)
+{
+  // BRit and BRti: 0x00 for 106 kbps up to 0x03 for 847 kbps
+  uint8_t  abtCmd[] = { InPSL, ui8Target, nbrInitiatorToTarget - NBR_106, nbrTargetToInitiator - NBR_106 };
+  return (pn53x_transceive(pnd, abtCmd, sizeof(abtCmd), NULL, 0, -1));
+}
+
 int
 pn53x_InDeselect(struct nfc_device *pnd, const uint8_t ui8Target)
 {
@@ -2632,6 +3678,7 @@ pn53x_check_ack_frame(struct nfc_device *pnd, const uint8_t *pbtRxFrame, const s
   if (szRxFrameLen >= sizeof(pn53x_ack_frame)) {
     if (0 == memcmp(pbtRxFrame, pn53x_ack_frame, sizeof(pn53x_ack_frame))) {
       log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "PN53x ACKed");
+      nfc_stats_ack(pnd, CHIP_DATA(pnd)->command_start);
       return NFC_SUCCESS;
     }
   }
@@ -2654,36 +3701,152 @@ pn53x_check_error_frame(struct nfc_device *pnd, const uint8_t *pbtRxFrame, const
 }
 
 /**
- * @brief Build a PN53x frame
+ * @brief Compute the length of the PN53x frame starting with \a pbtFrame
+ *
+ * @param pbtFrame bytes received so far
+ * @param szFrame count of bytes received so far
+ * @return Returns the whole frame length when it can be determined, the count of bytes needed to determine it otherwise or NFC_EIO when \a pbtFrame is not a valid frame start
+ *
+ * @note This function is meant to be used with uart_receive_frame()
+ */
+int
+pn53x_frame_length(const uint8_t *pbtFrame, const size_t szFrame)
+{
+  // Preamble, start code and LEN/LCS (or the extended frame marker)
+  if (szFrame < 5)
+    return 5;
+
+  const uint8_t pn53x_preamble[3] = { 0x00, 0x00, 0xff };
+  if (0 != memcmp(pbtFrame, pn53x_preamble, sizeof(pn53x_preamble))) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame preamble+start code mismatch");
+    return NFC_EIO;
+  }
+
+  if (((0x00 == pbtFrame[3]) && (0xff == pbtFrame[4])) || ((0xff == pbtFrame[3]) && (0x00 == pbtFrame[4]))) {
+    // ACK or NACK frame
+    return sizeof(pn53x_ack_frame);
+  } else if ((0x01 == pbtFrame[3]) && (0xff == pbtFrame[4])) {
+    // Error frame
+    return sizeof(pn53x_error_frame);
+  } else if ((0xff == pbtFrame[3]) && (0xff == pbtFrame[4])) {
+    // Extended frame: LENm, LENl and LCS follow the marker
+    if (szFrame < 8)
+      return 8;
+    if (((pbtFrame[5] + pbtFrame[6] + pbtFrame[7]) % 256) != 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
+      return NFC_EIO;
+    }
+    return ((pbtFrame[5] << 8) + pbtFrame[6]) + PN53x_EXTENDED_FRAME__OVERHEAD - 1;
+  }
+  // Normal frame
+  if (256 != (pbtFrame[3] + pbtFrame[4])) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
+    return NFC_EIO;
+  }
+  return pbtFrame[3] + PN53x_NORMAL_FRAME__OVERHEAD - 1;
+}
+
+/**
+ * @brief Check a PN53x response frame and extract its payload
+ *
+ * @param pbtFrame whole frame as returned by uart_receive_frame() with pn53x_frame_length()
+ * @param szFrame frame length
+ * @param ppbtData set to the payload (without TFI and CC+1), inside \a pbtFrame
+ * @return Returns payload length on success, otherwise returns libnfc's error code (negative value)
+ */
+int
+pn53x_decode_frame(struct nfc_device *pnd, const uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData)
+{
+  size_t len;
+  const uint8_t *pbtPayload;
+
+  if (szFrame < sizeof(pn53x_ack_frame)) {
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+  if ((0x01 == pbtFrame[3]) && (0xff == pbtFrame[4])) {
+    // Error frame
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Application level error detected");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  } else if ((0xff == pbtFrame[3]) && (0xff == pbtFrame[4])) {
+    // Extended frame
+    // (pbtFrame[5] << 8) + pbtFrame[6] (LEN) include TFI + (CC+1)
+    len = (pbtFrame[5] << 8) + pbtFrame[6];
+    pbtPayload = pbtFrame + 8;
+  } else {
+    // Normal frame
+    // pbtFrame[3] (LEN) include TFI + (CC+1)
+    len = pbtFrame[3];
+    pbtPayload = pbtFrame + 5;
+  }
+  if ((len < 2) || ((size_t)(pbtPayload - pbtFrame) + len + 2 != szFrame)) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame length mismatch");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+  len -= 2;
+
+  if (pbtPayload[0] != 0xD5) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "TFI Mismatch");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+
+  if (pbtPayload[1] != CHIP_DATA(pnd)->last_command + 1) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Command Code verification failed");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+
+  uint8_t btDCS = (256 - 0xD5);
+  btDCS -= CHIP_DATA(pnd)->last_command + 1;
+  for (size_t szPos = 0; szPos < len; szPos++) {
+    btDCS -= pbtPayload[2 + szPos];
+  }
+
+  if (btDCS != pbtPayload[2 + len]) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Data checksum mismatch");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+
+  if (0x00 != pbtPayload[3 + len]) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame postamble mismatch");
+    pnd->last_error = NFC_EIO;
+    return pnd->last_error;
+  }
+
+  *ppbtData = pbtPayload + 2;
+  return len;
+}
+
+/**
+ * @brief Frame a PN53x command in place
  *
  * @param pbtData payload (bytes array) of the frame, will become PD0, ..., PDn in PN53x frame
- * @note The first byte of pbtData is the Command Code (CC)
+ * @param szData payload length
+ * @param ppbtFrame set to the frame start, before \a pbtData
+ * @return Returns frame length on success, otherwise returns libnfc's error code
+ * @note The first byte of pbtData is the Command Code (CC). The header is
+ * written in the PN53X_FRAME_HEADROOM bytes before \a pbtData, DCS and
+ * postamble in the PN53X_FRAME_TAILROOM bytes after it.
  */
 int
-pn53x_build_frame(uint8_t *pbtFrame, size_t *pszFrame, const uint8_t *pbtData, const size_t szData)
+pn53x_frame_in_place(uint8_t *pbtData, const size_t szData, uint8_t **ppbtFrame)
 {
+  uint8_t *pbtFrame;
+  size_t szFrame;
+
   if (szData <= PN53x_NORMAL_FRAME__DATA_MAX_LEN) {
+    pbtFrame = pbtData - 6;
     // LEN - Packet length = data length (len) + checksum (1) + end of stream marker (1)
     pbtFrame[3] = szData + 1;
     // LCS - Packet length checksum
     pbtFrame[4] = 256 - (szData + 1);
-    // TFI
-    pbtFrame[5] = 0xD4;
-    // DATA - Copy the PN53X command into the packet buffer
-    memcpy(pbtFrame + 6, pbtData, szData);
-
-    // DCS - Calculate data payload checksum
-    uint8_t btDCS = (256 - 0xD4);
-    for (size_t szPos = 0; szPos < szData; szPos++) {
-      btDCS -= pbtData[szPos];
-    }
-    pbtFrame[6 + szData] = btDCS;
-
-    // 0x00 - End of stream marker
-    pbtFrame[szData + 7] = 0x00;
-
-    (*pszFrame) = szData + PN53x_NORMAL_FRAME__OVERHEAD;
+    szFrame = szData + PN53x_NORMAL_FRAME__OVERHEAD;
   } else if (szData <= PN53x_EXTENDED_FRAME__DATA_MAX_LEN) {
+    pbtFrame = pbtData - 9;
     // Extended frame marker
     pbtFrame[3] = 0xff;
     pbtFrame[4] = 0xff;
@@ -2693,28 +3856,32 @@ pn53x_build_frame(uint8_t *pbtFrame, size_t *pszFrame, const uint8_t *pbtData, c
     pbtFrame[6] = (szData + 1) & 0xff;
     // LCS
     pbtFrame[7] = 256 - ((pbtFrame[5] + pbtFrame[6]) & 0xff);
-    // TFI
-    pbtFrame[8] = 0xD4;
-    // DATA - Copy the PN53X command into the packet buffer
-    memcpy(pbtFrame + 9, pbtData, szData);
-
-    // DCS - Calculate data payload checksum
-    uint8_t btDCS = (256 - 0xD4);
-    for (size_t szPos = 0; szPos < szData; szPos++) {
-      btDCS -= pbtData[szPos];
-    }
-    pbtFrame[9 + szData] = btDCS;
-
-    // 0x00 - End of stream marker
-    pbtFrame[szData + 10] = 0x00;
-
-    (*pszFrame) = szData + PN53x_EXTENDED_FRAME__OVERHEAD;
+    szFrame = szData + PN53x_EXTENDED_FRAME__OVERHEAD;
   } else {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "We can't send more than %d bytes in a raw (requested: %zd)", PN53x_EXTENDED_FRAME__DATA_MAX_LEN, szData);
     return NFC_ECHIP;
   }
-  return NFC_SUCCESS;
+  // Every packet must start with "00 00 ff"
+  pbtFrame[0] = 0x00;
+  pbtFrame[1] = 0x00;
+  pbtFrame[2] = 0xff;
+  // TFI
+  pbtData[-1] = 0xD4;
+
+  // DCS - Calculate data payload checksum
+  uint8_t btDCS = (256 - 0xD4);
+  for (size_t szPos = 0; szPos < szData; szPos++) {
+    btDCS -= pbtData[szPos];
+  }
+  pbtData[szData] = btDCS;
+
+  // 0x00 - End of stream marker
+  pbtData[szData + 1] = 0x00;
+
+  *ppbtFrame = pbtFrame;
+  return szFrame;
 }
+
 pn53x_modulation
 pn53x_nm_to_pm(const nfc_modulation nm)
 {
@@ -2899,7 +4066,18 @@ pn53x_get_supported_baud_rate(nfc_device *pnd, const nfc_modulation_type nmt, co
       *supported_br = (nfc_baud_rate *)pn53x_felica_supported_baud_rates;
       break;
     case NMT_ISO14443A:
-      *supported_br = (nfc_baud_rate *)pn53x_iso14443a_supported_baud_rates;
+      // Higher rates are reached with ISO14443-4 targets, through PPS
+      switch (CHIP_DATA(pnd)->type) {
+        case PN532:
+          *supported_br = (nfc_baud_rate *)pn532_iso14443a_supported_baud_rates;
+          break;
+        case PN533:
+          *supported_br = (nfc_baud_rate *)pn533_iso14443a_supported_baud_rates;
+          break;
+        default:
+          *supported_br = (nfc_baud_rate *)pn53x_iso14443a_supported_baud_rates;
+          break;
+      }
       break;
     case NMT_ISO14443B:
     case NMT_ISO14443BI:
@@ -3057,14 +4235,28 @@ pn53x_get_information_about(nfc_device *pnd, char **pbuf)
 void
 pn53x_current_target_new(const struct nfc_device *pnd, const nfc_target *pnt)
 {
-  // Keep the current nfc_target for further commands
+  // Keep the current nfc_target for further commands, a new activation drops the other target
   if (CHIP_DATA(pnd)->current_target) {
     free(CHIP_DATA(pnd)->current_target);
   }
+  if (CHIP_DATA(pnd)->second_target) {
+    free(CHIP_DATA(pnd)->second_target);
+    CHIP_DATA(pnd)->second_target = NULL;
+  }
   CHIP_DATA(pnd)->current_target = malloc(sizeof(nfc_target));
   memcpy(CHIP_DATA(pnd)->current_target, pnt, sizeof(nfc_target));
 }
 
+static void
+pn53x_second_target_new(const struct nfc_device *pnd, const nfc_target *pnt)
+{
+  if (CHIP_DATA(pnd)->second_target) {
+    free(CHIP_DATA(pnd)->second_target);
+  }
+  CHIP_DATA(pnd)->second_target = malloc(sizeof(nfc_target));
+  memcpy(CHIP_DATA(pnd)->second_target, pnt, sizeof(nfc_target));
+}
+
 void
 pn53x_current_target_free(const struct nfc_device *pnd)
 {
@@ -3072,6 +4264,10 @@ pn53x_current_target_free(const struct nfc_device *pnd)
     free(CHIP_DATA(pnd)->current_target);
     CHIP_DATA(pnd)->current_target = NULL;
   }
+  if (CHIP_DATA(pnd)->second_target) {
+    free(CHIP_DATA(pnd)->second_target);
+    CHIP_DATA(pnd)->second_target = NULL;
+  }
 }
 
 bool
@@ -3110,13 +4306,21 @@ pn53x_data_new(struct nfc_device *pnd, const struct pn53x_io *io)
 
   // Set current target to NULL
   CHIP_DATA(pnd)->current_target = NULL;
+  CHIP_DATA(pnd)->second_target = NULL;
+
+  // No presence probe has been timed yet
+  CHIP_DATA(pnd)->presence_rtt = 0;
 
   // Set current sam_mode to normal mode
   CHIP_DATA(pnd)->sam_mode = PSM_NORMAL;
 
-  // WriteBack cache is clean
-  CHIP_DATA(pnd)->wb_trigged = false;
+  // WriteBack cache is clean, nothing is known about the registers yet
+  CHIP_DATA(pnd)->wb_dirty = 0;
   memset(CHIP_DATA(pnd)->wb_mask, 0x00, PN53X_CACHE_REGISTER_SIZE);
+  CHIP_DATA(pnd)->shadow_valid = 0;
+  CHIP_DATA(pnd)->shadow_extra_valid = 0;
+  // Nor about RF settings
+  CHIP_DATA(pnd)->property_known = 0;
 
   // Set default command timeout (350 ms)
   CHIP_DATA(pnd)->timeout_command = 350;
@@ -3127,6 +4331,8 @@ pn53x_data_new(struct nfc_device *pnd, const struct pn53x_io *io)
   // Set default communication timeout (52 ms)
   CHIP_DATA(pnd)->timeout_communication = 52;
 
+  CHIP_DATA(pnd)->submission = NULL;
+
   CHIP_DATA(pnd)->supported_modulation_as_initiator = NULL;
 
   CHIP_DATA(pnd)->supported_modulation_as_target = NULL;
@@ -3138,6 +4344,8 @@ pn53x_data_free(struct nfc_device *pnd)
   // Free current target
   pn53x_current_target_free(pnd);
 
+  free(CHIP_DATA(pnd)->submission);
+
   // Free supported modulation(s)
   if (CHIP_DATA(pnd)->supported_modulation_as_initiator) {
     free(CHIP_DATA(pnd)->supported_modulation_as_initiator);
@@ -145,20 +145,50 @@ typedef enum {
   PSM_DUAL_CARD = 0x04
 } pn532_sam_mode;
 
+/*
+ * Commands are handed to the drivers with some room around them, so they
+ * frame them in place. The largest header is the ACR122S one: STX, CCID
+ * header (10), pseudo-APDU header (5) and TFI. The largest trailer is two
+ * bytes: DCS and postamble, or checksum and ETX.
+ */
+#define PN53X_FRAME_HEADROOM 17
+#define PN53X_FRAME_TAILROOM 2
+#define PN53X_FRAME_BUFFER_LEN (PN53X_FRAME_HEADROOM + PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53X_FRAME_TAILROOM)
+
 /**
  * @internal
  * @struct pn53x_io
  * @brief PN53x I/O structure
+ *
+ * send() may write PN53X_FRAME_HEADROOM bytes before \a pbtData and
+ * PN53X_FRAME_TAILROOM bytes after its \a szData bytes.
+ * receive() reads the response frame in \a pbtFrame (or keeps it in its own
+ * buffer), points \a *ppbtData to the response data, after TFI and response
+ * code, and returns its length.
+ *
+ * The other functions are optional, pn53x_initiator_transceive_bytes_submit()
+ * needs them: get_pollfd() gives a file descriptor which is readable when
+ * receive_nonblock() may progress, send_nonblock() is send() without waiting
+ * for the ACK frame, receive_nonblock() goes on reading a frame in \a pbtFrame
+ * (\a *pszReceived bytes so far) and returns its length once whole, 0
+ * meanwhile, without waiting. ack() sends an ACK frame, which aborts the
+ * running command.
  */
 struct pn53x_io {
-  int (*send)(struct nfc_device *pnd, const uint8_t *pbtData, const size_t szData, int timeout);
-  int (*receive)(struct nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, int timeout);
+  int (*send)(struct nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout);
+  int (*receive)(struct nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, int timeout);
+  int (*get_pollfd)(struct nfc_device *pnd);
+  int (*send_nonblock)(struct nfc_device *pnd, uint8_t *pbtData, const size_t szData);
+  int (*receive_nonblock)(struct nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, size_t *pszReceived);
+  int (*ack)(struct nfc_device *pnd);
 };
 
 /* defines */
 #define PN53X_CACHE_REGISTER_MIN_ADDRESS 	PN53X_REG_CIU_Mode
 #define PN53X_CACHE_REGISTER_MAX_ADDRESS 	PN53X_REG_CIU_Coll
 #define PN53X_CACHE_REGISTER_SIZE 		((PN53X_CACHE_REGISTER_MAX_ADDRESS - PN53X_CACHE_REGISTER_MIN_ADDRESS) + 1)
+// Registers outside of the CIU window which are only changed by libnfc (port configurations), also shadowed
+#define PN53X_SHADOW_EXTRA_REGISTERS_LEN 5
 
 /**
  * @internal
@@ -176,6 +206,8 @@ struct pn53x_data {
   pn53x_operating_mode operating_mode;
   /** Current emulated target */
   nfc_target *current_target;
+  /** Target activated as Tg 2 along with the current target, by the same InListPassiveTarget */
+  nfc_target *second_target;
   /** Current sam mode (only applicable for PN532) */
   pn532_sam_mode sam_mode;
   /** PN53x I/O functions stored in struct */
@@ -188,6 +220,8 @@ struct pn53x_data {
   uint8_t ui8Parameters;
   /** Last sent command */
   uint8_t last_command;
+  /** When the last command was sent, see nfc_trace_now() */
+  uint64_t command_start;
   /** Interframe timer correction */
   int16_t timer_correction;
   /** Timer prescaler */
@@ -195,7 +229,23 @@ struct pn53x_data {
   /** WriteBack cache */
   uint8_t wb_data[PN53X_CACHE_REGISTER_SIZE];
   uint8_t wb_mask[PN53X_CACHE_REGISTER_SIZE];
-  bool wb_trigged;
+  /** WriteBack cache registers with a pending write, bit n is PN53X_CACHE_REGISTER_MIN_ADDRESS + n */
+  uint64_t wb_dirty;
+  /** Last value known to be in the CIU registers, only for the registers set in shadow_valid */
+  uint8_t shadow_data[PN53X_CACHE_REGISTER_SIZE];
+  uint64_t shadow_valid;
+  /** Last value known to be in the other shadowed registers, only for the ones set in shadow_extra_valid */
+  uint8_t shadow_extra_data[PN53X_SHADOW_EXTRA_REGISTERS_LEN];
+  uint8_t shadow_extra_valid;
+  /** Properties set through RFConfiguration known to be in effect, bit n for nfc_property n, boolean value in property_enabled */
+  uint32_t property_known;
+  uint32_t property_enabled;
+  /** Transceive started by pn53x_initiator_transceive_bytes_submit(), NULL until the first one */
+  struct pn53x_submission *submission;
+  /** Response frame of the last command, the drivers receive it there */
+  uint8_t abtRxFrame[PN53X_FRAME_BUFFER_LEN];
+  /** Smoothed round trip of the presence probes (ms), 0 until one is timed */
+  int presence_rtt;
   /** Command timeout */
   int timeout_command;
   /** ATR timeout */
@@ -319,6 +369,10 @@ int    pn53x_initiator_select_passive_target(struct nfc_device *pnd,
                                              const nfc_modulation nm,
                                              const uint8_t *pbtInitData, const size_t szInitData,
                                              nfc_target *pnt);
+int    pn53x_initiator_list_passive_targets(struct nfc_device *pnd,
+                                            const nfc_modulation nm,
+                                            const uint8_t *pbtInitData, const size_t szInitData,
+                                            nfc_target ant[], const size_t szTargets);
 int    pn53x_initiator_poll_target(struct nfc_device *pnd,
                                    const nfc_modulation *pnmModulations, const size_t szModulations,
                                    const uint8_t uiPollNr, const uint8_t uiPeriod,
@@ -337,6 +391,15 @@ int    pn53x_initiator_transceive_bits_timed(struct nfc_device *pnd, const uint8
 int    pn53x_initiator_transceive_bytes_timed(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx,
                                               uint8_t *pbtRx, const size_t szRx, uint32_t *cycles);
 int    pn53x_initiator_deselect_target(struct nfc_device *pnd);
+int    pn53x_initiator_target_transceive_bytes(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                               uint8_t *pbtRx, const size_t szRx, int timeout);
+int    pn53x_initiator_transceive_bytes_submit(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                               uint8_t *pbtRx, const size_t szRx, int timeout);
+int    pn53x_process_events(struct nfc_device *pnd, const bool bAbort, bool *pbDone);
+int    pn53x_get_pollfd(struct nfc_device *pnd);
+int    pn53x_get_event_timeout(struct nfc_device *pnd);
+int    pn53x_initiator_target_deselect(struct nfc_device *pnd, const nfc_target *pnt);
+int    pn53x_initiator_target_release(struct nfc_device *pnd, const nfc_target *pnt);
 int    pn53x_initiator_target_is_present(struct nfc_device *pnd, const nfc_target nt);
 
 // NFC device as Target functions
@@ -357,6 +420,7 @@ int    pn53x_InListPassiveTarget(struct nfc_device *pnd, const pn53x_modulation
                                  const uint8_t szMaxTargets, const uint8_t *pbtInitiatorData,
                                  const size_t szInitiatorDataLen, uint8_t *pbtTargetsData, size_t *pszTargetsData,
                                  int timeout);
+int    pn53x_InPSL(struct nfc_device *pnd, const uint8_t ui8Target, const nfc_baud_rate nbrInitiatorToTarget, const nfc_baud_rate nbrTargetToInitiator);
 int    pn53x_InDeselect(struct nfc_device *pnd, const uint8_t ui8Target);
 int    pn53x_InRelease(struct nfc_device *pnd, const uint8_t ui8Target);
 int    pn53x_InAutoPoll(struct nfc_device *pnd, const pn53x_target_type *ppttTargetTypes, const size_t szTargetTypes,
@@ -385,7 +449,9 @@ int    pn53x_RFConfiguration__MaxRetries(struct nfc_device *pnd, const uint8_t M
 // Misc
 int    pn53x_check_ack_frame(struct nfc_device *pnd, const uint8_t *pbtRxFrame, const size_t szRxFrameLen);
 int    pn53x_check_error_frame(struct nfc_device *pnd, const uint8_t *pbtRxFrame, const size_t szRxFrameLen);
-int    pn53x_build_frame(uint8_t *pbtFrame, size_t *pszFrame, const uint8_t *pbtData, const size_t szData);
+int    pn53x_frame_in_place(uint8_t *pbtData, const size_t szData, uint8_t **ppbtFrame);
+int    pn53x_frame_length(const uint8_t *pbtFrame, const size_t szFrame);
+int    pn53x_decode_frame(struct nfc_device *pnd, const uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData);
 int    pn53x_get_supported_modulation(nfc_device *pnd, const nfc_mode mode, const nfc_modulation_type **const supported_mt);
 int    pn53x_get_supported_baud_rate(nfc_device *pnd, const nfc_modulation_type nmt, const nfc_baud_rate **const supported_br);
 int    pn53x_get_information_about(nfc_device *pnd, char **pbuf);
@@ -112,6 +112,8 @@ conf_keyvalue_context(void *data, const char *key, const char *value)
     string_as_boolean(value, &(context->allow_intrusive_scan));
   } else if (strcmp(key, "log_level") == 0) {
     context->log_level = atoi(value);
+  } else if (strcmp(key, "uart_max_speed") == 0) {
+    context->uart_max_speed = strtoul(value, NULL, 10);
   } else if (strcmp(key, "device.name") == 0) {
     if ((context->user_defined_device_count == 0) || strcmp(context->user_defined_devices[context->user_defined_device_count - 1].name, "") != 0) {
       if (context->user_defined_device_count >= MAX_USER_DEFINED_DEVICES) {
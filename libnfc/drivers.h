@@ -29,6 +29,10 @@
 
 #include <nfc/nfc-types.h>
 
-extern const struct nfc_driver_list *nfc_drivers;
+// Drivers of a context, most recently registered first
+struct nfc_driver_list {
+  const struct nfc_driver_list *next;
+  const struct nfc_driver *driver;
+};
 
 #endif // __NFC_DRIVERS_H__
@@ -75,7 +75,6 @@
 
 #define FIRMWARE_TEXT "ACR122U" // Tested on: ACR122U101(ACS), ACR122U102(Tikitag), ACR122U203(ACS)
 
-#define ACR122_PCSC_WRAP_LEN 5
 #define ACR122_PCSC_COMMAND_LEN 266
 #define ACR122_PCSC_RESPONSE_LEN 268
 
@@ -334,7 +333,7 @@ acr122_pcsc_close(nfc_device *pnd)
 }
 
 static int
-acr122_pcsc_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, int timeout)
+acr122_pcsc_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
 {
   // FIXME: timeout is not handled
   (void) timeout;
@@ -345,11 +344,12 @@ acr122_pcsc_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
     return pnd->last_error;
   }
 
-  // Prepare and transmit the send buffer
+  // Prepare and transmit the send buffer, the pseudo-APDU header goes right before the command
   const size_t szTxBuf = szData + 6;
-  uint8_t  abtTxBuf[ACR122_PCSC_WRAP_LEN + ACR122_PCSC_COMMAND_LEN] = { 0xFF, 0x00, 0x00, 0x00, szData + 1, 0xD4 };
-  memcpy(abtTxBuf + 6, pbtData, szData);
-  LOG_HEX(NFC_LOG_GROUP_COM, "TX", abtTxBuf, szTxBuf);
+  uint8_t *pbtTxBuf = pbtData - 6;
+  const uint8_t abtHeader[] = { 0xFF, 0x00, 0x00, 0x00, szData + 1, 0xD4 };
+  memcpy(pbtTxBuf, abtHeader, sizeof(abtHeader));
+  LOG_HEX(NFC_LOG_GROUP_COM, "TX", pbtTxBuf, szTxBuf);
 
   DRIVER_DATA(pnd)->szRx = 0;
 
@@ -367,7 +367,7 @@ acr122_pcsc_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
      * This state is generaly reached when the ACR122 has no target in it's
      * field.
      */
-    if (SCardControl(DRIVER_DATA(pnd)->hCard, IOCTL_CCID_ESCAPE_SCARD_CTL_CODE, abtTxBuf, szTxBuf, DRIVER_DATA(pnd)->abtRx, ACR122_PCSC_RESPONSE_LEN, &dwRxLen) != SCARD_S_SUCCESS) {
+    if (SCardControl(DRIVER_DATA(pnd)->hCard, IOCTL_CCID_ESCAPE_SCARD_CTL_CODE, pbtTxBuf, szTxBuf, DRIVER_DATA(pnd)->abtRx, ACR122_PCSC_RESPONSE_LEN, &dwRxLen) != SCARD_S_SUCCESS) {
       pnd->last_error = NFC_EIO;
       return pnd->last_error;
     }
@@ -376,7 +376,7 @@ acr122_pcsc_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
      * In T=0 mode, we receive an acknoledge from the MCU, in T=1 mode, we
      * receive the response from the PN532.
      */
-    if (SCardTransmit(DRIVER_DATA(pnd)->hCard, &(DRIVER_DATA(pnd)->ioCard), abtTxBuf, szTxBuf, NULL, DRIVER_DATA(pnd)->abtRx, &dwRxLen) != SCARD_S_SUCCESS) {
+    if (SCardTransmit(DRIVER_DATA(pnd)->hCard, &(DRIVER_DATA(pnd)->ioCard), pbtTxBuf, szTxBuf, NULL, DRIVER_DATA(pnd)->abtRx, &dwRxLen) != SCARD_S_SUCCESS) {
       pnd->last_error = NFC_EIO;
       return pnd->last_error;
     }
@@ -405,10 +405,13 @@ acr122_pcsc_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
 }
 
 static int
-acr122_pcsc_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
+acr122_pcsc_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, int timeout)
 {
   // FIXME: timeout is not handled
   (void) timeout;
+  // The answer is kept in the driver data
+  (void) pbtFrame;
+  (void) szFrame;
 
   int len;
   uint8_t  abtRxCmd[5] = { 0xFF, 0xC0, 0x00, 0x00 };
@@ -431,14 +434,14 @@ acr122_pcsc_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int
   }
   LOG_HEX(NFC_LOG_GROUP_COM, "RX", DRIVER_DATA(pnd)->abtRx, DRIVER_DATA(pnd)->szRx);
 
-  // Make sure we have an emulated answer that fits the return buffer
-  if (DRIVER_DATA(pnd)->szRx < 4 || (DRIVER_DATA(pnd)->szRx - 4) > szData) {
+  // Make sure we have an emulated answer
+  if (DRIVER_DATA(pnd)->szRx < 4) {
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
   }
   // Wipe out the 4 APDU emulation bytes: D5 4B .. .. .. 90 00
   len = DRIVER_DATA(pnd)->szRx - 4;
-  memcpy(pbtData, DRIVER_DATA(pnd)->abtRx + 2, len);
+  *ppbtData = DRIVER_DATA(pnd)->abtRx + 2;
 
   return len;
 }
@@ -496,6 +499,7 @@ const struct nfc_driver acr122_pcsc_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = NULL, // No secure-element support
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -504,6 +508,9 @@ const struct nfc_driver acr122_pcsc_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
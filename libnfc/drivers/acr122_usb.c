@@ -50,28 +50,17 @@ Thanks to d18c7db and Okko for example code
 */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include <sys/select.h>
-#include <errno.h>
-
-#ifndef _WIN32
-// Under POSIX system, we use libusb (>= 0.1.12)
-#include <usb.h>
-#define USB_TIMEDOUT ETIMEDOUT
-#define _usb_strerror( X ) strerror(-X)
-#else
-// Under Windows we use libusb-win32 (>= 1.2.5)
-#include <lusb0_usb.h>
-#define USB_TIMEDOUT 116
-#define _usb_strerror( X ) usb_strerror()
-#endif
-
 #include <string.h>
 
+#include <libusb.h>
+
 #include <nfc/nfc.h>
 
 #include "nfc-internal.h"
+#include "buses/usbbus.h"
 #include "chips/pn53x.h"
 #include "chips/pn53x-internal.h"
 #include "drivers/acr122_usb.h"
@@ -81,8 +70,6 @@ Thanks to d18c7db and Okko for example code
 #define LOG_GROUP     NFC_LOG_GROUP_DRIVER
 #define LOG_CATEGORY "libnfc.driver.acr122_usb"
 
-#define USB_INFINITE_TIMEOUT   0
-
 #define DRIVER_DATA(pnd) ((struct acr122_usb_data*)(pnd->driver_data))
 
 typedef enum {
@@ -172,13 +159,16 @@ struct acr122_usb_apdu_frame {
 };
 #pragma pack()
 
+#define ACR122_USB_BUFFER_LEN (255 + sizeof(struct ccid_header))
+
 struct acr122_usb_data {
-  usb_dev_handle *pudh;
+  libusb_context *ctx;
+  libusb_device_handle *pudh;
+  struct usbbus_transport *transport;
   acr122_usb_model model;
-  uint32_t uiEndPointIn;
-  uint32_t uiEndPointOut;
-  uint32_t uiMaxPacketSize;
-  volatile bool abort_flag;
+  uint8_t uiEndPointIn;
+  uint8_t uiEndPointOut;
+  uint16_t uiMaxPacketSize;
   // Keep some buffers to reduce memcpy() usage
   struct acr122_usb_tama_frame tama_frame;
   struct acr122_usb_apdu_frame apdu_frame;
@@ -213,44 +203,6 @@ static int acr122_usb_send_apdu(nfc_device *pnd,
                                 const uint8_t ins, const uint8_t p1, const uint8_t p2, const uint8_t *const data, size_t data_len, const uint8_t le,
                                 uint8_t *out, const size_t out_size);
 
-static int
-acr122_usb_bulk_read(struct acr122_usb_data *data, uint8_t abtRx[], const size_t szRx, const int timeout)
-{
-  int res = usb_bulk_read(data->pudh, data->uiEndPointIn, (char *) abtRx, szRx, timeout);
-  if (res > 0) {
-    LOG_HEX(NFC_LOG_GROUP_COM, "RX", abtRx, res);
-  } else if (res < 0) {
-    if (res != -USB_TIMEDOUT) {
-      res = NFC_EIO;
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to read from USB (%s)", _usb_strerror(res));
-    } else {
-      res = NFC_ETIMEOUT;
-    }
-  }
-  return res;
-}
-
-static int
-acr122_usb_bulk_write(struct acr122_usb_data *data, uint8_t abtTx[], const size_t szTx, const int timeout)
-{
-  LOG_HEX(NFC_LOG_GROUP_COM, "TX", abtTx, szTx);
-  int res = usb_bulk_write(data->pudh, data->uiEndPointOut, (char *) abtTx, szTx, timeout);
-  if (res > 0) {
-    // HACK This little hack is a well know problem of USB, see http://www.libusb.org/ticket/6 for more details
-    if ((res % data->uiMaxPacketSize) == 0) {
-      usb_bulk_write(data->pudh, data->uiEndPointOut, "\0", 0, timeout);
-    }
-  } else if (res < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to write to USB (%s)", _usb_strerror(res));
-    if (res == -USB_TIMEDOUT) {
-      res = NFC_ETIMEOUT;
-    } else {
-      res = NFC_EIO;
-    }
-  }
-  return res;
-}
-
 struct acr122_usb_supported_device {
   uint16_t vendor_id;
   uint16_t product_id;
@@ -275,92 +227,25 @@ acr122_usb_get_device_model(uint16_t vendor_id, uint16_t product_id)
   return UNKNOWN;
 }
 
-// Find transfer endpoints for bulk transfers
-static void
-acr122_usb_get_end_points(struct usb_device *dev, struct acr122_usb_data *data)
-{
-  uint32_t uiIndex;
-  uint32_t uiEndPoint;
-  struct usb_interface_descriptor *puid = dev->config->interface->altsetting;
-
-  // 3 Endpoints maximum: Interrupt In, Bulk In, Bulk Out
-  for (uiIndex = 0; uiIndex < puid->bNumEndpoints; uiIndex++) {
-    // Only accept bulk transfer endpoints (ignore interrupt endpoints)
-    if (puid->endpoint[uiIndex].bmAttributes != USB_ENDPOINT_TYPE_BULK)
-      continue;
-
-    // Copy the endpoint to a local var, makes it more readable code
-    uiEndPoint = puid->endpoint[uiIndex].bEndpointAddress;
-
-    // Test if we dealing with a bulk IN endpoint
-    if ((uiEndPoint & USB_ENDPOINT_DIR_MASK) == USB_ENDPOINT_IN) {
-      data->uiEndPointIn = uiEndPoint;
-      data->uiMaxPacketSize = puid->endpoint[uiIndex].wMaxPacketSize;
-    }
-    // Test if we dealing with a bulk OUT endpoint
-    if ((uiEndPoint & USB_ENDPOINT_DIR_MASK) == USB_ENDPOINT_OUT) {
-      data->uiEndPointOut = uiEndPoint;
-      data->uiMaxPacketSize = puid->endpoint[uiIndex].wMaxPacketSize;
-    }
-  }
-}
-
 static size_t
 acr122_usb_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
 {
-  (void)context;
-  usb_init();
-
-  int res;
-  // usb_find_busses will find all of the busses on the system. Returns the
-  // number of changes since previous call to this function (total of new
-  // busses and busses removed).
-  if ((res = usb_find_busses()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB busses (%s)", _usb_strerror(res));
-    return 0;
-  }
-  // usb_find_devices will find all of the devices on each bus. This should be
-  // called after usb_find_busses. Returns the number of changes since the
-  // previous call to this function (total of new device and devices removed).
-  if ((res = usb_find_devices()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", _usb_strerror(res));
+  if (!context->usb_registry)
     return 0;
-  }
+
+  // Devices are not opened to be listed, the registry knows them already
+  struct usbbus_device devices[USBBUS_REGISTRY_LEN];
+  const size_t devices_count = usbbus_registry_list(context->usb_registry, devices, USBBUS_REGISTRY_LEN);
 
   size_t device_found = 0;
-  uint32_t uiBusIndex = 0;
-  struct usb_bus *bus;
-  for (bus = usb_get_busses(); bus; bus = bus->next) {
-    struct usb_device *dev;
-
-    for (dev = bus->devices; dev; dev = dev->next, uiBusIndex++) {
-      for (size_t n = 0; n < sizeof(acr122_usb_supported_devices) / sizeof(struct acr122_usb_supported_device); n++) {
-        if ((acr122_usb_supported_devices[n].vendor_id == dev->descriptor.idVendor) &&
-            (acr122_usb_supported_devices[n].product_id == dev->descriptor.idProduct)) {
-          // Make sure there are 2 endpoints available
-          // with libusb-win32 we got some null pointers so be robust before looking at endpoints:
-          if (dev->config == NULL || dev->config->interface == NULL || dev->config->interface->altsetting == NULL) {
-            // Nope, we maybe want the next one, let's try to find another
-            continue;
-          }
-          if (dev->config->interface->altsetting->bNumEndpoints < 2) {
-            // Nope, we maybe want the next one, let's try to find another
-            continue;
-          }
-
-          usb_dev_handle *udev = usb_open(dev);
-
-          // Set configuration
-          // acr122_usb_get_usb_device_name (dev, udev, pnddDevices[device_found].acDevice, sizeof (pnddDevices[device_found].acDevice));
-          log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "device found: Bus %s Device %s Name %s", bus->dirname, dev->filename, acr122_usb_supported_devices[n].name);
-          usb_close(udev);
-          snprintf(connstrings[device_found], sizeof(nfc_connstring), "%s:%s:%s", ACR122_USB_DRIVER_NAME, bus->dirname, dev->filename);
-          device_found++;
-          // Test if we reach the maximum "wanted" devices
-          if (device_found == connstrings_len) {
-            return device_found;
-          }
-        }
+  for (size_t i = 0; (i < devices_count) && (device_found < connstrings_len); i++) {
+    for (size_t n = 0; n < sizeof(acr122_usb_supported_devices) / sizeof(struct acr122_usb_supported_device); n++) {
+      if ((acr122_usb_supported_devices[n].vendor_id == devices[i].vendor_id) &&
+          (acr122_usb_supported_devices[n].product_id == devices[i].product_id)) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "device found: Bus %03d Device %03d Name %s", devices[i].bus, devices[i].address, acr122_usb_supported_devices[n].name);
+        snprintf(connstrings[device_found], sizeof(nfc_connstring), "%s:%03d:%03d", ACR122_USB_DRIVER_NAME, devices[i].bus, devices[i].address);
+        device_found++;
+        break;
       }
     }
   }
@@ -401,23 +286,27 @@ acr122_usb_connstring_decode(const nfc_connstring connstring, struct acr122_usb_
 }
 
 static bool
-acr122_usb_get_usb_device_name(struct usb_device *dev, usb_dev_handle *udev, char *buffer, size_t len)
+acr122_usb_get_usb_device_name(libusb_device *dev, libusb_device_handle *udev, char *buffer, size_t len)
 {
+  struct libusb_device_descriptor descriptor;
   *buffer = '\0';
 
-  if (dev->descriptor.iManufacturer || dev->descriptor.iProduct) {
+  if (libusb_get_device_descriptor(dev, &descriptor) < 0)
+    return false;
+
+  if (descriptor.iManufacturer || descriptor.iProduct) {
     if (udev) {
-      usb_get_string_simple(udev, dev->descriptor.iManufacturer, buffer, len);
+      libusb_get_string_descriptor_ascii(udev, descriptor.iManufacturer, (unsigned char *) buffer, len);
       if (strlen(buffer) > 0)
         strcpy(buffer + strlen(buffer), " / ");
-      usb_get_string_simple(udev, dev->descriptor.iProduct, buffer + strlen(buffer), len - strlen(buffer));
+      libusb_get_string_descriptor_ascii(udev, descriptor.iProduct, (unsigned char *) buffer + strlen(buffer), len - strlen(buffer));
     }
   }
 
   if (!*buffer) {
     for (size_t n = 0; n < sizeof(acr122_usb_supported_devices) / sizeof(struct acr122_usb_supported_device); n++) {
-      if ((acr122_usb_supported_devices[n].vendor_id == dev->descriptor.idVendor) &&
-          (acr122_usb_supported_devices[n].product_id == dev->descriptor.idProduct)) {
+      if ((acr122_usb_supported_devices[n].vendor_id == descriptor.idVendor) &&
+          (acr122_usb_supported_devices[n].product_id == descriptor.idProduct)) {
         strncpy(buffer, acr122_usb_supported_devices[n].name, len);
         return true;
       }
@@ -432,107 +321,122 @@ acr122_usb_open(const nfc_context *context, const nfc_connstring connstring)
 {
   nfc_device *pnd = NULL;
   struct acr122_usb_descriptor desc = { NULL, NULL };
+  libusb_device **devices = NULL;
   int connstring_decode_level = acr122_usb_connstring_decode(connstring, &desc);
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%d element(s) have been decoded from \"%s\"", connstring_decode_level, connstring);
-  if (connstring_decode_level < 1) {
-    goto free_mem;
-  }
 
   struct acr122_usb_data data = {
+    .ctx = NULL,
     .pudh = NULL,
+    .transport = NULL,
     .uiEndPointIn = 0,
     .uiEndPointOut = 0,
   };
-  struct usb_bus *bus;
-  struct usb_device *dev;
 
-  usb_init();
+  if (connstring_decode_level < 1) {
+    goto free_mem;
+  }
 
   int res;
-  // usb_find_busses will find all of the busses on the system. Returns the
-  // number of changes since previous call to this function (total of new
-  // busses and busses removed).
-  if ((res = usb_find_busses()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB busses (%s)", _usb_strerror(res));
+  if ((res = libusb_init(&data.ctx)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to initialize libusb (%s)", libusb_error_name(res));
+    data.ctx = NULL;
     goto free_mem;
   }
-  // usb_find_devices will find all of the devices on each bus. This should be
-  // called after usb_find_busses. Returns the number of changes since the
-  // previous call to this function (total of new device and devices removed).
-  if ((res = usb_find_devices()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", _usb_strerror(res));
+  ssize_t devices_count = libusb_get_device_list(data.ctx, &devices);
+  if (devices_count < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", libusb_error_name(devices_count));
+    devices = NULL;
     goto free_mem;
   }
 
-  for (bus = usb_get_busses(); bus; bus = bus->next) {
+  for (ssize_t i = 0; i < devices_count; i++) {
+    libusb_device *dev = devices[i];
     if (connstring_decode_level > 1)  {
       // A specific bus have been specified
-      if (0 != strcmp(bus->dirname, desc.dirname))
+      if (libusb_get_bus_number(dev) != atoi(desc.dirname))
         continue;
     }
-    for (dev = bus->devices; dev; dev = dev->next) {
-      if (connstring_decode_level > 2)  {
-        // A specific dev have been specified
-        if (0 != strcmp(dev->filename, desc.filename))
-          continue;
-      }
-      // Open the USB device
-      data.pudh = usb_open(dev);
-      // Reset device
-      usb_reset(data.pudh);
-      // Retrieve end points
-      acr122_usb_get_end_points(dev, &data);
-      // Claim interface
-      res = usb_claim_interface(data.pudh, 0);
-      if (res < 0) {
-        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to claim USB interface (%s)", _usb_strerror(res));
-        usb_close(data.pudh);
-        // we failed to use the specified device
-        goto free_mem;
-      }
+    if (connstring_decode_level > 2)  {
+      // A specific dev have been specified
+      if (libusb_get_device_address(dev) != atoi(desc.filename))
+        continue;
+    }
+    struct libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(dev, &descriptor) < 0)
+      continue;
+    if ((data.model = acr122_usb_get_device_model(descriptor.idVendor, descriptor.idProduct)) == UNKNOWN)
+      continue;
 
-      res = usb_set_altinterface(data.pudh, 0);
-      if (res < 0) {
-        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set alternate setting on USB interface (%s)", _usb_strerror(res));
-        usb_close(data.pudh);
-        // we failed to use the specified device
-        goto free_mem;
-      }
+    // Retrieve end points
+    if (usbbus_get_end_points(dev, &data.uiEndPointIn, &data.uiEndPointOut, &data.uiMaxPacketSize) < 0)
+      continue;
+    // Open the USB device
+    if ((res = libusb_open(dev, &data.pudh)) < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to open USB device (%s)", libusb_error_name(res));
+      // we failed to use the specified device
+      goto free_mem;
+    }
+    // Reset device
+    libusb_reset_device(data.pudh);
+    // Claim interface
+    res = libusb_claim_interface(data.pudh, 0);
+    if (res < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to claim USB interface (%s)", libusb_error_name(res));
+      libusb_close(data.pudh);
+      // we failed to use the specified device
+      goto free_mem;
+    }
 
-      data.model = acr122_usb_get_device_model(dev->descriptor.idVendor, dev->descriptor.idProduct);
-      // Allocate memory for the device info and specification, fill it and return the info
-      pnd = nfc_device_new(context, connstring);
-      acr122_usb_get_usb_device_name(dev, data.pudh, pnd->name, sizeof(pnd->name));
-
-      pnd->driver_data = malloc(sizeof(struct acr122_usb_data));
-      *DRIVER_DATA(pnd) = data;
-
-      // Alloc and init chip's data
-      pn53x_data_new(pnd, &acr122_usb_io);
-
-      memcpy(&(DRIVER_DATA(pnd)->tama_frame), acr122_usb_frame_template, sizeof(acr122_usb_frame_template));
-      memcpy(&(DRIVER_DATA(pnd)->apdu_frame), acr122_usb_frame_template, sizeof(acr122_usb_frame_template));
-      switch (DRIVER_DATA(pnd)->model) {
-        case ACR122:
-          CHIP_DATA(pnd)->timer_correction = 46; // empirical tuning
-          break;
-        case TOUCHATAG:
-          CHIP_DATA(pnd)->timer_correction = 50; // empirical tuning
-          DRIVER_DATA(pnd)->tama_frame.ccid_header.bMessageType = PC_to_RDR_XfrBlock;
-          DRIVER_DATA(pnd)->apdu_frame.ccid_header.bMessageType = PC_to_RDR_XfrBlock;
-          break;
-        case UNKNOWN:
-          break;
-      }
-      pnd->driver = &acr122_usb_driver;
+    res = libusb_set_interface_alt_setting(data.pudh, 0, 0);
+    if (res < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set alternate setting on USB interface (%s)", libusb_error_name(res));
+      libusb_release_interface(data.pudh, 0);
+      libusb_close(data.pudh);
+      // we failed to use the specified device
+      goto free_mem;
+    }
 
-      if (acr122_usb_init(pnd) < 0) {
-        usb_close(data.pudh);
-        goto error;
-      }
-      DRIVER_DATA(pnd)->abort_flag = false;
+    // From now on, what the reader sends is received as soon as it is sent
+    if (!(data.transport = usbbus_transport_new(data.ctx, data.pudh, data.uiEndPointIn, data.uiEndPointOut, data.uiMaxPacketSize, ACR122_USB_BUFFER_LEN))) {
+      libusb_release_interface(data.pudh, 0);
+      libusb_close(data.pudh);
       goto free_mem;
     }
+
+    // Allocate memory for the device info and specification, fill it and return the info
+    pnd = nfc_device_new(context, connstring);
+    acr122_usb_get_usb_device_name(dev, data.pudh, pnd->name, sizeof(pnd->name));
+
+    pnd->driver_data = malloc(sizeof(struct acr122_usb_data));
+    *DRIVER_DATA(pnd) = data;
+
+    // Alloc and init chip's data
+    pn53x_data_new(pnd, &acr122_usb_io);
+
+    memcpy(&(DRIVER_DATA(pnd)->tama_frame), acr122_usb_frame_template, sizeof(acr122_usb_frame_template));
+    memcpy(&(DRIVER_DATA(pnd)->apdu_frame), acr122_usb_frame_template, sizeof(acr122_usb_frame_template));
+    switch (DRIVER_DATA(pnd)->model) {
+      case ACR122:
+        CHIP_DATA(pnd)->timer_correction = 46; // empirical tuning
+        break;
+      case TOUCHATAG:
+        CHIP_DATA(pnd)->timer_correction = 50; // empirical tuning
+        DRIVER_DATA(pnd)->tama_frame.ccid_header.bMessageType = PC_to_RDR_XfrBlock;
+        DRIVER_DATA(pnd)->apdu_frame.ccid_header.bMessageType = PC_to_RDR_XfrBlock;
+        break;
+      case UNKNOWN:
+        break;
+    }
+    pnd->driver = &acr122_usb_driver;
+
+    if (acr122_usb_init(pnd) < 0) {
+      usbbus_transport_free(data.transport);
+      libusb_release_interface(data.pudh, 0);
+      libusb_close(data.pudh);
+      goto error;
+    }
+    goto free_mem;
   }
   // We ran out of devices before the index required
   goto free_mem;
@@ -542,6 +446,10 @@ error:
   nfc_device_free(pnd);
   pnd = NULL;
 free_mem:
+  if (devices)
+    libusb_free_device_list(devices, 1);
+  if (!pnd && data.ctx)
+    libusb_exit(data.ctx);
   free(desc.dirname);
   free(desc.filename);
   return pnd;
@@ -553,14 +461,15 @@ acr122_usb_close(nfc_device *pnd)
   acr122_usb_ack(pnd);
   pn53x_idle(pnd);
 
+  usbbus_transport_free(DRIVER_DATA(pnd)->transport);
+
   int res;
-  if ((res = usb_release_interface(DRIVER_DATA(pnd)->pudh, 0)) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to release USB interface (%s)", _usb_strerror(res));
+  if ((res = libusb_release_interface(DRIVER_DATA(pnd)->pudh, 0)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to release USB interface (%s)", libusb_error_name(res));
   }
 
-  if ((res = usb_close(DRIVER_DATA(pnd)->pudh)) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to close USB connection (%s)", _usb_strerror(res));
-  }
+  libusb_close(DRIVER_DATA(pnd)->pudh);
+  libusb_exit(DRIVER_DATA(pnd)->ctx);
   pn53x_data_free(pnd);
   nfc_device_free(pnd);
 }
@@ -607,51 +516,44 @@ acr122_build_frame_from_tama(nfc_device *pnd, const uint8_t *tama, const size_t
 }
 
 static int
-acr122_usb_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, const int timeout)
+acr122_usb_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, const int timeout)
 {
   int res;
-  if ((res = acr122_build_frame_from_tama(pnd, pbtData, szData)) < 0) {
+  if (szData > sizeof(DRIVER_DATA(pnd)->tama_frame.tama_payload)) {
     pnd->last_error = NFC_EINVARG;
     return pnd->last_error;
   }
 
-  if ((res = acr122_usb_bulk_write(DRIVER_DATA(pnd), (unsigned char *) & (DRIVER_DATA(pnd)->tama_frame), res, timeout)) < 0) {
+  // The header of the TAMA frame template goes right before the command
+  struct acr122_usb_tama_frame *frame = (struct acr122_usb_tama_frame *)(pbtData - offsetof(struct acr122_usb_tama_frame, tama_payload));
+  memcpy(frame, &(DRIVER_DATA(pnd)->tama_frame), offsetof(struct acr122_usb_tama_frame, tama_payload));
+  frame->ccid_header.dwLength = htole32(szData + sizeof(struct apdu_header) + 1);
+  frame->apdu_header.bLen = szData + 1;
+
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, (const uint8_t *) frame, offsetof(struct acr122_usb_tama_frame, tama_payload) + szData);
+  if ((res = usbbus_write(DRIVER_DATA(pnd)->transport, (unsigned char *) frame, offsetof(struct acr122_usb_tama_frame, tama_payload) + szData, timeout)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
   return NFC_SUCCESS;
 }
 
-#define USB_TIMEOUT_PER_PASS 200
 static int
-acr122_usb_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, const int timeout)
+acr122_usb_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, const int timeout)
 {
   off_t offset = 0;
-
-  uint8_t  abtRxBuf[255 + sizeof(struct ccid_header)];
   int res;
 
-  /*
-   * If no timeout is specified but the command is blocking, force a 200ms (USB_TIMEOUT_PER_PASS)
-   * timeout to allow breaking the loop if the user wants to stop it.
-   */
-  int usb_timeout;
-  int remaining_time = timeout;
-read:
-  if (timeout == USB_INFINITE_TIMEOUT) {
-    usb_timeout = USB_TIMEOUT_PER_PASS;
-  } else {
-    // A user-provided timeout is set, we have to cut it in multiple chunk to be able to keep an nfc_abort_command() mecanism
-    remaining_time -= USB_TIMEOUT_PER_PASS;
-    if (remaining_time <= 0) {
-      pnd->last_error = NFC_ETIMEOUT;
-      return pnd->last_error;
-    } else {
-      usb_timeout = MIN(remaining_time, USB_TIMEOUT_PER_PASS);
-    }
-  }
+  // nfc_abort_command() wakes this wait up right away, no need to slice it
+  res = usbbus_read(DRIVER_DATA(pnd)->transport, pbtFrame, szFrame, timeout);
 
-  res = acr122_usb_bulk_read(DRIVER_DATA(pnd), abtRxBuf, sizeof(abtRxBuf), usb_timeout);
+  if (res < 0) {
+    // try to interrupt current device state
+    acr122_usb_ack(pnd);
+    pnd->last_error = res;
+    return pnd->last_error;
+  }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, res);
 
   uint8_t attempted_response = RDR_to_PC_Escape; // ACR122U attempted response
   size_t len;
@@ -659,30 +561,20 @@ read:
   switch (DRIVER_DATA(pnd)->model) {
     case TOUCHATAG:
       attempted_response = RDR_to_PC_DataBlock;
-      if (res == NFC_ETIMEOUT) {
-        if (DRIVER_DATA(pnd)->abort_flag) {
-          DRIVER_DATA(pnd)->abort_flag = false;
-          acr122_usb_ack(pnd);
-          pnd->last_error = NFC_EOPABORTED;
-          return pnd->last_error;
-        } else {
-          goto read;
-        }
-      }
-      if (abtRxBuf[offset] != attempted_response) {
+      if (pbtFrame[offset] != attempted_response) {
         log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame header mismatch");
         pnd->last_error = NFC_EIO;
         return pnd->last_error;
       }
       offset++;
 
-      len = abtRxBuf[offset++];
+      len = pbtFrame[offset++];
       if (len != 2) {
         log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Wrong reply");
         pnd->last_error = NFC_EIO;
         return pnd->last_error;
       }
-      acr122_usb_send_apdu(pnd, APDU_GetAdditionnalData, 0x00, 0x00, NULL, 0, abtRxBuf[11], abtRxBuf, sizeof(abtRxBuf));
+      acr122_usb_send_apdu(pnd, APDU_GetAdditionnalData, 0x00, 0x00, NULL, 0, pbtFrame[11], pbtFrame, szFrame);
       offset = 0;
       break;
     case ACR122:
@@ -690,25 +582,8 @@ read:
     case UNKNOWN:
       break;
   }
-  if (res == NFC_ETIMEOUT) {
-    if (DRIVER_DATA(pnd)->abort_flag) {
-      DRIVER_DATA(pnd)->abort_flag = false;
-      acr122_usb_ack(pnd);
-      pnd->last_error = NFC_EOPABORTED;
-      return pnd->last_error;
-    } else {
-      goto read; // FIXME May cause some trouble on Touchatag, right ?
-    }
-  }
 
-  if (res < 0) {
-    // try to interrupt current device state
-    acr122_usb_ack(pnd);
-    pnd->last_error = res;
-    return pnd->last_error;
-  }
-
-  if (abtRxBuf[offset] != attempted_response) {
+  if (pbtFrame[offset] != attempted_response) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame header mismatch");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
@@ -716,8 +591,8 @@ read:
   offset++;
 
   // XXX In CCID specification, len is a 32-bits (dword), do we need to decode more than 1 byte ? (0-255 bytes for PN532 reply)
-  len = abtRxBuf[offset++];
-  if ((abtRxBuf[offset] != 0x00) && (abtRxBuf[offset + 1] != 0x00) && (abtRxBuf[offset + 2] != 0x00)) {
+  len = pbtFrame[offset++];
+  if ((pbtFrame[offset] != 0x00) && (pbtFrame[offset + 1] != 0x00) && (pbtFrame[offset + 2] != 0x00)) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Not implemented: only 1-byte length is supported, please report this bug with a full trace.");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
@@ -731,35 +606,27 @@ read:
   }
   len -= 4; // We skip 2 bytes for PN532 direction byte (D5) and command byte (CMD+1), then 2 bytes for APDU status (90 00).
 
-  if (len > szDataLen) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive data: buffer too small. (szDataLen: %zu, len: %zu)", szDataLen, len);
-    pnd->last_error = NFC_EOVFLOW;
-    return pnd->last_error;
-  }
-
   // Skip CCID remaining bytes
   offset += 2; // bSlot and bSeq are not used
   offset += 2; // XXX bStatus and bError should maybe checked ?
   offset += 1; // bRFU should be 0x00
 
   // TFI + PD0 (CC+1)
-  if (abtRxBuf[offset] != 0xD5) {
+  if (pbtFrame[offset] != 0xD5) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "TFI Mismatch");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
   }
   offset += 1;
 
-  if (abtRxBuf[offset] != CHIP_DATA(pnd)->last_command + 1) {
+  if (pbtFrame[offset] != CHIP_DATA(pnd)->last_command + 1) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Command Code verification failed");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
   }
   offset += 1;
 
-  memcpy(pbtData, abtRxBuf + offset, len);
-  offset += len;
-
+  *ppbtData = pbtFrame + offset;
   return len;
 }
 
@@ -773,9 +640,9 @@ acr122_usb_ack(nfc_device *pnd)
   if ((res = acr122_build_frame_from_tama(pnd, acr122_ack_frame, sizeof(acr122_ack_frame))) < 0)
     return res;
 
-  res = acr122_usb_bulk_write(DRIVER_DATA(pnd), (unsigned char *) & (DRIVER_DATA(pnd)->tama_frame), res, 1000);
-  uint8_t  abtRxBuf[255 + sizeof(struct ccid_header)];
-  res = acr122_usb_bulk_read(DRIVER_DATA(pnd), abtRxBuf, sizeof(abtRxBuf), 1000);
+  res = usbbus_write(DRIVER_DATA(pnd)->transport, (unsigned char *) & (DRIVER_DATA(pnd)->tama_frame), res, 1000);
+  uint8_t  abtRxBuf[ACR122_USB_BUFFER_LEN];
+  res = usbbus_read(DRIVER_DATA(pnd)->transport, abtRxBuf, sizeof(abtRxBuf), 1000);
   return res;
 }
 
@@ -786,9 +653,9 @@ acr122_usb_send_apdu(nfc_device *pnd,
 {
   int res;
   size_t frame_len = acr122_build_frame_from_apdu(pnd, ins, p1, p2, data, data_len, le);
-  if ((res = acr122_usb_bulk_write(DRIVER_DATA(pnd), (unsigned char *) & (DRIVER_DATA(pnd)->apdu_frame), frame_len, 1000)) < 0)
+  if ((res = usbbus_write(DRIVER_DATA(pnd)->transport, (unsigned char *) & (DRIVER_DATA(pnd)->apdu_frame), frame_len, 1000)) < 0)
     return res;
-  if ((res = acr122_usb_bulk_read(DRIVER_DATA(pnd), out, out_size, 1000)) < 0)
+  if ((res = usbbus_read(DRIVER_DATA(pnd)->transport, out, out_size, 1000)) < 0)
     return res;
   return res;
 }
@@ -797,7 +664,7 @@ int
 acr122_usb_init(nfc_device *pnd)
 {
   int res = 0;
-  uint8_t  abtRxBuf[255 + sizeof(struct ccid_header)];
+  uint8_t  abtRxBuf[ACR122_USB_BUFFER_LEN];
 
   /*
   // See ACR122 manual: "Bi-Color LED and Buzzer Control" section
@@ -815,10 +682,10 @@ acr122_usb_init(nfc_device *pnd)
   };
 
   log_put (LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "ACR122 Get LED state");
-  if ((res = acr122_usb_bulk_write (DRIVER_DATA (pnd), (uint8_t *) acr122u_get_led_state_frame, sizeof (acr122u_get_led_state_frame), 1000)) < 0)
+  if ((res = usbbus_write (DRIVER_DATA (pnd)->transport, acr122u_get_led_state_frame, sizeof (acr122u_get_led_state_frame), 1000)) < 0)
     return res;
 
-  if ((res = acr122_usb_bulk_read (DRIVER_DATA (pnd), abtRxBuf, sizeof (abtRxBuf), 1000)) < 0)
+  if ((res = usbbus_read (DRIVER_DATA (pnd)->transport, abtRxBuf, sizeof (abtRxBuf), 1000)) < 0)
     return res;
   */
 
@@ -834,9 +701,9 @@ acr122_usb_init(nfc_device *pnd)
     .bMessageSpecific = { 0x01, 0x00, 0x00 },
   };
 
-  if ((res = acr122_usb_bulk_write(DRIVER_DATA(pnd), (unsigned char *)&ccid_frame, sizeof(struct ccid_header), 1000)) < 0)
+  if ((res = usbbus_write(DRIVER_DATA(pnd)->transport, (unsigned char *)&ccid_frame, sizeof(struct ccid_header), 1000)) < 0)
     return res;
-  if ((res = acr122_usb_bulk_read(DRIVER_DATA(pnd), abtRxBuf, sizeof(abtRxBuf), 1000)) < 0)
+  if ((res = usbbus_read(DRIVER_DATA(pnd)->transport, abtRxBuf, sizeof(abtRxBuf), 1000)) < 0)
     return res;
 
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "ACR122 PICC Operating Parameters");
@@ -852,8 +719,7 @@ acr122_usb_init(nfc_device *pnd)
 static int
 acr122_usb_abort_command(nfc_device *pnd)
 {
-  DRIVER_DATA(pnd)->abort_flag = true;
-  return NFC_SUCCESS;
+  return usbbus_abort(DRIVER_DATA(pnd)->transport);
 }
 
 const struct pn53x_io acr122_usb_io = {
@@ -872,6 +738,7 @@ const struct nfc_driver acr122_usb_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = NULL, // No secure-element support
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -880,6 +747,9 @@ const struct nfc_driver acr122_usb_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
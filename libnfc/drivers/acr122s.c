@@ -217,6 +217,22 @@ acr122s_send_frame(nfc_device *pnd, uint8_t *frame, int timeout)
   return 0;
 }
 
+/**
+ * Compute the response frame length from its first bytes.
+ *
+ * @note the frame length is known once the 11 bytes header is received
+ */
+static int
+acr122s_frame_length(const uint8_t *frame, const size_t frame_size)
+{
+  if (frame_size < 11)
+    return 11;
+  // A length this large can only come from a corrupted header
+  if (APDU_SIZE(frame) > MAX_FRAME_SIZE)
+    return NFC_EIO;
+  return FRAME_SIZE(frame);
+}
+
 /**
  * Receive response frame after a successfull acr122s_send_command().
  *
@@ -239,19 +255,15 @@ acr122s_recv_frame(nfc_device *pnd, uint8_t *frame, size_t frame_size, void *abo
   int ret;
   serial_port port = DRIVER_DATA(pnd)->port;
 
-  if ((ret = uart_receive(port, frame, 11, abort_p, timeout)) != 0)
+  if ((ret = uart_receive_frame(port, frame, frame_size, acr122s_frame_length, abort_p, timeout)) < 0) {
+    // Is buffer sufficient to store response?
+    if (ret == NFC_EOVFLOW) {
+      pnd->last_error = NFC_EIO;
+      return pnd->last_error;
+    }
     return ret;
-
-  // Is buffer sufficient to store response?
-  if (frame_size < FRAME_SIZE(frame)) {
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
   }
 
-  size_t remaining = FRAME_SIZE(frame) - 11;
-  if ((ret = uart_receive(port, frame + 11, remaining, abort_p, timeout)) != 0)
-    return ret;
-
   struct xfr_block_res *res = (struct xfr_block_res *) &frame[1];
   if ((uint8_t)(res->seq + 1) != DRIVER_DATA(pnd)->seq) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Invalid response sequence number.");
@@ -287,7 +299,7 @@ le32(uint32_t val)
  * @param frame_size is the passed command frame size
  * @param p1
  * @param p2
- * @param data is PN532 APDU data without the direction prefix (0xD4)
+ * @param data is PN532 APDU data without the direction prefix (0xD4), it may be in the frame already
  * @param data_size is APDU data size
  * @param should_prefix 1 if prefix 0xD4 should be inserted before APDU data, 0 if not
  *
@@ -322,7 +334,9 @@ acr122s_build_frame(nfc_device *pnd,
   uint8_t *buf = (uint8_t *) &frame[16];
   if (should_prefix)
     *buf++ = 0xD4;
-  memcpy(buf, data, data_size);
+  // data may already be in place
+  if (buf != data)
+    memcpy(buf, data, data_size);
   acr122s_fix_frame(frame);
 
   return true;
@@ -449,73 +463,71 @@ acr122s_connstring_decode(const nfc_connstring connstring, struct acr122s_descri
   return 3;
 }
 
-static size_t
-acr122s_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+// ACR122S is a RS232 reader, plugged to an on-board UART or an USB to RS232 cable
+static const struct uart_adapter acr122s_adapters[] = {
+  { 0x0403, 0, NULL },  // FTDI
+  { 0x10c4, 0, NULL },  // Silicon Labs CP210x
+  { 0x067b, 0, NULL },  // Prolific PL2303
+  { 0x1a86, 0, NULL },  // WCH CH340/CH341
+  { 0, 0, NULL },       // On-board UART
+};
+
+static int
+acr122s_probe(const nfc_context *context, const char *acPort, nfc_connstring connstring)
 {
-  size_t device_found = 0;
-  serial_port sp;
-  char **acPorts = uart_list_ports();
-  const char *acPort;
-  int     iDevice = 0;
+  serial_port sp = uart_open(acPort);
+  log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find ACR122S device on serial port: %s at %d bauds.", acPort, ACR122S_DEFAULT_SPEED);
 
-  while ((acPort = acPorts[iDevice++])) {
-    sp = uart_open(acPort);
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find ACR122S device on serial port: %s at %d bauds.", acPort, ACR122S_DEFAULT_SPEED);
+  if ((sp == INVALID_SERIAL_PORT) || (sp == CLAIMED_SERIAL_PORT))
+    return NFC_EIO;
 
-    if ((sp != INVALID_SERIAL_PORT) && (sp != CLAIMED_SERIAL_PORT)) {
-      // We need to flush input to be sure first reply does not comes from older byte transceive
-      uart_flush_input(sp);
-      uart_set_speed(sp, ACR122S_DEFAULT_SPEED);
+  // We need to flush input to be sure first reply does not comes from older byte transceive
+  uart_flush_input(sp);
+  uart_set_speed(sp, ACR122S_DEFAULT_SPEED);
 
-      nfc_connstring connstring;
-      snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, ACR122S_DRIVER_NAME, acPort, ACR122S_DEFAULT_SPEED);
-      nfc_device *pnd = nfc_device_new(context, connstring);
+  snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, ACR122S_DRIVER_NAME, acPort, ACR122S_DEFAULT_SPEED);
+  nfc_device *pnd = nfc_device_new(context, connstring);
 
-      pnd->driver = &acr122s_driver;
-      pnd->driver_data = malloc(sizeof(struct acr122s_data));
-      DRIVER_DATA(pnd)->port = sp;
-      DRIVER_DATA(pnd)->seq = 0;
+  pnd->driver = &acr122s_driver;
+  pnd->driver_data = malloc(sizeof(struct acr122s_data));
+  DRIVER_DATA(pnd)->port = sp;
+  DRIVER_DATA(pnd)->seq = 0;
 
+  pn53x_data_new(pnd, &acr122s_io);
+  CHIP_DATA(pnd)->type = PN532;
+  CHIP_DATA(pnd)->power_mode = NORMAL;
+
+  char version[32];
+  int ret = NFC_ESOFT;
 #ifndef WIN32
-      if (pipe(DRIVER_DATA(pnd)->abort_fds) < 0) {
-        return 0;
-      }
+  if (pipe(DRIVER_DATA(pnd)->abort_fds) == 0) {
+    ret = acr122s_get_firmware_version(pnd, version, sizeof(version));
+    close(DRIVER_DATA(pnd)->abort_fds[0]);
+    close(DRIVER_DATA(pnd)->abort_fds[1]);
+  }
 #else
-      DRIVER_DATA(pnd)->abort_flag = false;
+  DRIVER_DATA(pnd)->abort_flag = false;
+  ret = acr122s_get_firmware_version(pnd, version, sizeof(version));
 #endif
+  if (ret == 0 && strncmp("ACR122S", version, 7) != 0) {
+    ret = -1;
+  }
 
-      pn53x_data_new(pnd, &acr122s_io);
-      CHIP_DATA(pnd)->type = PN532;
-      CHIP_DATA(pnd)->power_mode = NORMAL;
-
-      char version[32];
-      int ret = acr122s_get_firmware_version(pnd, version, sizeof(version));
-      if (ret == 0 && strncmp("ACR122S", version, 7) != 0) {
-        ret = -1;
-      }
-
-      pn53x_data_free(pnd);
-      nfc_device_free(pnd);
-      uart_close(sp);
-
-      if (ret != 0)
-        continue;
+  pn53x_data_free(pnd);
+  nfc_device_free(pnd);
+  uart_close(sp);
 
-      // ACR122S reader is found
-      memcpy(connstrings[device_found], connstring, sizeof(nfc_connstring));
-      device_found++;
+  if (ret == NFC_ESOFT)
+    return ret;
+  // ACR122S reader is found
+  return (ret == 0) ? 1 : 0;
+}
 
-      // Test if we reach the maximum "wanted" devices
-      if (device_found >= connstrings_len)
-        break;
-    }
-  }
-  iDevice = 0;
-  while ((acPort = acPorts[iDevice++])) {
-    free((void *)acPort);
-  }
-  free(acPorts);
-  return device_found;
+static size_t
+acr122s_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+{
+  return uart_scan_ports(context, ACR122S_DRIVER_NAME, acr122s_adapters, sizeof(acr122s_adapters) / sizeof(acr122s_adapters[0]),
+                         acr122s_probe, connstrings, connstrings_len);
 }
 
 static void
@@ -624,12 +636,16 @@ acr122s_open(const nfc_context *context, const nfc_connstring connstring)
 }
 
 static int
-acr122s_send(nfc_device *pnd, const uint8_t *buf, const size_t buf_len, int timeout)
+acr122s_send(nfc_device *pnd, uint8_t *buf, const size_t buf_len, int timeout)
 {
   uart_flush_input(DRIVER_DATA(pnd)->port);
 
-  uint8_t cmd[MAX_FRAME_SIZE];
-  acr122s_build_frame(pnd, cmd, sizeof(cmd), 0, 0, buf, buf_len, 1);
+  // The command frame is built around buf, in the room it has
+  uint8_t *cmd = buf - (APDU_OVERHEAD - 1);
+  if (!acr122s_build_frame(pnd, cmd, buf_len + APDU_OVERHEAD + 1, 0, 0, buf, buf_len, 1)) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
   int ret;
   if ((ret = acr122s_send_frame(pnd, cmd, timeout)) != 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to transmit data. (TX)");
@@ -641,7 +657,7 @@ acr122s_send(nfc_device *pnd, const uint8_t *buf, const size_t buf_len, int time
 }
 
 static int
-acr122s_receive(nfc_device *pnd, uint8_t *buf, size_t buf_len, int timeout)
+acr122s_receive(nfc_device *pnd, uint8_t *frame, size_t frame_size, const uint8_t **data, int timeout)
 {
   void *abort_p;
 
@@ -651,8 +667,7 @@ acr122s_receive(nfc_device *pnd, uint8_t *buf, size_t buf_len, int timeout)
   abort_p = &(DRIVER_DATA(pnd)->abort_flag);
 #endif
 
-  uint8_t tmp[MAX_FRAME_SIZE];
-  pnd->last_error = acr122s_recv_frame(pnd, tmp, sizeof(tmp), abort_p, timeout);
+  pnd->last_error = acr122s_recv_frame(pnd, frame, frame_size, abort_p, timeout);
 
   if (abort_p && (NFC_EOPABORTED == pnd->last_error)) {
     pnd->last_error = NFC_EOPABORTED;
@@ -664,15 +679,14 @@ acr122s_receive(nfc_device *pnd, uint8_t *buf, size_t buf_len, int timeout)
     return -1;
   }
 
-  size_t data_len = FRAME_SIZE(tmp) - 17;
-  if (data_len > buf_len) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Receive buffer too small. (buf_len: %zu, data_len: %zu)", buf_len, data_len);
+  // STX, CCID header, TFI and CC+1 before the data, status word, checksum and ETX after it
+  if (FRAME_SIZE(frame) < 17) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Too small reply");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
   }
-
-  memcpy(buf, tmp + 13, data_len);
-  return data_len;
+  *data = frame + 13;
+  return FRAME_SIZE(frame) - 17;
 }
 
 static int
@@ -708,6 +722,7 @@ const struct nfc_driver acr122s_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = NULL, // No secure-element support
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -716,6 +731,9 @@ const struct nfc_driver acr122s_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
@@ -93,67 +93,60 @@ static const uint8_t arygon_error_unknown_mode[] = "FF060000\x0d\x0a";
 int     arygon_reset_tama(nfc_device *pnd);
 void    arygon_firmware(nfc_device *pnd, char *str);
 
-static size_t
-arygon_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+// ARYGON readers are either USB ones, using a FTDI chip, or RS232 ones
+static const struct uart_adapter arygon_adapters[] = {
+  { 0x0403, 0, NULL },  // FTDI
+  { 0, 0, NULL },       // On-board UART
+};
+
+static int
+arygon_probe(const nfc_context *context, const char *acPort, nfc_connstring connstring)
 {
-  size_t device_found = 0;
-  serial_port sp;
-  char **acPorts = uart_list_ports();
-  const char *acPort;
-  int     iDevice = 0;
+  serial_port sp = uart_open(acPort);
+  log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find ARYGON device on serial port: %s at %d bauds.", acPort, ARYGON_DEFAULT_SPEED);
 
-  while ((acPort = acPorts[iDevice++])) {
-    sp = uart_open(acPort);
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find ARYGON device on serial port: %s at %d bauds.", acPort, ARYGON_DEFAULT_SPEED);
+  if ((sp == INVALID_SERIAL_PORT) || (sp == CLAIMED_SERIAL_PORT))
+    return NFC_EIO;
 
-    if ((sp != INVALID_SERIAL_PORT) && (sp != CLAIMED_SERIAL_PORT)) {
-      // We need to flush input to be sure first reply does not comes from older byte transceive
-      uart_flush_input(sp);
-      uart_set_speed(sp, ARYGON_DEFAULT_SPEED);
+  // We need to flush input to be sure first reply does not comes from older byte transceive
+  uart_flush_input(sp);
+  uart_set_speed(sp, ARYGON_DEFAULT_SPEED);
 
-      nfc_connstring connstring;
-      snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, ARYGON_DRIVER_NAME, acPort, ARYGON_DEFAULT_SPEED);
-      nfc_device *pnd = nfc_device_new(context, connstring);
+  snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, ARYGON_DRIVER_NAME, acPort, ARYGON_DEFAULT_SPEED);
+  nfc_device *pnd = nfc_device_new(context, connstring);
 
-      pnd->driver = &arygon_driver;
-      pnd->driver_data = malloc(sizeof(struct arygon_data));
-      DRIVER_DATA(pnd)->port = sp;
+  pnd->driver = &arygon_driver;
+  pnd->driver_data = malloc(sizeof(struct arygon_data));
+  DRIVER_DATA(pnd)->port = sp;
 
-      // Alloc and init chip's data
-      pn53x_data_new(pnd, &arygon_tama_io);
+  // Alloc and init chip's data
+  pn53x_data_new(pnd, &arygon_tama_io);
 
+  int res = NFC_ESOFT;
 #ifndef WIN32
-      // pipe-based abort mecanism
-      if (pipe(DRIVER_DATA(pnd)->iAbortFds) < 0) {
-        return 0;
-      }
+  // pipe-based abort mecanism
+  if (pipe(DRIVER_DATA(pnd)->iAbortFds) == 0) {
+    res = arygon_reset_tama(pnd);
+    close(DRIVER_DATA(pnd)->iAbortFds[0]);
+    close(DRIVER_DATA(pnd)->iAbortFds[1]);
+  }
 #else
-      DRIVER_DATA(pnd)->abort_flag = false;
+  DRIVER_DATA(pnd)->abort_flag = false;
+  res = arygon_reset_tama(pnd);
 #endif
+  pn53x_data_free(pnd);
+  nfc_device_free(pnd);
+  uart_close(sp);
+  if (res == NFC_ESOFT)
+    return res;
+  return (res >= 0) ? 1 : 0;
+}
 
-      int res = arygon_reset_tama(pnd);
-      pn53x_data_free(pnd);
-      nfc_device_free(pnd);
-      uart_close(sp);
-      if (res < 0) {
-        continue;
-      }
-
-      // ARYGON reader is found
-      memcpy(connstrings[device_found], connstring, sizeof(nfc_connstring));
-      device_found++;
-
-      // Test if we reach the maximum "wanted" devices
-      if (device_found >= connstrings_len)
-        break;
-    }
-  }
-  iDevice = 0;
-  while ((acPort = acPorts[iDevice++])) {
-    free((void *)acPort);
-  }
-  free(acPorts);
-  return device_found;
+static size_t
+arygon_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+{
+  return uart_scan_ports(context, ARYGON_DRIVER_NAME, arygon_adapters, sizeof(arygon_adapters) / sizeof(arygon_adapters[0]),
+                         arygon_probe, connstrings, connstrings_len);
 }
 
 struct arygon_descriptor {
@@ -300,18 +293,14 @@ arygon_open(const nfc_context *context, const nfc_connstring connstring)
   return pnd;
 }
 
-#define ARYGON_TX_BUFFER_LEN (PN53x_NORMAL_FRAME__DATA_MAX_LEN + PN53x_NORMAL_FRAME__OVERHEAD + 1)
-#define ARYGON_RX_BUFFER_LEN (PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53x_EXTENDED_FRAME__OVERHEAD)
 static int
-arygon_tama_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, int timeout)
+arygon_tama_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
 {
   int res = 0;
   // Before sending anything, we need to discard from any junk bytes
   uart_flush_input(DRIVER_DATA(pnd)->port);
 
-  uint8_t abtFrame[ARYGON_TX_BUFFER_LEN] = { DEV_ARYGON_PROTOCOL_TAMA, 0x00, 0x00, 0xff };     // Every packet must start with "0x32 0x00 0x00 0xff"
-
-  size_t szFrame = 0;
+  uint8_t *pbtFrame;
   if (szData > PN53x_NORMAL_FRAME__DATA_MAX_LEN) {
     // ARYGON Reader with PN532 equipped does not support extended frame (bug in ARYGON firmware?)
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "ARYGON device does not support more than %d bytes as payload (requested: %zd)", PN53x_NORMAL_FRAME__DATA_MAX_LEN, szData);
@@ -319,12 +308,15 @@ arygon_tama_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
     return pnd->last_error;
   }
 
-  if ((res = pn53x_build_frame(abtFrame + 1, &szFrame, pbtData, szData)) < 0) {
+  if ((res = pn53x_frame_in_place(pbtData, szData, &pbtFrame)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
+  // Every packet must start with "0x32 0x00 0x00 0xff"
+  *--pbtFrame = DEV_ARYGON_PROTOCOL_TAMA;
 
-  if ((res = uart_send(DRIVER_DATA(pnd)->port, abtFrame, szFrame + 1, timeout)) != 0) {
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pbtFrame, res + 1);
+  if ((res = uart_send(DRIVER_DATA(pnd)->port, pbtFrame, res + 1, timeout)) != 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to transmit data. (TX)");
     pnd->last_error = res;
     return pnd->last_error;
@@ -336,6 +328,7 @@ arygon_tama_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, i
     pnd->last_error = res;
     return pnd->last_error;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, abtRxBuf, sizeof(abtRxBuf));
 
   if (pn53x_check_ack_frame(pnd, abtRxBuf, sizeof(abtRxBuf)) == 0) {
     // The PN53x is running the sent command
@@ -364,10 +357,8 @@ arygon_abort(nfc_device *pnd)
 }
 
 static int
-arygon_tama_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, int timeout)
+arygon_tama_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, int timeout)
 {
-  uint8_t  abtRxBuf[5];
-  size_t len;
   void *abort_p = NULL;
 
 #ifndef WIN32
@@ -376,9 +367,9 @@ arygon_tama_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, i
   abort_p = (void *) & (DRIVER_DATA(pnd)->abort_flag);
 #endif
 
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 5, abort_p, timeout);
+  int res = uart_receive_frame(DRIVER_DATA(pnd)->port, pbtFrame, szFrame, pn53x_frame_length, abort_p, timeout);
 
-  if (abort_p && (NFC_EOPABORTED == pnd->last_error)) {
+  if (abort_p && (NFC_EOPABORTED == res)) {
     arygon_abort(pnd);
 
     /* last_error got reset by arygon_abort() */
@@ -386,99 +377,15 @@ arygon_tama_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, i
     return pnd->last_error;
   }
 
-  if (pnd->last_error != 0) {
+  if (res < 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
+    pnd->last_error = res;
     return pnd->last_error;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, res);
 
-  const uint8_t pn53x_preamble[3] = { 0x00, 0x00, 0xff };
-  if (0 != (memcmp(abtRxBuf, pn53x_preamble, 3))) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame preamble+start code mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  if ((0x01 == abtRxBuf[3]) && (0xff == abtRxBuf[4])) {
-    // Error frame
-    uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 3, 0, timeout);
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Application level error detected");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  } else if ((0xff == abtRxBuf[3]) && (0xff == abtRxBuf[4])) {
-    // Extended frame
-    // ARYGON devices does not support extended frame sending
-    abort();
-  } else {
-    // Normal frame
-    if (256 != (abtRxBuf[3] + abtRxBuf[4])) {
-      // TODO: Retry
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
-      pnd->last_error = NFC_EIO;
-      return pnd->last_error;
-    }
-
-    // abtRxBuf[3] (LEN) include TFI + (CC+1)
-    len = abtRxBuf[3] - 2;
-  }
-
-  if (len > szDataLen) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive data: buffer too small. (szDataLen: %zu, len: %zu)", szDataLen, len);
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  // TFI + PD0 (CC+1)
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 2, 0, timeout);
-  if (pnd->last_error != 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-    return pnd->last_error;
-  }
-
-  if (abtRxBuf[0] != 0xD5) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "TFI Mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  if (abtRxBuf[1] != CHIP_DATA(pnd)->last_command + 1) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Command Code verification failed");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  if (len) {
-    pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, pbtData, len, 0, timeout);
-    if (pnd->last_error != 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-      return pnd->last_error;
-    }
-  }
-
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 2, 0, timeout);
-  if (pnd->last_error != 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-    return pnd->last_error;
-  }
-
-  uint8_t btDCS = (256 - 0xD5);
-  btDCS -= CHIP_DATA(pnd)->last_command + 1;
-  for (size_t szPos = 0; szPos < len; szPos++) {
-    btDCS -= pbtData[szPos];
-  }
-
-  if (btDCS != abtRxBuf[0]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Data checksum mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  if (0x00 != abtRxBuf[1]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame postamble mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
   // The PN53x command is done and we successfully received the reply
-  return len;
+  return pn53x_decode_frame(pnd, pbtFrame, (size_t) res, ppbtData);
 }
 
 void
@@ -569,6 +476,7 @@ const struct nfc_driver arygon_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = NULL, // No secure-element support
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -577,6 +485,9 @@ const struct nfc_driver arygon_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
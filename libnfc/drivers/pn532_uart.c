@@ -44,6 +44,8 @@
 #include "uart.h"
 
 #define PN532_UART_DEFAULT_SPEED 115200
+// Time given to the PN532 to switch its HSU to a new bit rate
+#define PN532_UART_SPEED_SWITCH_DELAY_MS 5
 #define PN532_UART_DRIVER_NAME "pn532_uart"
 
 #define LOG_CATEGORY "libnfc.driver.pn532_uart"
@@ -53,6 +55,7 @@
 const struct pn53x_io pn532_uart_io;
 struct pn532_uart_data {
   serial_port port;
+  uint32_t initial_speed;
 #ifndef WIN32
   int     iAbortFds[2];
 #else
@@ -66,76 +69,75 @@ int     pn532_uart_wakeup(nfc_device *pnd);
 
 #define DRIVER_DATA(pnd) ((struct pn532_uart_data*)(pnd->driver_data))
 
-static size_t
-pn532_uart_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+// PN532 boards come with an USB to UART bridge or are wired to an on-board UART
+static const struct uart_adapter pn532_uart_adapters[] = {
+  { 0x0403, 0, NULL },  // FTDI
+  { 0x10c4, 0, NULL },  // Silicon Labs CP210x
+  { 0x067b, 0, NULL },  // Prolific PL2303
+  { 0x1a86, 0, NULL },  // WCH CH340/CH341
+  { 0, 0, NULL },       // On-board UART
+};
+
+static int
+pn532_uart_probe(const nfc_context *context, const char *acPort, nfc_connstring connstring)
 {
-  size_t device_found = 0;
-  serial_port sp;
-  char **acPorts = uart_list_ports();
-  const char *acPort;
-  int     iDevice = 0;
-
-  while ((acPort = acPorts[iDevice++])) {
-    sp = uart_open(acPort);
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find PN532 device on serial port: %s at %d bauds.", acPort, PN532_UART_DEFAULT_SPEED);
-
-    if ((sp != INVALID_SERIAL_PORT) && (sp != CLAIMED_SERIAL_PORT)) {
-      // We need to flush input to be sure first reply does not comes from older byte transceive
-      uart_flush_input(sp);
-      // Serial port claimed but we need to check if a PN532_UART is opened.
-      uart_set_speed(sp, PN532_UART_DEFAULT_SPEED);
-
-      nfc_connstring connstring;
-      snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, PN532_UART_DRIVER_NAME, acPort, PN532_UART_DEFAULT_SPEED);
-      nfc_device *pnd = nfc_device_new(context, connstring);
-      pnd->driver = &pn532_uart_driver;
-      pnd->driver_data = malloc(sizeof(struct pn532_uart_data));
-      DRIVER_DATA(pnd)->port = sp;
-
-      // Alloc and init chip's data
-      pn53x_data_new(pnd, &pn532_uart_io);
-      // SAMConfiguration command if needed to wakeup the chip and pn53x_SAMConfiguration check if the chip is a PN532
-      CHIP_DATA(pnd)->type = PN532;
-      // This device starts in LowVBat power mode
-      CHIP_DATA(pnd)->power_mode = LOWVBAT;
+  serial_port sp = uart_open(acPort);
+  log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Trying to find PN532 device on serial port: %s at %d bauds.", acPort, PN532_UART_DEFAULT_SPEED);
 
-#ifndef WIN32
-      // pipe-based abort mecanism
-      if (pipe(DRIVER_DATA(pnd)->iAbortFds) < 0) {
-        return 0;
-      }
-#else
-      DRIVER_DATA(pnd)->abort_flag = false;
-#endif
+  if ((sp == INVALID_SERIAL_PORT) || (sp == CLAIMED_SERIAL_PORT))
+    return NFC_EIO;
 
-      // Check communication using "Diagnose" command, with "Communication test" (0x00)
-      int res = pn53x_check_communication(pnd);
-      pn53x_data_free(pnd);
-      nfc_device_free(pnd);
-      uart_close(sp);
-      if (res < 0) {
-        continue;
-      }
+  // We need to flush input to be sure first reply does not comes from older byte transceive
+  uart_flush_input(sp);
+  // Serial port claimed but we need to check if a PN532_UART is opened.
+  uart_set_speed(sp, PN532_UART_DEFAULT_SPEED);
 
-      memcpy(connstrings[device_found], connstring, sizeof(nfc_connstring));
-      device_found++;
+  snprintf(connstring, sizeof(nfc_connstring), "%s:%s:%"PRIu32, PN532_UART_DRIVER_NAME, acPort, PN532_UART_DEFAULT_SPEED);
+  nfc_device *pnd = nfc_device_new(context, connstring);
+  pnd->driver = &pn532_uart_driver;
+  pnd->driver_data = malloc(sizeof(struct pn532_uart_data));
+  DRIVER_DATA(pnd)->port = sp;
 
-      // Test if we reach the maximum "wanted" devices
-      if (device_found >= connstrings_len)
-        break;
-    }
-  }
-  iDevice = 0;
-  while ((acPort = acPorts[iDevice++])) {
-    free((void *)acPort);
+  // Alloc and init chip's data
+  pn53x_data_new(pnd, &pn532_uart_io);
+  // SAMConfiguration command if needed to wakeup the chip and pn53x_SAMConfiguration check if the chip is a PN532
+  CHIP_DATA(pnd)->type = PN532;
+  // This device starts in LowVBat power mode
+  CHIP_DATA(pnd)->power_mode = LOWVBAT;
+
+  int res = NFC_ESOFT;
+#ifndef WIN32
+  // pipe-based abort mecanism
+  if (pipe(DRIVER_DATA(pnd)->iAbortFds) == 0) {
+    // Check communication using "Diagnose" command, with "Communication test" (0x00)
+    res = pn53x_check_communication(pnd);
+    close(DRIVER_DATA(pnd)->iAbortFds[0]);
+    close(DRIVER_DATA(pnd)->iAbortFds[1]);
   }
-  free(acPorts);
-  return device_found;
+#else
+  DRIVER_DATA(pnd)->abort_flag = false;
+  // Check communication using "Diagnose" command, with "Communication test" (0x00)
+  res = pn53x_check_communication(pnd);
+#endif
+  pn53x_data_free(pnd);
+  nfc_device_free(pnd);
+  uart_close(sp);
+  if (res == NFC_ESOFT)
+    return res;
+  return (res >= 0) ? 1 : 0;
+}
+
+static size_t
+pn532_uart_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
+{
+  return uart_scan_ports(context, PN532_UART_DRIVER_NAME, pn532_uart_adapters, sizeof(pn532_uart_adapters) / sizeof(pn532_uart_adapters[0]),
+                         pn532_uart_probe, connstrings, connstrings_len);
 }
 
 struct pn532_uart_descriptor {
   char port[128];
   uint32_t speed;
+  uint32_t max_speed;
 };
 
 static int
@@ -183,13 +185,127 @@ pn532_connstring_decode(const nfc_connstring connstring, struct pn532_uart_descr
   }
   desc->speed = speed;
 
+  const char *max_speed_s = strtok(NULL, ":");
+  if (!max_speed_s) {
+    // max_speed not specified (or parsing error)
+    free(cs);
+    return 3;
+  }
+  unsigned long max_speed;
+  if (sscanf(max_speed_s, "%lu", &max_speed) != 1) {
+    // max_speed_s is not a number
+    free(cs);
+    return 3;
+  }
+  desc->max_speed = max_speed;
+
   free(cs);
-  return 3;
+  return 4;
+}
+
+// Bit rates of the PN532 HSU, indexed by SetSerialBaudRate BR parameter
+static const uint32_t pn532_uart_hsu_speeds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1288000 };
+
+/*
+ * Switch both the PN532 HSU and the host serial port to uiSpeed.
+ * PN532 user manual: the reply comes at the current bit rate, the chip only
+ * switches once the host acknowledged it.
+ */
+static int
+pn532_uart_switch_speed(nfc_device *pnd, const uint8_t btBaudRate, const uint32_t uiSpeed)
+{
+  int res;
+  const uint8_t abtCmd[] = { SetSerialBaudRate, btBaudRate };
+
+  if ((res = pn53x_transceive(pnd, abtCmd, sizeof(abtCmd), NULL, 0, -1)) < 0)
+    return res;
+  if ((res = pn532_uart_ack(pnd)) < 0)
+    return res;
+  // uart_set_speed() waits for the ACK to be sent before changing the bit rate
+  if ((res = uart_set_speed(DRIVER_DATA(pnd)->port, uiSpeed)) < 0)
+    return res;
+  usleep(PN532_UART_SPEED_SWITCH_DELAY_MS * 1000);
+  uart_flush_input(DRIVER_DATA(pnd)->port);
+  return NFC_SUCCESS;
+}
+
+// SetSerialBaudRate BR parameter of a bit rate, -1 if the HSU has no such rate
+static int
+pn532_uart_hsu_br(const uint32_t uiSpeed)
+{
+  for (size_t br = 0; br < sizeof(pn532_uart_hsu_speeds) / sizeof(pn532_uart_hsu_speeds[0]); br++) {
+    if (pn532_uart_hsu_speeds[br] == uiSpeed)
+      return (int) br;
+  }
+  return -1;
+}
+
+/*
+ * Bring the link back to uiCurrentSpeed after a failed switch to uiSpeed.
+ * Once it acknowledged SetSerialBaudRate, the PN532 may run at either rate:
+ * when it answers at uiSpeed, it is asked to switch back.
+ */
+static int
+pn532_uart_recover_speed(nfc_device *pnd, const uint32_t uiSpeed, const uint32_t uiCurrentSpeed)
+{
+  serial_port sp = DRIVER_DATA(pnd)->port;
+
+  if (uart_set_speed(sp, uiSpeed) == NFC_SUCCESS) {
+    uart_flush_input(sp);
+    if (pn53x_check_communication(pnd) == NFC_SUCCESS) {
+      const int iCurrentBr = pn532_uart_hsu_br(uiCurrentSpeed);
+      if (iCurrentBr < 0)
+        return NFC_EIO;
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "PN532 runs at %d bauds, switching it back to %d bauds.", uiSpeed, uiCurrentSpeed);
+      pn532_uart_switch_speed(pnd, (uint8_t) iCurrentBr, uiCurrentSpeed);
+    }
+  }
+  uart_set_speed(sp, uiCurrentSpeed);
+  uart_flush_input(sp);
+  return pn53x_check_communication(pnd);
+}
+
+static int
+pn532_uart_negotiate_speed(nfc_device *pnd, const uint32_t uiMaxSpeed)
+{
+  serial_port sp = DRIVER_DATA(pnd)->port;
+  const uint32_t uiCurrentSpeed = uart_get_speed(sp);
+
+  for (int br = (sizeof(pn532_uart_hsu_speeds) / sizeof(pn532_uart_hsu_speeds[0])) - 1; br >= 0; br--) {
+    const uint32_t uiSpeed = pn532_uart_hsu_speeds[br];
+    if (uiSpeed > uiMaxSpeed)
+      continue;
+    if (uiSpeed <= uiCurrentSpeed)
+      break;
+    // Make sure the host side can follow before asking the PN532 to switch
+    if (uart_set_speed(sp, uiSpeed) < 0)
+      continue;
+    uart_set_speed(sp, uiCurrentSpeed);
+
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Negotiating %d bauds with PN532.", uiSpeed);
+    int res = pn532_uart_switch_speed(pnd, br, uiSpeed);
+    if ((res == NFC_SUCCESS) && (pn53x_check_communication(pnd) == NFC_SUCCESS)) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Serial link now runs at %d bauds.", uiSpeed);
+      return NFC_SUCCESS;
+    }
+
+    // Back to the previous bit rate, then try the next lower one
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Unable to communicate at %d bauds, falling back to %d bauds.", uiSpeed, uiCurrentSpeed);
+    if ((res = pn532_uart_recover_speed(pnd, uiSpeed, uiCurrentSpeed)) < 0)
+      return res;
+  }
+  return NFC_SUCCESS;
 }
 
 static void
 pn532_uart_close(nfc_device *pnd)
 {
+  // Leave the PN532 HSU at the bit rate the next user will expect
+  const uint32_t uiInitialSpeed = DRIVER_DATA(pnd)->initial_speed;
+  const int iInitialBr = pn532_uart_hsu_br(uiInitialSpeed);
+  if ((uart_get_speed(DRIVER_DATA(pnd)->port) != uiInitialSpeed) && (iInitialBr >= 0))
+    pn532_uart_switch_speed(pnd, (uint8_t) iInitialBr, uiInitialSpeed);
+
   pn53x_idle(pnd);
 
   // Release UART port
@@ -217,6 +333,9 @@ pn532_uart_open(const nfc_context *context, const nfc_connstring connstring)
   if (connstring_decode_level < 3) {
     ndd.speed = PN532_UART_DEFAULT_SPEED;
   }
+  if (connstring_decode_level < 4) {
+    ndd.max_speed = context->uart_max_speed;
+  }
   serial_port sp;
   nfc_device *pnd = NULL;
 
@@ -240,6 +359,7 @@ pn532_uart_open(const nfc_context *context, const nfc_connstring connstring)
 
   pnd->driver_data = malloc(sizeof(struct pn532_uart_data));
   DRIVER_DATA(pnd)->port = sp;
+  DRIVER_DATA(pnd)->initial_speed = uart_get_speed(sp);
 
   // Alloc and init chip's data
   pn53x_data_new(pnd, &pn532_uart_io);
@@ -268,6 +388,13 @@ pn532_uart_open(const nfc_context *context, const nfc_connstring connstring)
     return NULL;
   }
 
+  // Speed up the serial link if allowed to
+  if (pn532_uart_negotiate_speed(pnd, ndd.max_speed) < 0) {
+    nfc_perror(pnd, "pn532_uart_negotiate_speed");
+    pn532_uart_close(pnd);
+    return NULL;
+  }
+
   pn53x_init(pnd);
   return pnd;
 }
@@ -282,9 +409,9 @@ pn532_uart_wakeup(nfc_device *pnd)
   return res;
 }
 
-#define PN532_BUFFER_LEN (PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53x_EXTENDED_FRAME__OVERHEAD)
+// Wake the chip up when needed, then send the command framed in place
 static int
-pn532_uart_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, int timeout)
+pn532_uart_send_frame(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
 {
   int res = 0;
   // Before sending anything, we need to discard from any junk bytes
@@ -313,20 +440,29 @@ pn532_uart_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, in
       break;
   };
 
-  uint8_t  abtFrame[PN532_BUFFER_LEN] = { 0x00, 0x00, 0xff };       // Every packet must start with "00 00 ff"
-  size_t szFrame = 0;
-
-  if ((res = pn53x_build_frame(abtFrame, &szFrame, pbtData, szData)) < 0) {
+  uint8_t *pbtFrame;
+  if ((res = pn53x_frame_in_place(pbtData, szData, &pbtFrame)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
 
-  res = uart_send(DRIVER_DATA(pnd)->port, abtFrame, szFrame, timeout);
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pbtFrame, res);
+  res = uart_send(DRIVER_DATA(pnd)->port, pbtFrame, res, timeout);
   if (res != 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to transmit data. (TX)");
     pnd->last_error = res;
     return pnd->last_error;
   }
+  return NFC_SUCCESS;
+}
+
+static int
+pn532_uart_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
+{
+  int res = 0;
+  if ((res = pn532_uart_send_frame(pnd, pbtData, szData, timeout)) < 0) {
+    return res;
+  }
 
   uint8_t abtRxBuf[6];
   res = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 6, 0, timeout);
@@ -335,6 +471,7 @@ pn532_uart_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, in
     pnd->last_error = res;
     return pnd->last_error;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, abtRxBuf, sizeof(abtRxBuf));
 
   if (pn53x_check_ack_frame(pnd, abtRxBuf, sizeof(abtRxBuf)) == 0) {
     // The PN53x is running the sent command
@@ -345,10 +482,8 @@ pn532_uart_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, in
 }
 
 static int
-pn532_uart_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, int timeout)
+pn532_uart_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, int timeout)
 {
-  uint8_t  abtRxBuf[5];
-  size_t len;
   void *abort_p = NULL;
 
 #ifndef WIN32
@@ -357,117 +492,55 @@ pn532_uart_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, in
   abort_p = (void *) & (DRIVER_DATA(pnd)->abort_flag);
 #endif
 
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 5, abort_p, timeout);
+  int res = uart_receive_frame(DRIVER_DATA(pnd)->port, pbtFrame, szFrame, pn53x_frame_length, abort_p, timeout);
 
-  if (abort_p && (NFC_EOPABORTED == pnd->last_error)) {
+  if (abort_p && (NFC_EOPABORTED == res)) {
     return pn532_uart_ack(pnd);
   }
 
-  if (pnd->last_error < 0) {
-    goto error;
-  }
-
-  const uint8_t pn53x_preamble[3] = { 0x00, 0x00, 0xff };
-  if (0 != (memcmp(abtRxBuf, pn53x_preamble, 3))) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame preamble+start code mismatch");
-    pnd->last_error = NFC_EIO;
-    goto error;
-  }
-
-  if ((0x01 == abtRxBuf[3]) && (0xff == abtRxBuf[4])) {
-    // Error frame
-    uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 3, 0, timeout);
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Application level error detected");
-    pnd->last_error = NFC_EIO;
-    goto error;
-  } else if ((0xff == abtRxBuf[3]) && (0xff == abtRxBuf[4])) {
-    // Extended frame
-    pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 3, 0, timeout);
-    if (pnd->last_error != 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-      goto error;
-    }
-    // (abtRxBuf[0] << 8) + abtRxBuf[1] (LEN) include TFI + (CC+1)
-    len = (abtRxBuf[0] << 8) + abtRxBuf[1] - 2;
-    if (((abtRxBuf[0] + abtRxBuf[1] + abtRxBuf[2]) % 256) != 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
-      pnd->last_error = NFC_EIO;
-      goto error;
-    }
-  } else {
-    // Normal frame
-    if (256 != (abtRxBuf[3] + abtRxBuf[4])) {
-      // TODO: Retry
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
-      pnd->last_error = NFC_EIO;
-      goto error;
-    }
-
-    // abtRxBuf[3] (LEN) include TFI + (CC+1)
-    len = abtRxBuf[3] - 2;
-  }
-
-  if (len > szDataLen) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive data: buffer too small. (szDataLen: %zu, len: %zu)", szDataLen, len);
-    pnd->last_error = NFC_EIO;
-    goto error;
-  }
-
-  // TFI + PD0 (CC+1)
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 2, 0, timeout);
-  if (pnd->last_error != 0) {
+  if (res < 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
+    pnd->last_error = res;
     goto error;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, res);
 
-  if (abtRxBuf[0] != 0xD5) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "TFI Mismatch");
-    pnd->last_error = NFC_EIO;
-    goto error;
-  }
-
-  if (abtRxBuf[1] != CHIP_DATA(pnd)->last_command + 1) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Command Code verification failed");
-    pnd->last_error = NFC_EIO;
+  if ((res = pn53x_decode_frame(pnd, pbtFrame, (size_t) res, ppbtData)) < 0) {
     goto error;
   }
+  // The PN53x command is done and we successfully received the reply
+  return res;
+error:
+  uart_flush_input(DRIVER_DATA(pnd)->port);
+  return pnd->last_error;
+}
 
-  if (len) {
-    pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, pbtData, len, 0, timeout);
-    if (pnd->last_error != 0) {
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-      goto error;
-    }
-  }
+// The ACK is read by pn532_uart_receive_nonblock(), as any other frame
+static int
+pn532_uart_send_nonblock(nfc_device *pnd, uint8_t *pbtData, const size_t szData)
+{
+  return pn532_uart_send_frame(pnd, pbtData, szData, 0);
+}
 
-  pnd->last_error = uart_receive(DRIVER_DATA(pnd)->port, abtRxBuf, 2, 0, timeout);
-  if (pnd->last_error != 0) {
+static int
+pn532_uart_receive_nonblock(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, size_t *pszReceived)
+{
+  const int res = uart_receive_frame_nonblock(DRIVER_DATA(pnd)->port, pbtFrame, szFrame, pszReceived, pn53x_frame_length);
+  if (res < 0) {
     log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to receive data. (RX)");
-    goto error;
-  }
-
-  uint8_t btDCS = (256 - 0xD5);
-  btDCS -= CHIP_DATA(pnd)->last_command + 1;
-  for (size_t szPos = 0; szPos < len; szPos++) {
-    btDCS -= pbtData[szPos];
-  }
-
-  if (btDCS != abtRxBuf[0]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Data checksum mismatch");
-    pnd->last_error = NFC_EIO;
-    goto error;
+    uart_flush_input(DRIVER_DATA(pnd)->port);
+    pnd->last_error = res;
   }
+  return res;
+}
 
-  if (0x00 != abtRxBuf[1]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame postamble mismatch");
-    pnd->last_error = NFC_EIO;
-    goto error;
-  }
-  // The PN53x command is done and we successfully received the reply
-  return len;
-error:
-  uart_flush_input(DRIVER_DATA(pnd)->port);
-  return pnd->last_error;
+static int
+pn532_uart_get_pollfd(nfc_device *pnd)
+{
+  const int res = uart_get_fd(DRIVER_DATA(pnd)->port);
+  if (res < 0)
+    pnd->last_error = res;
+  return res;
 }
 
 int
@@ -479,6 +552,7 @@ pn532_uart_ack(nfc_device *pnd)
       return res;
     }
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pn53x_ack_frame, sizeof(pn53x_ack_frame));
   return (uart_send(DRIVER_DATA(pnd)->port, pn53x_ack_frame, sizeof(pn53x_ack_frame),  0));
 }
 
@@ -499,8 +573,12 @@ pn532_uart_abort_command(nfc_device *pnd)
 }
 
 const struct pn53x_io pn532_uart_io = {
-  .send       = pn532_uart_send,
-  .receive    = pn532_uart_receive,
+  .send             = pn532_uart_send,
+  .receive          = pn532_uart_receive,
+  .get_pollfd       = pn532_uart_get_pollfd,
+  .send_nonblock    = pn532_uart_send_nonblock,
+  .receive_nonblock = pn532_uart_receive_nonblock,
+  .ack              = pn532_uart_ack,
 };
 
 const struct nfc_driver pn532_uart_driver = {
@@ -514,6 +592,7 @@ const struct nfc_driver pn532_uart_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = pn532_initiator_init_secure_element,
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -522,6 +601,9 @@ const struct nfc_driver pn532_uart_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
@@ -538,5 +620,10 @@ const struct nfc_driver pn532_uart_driver = {
   .abort_command  = pn532_uart_abort_command,
   .idle           = pn53x_idle,
   .powerdown      = pn53x_PowerDown,
+
+  .device_get_pollfd                 = pn53x_get_pollfd,
+  .initiator_transceive_bytes_submit = pn53x_initiator_transceive_bytes_submit,
+  .device_process_events             = pn53x_process_events,
+  .device_get_event_timeout          = pn53x_get_event_timeout,
 };
 
@@ -0,0 +1,1957 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file pn53x_sim.c
+ * @brief Driver for a PN532 simulated in software
+ *
+ * The chip is answered in process, frame by frame, so the whole pn53x code
+ * runs as with a real device. Targets in the field and the initiator talking
+ * to the chip in target mode are struct nfc_emulator, see nfc-sim.h.
+ *
+ * Latencies of the serial link, of the chip and of the RF exchanges are
+ * modelled when asked to, by the connstring or nfc_sim_set_latency(), answers
+ * are otherwise immediate.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include "pn53x_sim.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <time.h>
+#else
+#  include <windows.h>
+#endif
+
+#include <nfc/nfc.h>
+
+#include "drivers.h"
+#include "nfc-internal.h"
+#include "iso14443-4.h"
+#include "chips/pn53x.h"
+#include "chips/pn53x-internal.h"
+
+#define PN53X_SIM_DRIVER_NAME "pn53x_sim"
+
+#define LOG_CATEGORY "libnfc.driver.pn53x_sim"
+#define LOG_GROUP    NFC_LOG_GROUP_DRIVER
+
+#define DRIVER_DATA(pnd) ((struct pn53x_sim_data*)(pnd->driver_data))
+
+#define PN53X_SIM_TARGETS_MAX 8
+#define PN53X_SIM_FIFO_LEN 64
+// Longest command or response chained by the chip, an extended APDU
+#define PN53X_SIM_DATA_MAX_LEN 65544
+// Status byte and data of the longest response frame
+#define PN53X_SIM_RESPONSE_MAX_LEN (PN53x_EXTENDED_FRAME__DATA_MAX_LEN - 2)
+// Frame size the chip asks ISO14443-4 targets for
+#define PN53X_SIM_FSD 256
+// DEP frames carry at most 254 bytes, header included
+#define PN53X_SIM_DEP_PAYLOAD_LEN 250
+
+// Time the chip needs to handle a command, in microseconds
+#define PN53X_SIM_CHIP_US 60
+// Frame delay time of the targets (1236 carrier periods) rounded, in microseconds
+#define PN53X_SIM_FDT_US 90
+#define PN53X_SIM_FDT_CYCLES 1236
+// fc/128 in bits per second
+#define PN53X_SIM_RATE_106 105938
+
+// Tg the chip does not hold, and Tg of a target which left the field
+#define PN53X_SIM_NO_TG -1
+#define PN53X_SIM_GONE -2
+
+#define SAK_ISO14443_4_COMPLIANT 0x20
+
+#define ISO14443_4_PCB_CID_NAD 0x0c
+#define ISO14443_4_PCB_S_DESELECT 0xc2
+#define ISO14443_4_IS_R_NAK(pcb) ((pcb & 0xf6) == ISO14443_4_PCB_R_NAK)
+
+enum pn53x_sim_state {
+  PN53X_SIM_IDLE,
+  PN53X_SIM_ACTIVE,
+  PN53X_SIM_HALTED,
+};
+
+struct pn53x_sim_target {
+  struct nfc_emulator *emulator;
+  enum pn53x_sim_state state;
+  nfc_baud_rate nbr;
+  // ISO14443-4 layer, activated by RATS or ATTRIB
+  bool bIsoDep;
+  uint8_t btPiccBlockNumber;
+  uint8_t btPcdBlockNumber;
+  size_t szFsd;
+  uint8_t abtLastBlock[PN53X_SIM_FSD];
+  size_t szLastBlock;
+};
+
+struct pn53x_sim_data {
+#ifndef _WIN32
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+  volatile bool bAbort;
+  // Bumped when targets or the initiator come and go
+  uint32_t uiFieldChanges;
+
+  // Latency model
+  uint32_t uiWireSpeed;
+  bool bRf;
+  uint64_t uiRfNs;
+
+  // Command being run
+  uint8_t abtCommand[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  size_t szCommand;
+  uint32_t uiCommandFieldChanges;
+  uint8_t abtResponse[PN53X_SIM_RESPONSE_MAX_LEN];
+  size_t szResponse;
+  bool bAnswered;
+  bool bErrorFrame;
+  uint64_t uiReadyAt;
+
+  // Chip
+  uint8_t abtRegisters[0x10000];
+  uint8_t abtFifo[PN53X_SIM_FIFO_LEN];
+  size_t szFifo;
+  uint8_t btParameters;
+  bool bField;
+  uint8_t btMxRtyPassiveActivation;
+  uint8_t btRetryTimeout;
+
+  // Field
+  struct pn53x_sim_target aTargets[PN53X_SIM_TARGETS_MAX];
+  int aiTg[2];
+  int iReadySlot;
+  struct nfc_emulator *initiator;
+  bool bInitiatorActive;
+  uint8_t btTargetMode;
+
+  // Data chained between the host and the chip
+  uint8_t abtIn[PN53X_SIM_DATA_MAX_LEN];
+  size_t szIn;
+  uint8_t abtOut[PN53X_SIM_DATA_MAX_LEN];
+  size_t szOut;
+  size_t szOutSent;
+
+  // Data chained between the chip and an ISO14443-4 target
+  int iPiccSlot;
+  uint8_t abtPiccIn[PN53X_SIM_DATA_MAX_LEN];
+  size_t szPiccIn;
+  uint8_t abtPiccOut[PN53X_SIM_DATA_MAX_LEN];
+  size_t szPiccOut;
+  size_t szPiccOutSent;
+};
+
+const struct pn53x_io pn53x_sim_io;
+
+static const uint8_t pn53x_sim_error_frame[] = { 0x00, 0x00, 0xff, 0x01, 0xff, 0x7f, 0x81, 0x00 };
+
+static void
+pn53x_sim_lock(struct pn53x_sim_data *data)
+{
+#ifndef _WIN32
+  pthread_mutex_lock(&data->mutex);
+#else
+  (void) data;
+#endif
+}
+
+static void
+pn53x_sim_unlock(struct pn53x_sim_data *data)
+{
+#ifndef _WIN32
+  pthread_mutex_unlock(&data->mutex);
+#else
+  (void) data;
+#endif
+}
+
+static void
+pn53x_sim_wake(struct pn53x_sim_data *data)
+{
+#ifndef _WIN32
+  pthread_cond_broadcast(&data->cond);
+#else
+  (void) data;
+#endif
+}
+
+// Wait, lock held, for a change or until the deadline (0: none)
+static void
+pn53x_sim_wait(struct pn53x_sim_data *data, const uint64_t uiDeadline)
+{
+#ifndef _WIN32
+  if (!uiDeadline) {
+    pthread_cond_wait(&data->cond, &data->mutex);
+    return;
+  }
+  const struct timespec ts = {
+    .tv_sec = (time_t)(uiDeadline / 1000000000ULL),
+    .tv_nsec = (long)(uiDeadline % 1000000000ULL)
+  };
+  pthread_cond_timedwait(&data->cond, &data->mutex, &ts);
+#else
+  (void) data;
+  (void) uiDeadline;
+  Sleep(1);
+#endif
+}
+
+static void
+pn53x_sim_sleep_until(const uint64_t uiDeadline)
+{
+  const uint64_t uiNow = nfc_trace_now();
+
+  if (uiDeadline <= uiNow)
+    return;
+#ifndef _WIN32
+  const uint64_t uiNs = uiDeadline - uiNow;
+  const struct timespec ts = {
+    .tv_sec = (time_t)(uiNs / 1000000000ULL),
+    .tv_nsec = (long)(uiNs % 1000000000ULL)
+  };
+  nanosleep(&ts, NULL);
+#else
+  Sleep((DWORD)((uiDeadline - uiNow + 999999) / 1000000));
+#endif
+}
+
+// Time to send bytes on the serial link, 10 bits each
+static uint64_t
+pn53x_sim_wire_ns(const struct pn53x_sim_data *data, const size_t szBytes)
+{
+  if (!data->uiWireSpeed)
+    return 0;
+  return (uint64_t) szBytes * 10 * 1000000000ULL / data->uiWireSpeed;
+}
+
+/*
+ * Add the time on air of szExchanges exchanges with a target, szTx and szRx
+ * bytes in all. The target answers each frame after its frame delay time,
+ * which the next frame waits for too.
+ */
+static void
+pn53x_sim_rf(struct pn53x_sim_data *data, const nfc_modulation_type nmt, const nfc_baud_rate nbr,
+             const size_t szTx, const size_t szRx, const size_t szExchanges)
+{
+  if (!data->bRf)
+    return;
+  const uint64_t uiRate = (uint64_t) PN53X_SIM_RATE_106 << ((nbr > NBR_106) ? (nbr - NBR_106) : 0);
+  uint64_t uiBits;
+
+  if ((nmt == NMT_FELICA) || ((nmt == NMT_DEP) && (nbr > NBR_106))) {
+    // Manchester coded bytes, each frame after a 6 bytes preamble and a 2 bytes sync code
+    uiBits = (uint64_t)(szTx + szRx + 2 * 8 * szExchanges) * 8;
+  } else if (nmt == NMT_ISO14443B) {
+    // Start and stop bit of each byte, SOF and EOF of each frame
+    uiBits = (uint64_t)(szTx + szRx) * 10 + 2 * 22 * szExchanges;
+  } else {
+    // Parity bit of each byte, start and end of each frame
+    uiBits = (uint64_t)(szTx + szRx) * 9 + 2 * 2 * szExchanges;
+  }
+  data->uiRfNs += uiBits * 1000000000ULL / uiRate + 2 * szExchanges * PN53X_SIM_FDT_US * 1000ULL;
+}
+
+// The chip waited for an answer until its retry timeout: 100 us * 2^(n-1)
+static void
+pn53x_sim_rf_timeout(struct pn53x_sim_data *data)
+{
+  if (data->bRf && data->btRetryTimeout)
+    data->uiRfNs += (100000ULL << (data->btRetryTimeout - 1));
+}
+
+static void
+pn53x_sim_append(struct pn53x_sim_data *data, const uint8_t *pbtData, const size_t szData)
+{
+  const size_t szCopied = MIN(szData, sizeof(data->abtResponse) - data->szResponse);
+
+  memcpy(data->abtResponse + data->szResponse, pbtData, szCopied);
+  data->szResponse += szCopied;
+}
+
+static void
+pn53x_sim_append_byte(struct pn53x_sim_data *data, const uint8_t btByte)
+{
+  pn53x_sim_append(data, &btByte, 1);
+}
+
+static void
+pn53x_sim_status(struct pn53x_sim_data *data, const uint8_t btStatus)
+{
+  data->szResponse = 0;
+  pn53x_sim_append_byte(data, btStatus);
+}
+
+// Answer the next part of abtOut, the host asks for the others with MI set
+static void
+pn53x_sim_answer_out(struct pn53x_sim_data *data)
+{
+  const size_t szPart = MIN(data->szOut - data->szOutSent, PN53X_SIM_RESPONSE_MAX_LEN - 1);
+  const bool bMore = data->szOutSent + szPart < data->szOut;
+
+  pn53x_sim_status(data, bMore ? PN53X_STATUS_MI : 0x00);
+  pn53x_sim_append(data, data->abtOut + data->szOutSent, szPart);
+  data->szOutSent += szPart;
+  if (!bMore)
+    data->szOut = data->szOutSent = 0;
+}
+
+// Append data chained by the host, false when it does not fit
+static bool
+pn53x_sim_chain_in(struct pn53x_sim_data *data, const uint8_t *pbtData, const size_t szData)
+{
+  if (data->szIn + szData > sizeof(data->abtIn)) {
+    data->szIn = 0;
+    return false;
+  }
+  memcpy(data->abtIn + data->szIn, pbtData, szData);
+  data->szIn += szData;
+  return true;
+}
+
+static void
+pn53x_sim_crc(const nfc_modulation_type nmt, const uint8_t *pbtData, const size_t szData, uint8_t *pbtCrc)
+{
+  if (nmt != NMT_ISO14443B) {
+    iso14443a_crc((uint8_t *) pbtData, szData, pbtCrc);
+    return;
+  }
+  uint32_t wCrc = 0xffff;
+  for (size_t n = 0; n < szData; n++) {
+    uint8_t bt = pbtData[n] ^ (uint8_t)(wCrc & 0xff);
+    bt ^= bt << 4;
+    wCrc = (wCrc >> 8) ^ ((uint32_t) bt << 8) ^ ((uint32_t) bt << 3) ^ ((uint32_t) bt >> 4);
+  }
+  wCrc = ~wCrc;
+  pbtCrc[0] = (uint8_t)(wCrc & 0xff);
+  pbtCrc[1] = (uint8_t)((wCrc >> 8) & 0xff);
+}
+
+static const nfc_target *
+pn53x_sim_nt(const struct pn53x_sim_target *pst)
+{
+  return pst->emulator->target;
+}
+
+static int
+pn53x_sim_target_io(struct pn53x_sim_target *pst, const uint8_t *pbtIn, const size_t szIn, uint8_t *pbtOut, const size_t szOut)
+{
+  const int res = pst->emulator->state_machine->io(pst->emulator, pbtIn, szIn, pbtOut, szOut);
+  return ((res >= 0) && ((size_t) res > szOut)) ? NFC_EOVFLOW : res;
+}
+
+static void
+pn53x_sim_deactivate(struct pn53x_sim_data *data, struct pn53x_sim_target *pst, const enum pn53x_sim_state state)
+{
+  pst->state = state;
+  pst->bIsoDep = false;
+  if ((data->iPiccSlot >= 0) && (&data->aTargets[data->iPiccSlot] == pst))
+    data->iPiccSlot = -1;
+}
+
+/*
+ * Slot of the target the chip holds as Tg, or minus the status the chip
+ * answers: ETGREL when it holds no such target, ETIMEOUT when the target left
+ * the field or does not listen anymore.
+ */
+static int
+pn53x_sim_tg_slot(const struct pn53x_sim_data *data, const uint8_t btTg)
+{
+  if ((btTg < 1) || (btTg > 2) || (data->aiTg[btTg - 1] == PN53X_SIM_NO_TG))
+    return -ETGREL;
+  const int iSlot = data->aiTg[btTg - 1];
+  if ((iSlot == PN53X_SIM_GONE) || (data->aTargets[iSlot].state != PN53X_SIM_ACTIVE))
+    return -ETIMEOUT;
+  return iSlot;
+}
+
+// Next block of the answer of an ISO14443-4 target, chained past its FSD
+static size_t
+pn53x_sim_picc_next_block(struct pn53x_sim_data *data, struct pn53x_sim_target *pst, uint8_t *pbtBlock)
+{
+  const size_t szInf = MIN(data->szPiccOut - data->szPiccOutSent, pst->szFsd - 3);
+  const bool bMore = data->szPiccOutSent + szInf < data->szPiccOut;
+
+  pbtBlock[0] = ISO14443_4_PCB_I_BLOCK | pst->btPiccBlockNumber | (bMore ? ISO14443_4_PCB_CHAINING : 0);
+  memcpy(pbtBlock + 1, data->abtPiccOut + data->szPiccOutSent, szInf);
+  data->szPiccOutSent += szInf;
+  if (!bMore)
+    data->szPiccOut = data->szPiccOutSent = 0;
+  return 1 + szInf;
+}
+
+/*
+ * ISO14443-4 layer of a target: chain the I-blocks it gets, hand the whole
+ * command to the emulator and chain its answer back, as told by the R-blocks.
+ * Returns the length of the block answered, a negative value when the target
+ * stays mute.
+ */
+static int
+pn53x_sim_picc_block(struct pn53x_sim_data *data, const int iSlot, const uint8_t *pbtBlock, const size_t szBlock, uint8_t *pbtAnswer)
+{
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  size_t szAnswer;
+
+  if (!szBlock || (pbtBlock[0] & ISO14443_4_PCB_CID_NAD))
+    return NFC_ENOTIMPL;
+  const uint8_t btPcb = pbtBlock[0];
+  const uint8_t btBlockNumber = btPcb & ISO14443_4_PCB_BLOCK_NUMBER;
+
+  if (data->iPiccSlot != iSlot) {
+    data->iPiccSlot = iSlot;
+    data->szPiccIn = data->szPiccOut = data->szPiccOutSent = 0;
+  }
+
+  if (ISO14443_4_IS_I_BLOCK(btPcb)) {
+    if (data->szPiccIn + szBlock - 1 > sizeof(data->abtPiccIn)) {
+      data->szPiccIn = 0;
+      return NFC_EOVFLOW;
+    }
+    memcpy(data->abtPiccIn + data->szPiccIn, pbtBlock + 1, szBlock - 1);
+    data->szPiccIn += szBlock - 1;
+    pst->btPiccBlockNumber = btBlockNumber;
+    if (btPcb & ISO14443_4_PCB_CHAINING) {
+      pbtAnswer[0] = ISO14443_4_PCB_R_ACK | btBlockNumber;
+      szAnswer = 1;
+    } else {
+      const int res = pn53x_sim_target_io(pst, data->abtPiccIn, data->szPiccIn, data->abtPiccOut, sizeof(data->abtPiccOut));
+      data->szPiccIn = 0;
+      if (res < 0)
+        return res;
+      data->szPiccOut = (size_t) res;
+      data->szPiccOutSent = 0;
+      szAnswer = pn53x_sim_picc_next_block(data, pst, pbtAnswer);
+    }
+  } else if (ISO14443_4_IS_R_ACK(btPcb) || ISO14443_4_IS_R_NAK(btPcb)) {
+    if ((btBlockNumber == pst->btPiccBlockNumber) && pst->szLastBlock) {
+      // Our last block was lost
+      memcpy(pbtAnswer, pst->abtLastBlock, pst->szLastBlock);
+      szAnswer = pst->szLastBlock;
+    } else if (ISO14443_4_IS_R_NAK(btPcb) || (btBlockNumber == pst->btPiccBlockNumber)) {
+      pbtAnswer[0] = ISO14443_4_PCB_R_ACK | pst->btPiccBlockNumber;
+      szAnswer = 1;
+    } else if (data->szPiccOut) {
+      pst->btPiccBlockNumber = btBlockNumber;
+      szAnswer = pn53x_sim_picc_next_block(data, pst, pbtAnswer);
+    } else {
+      return NFC_ERFTRANS;
+    }
+  } else if ((btPcb & 0xf7) == ISO14443_4_PCB_S_DESELECT) {
+    pbtAnswer[0] = ISO14443_4_PCB_S_DESELECT;
+    pn53x_sim_deactivate(data, pst, PN53X_SIM_HALTED);
+    return 1;
+  } else {
+    return NFC_ENOTIMPL;
+  }
+  memcpy(pst->abtLastBlock, pbtAnswer, szAnswer);
+  pst->szLastBlock = szAnswer;
+  return (int) szAnswer;
+}
+
+/*
+ * A frame sent on air to an active target, CRC excluded. Returns the length
+ * of its answer, a negative value when it stays mute.
+ */
+static int
+pn53x_sim_air(struct pn53x_sim_data *data, const int iSlot, const uint8_t *pbtFrame, const size_t szFrame,
+              uint8_t *pbtAnswer, const size_t szAnswerLen)
+{
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  int res;
+
+  if (pst->bIsoDep)
+    res = pn53x_sim_picc_block(data, iSlot, pbtFrame, szFrame, pbtAnswer);
+  else
+    res = pn53x_sim_target_io(pst, pbtFrame, szFrame, pbtAnswer, szAnswerLen);
+  pn53x_sim_rf(data, pn53x_sim_nt(pst)->nm.nmt, pst->nbr, szFrame + 2, (res >= 0) ? (size_t) res + 2 : 0, 1);
+  if (res < 0)
+    pn53x_sim_rf_timeout(data);
+  return res;
+}
+
+/*
+ * Run an InDataExchange on an ISO14443-4 target as the chip does, chaining
+ * abtIn to the target FSC and its answer to abtOut. Returns 0, or minus the
+ * status of the failure.
+ */
+static int
+pn53x_sim_pcd_exchange(struct pn53x_sim_data *data, const int iSlot)
+{
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  const size_t szInfLen = MIN(iso14443_4_fsc(pn53x_sim_nt(pst)), PN53X_SIM_FSD) - 3;
+  uint8_t abtBlock[PN53X_SIM_FSD];
+  uint8_t abtAnswer[PN53X_SIM_FSD];
+  size_t szSent = 0;
+  int res;
+
+  do {
+    const size_t szInf = MIN(data->szIn - szSent, szInfLen);
+    const bool bMore = szSent + szInf < data->szIn;
+    abtBlock[0] = ISO14443_4_PCB_I_BLOCK | pst->btPcdBlockNumber | (bMore ? ISO14443_4_PCB_CHAINING : 0);
+    memcpy(abtBlock + 1, data->abtIn + szSent, szInf);
+    if ((res = pn53x_sim_air(data, iSlot, abtBlock, 1 + szInf, abtAnswer, sizeof(abtAnswer))) < 1)
+      return -ETIMEOUT;
+    szSent += szInf;
+    if (bMore) {
+      if (!ISO14443_4_IS_R_ACK(abtAnswer[0]) || ((abtAnswer[0] & ISO14443_4_PCB_BLOCK_NUMBER) != pst->btPcdBlockNumber))
+        return -ERFPROTO;
+      pst->btPcdBlockNumber ^= ISO14443_4_PCB_BLOCK_NUMBER;
+    }
+  } while (szSent < data->szIn);
+
+  data->szOut = data->szOutSent = 0;
+  for (;;) {
+    if (!ISO14443_4_IS_I_BLOCK(abtAnswer[0]))
+      return -ERFPROTO;
+    pst->btPcdBlockNumber ^= ISO14443_4_PCB_BLOCK_NUMBER;
+    if (data->szOut + (size_t) res - 1 > sizeof(data->abtOut))
+      return -EBUFOVF;
+    memcpy(data->abtOut + data->szOut, abtAnswer + 1, (size_t) res - 1);
+    data->szOut += (size_t) res - 1;
+    if (!(abtAnswer[0] & ISO14443_4_PCB_CHAINING))
+      return 0;
+    abtBlock[0] = ISO14443_4_PCB_R_ACK | pst->btPcdBlockNumber;
+    if ((res = pn53x_sim_air(data, iSlot, abtBlock, 1, abtAnswer, sizeof(abtAnswer))) < 1)
+      return -ETIMEOUT;
+  }
+}
+
+// UID part of an anticollision cascade level, true for the last level
+static bool
+pn53x_sim_cascade(const nfc_iso14443a_info *pnai, const uint8_t btSel, uint8_t *pbtClUid)
+{
+  const size_t szLevel = (size_t)(btSel - 0x93) / 2;
+  const size_t szLevels = (pnai->szUidLen == 4) ? 1 : ((pnai->szUidLen == 7) ? 2 : 3);
+  const bool bLast = (szLevel + 1 == szLevels);
+
+  if (bLast) {
+    memcpy(pbtClUid, pnai->abtUid + 3 * szLevel, 4);
+  } else {
+    pbtClUid[0] = 0x88;
+    memcpy(pbtClUid + 1, pnai->abtUid + 3 * szLevel, 3);
+  }
+  pbtClUid[4] = pbtClUid[0] ^ pbtClUid[1] ^ pbtClUid[2] ^ pbtClUid[3];
+  return bLast;
+}
+
+static bool
+pn53x_sim_is_sel(const uint8_t btSel)
+{
+  return (btSel == 0x93) || (btSel == 0x95) || (btSel == 0x97);
+}
+
+// ISO14443-4A activation by RATS, the ATS is put in pbtAts
+static size_t
+pn53x_sim_rats(struct pn53x_sim_target *pst, const uint8_t btParam, uint8_t *pbtAts)
+{
+  static const size_t aszFsd[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+  const nfc_iso14443a_info *pnai = &pn53x_sim_nt(pst)->nti.nai;
+  const size_t szAtsLen = MIN(pnai->szAtsLen, sizeof(pnai->abtAts));
+
+  pbtAts[0] = (uint8_t)(szAtsLen + 1);
+  memcpy(pbtAts + 1, pnai->abtAts, szAtsLen);
+  pst->bIsoDep = true;
+  pst->szFsd = aszFsd[MIN(btParam >> 4, 8)];
+  pst->btPiccBlockNumber = ISO14443_4_PCB_BLOCK_NUMBER;
+  pst->btPcdBlockNumber = 0;
+  pst->szLastBlock = 0;
+  return szAtsLen + 1;
+}
+
+/*
+ * Send a raw frame to the field as InCommunicateThru and the CIU Transceive
+ * command do, with or without CRC and last bits as the registers tell.
+ * Returns the length of the answer put in pbtAnswer, a negative value when
+ * none came. pbtAnswer holds at least PN53X_SIM_FSD + 2 bytes.
+ */
+static int
+pn53x_sim_thru(struct pn53x_sim_data *data, const uint8_t *pbtFrame, size_t szFrame, uint8_t *pbtAnswer)
+{
+  const uint8_t btTxBits = data->abtRegisters[PN53X_REG_CIU_BitFraming] & SYMBOL_TX_LAST_BITS;
+  const bool bTxCrc = data->abtRegisters[PN53X_REG_CIU_TxMode] & SYMBOL_TX_CRC_ENABLE;
+  const bool bRxCrc = data->abtRegisters[PN53X_REG_CIU_RxMode] & SYMBOL_RX_CRC_ENABLE;
+  struct pn53x_sim_target *pst;
+  int res;
+
+  data->abtRegisters[PN53X_REG_CIU_Control] &= ~SYMBOL_RX_LAST_BITS;
+  data->bField = true;
+
+  if (btTxBits) {
+    // Only REQA and WUPA are short frames
+    if ((btTxBits == 7) && (szFrame == 1) && ((pbtFrame[0] == 0x26) || (pbtFrame[0] == 0x52))) {
+      for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+        pst = &data->aTargets[iSlot];
+        if (!pst->emulator || (pn53x_sim_nt(pst)->nm.nmt != NMT_ISO14443A))
+          continue;
+        if ((pst->state == PN53X_SIM_ACTIVE) || ((pst->state == PN53X_SIM_HALTED) && (pbtFrame[0] == 0x26)))
+          continue;
+        pn53x_sim_deactivate(data, pst, PN53X_SIM_IDLE);
+        data->iReadySlot = iSlot;
+        // ATQA is sent LSB first
+        pbtAnswer[0] = pn53x_sim_nt(pst)->nti.nai.abtAtqa[1];
+        pbtAnswer[1] = pn53x_sim_nt(pst)->nti.nai.abtAtqa[0];
+        pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 1, 2, 1);
+        return 2;
+      }
+    }
+    pn53x_sim_rf_timeout(data);
+    return NFC_ETIMEOUT;
+  }
+
+  // Anticollision frames have no CRC
+  if ((szFrame == 2) && pn53x_sim_is_sel(pbtFrame[0]) && (pbtFrame[1] == 0x20) && (data->iReadySlot >= 0)) {
+    pst = &data->aTargets[data->iReadySlot];
+    pn53x_sim_cascade(&pn53x_sim_nt(pst)->nti.nai, pbtFrame[0], pbtAnswer);
+    pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 2, 5, 1);
+    return 5;
+  }
+
+  const int iHeld = data->aiTg[0];
+  const nfc_modulation_type nmt = (iHeld >= 0) ? pn53x_sim_nt(&data->aTargets[iHeld])->nm.nmt : NMT_ISO14443A;
+  // FeliCa and DEP frames are given as they are
+  const bool bCrc = (nmt == NMT_ISO14443A) || (nmt == NMT_ISO14443B);
+  if (bCrc && !bTxCrc) {
+    uint8_t abtCrc[2];
+    if (szFrame < 2)
+      return NFC_ETIMEOUT;
+    pn53x_sim_crc(nmt, pbtFrame, szFrame - 2, abtCrc);
+    if (memcmp(abtCrc, pbtFrame + szFrame - 2, 2) != 0) {
+      pn53x_sim_rf_timeout(data);
+      return NFC_ETIMEOUT;
+    }
+    szFrame -= 2;
+  }
+
+  if ((szFrame == 7) && pn53x_sim_is_sel(pbtFrame[0]) && (pbtFrame[1] == 0x70) && (data->iReadySlot >= 0)) {
+    // Select of a cascade level
+    const int iSlot = data->iReadySlot;
+    uint8_t abtClUid[5];
+    pst = &data->aTargets[iSlot];
+    const bool bLast = pn53x_sim_cascade(&pn53x_sim_nt(pst)->nti.nai, pbtFrame[0], abtClUid);
+    if (memcmp(abtClUid, pbtFrame + 2, 5) != 0) {
+      pn53x_sim_rf_timeout(data);
+      return NFC_ETIMEOUT;
+    }
+    pbtAnswer[0] = bLast ? pn53x_sim_nt(pst)->nti.nai.btSak : 0x04;
+    res = 1;
+    if (bLast) {
+      pst->state = PN53X_SIM_ACTIVE;
+      pst->nbr = NBR_106;
+      data->aiTg[0] = iSlot;
+      data->iReadySlot = -1;
+    }
+    pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 9, 3, 1);
+  } else if (iHeld < 0) {
+    pn53x_sim_rf_timeout(data);
+    return NFC_ETIMEOUT;
+  } else {
+    pst = &data->aTargets[iHeld];
+    if (pst->state != PN53X_SIM_ACTIVE) {
+      pn53x_sim_rf_timeout(data);
+      return NFC_ETIMEOUT;
+    }
+    if ((nmt == NMT_ISO14443A) && !pst->bIsoDep && (szFrame == 2) && (pbtFrame[0] == 0x50) && (pbtFrame[1] == 0x00)) {
+      // HLTA is not answered
+      pn53x_sim_deactivate(data, pst, PN53X_SIM_HALTED);
+      pn53x_sim_rf(data, nmt, pst->nbr, 4, 0, 1);
+      pn53x_sim_rf_timeout(data);
+      return NFC_ETIMEOUT;
+    }
+    if ((nmt == NMT_ISO14443A) && !pst->bIsoDep && (szFrame == 2) && (pbtFrame[0] == 0xe0) &&
+        (pn53x_sim_nt(pst)->nti.nai.btSak & SAK_ISO14443_4_COMPLIANT)) {
+      res = (int) pn53x_sim_rats(pst, pbtFrame[1], pbtAnswer);
+      pn53x_sim_rf(data, nmt, pst->nbr, 4, (size_t) res + 2, 1);
+    } else if ((res = pn53x_sim_air(data, iHeld, pbtFrame, szFrame, pbtAnswer, PN53X_SIM_FSD)) < 0) {
+      return NFC_ETIMEOUT;
+    }
+  }
+
+  if (bCrc && !bRxCrc) {
+    pn53x_sim_crc(nmt, pbtAnswer, (size_t) res, pbtAnswer + res);
+    res += 2;
+  }
+  return res;
+}
+
+// CIU Transceive command: the FIFO is sent, the answer comes back in it
+static void
+pn53x_sim_ciu_transceive(struct pn53x_sim_data *data)
+{
+  uint8_t abtFrame[PN53X_SIM_FIFO_LEN];
+  uint8_t abtAnswer[PN53X_SIM_FSD + 2];
+  const size_t szFrame = data->szFifo;
+  uint16_t ui16Counter = 0;
+
+  memcpy(abtFrame, data->abtFifo, szFrame);
+  data->szFifo = 0;
+  const int res = pn53x_sim_thru(data, abtFrame, szFrame, abtAnswer);
+  if (res >= 0) {
+    data->szFifo = MIN((size_t) res, sizeof(data->abtFifo));
+    memcpy(data->abtFifo, abtAnswer, data->szFifo);
+    // The timer runs from the end of the frame sent to the first bits of the answer
+    const uint32_t uiPrescaler = ((data->abtRegisters[PN53X_REG_CIU_TMode] & 0x0f) << 8) | data->abtRegisters[PN53X_REG_CIU_TPrescaler];
+    const uint32_t uiTicks = (PN53X_SIM_FDT_CYCLES + 640) / (2 * uiPrescaler + 1);
+    ui16Counter = (uint16_t)(0xffff - MIN(uiTicks, 0xfffe));
+  }
+  data->abtRegisters[PN53X_REG_CIU_TCounterVal_hi] = ui16Counter >> 8;
+  data->abtRegisters[PN53X_REG_CIU_TCounterVal_lo] = ui16Counter & 0xff;
+}
+
+static void
+pn53x_sim_field_off(struct pn53x_sim_data *data)
+{
+  data->bField = false;
+  for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+    if (data->aTargets[iSlot].emulator)
+      pn53x_sim_deactivate(data, &data->aTargets[iSlot], PN53X_SIM_IDLE);
+  }
+  data->aiTg[0] = data->aiTg[1] = PN53X_SIM_NO_TG;
+  data->iReadySlot = -1;
+  data->szIn = data->szOut = data->szOutSent = 0;
+}
+
+/*
+ * InDeselect and InRelease: the targets stop listening, but FeliCa and DEP
+ * targets which have no halted state. InRelease forgets them too.
+ */
+static void
+pn53x_sim_release(struct pn53x_sim_data *data, const uint8_t btTg, const bool bForget)
+{
+  for (int n = 0; n < 2; n++) {
+    if ((btTg != 0) && (btTg != n + 1))
+      continue;
+    const int iSlot = data->aiTg[n];
+    if ((iSlot >= 0) && (data->aTargets[iSlot].state == PN53X_SIM_ACTIVE)) {
+      const nfc_modulation_type nmt = pn53x_sim_nt(&data->aTargets[iSlot])->nm.nmt;
+      pn53x_sim_deactivate(data, &data->aTargets[iSlot], ((nmt == NMT_FELICA) || (nmt == NMT_DEP)) ? PN53X_SIM_IDLE : PN53X_SIM_HALTED);
+      pn53x_sim_rf(data, nmt, data->aTargets[iSlot].nbr, 3, 3, 1);
+    }
+    if (bForget)
+      data->aiTg[n] = PN53X_SIM_NO_TG;
+  }
+}
+
+// A new polling: the chip forgets its targets, which answer it again
+static void
+pn53x_sim_poll(struct pn53x_sim_data *data)
+{
+  data->bField = true;
+  for (int n = 0; n < 2; n++) {
+    const int iSlot = data->aiTg[n];
+    if ((iSlot >= 0) && (data->aTargets[iSlot].state == PN53X_SIM_ACTIVE))
+      pn53x_sim_deactivate(data, &data->aTargets[iSlot], PN53X_SIM_IDLE);
+    data->aiTg[n] = PN53X_SIM_NO_TG;
+  }
+  data->iReadySlot = -1;
+  data->szIn = data->szOut = data->szOutSent = 0;
+}
+
+// Does an idle target answer the polling of InListPassiveTarget?
+static bool
+pn53x_sim_match(const struct pn53x_sim_target *pst, const nfc_modulation_type nmt, const nfc_baud_rate nbr,
+                const uint8_t *pbtInit, const size_t szInit)
+{
+  if (!pst->emulator || (pst->state != PN53X_SIM_IDLE))
+    return false;
+  const nfc_target *pnt = pn53x_sim_nt(pst);
+  if (pnt->nm.nmt != nmt)
+    return false;
+  switch (nmt) {
+    case NMT_ISO14443A: {
+      // The UID asked for comes with its cascade tags
+      uint8_t abtCascadedUid[12];
+      size_t szCascadedUid;
+      iso14443_cascade_uid(pnt->nti.nai.abtUid, pnt->nti.nai.szUidLen, abtCascadedUid, &szCascadedUid);
+      return !szInit || ((szInit == szCascadedUid) && (memcmp(pbtInit, abtCascadedUid, szInit) == 0));
+    }
+    case NMT_FELICA:
+      if ((pnt->nm.nbr != NBR_UNDEFINED) && (pnt->nm.nbr != nbr))
+        return false;
+      // System code, 0xff matches any byte
+      return (szInit < 3) ||
+             (((pbtInit[1] == 0xff) || (pbtInit[1] == pnt->nti.nfi.abtSysCode[0])) &&
+              ((pbtInit[2] == 0xff) || (pbtInit[2] == pnt->nti.nfi.abtSysCode[1])));
+    case NMT_ISO14443B:
+      // Application family identifier, 0x00 matches any family
+      return !szInit || !pbtInit[0] || (pbtInit[0] == pnt->nti.nbi.abtApplicationData[0]);
+    default:
+      return false;
+  }
+}
+
+/*
+ * Activate a target polled by InListPassiveTarget or InAutoPoll and put the
+ * data the chip reports about it, Tg first, in pbtData.
+ */
+static size_t
+pn53x_sim_activate(struct pn53x_sim_data *data, const int iSlot, const uint8_t btTg, const nfc_baud_rate nbr,
+                   const bool bSysCode, uint8_t *pbtData)
+{
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  const nfc_target *pnt = pn53x_sim_nt(pst);
+  size_t szData = 0;
+
+  pst->state = PN53X_SIM_ACTIVE;
+  pst->bIsoDep = false;
+  pst->nbr = nbr;
+  data->aiTg[btTg - 1] = iSlot;
+  pbtData[szData++] = btTg;
+  switch (pnt->nm.nmt) {
+    case NMT_ISO14443A: {
+      const nfc_iso14443a_info *pnai = &pnt->nti.nai;
+      const size_t szLevels = (pnai->szUidLen == 4) ? 1 : ((pnai->szUidLen == 7) ? 2 : 3);
+      pbtData[szData++] = pnai->abtAtqa[0];
+      pbtData[szData++] = pnai->abtAtqa[1];
+      pbtData[szData++] = pnai->btSak;
+      pbtData[szData++] = (uint8_t) pnai->szUidLen;
+      memcpy(pbtData + szData, pnai->abtUid, pnai->szUidLen);
+      szData += pnai->szUidLen;
+      // REQA, then anticollision and select of each cascade level
+      pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 1 + 11 * szLevels, 2 + 8 * szLevels, 1 + 2 * szLevels);
+      if ((pnai->btSak & SAK_ISO14443_4_COMPLIANT) && (data->btParameters & PARAM_AUTO_RATS)) {
+        const size_t szAts = pn53x_sim_rats(pst, 0x80, pbtData + szData);
+        pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 4, szAts + 2, 1);
+        szData += szAts;
+      }
+    }
+    break;
+    case NMT_FELICA: {
+      const nfc_felica_info *pnfi = &pnt->nti.nfi;
+      pbtData[szData++] = bSysCode ? 0x14 : 0x12;
+      pbtData[szData++] = 0x01;
+      memcpy(pbtData + szData, pnfi->abtId, 8);
+      szData += 8;
+      memcpy(pbtData + szData, pnfi->abtPad, 8);
+      szData += 8;
+      if (bSysCode) {
+        memcpy(pbtData + szData, pnfi->abtSysCode, 2);
+        szData += 2;
+      }
+      pn53x_sim_rf(data, NMT_FELICA, nbr, 6, szData - 2, 1);
+    }
+    break;
+    case NMT_ISO14443B: {
+      const nfc_iso14443b_info *pnbi = &pnt->nti.nbi;
+      pbtData[szData++] = 0x50;
+      memcpy(pbtData + szData, pnbi->abtPupi, 4);
+      szData += 4;
+      memcpy(pbtData + szData, pnbi->abtApplicationData, 4);
+      szData += 4;
+      memcpy(pbtData + szData, pnbi->abtProtocolInfo, 3);
+      szData += 3;
+      // ATTRIB_RES
+      pbtData[szData++] = 1;
+      pbtData[szData++] = pnbi->ui8CardIdentifier;
+      // REQB/ATQB, then ATTRIB
+      pn53x_sim_rf(data, NMT_ISO14443B, NBR_106, 3 + 9, 12 + 1, 2);
+      pst->bIsoDep = true;
+      pst->szFsd = PN53X_SIM_FSD;
+      pst->btPiccBlockNumber = ISO14443_4_PCB_BLOCK_NUMBER;
+      pst->btPcdBlockNumber = 0;
+      pst->szLastBlock = 0;
+    }
+    break;
+    default:
+      break;
+  }
+  return szData;
+}
+
+// Modulation polled by an InListPassiveTarget BrTy
+static bool
+pn53x_sim_brty(const uint8_t btBrTy, nfc_modulation_type *pnmt, nfc_baud_rate *pnbr)
+{
+  switch (btBrTy) {
+    case PM_ISO14443A_106:
+      *pnmt = NMT_ISO14443A;
+      *pnbr = NBR_106;
+      return true;
+    case PM_FELICA_212:
+      *pnmt = NMT_FELICA;
+      *pnbr = NBR_212;
+      return true;
+    case PM_FELICA_424:
+      *pnmt = NMT_FELICA;
+      *pnbr = NBR_424;
+      return true;
+    case PM_ISO14443B_106:
+      *pnmt = NMT_ISO14443B;
+      *pnbr = NBR_106;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void
+pn53x_sim_diagnose(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (szCmd < 2) {
+    data->bErrorFrame = true;
+    return;
+  }
+  switch (pbtCmd[1]) {
+    case 0x00: // Communication line test
+      pn53x_sim_append(data, pbtCmd + 1, szCmd - 1);
+      break;
+    case 0x06: { // Card presence detection
+      const int iSlot = pn53x_sim_tg_slot(data, 1);
+      if (iSlot >= 0)
+        pn53x_sim_rf(data, pn53x_sim_nt(&data->aTargets[iSlot])->nm.nmt, data->aTargets[iSlot].nbr, 4, 4, 1);
+      else
+        pn53x_sim_rf_timeout(data);
+      pn53x_sim_status(data, (iSlot >= 0) ? 0x00 : ETIMEOUT);
+    }
+    break;
+    default:
+      pn53x_sim_status(data, 0x00);
+      break;
+  }
+}
+
+static void
+pn53x_sim_get_general_status(struct pn53x_sim_data *data)
+{
+  uint8_t btNbTg = 0;
+
+  pn53x_sim_append_byte(data, 0x00);
+  pn53x_sim_append_byte(data, data->bField ? 0x01 : 0x00);
+  for (int n = 0; n < 2; n++)
+    btNbTg += (pn53x_sim_tg_slot(data, (uint8_t)(n + 1)) >= 0);
+  pn53x_sim_append_byte(data, btNbTg);
+  for (int n = 0; n < 2; n++) {
+    const int iSlot = pn53x_sim_tg_slot(data, (uint8_t)(n + 1));
+    if (iSlot < 0)
+      continue;
+    const struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+    const uint8_t btBr = (uint8_t)(pst->nbr - NBR_106);
+    pn53x_sim_append_byte(data, (uint8_t)(n + 1));
+    pn53x_sim_append_byte(data, btBr);
+    pn53x_sim_append_byte(data, btBr);
+    pn53x_sim_append_byte(data, (pn53x_sim_nt(pst)->nm.nmt == NMT_FELICA) ? 0x10 : 0x00);
+  }
+  // SAM status
+  pn53x_sim_append_byte(data, 0x00);
+}
+
+static void
+pn53x_sim_read_register(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if ((szCmd - 1) % 2) {
+    data->bErrorFrame = true;
+    return;
+  }
+  for (size_t n = 1; n < szCmd; n += 2) {
+    const uint16_t ui16Address = (pbtCmd[n] << 8) | pbtCmd[n + 1];
+    switch (ui16Address) {
+      case PN53X_REG_CIU_FIFOData:
+        if (data->szFifo) {
+          pn53x_sim_append_byte(data, data->abtFifo[0]);
+          memmove(data->abtFifo, data->abtFifo + 1, --data->szFifo);
+        } else {
+          pn53x_sim_append_byte(data, 0x00);
+        }
+        break;
+      case PN53X_REG_CIU_FIFOLevel:
+        pn53x_sim_append_byte(data, (uint8_t) data->szFifo);
+        break;
+      default:
+        pn53x_sim_append_byte(data, data->abtRegisters[ui16Address]);
+        break;
+    }
+  }
+}
+
+static void
+pn53x_sim_write_register(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if ((szCmd - 1) % 3) {
+    data->bErrorFrame = true;
+    return;
+  }
+  for (size_t n = 1; n < szCmd; n += 3) {
+    const uint16_t ui16Address = (pbtCmd[n] << 8) | pbtCmd[n + 1];
+    const uint8_t btValue = pbtCmd[n + 2];
+    switch (ui16Address) {
+      case PN53X_REG_CIU_FIFOData:
+        if (data->szFifo < sizeof(data->abtFifo))
+          data->abtFifo[data->szFifo++] = btValue;
+        break;
+      case PN53X_REG_CIU_FIFOLevel:
+        if (btValue & SYMBOL_FLUSH_BUFFER)
+          data->szFifo = 0;
+        break;
+      case PN53X_REG_CIU_BitFraming:
+        data->abtRegisters[ui16Address] = btValue & ~SYMBOL_START_SEND;
+        if ((btValue & SYMBOL_START_SEND) &&
+            ((data->abtRegisters[PN53X_REG_CIU_Command] & SYMBOL_COMMAND) == SYMBOL_COMMAND_TRANSCEIVE))
+          pn53x_sim_ciu_transceive(data);
+        break;
+      default:
+        data->abtRegisters[ui16Address] = btValue;
+        break;
+    }
+  }
+}
+
+static void
+pn53x_sim_rf_configuration(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (szCmd < 3) {
+    data->bErrorFrame = true;
+    return;
+  }
+  switch (pbtCmd[1]) {
+    case RFCI_FIELD:
+      if (pbtCmd[2] & 0x01)
+        data->bField = true;
+      else
+        pn53x_sim_field_off(data);
+      break;
+    case RFCI_TIMING:
+      if (szCmd >= 5)
+        data->btRetryTimeout = pbtCmd[4];
+      break;
+    case RFCI_RETRY_SELECT:
+      if (szCmd >= 5)
+        data->btMxRtyPassiveActivation = pbtCmd[4];
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+pn53x_sim_in_list_passive_target(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  nfc_modulation_type nmt;
+  nfc_baud_rate nbr;
+
+  if ((szCmd < 3) || (pbtCmd[1] < 1) || (pbtCmd[1] > 2) || !pn53x_sim_brty(pbtCmd[2], &nmt, &nbr)) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const uint8_t btMaxTg = pbtCmd[1];
+  const uint8_t *pbtInit = pbtCmd + 3;
+  const size_t szInit = szCmd - 3;
+  uint8_t btNbTg = 0;
+
+  pn53x_sim_poll(data);
+
+  pn53x_sim_append_byte(data, 0);
+  for (int iSlot = 0; (iSlot < PN53X_SIM_TARGETS_MAX) && (btNbTg < btMaxTg); iSlot++) {
+    if (!pn53x_sim_match(&data->aTargets[iSlot], nmt, nbr, pbtInit, szInit))
+      continue;
+    uint8_t abtTargetData[64];
+    const bool bSysCode = (nmt == NMT_FELICA) && (szInit >= 4) && (pbtInit[3] == 0x01);
+    const size_t szTargetData = pn53x_sim_activate(data, iSlot, (uint8_t)(btNbTg + 1), nbr, bSysCode, abtTargetData);
+    pn53x_sim_append(data, abtTargetData, szTargetData);
+    btNbTg++;
+  }
+  if (!btNbTg) {
+    if (data->btMxRtyPassiveActivation == 0xff) {
+      // Retries forever, until a target comes
+      data->bAnswered = false;
+      return;
+    }
+    pn53x_sim_rf_timeout(data);
+  }
+  data->abtResponse[0] = btNbTg;
+}
+
+static void
+pn53x_sim_in_data_exchange(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (szCmd < 2) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const bool bMore = pbtCmd[1] & PN53X_STATUS_MI;
+  const int iSlot = pn53x_sim_tg_slot(data, pbtCmd[1] & PN53X_STATUS_ERROR);
+
+  if ((szCmd == 2) && !bMore && data->szOut) {
+    // The host asks for the next part of the answer
+    pn53x_sim_answer_out(data);
+    return;
+  }
+  if (iSlot < 0) {
+    data->szIn = 0;
+    pn53x_sim_status(data, (uint8_t)(-iSlot));
+    return;
+  }
+  if (!pn53x_sim_chain_in(data, pbtCmd + 2, szCmd - 2)) {
+    pn53x_sim_status(data, EINBUFOVF);
+    return;
+  }
+  if (bMore) {
+    pn53x_sim_status(data, 0x00);
+    return;
+  }
+
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  const nfc_modulation_type nmt = pn53x_sim_nt(pst)->nm.nmt;
+  if (pst->bIsoDep) {
+    const int res = pn53x_sim_pcd_exchange(data, iSlot);
+    data->szIn = 0;
+    if (res < 0) {
+      data->szOut = 0;
+      pn53x_sim_status(data, (uint8_t)(-res));
+      return;
+    }
+  } else {
+    const int res = pn53x_sim_target_io(pst, data->abtIn, data->szIn, data->abtOut, sizeof(data->abtOut));
+    // DEP frames are chained by the chip, others are a single exchange
+    const size_t szExchanges = (nmt == NMT_DEP) ?
+                               (data->szIn + PN53X_SIM_DEP_PAYLOAD_LEN - 1) / PN53X_SIM_DEP_PAYLOAD_LEN +
+                               ((res > 0) ? ((size_t) res + PN53X_SIM_DEP_PAYLOAD_LEN - 1) / PN53X_SIM_DEP_PAYLOAD_LEN : 0) : 1;
+    const size_t szOverhead = (nmt == NMT_DEP) ? 4 : 2;
+    pn53x_sim_rf(data, nmt, pst->nbr, data->szIn + szOverhead * szExchanges, (res >= 0) ? (size_t) res + szOverhead * szExchanges : 0,
+                 MAX(szExchanges, 1));
+    data->szIn = 0;
+    if (res == NFC_EMFCAUTHFAIL) {
+      // The tag stops listening until woken up again
+      pn53x_sim_deactivate(data, pst, PN53X_SIM_IDLE);
+      pn53x_sim_status(data, EMFAUTH);
+      return;
+    }
+    if (res < 0) {
+      pn53x_sim_rf_timeout(data);
+      pn53x_sim_status(data, ETIMEOUT);
+      return;
+    }
+    data->szOut = (size_t) res;
+  }
+  data->szOutSent = 0;
+  pn53x_sim_answer_out(data);
+}
+
+static void
+pn53x_sim_in_communicate_thru(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  uint8_t abtAnswer[PN53X_SIM_FSD + 2];
+
+  const int res = pn53x_sim_thru(data, pbtCmd + 1, szCmd - 1, abtAnswer);
+  if (res < 0) {
+    pn53x_sim_status(data, ETIMEOUT);
+    return;
+  }
+  pn53x_sim_status(data, 0x00);
+  pn53x_sim_append(data, abtAnswer, (size_t) res);
+}
+
+static void
+pn53x_sim_in_select(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if ((szCmd < 2) || (pbtCmd[1] < 1) || (pbtCmd[1] > 2)) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const int iSlot = data->aiTg[pbtCmd[1] - 1];
+  if (iSlot < 0) {
+    pn53x_sim_status(data, (iSlot == PN53X_SIM_GONE) ? ETIMEOUT : ETGREL);
+    return;
+  }
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  if (pst->state != PN53X_SIM_ACTIVE) {
+    // WUPA and select, or polling again
+    const nfc_modulation_type nmt = pn53x_sim_nt(pst)->nm.nmt;
+    pst->state = PN53X_SIM_ACTIVE;
+    pn53x_sim_rf(data, nmt, pst->nbr, 12, 10, 3);
+    if (nmt == NMT_ISO14443B) {
+      pst->bIsoDep = true;
+      pst->btPiccBlockNumber = ISO14443_4_PCB_BLOCK_NUMBER;
+      pst->btPcdBlockNumber = 0;
+      pst->szLastBlock = 0;
+    }
+  }
+  pn53x_sim_status(data, 0x00);
+}
+
+static void
+pn53x_sim_in_psl(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if ((szCmd < 4) || (pbtCmd[2] > 2) || (pbtCmd[3] > 2)) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const int iSlot = pn53x_sim_tg_slot(data, pbtCmd[1]);
+  if (iSlot < 0) {
+    pn53x_sim_status(data, (uint8_t)(-iSlot));
+    return;
+  }
+  struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+  pn53x_sim_rf(data, pn53x_sim_nt(pst)->nm.nmt, pst->nbr, 5, 3, 1);
+  pst->nbr = (nfc_baud_rate)(NBR_106 + pbtCmd[2]);
+  data->abtRegisters[PN53X_REG_CIU_TxMode] = (data->abtRegisters[PN53X_REG_CIU_TxMode] & ~SYMBOL_TX_SPEED) | (pbtCmd[2] << 4);
+  data->abtRegisters[PN53X_REG_CIU_RxMode] = (data->abtRegisters[PN53X_REG_CIU_RxMode] & ~SYMBOL_RX_SPEED) | (pbtCmd[3] << 4);
+  pn53x_sim_status(data, 0x00);
+}
+
+static void
+pn53x_sim_in_jump_for_dep(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if ((szCmd < 4) || (pbtCmd[1] > 1) || (pbtCmd[2] > 2)) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const nfc_dep_mode ndm = pbtCmd[1] ? NDM_ACTIVE : NDM_PASSIVE;
+  const nfc_baud_rate nbr = (nfc_baud_rate)(NBR_106 + pbtCmd[2]);
+  size_t szGi = szCmd - 4;
+  if (pbtCmd[3] & 0x01)
+    szGi -= MIN(szGi, (nbr == NBR_106) ? 4 : 5);
+  if (pbtCmd[3] & 0x02)
+    szGi -= MIN(szGi, 10);
+  if (!(pbtCmd[3] & 0x04))
+    szGi = 0;
+
+  pn53x_sim_poll(data);
+  for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+    struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+    if (!pst->emulator || (pst->state != PN53X_SIM_IDLE))
+      continue;
+    const nfc_target *pnt = pn53x_sim_nt(pst);
+    if ((pnt->nm.nmt != NMT_DEP) || ((pnt->nm.nbr != NBR_UNDEFINED) && (pnt->nm.nbr != nbr)) ||
+        ((pnt->nti.ndi.ndm != NDM_UNDEFINED) && (pnt->nti.ndi.ndm != ndm)))
+      continue;
+    const nfc_dep_info *pndi = &pnt->nti.ndi;
+    const size_t szGt = MIN(pndi->szGB, sizeof(pndi->abtGB));
+    pst->state = PN53X_SIM_ACTIVE;
+    pst->nbr = nbr;
+    data->aiTg[0] = iSlot;
+    pn53x_sim_status(data, 0x00);
+    pn53x_sim_append_byte(data, 1);
+    pn53x_sim_append(data, pndi->abtNFCID3, 10);
+    pn53x_sim_append_byte(data, pndi->btDID);
+    pn53x_sim_append_byte(data, pndi->btBS);
+    pn53x_sim_append_byte(data, pndi->btBR);
+    pn53x_sim_append_byte(data, pndi->btTO);
+    pn53x_sim_append_byte(data, pndi->btPP);
+    pn53x_sim_append(data, pndi->abtGB, szGt);
+    // ATR_REQ and ATR_RES, after the passive activation
+    pn53x_sim_rf(data, NMT_DEP, nbr, 17 + szGi, 18 + szGt, 1);
+    if (ndm == NDM_PASSIVE)
+      pn53x_sim_rf(data, (nbr == NBR_106) ? NMT_ISO14443A : NMT_FELICA, nbr, 12, 18, 3);
+    return;
+  }
+  if ((ndm == NDM_PASSIVE) && (data->btMxRtyPassiveActivation == 0xff)) {
+    data->bAnswered = false;
+    return;
+  }
+  pn53x_sim_rf_timeout(data);
+  pn53x_sim_status(data, ETIMEOUT);
+}
+
+// Polling of InAutoPoll, as InListPassiveTarget would do it for a target type
+static bool
+pn53x_sim_ptt(const uint8_t btType, nfc_modulation_type *pnmt, nfc_baud_rate *pnbr, bool *pbIsoDepOnly)
+{
+  *pbIsoDepOnly = false;
+  switch (btType) {
+    case PTT_GENERIC_PASSIVE_106:
+    case PTT_MIFARE:
+      *pnmt = NMT_ISO14443A;
+      *pnbr = NBR_106;
+      return true;
+    case PTT_ISO14443_4A_106:
+      *pnmt = NMT_ISO14443A;
+      *pnbr = NBR_106;
+      *pbIsoDepOnly = true;
+      return true;
+    case PTT_GENERIC_PASSIVE_212:
+    case PTT_FELICA_212:
+      *pnmt = NMT_FELICA;
+      *pnbr = NBR_212;
+      return true;
+    case PTT_GENERIC_PASSIVE_424:
+    case PTT_FELICA_424:
+      *pnmt = NMT_FELICA;
+      *pnbr = NBR_424;
+      return true;
+    case PTT_ISO14443_4B_106:
+    case PTT_ISO14443_4B_TCL_106:
+      *pnmt = NMT_ISO14443B;
+      *pnbr = NBR_106;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void
+pn53x_sim_in_auto_poll(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (szCmd < 4) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const uint8_t btPollNr = pbtCmd[1];
+  const uint8_t btPeriod = pbtCmd[2];
+
+  pn53x_sim_poll(data);
+  for (size_t n = 3; n < szCmd; n++) {
+    nfc_modulation_type nmt;
+    nfc_baud_rate nbr;
+    bool bIsoDepOnly;
+    if (!pn53x_sim_ptt(pbtCmd[n], &nmt, &nbr, &bIsoDepOnly))
+      continue;
+    for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+      if (!pn53x_sim_match(&data->aTargets[iSlot], nmt, nbr, NULL, 0) ||
+          (bIsoDepOnly && !(pn53x_sim_nt(&data->aTargets[iSlot])->nti.nai.btSak & SAK_ISO14443_4_COMPLIANT)))
+        continue;
+      uint8_t abtTargetData[64];
+      const size_t szTargetData = pn53x_sim_activate(data, iSlot, 1, nbr, false, abtTargetData);
+      pn53x_sim_append_byte(data, 1);
+      pn53x_sim_append_byte(data, pbtCmd[n]);
+      pn53x_sim_append_byte(data, (uint8_t) szTargetData);
+      pn53x_sim_append(data, abtTargetData, szTargetData);
+      return;
+    }
+  }
+  if (btPollNr == 0xff) {
+    data->bAnswered = false;
+    return;
+  }
+  // Each polling lasts Period x 150 ms
+  if (data->bRf)
+    data->uiRfNs += (uint64_t) btPollNr * btPeriod * 150000000ULL;
+  pn53x_sim_append_byte(data, 0);
+}
+
+static void
+pn53x_sim_tg_init_as_target(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (szCmd < 37) {
+    data->bErrorFrame = true;
+    return;
+  }
+  const uint8_t btMode = pbtCmd[1];
+  struct nfc_emulator *initiator = data->initiator;
+
+  // The chip waits for an external field
+  data->bAnswered = false;
+  if (!initiator)
+    return;
+  const nfc_target *pnt = initiator->target;
+  const nfc_baud_rate nbr = (pnt->nm.nbr == NBR_UNDEFINED) ? ((pnt->nm.nmt == NMT_FELICA) ? NBR_212 : NBR_106) : pnt->nm.nbr;
+  const uint8_t btBr = (uint8_t)((nbr - NBR_106) << 4);
+  uint8_t btActivatedMode;
+  int res = 0;
+
+  switch (pnt->nm.nmt) {
+    case NMT_DEP:
+      if ((btMode & PTM_PASSIVE_ONLY) && (pnt->nti.ndi.ndm == NDM_ACTIVE))
+        return;
+      btActivatedMode = btBr | 0x04 | ((pnt->nti.ndi.ndm == NDM_ACTIVE) ? 0x01 : 0x00);
+      break;
+    case NMT_ISO14443A:
+      if (btMode & PTM_DEP_ONLY)
+        return;
+      btActivatedMode = btBr | ((btMode & PTM_ISO14443_4_PICC_ONLY) ? 0x08 : 0x00);
+      break;
+    case NMT_FELICA:
+      if (btMode & PTM_DEP_ONLY)
+        return;
+      btActivatedMode = btBr | 0x02;
+      break;
+    default:
+      return;
+  }
+
+  data->szIn = data->szOut = data->szOutSent = 0;
+  pn53x_sim_append_byte(data, btActivatedMode);
+  if (pnt->nm.nmt == NMT_DEP) {
+    // The ATR_REQ of the initiator
+    const nfc_dep_info *pndi = &pnt->nti.ndi;
+    const size_t szGi = MIN(pndi->szGB, sizeof(pndi->abtGB));
+    pn53x_sim_append_byte(data, 0xd4);
+    pn53x_sim_append_byte(data, 0x00);
+    pn53x_sim_append(data, pndi->abtNFCID3, 10);
+    pn53x_sim_append_byte(data, pndi->btDID);
+    pn53x_sim_append_byte(data, pndi->btBS);
+    pn53x_sim_append_byte(data, pndi->btBR);
+    pn53x_sim_append_byte(data, (uint8_t)(pndi->btPP | (szGi ? 0x02 : 0x00)));
+    pn53x_sim_append(data, pndi->abtGB, szGi);
+    pn53x_sim_rf(data, NMT_DEP, nbr, 17 + szGi, 18, 1);
+  } else if (btMode & PTM_ISO14443_4_PICC_ONLY) {
+    // RATS, answered by the chip
+    const uint8_t abtRats[] = { 0xe0, 0x80 };
+    pn53x_sim_append(data, abtRats, sizeof(abtRats));
+    pn53x_sim_rf(data, NMT_ISO14443A, NBR_106, 1 + 11 + 4, 2 + 8 + 7, 3);
+  } else {
+    // First command of the initiator
+    if ((res = initiator->state_machine->io(initiator, NULL, 0, data->abtOut, sizeof(data->abtOut))) < 0) {
+      data->szResponse = 0;
+      return;
+    }
+    pn53x_sim_append(data, data->abtOut, MIN((size_t) res, sizeof(data->abtResponse) - 1));
+    pn53x_sim_rf(data, pnt->nm.nmt, nbr, 12 + (size_t) res, 10, 3);
+  }
+  data->bAnswered = true;
+  data->bInitiatorActive = true;
+  data->btTargetMode = btActivatedMode;
+}
+
+static void
+pn53x_sim_tg_get_data(struct pn53x_sim_data *data, const size_t szCmd)
+{
+  if ((szCmd == 1) && data->szOut) {
+    pn53x_sim_answer_out(data);
+    return;
+  }
+  if (!data->bInitiatorActive) {
+    pn53x_sim_status(data, ETGREL);
+    return;
+  }
+  struct nfc_emulator *initiator = data->initiator;
+  const nfc_target *pnt = initiator->target;
+  const int res = initiator->state_machine->io(initiator, data->abtIn, data->szIn, data->abtOut, sizeof(data->abtOut));
+  pn53x_sim_rf(data, pnt->nm.nmt, (nfc_baud_rate)(NBR_106 + ((data->btTargetMode >> 4) & 0x07)), data->szIn + 2,
+               (res >= 0) ? (size_t) res + 2 : 0, 1);
+  data->szIn = 0;
+  if ((res < 0) || ((size_t) res > sizeof(data->abtOut))) {
+    // The initiator released the chip
+    data->bInitiatorActive = false;
+    pn53x_sim_status(data, ETGREL);
+    return;
+  }
+  data->szOut = (size_t) res;
+  data->szOutSent = 0;
+  pn53x_sim_answer_out(data);
+}
+
+static void
+pn53x_sim_tg_set_data(struct pn53x_sim_data *data, const uint8_t *pbtCmd, const size_t szCmd)
+{
+  if (!data->bInitiatorActive) {
+    pn53x_sim_status(data, ETGREL);
+    return;
+  }
+  pn53x_sim_status(data, pn53x_sim_chain_in(data, pbtCmd + 1, szCmd - 1) ? 0x00 : EINBUFOVF);
+}
+
+// Run the command received, lock held
+static void
+pn53x_sim_process(struct pn53x_sim_data *data)
+{
+  const uint8_t *pbtCmd = data->abtCommand;
+  const size_t szCmd = data->szCommand;
+
+  data->bAnswered = true;
+  data->bErrorFrame = false;
+  data->szResponse = 0;
+  data->uiRfNs = 0;
+  data->uiCommandFieldChanges = data->uiFieldChanges;
+
+  switch (pbtCmd[0]) {
+    case Diagnose:
+      pn53x_sim_diagnose(data, pbtCmd, szCmd);
+      break;
+    case GetFirmwareVersion: {
+      const uint8_t abtFirmware[] = { 0x32, 0x01, 0x06, SUPPORT_ISO14443A | SUPPORT_ISO14443B | SUPPORT_ISO18092 };
+      pn53x_sim_append(data, abtFirmware, sizeof(abtFirmware));
+    }
+    break;
+    case GetGeneralStatus:
+      pn53x_sim_get_general_status(data);
+      break;
+    case ReadRegister:
+      pn53x_sim_read_register(data, pbtCmd, szCmd);
+      break;
+    case WriteRegister:
+      pn53x_sim_write_register(data, pbtCmd, szCmd);
+      break;
+    case SetParameters:
+      if (szCmd < 2)
+        data->bErrorFrame = true;
+      else
+        data->btParameters = pbtCmd[1];
+      break;
+    case SetSerialBaudRate:
+    case SAMConfiguration:
+      break;
+    case PowerDown:
+      pn53x_sim_status(data, 0x00);
+      break;
+    case RFConfiguration:
+      pn53x_sim_rf_configuration(data, pbtCmd, szCmd);
+      break;
+    case InListPassiveTarget:
+      pn53x_sim_in_list_passive_target(data, pbtCmd, szCmd);
+      break;
+    case InDataExchange:
+      pn53x_sim_in_data_exchange(data, pbtCmd, szCmd);
+      break;
+    case InCommunicateThru:
+      pn53x_sim_in_communicate_thru(data, pbtCmd, szCmd);
+      break;
+    case InDeselect:
+    case InRelease:
+      if (szCmd < 2) {
+        data->bErrorFrame = true;
+        break;
+      }
+      pn53x_sim_release(data, pbtCmd[1], pbtCmd[0] == InRelease);
+      if ((pbtCmd[0] == InRelease) && data->bInitiatorActive) {
+        // Ends the target mode too
+        data->bInitiatorActive = false;
+        data->btTargetMode = 0;
+      }
+      pn53x_sim_status(data, 0x00);
+      break;
+    case InSelect:
+      pn53x_sim_in_select(data, pbtCmd, szCmd);
+      break;
+    case InPSL:
+      pn53x_sim_in_psl(data, pbtCmd, szCmd);
+      break;
+    case InJumpForDEP:
+      pn53x_sim_in_jump_for_dep(data, pbtCmd, szCmd);
+      break;
+    case InAutoPoll:
+      pn53x_sim_in_auto_poll(data, pbtCmd, szCmd);
+      break;
+    case TgInitAsTarget:
+      pn53x_sim_tg_init_as_target(data, pbtCmd, szCmd);
+      break;
+    case TgGetData:
+    case TgGetInitiatorCommand:
+      pn53x_sim_tg_get_data(data, szCmd);
+      break;
+    case TgSetData:
+    case TgSetMetaData:
+    case TgResponseToInitiator:
+      pn53x_sim_tg_set_data(data, pbtCmd, szCmd);
+      break;
+    case TgSetGeneralBytes:
+      pn53x_sim_status(data, 0x00);
+      break;
+    case TgGetTargetStatus: {
+      const uint8_t btBr = (data->btTargetMode >> 4) & 0x07;
+      pn53x_sim_append_byte(data, data->bInitiatorActive ? 0x01 : 0x00);
+      pn53x_sim_append_byte(data, (uint8_t)((btBr << 4) | btBr));
+    }
+    break;
+    default:
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Command not simulated: %02x", pbtCmd[0]);
+      data->bErrorFrame = true;
+      break;
+  }
+}
+
+/*
+ * When the response is read: after the command frame and the ACK on the
+ * wire, the chip processing and the RF exchanges, then the response frame on
+ * the wire.
+ */
+static void
+pn53x_sim_set_deadline(struct pn53x_sim_data *data, const uint64_t uiStart, const size_t szCommandFrame)
+{
+  uint64_t uiNs = data->uiRfNs;
+
+  if (data->uiWireSpeed) {
+    const size_t szResponseFrame = data->bErrorFrame ? sizeof(pn53x_sim_error_frame) :
+                                   data->szResponse + 1 + ((data->szResponse + 2 > 0xff) ? PN53x_EXTENDED_FRAME__OVERHEAD : PN53x_NORMAL_FRAME__OVERHEAD);
+    uiNs += pn53x_sim_wire_ns(data, szCommandFrame + sizeof(pn53x_ack_frame) + szResponseFrame) + PN53X_SIM_CHIP_US * 1000ULL;
+  }
+  data->uiReadyAt = uiStart + uiNs;
+}
+
+// Frame of the response, as the chip sends it
+static size_t
+pn53x_sim_frame(const struct pn53x_sim_data *data, uint8_t *pbtFrame)
+{
+  const size_t szLen = data->szResponse + 2;
+  const uint8_t btCommand = data->abtCommand[0] + 1;
+  size_t szFrame = 0;
+
+  if (data->bErrorFrame) {
+    memcpy(pbtFrame, pn53x_sim_error_frame, sizeof(pn53x_sim_error_frame));
+    return sizeof(pn53x_sim_error_frame);
+  }
+  pbtFrame[szFrame++] = 0x00;
+  pbtFrame[szFrame++] = 0x00;
+  pbtFrame[szFrame++] = 0xff;
+  if (szLen > 0xff) {
+    pbtFrame[szFrame++] = 0xff;
+    pbtFrame[szFrame++] = 0xff;
+    pbtFrame[szFrame++] = (uint8_t)(szLen >> 8);
+    pbtFrame[szFrame++] = (uint8_t)(szLen & 0xff);
+    pbtFrame[szFrame++] = (uint8_t)(0x100 - (((szLen >> 8) + szLen) & 0xff));
+  } else {
+    pbtFrame[szFrame++] = (uint8_t) szLen;
+    pbtFrame[szFrame++] = (uint8_t)(0x100 - szLen);
+  }
+  pbtFrame[szFrame++] = 0xd5;
+  pbtFrame[szFrame++] = btCommand;
+  memcpy(pbtFrame + szFrame, data->abtResponse, data->szResponse);
+  szFrame += data->szResponse;
+
+  uint8_t btDCS = (256 - 0xd5);
+  btDCS -= btCommand;
+  for (size_t szPos = 0; szPos < data->szResponse; szPos++) {
+    btDCS -= data->abtResponse[szPos];
+  }
+  pbtFrame[szFrame++] = btDCS;
+  pbtFrame[szFrame++] = 0x00;
+  return szFrame;
+}
+
+static int
+pn53x_sim_ack(nfc_device *pnd)
+{
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pn53x_ack_frame, sizeof(pn53x_ack_frame));
+  return NFC_SUCCESS;
+}
+
+static int
+pn53x_sim_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, int timeout)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+  uint8_t *pbtFrame;
+  int res;
+  (void) timeout;
+
+  // The simulated chip wakes up on any frame
+  CHIP_DATA(pnd)->power_mode = NORMAL;
+
+  if ((res = pn53x_frame_in_place(pbtData, szData, &pbtFrame)) < 0) {
+    pnd->last_error = res;
+    return pnd->last_error;
+  }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pbtFrame, res);
+  const uint64_t uiSent = nfc_trace_now();
+
+  pn53x_sim_lock(data);
+  data->bAbort = false;
+  memcpy(data->abtCommand, pbtData, szData);
+  data->szCommand = szData;
+  pn53x_sim_process(data);
+  pn53x_sim_set_deadline(data, uiSent, (size_t) res);
+  const uint64_t uiAck = uiSent + pn53x_sim_wire_ns(data, (size_t) res + sizeof(pn53x_ack_frame));
+  pn53x_sim_unlock(data);
+
+  pn53x_sim_sleep_until(uiAck);
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pn53x_ack_frame, sizeof(pn53x_ack_frame));
+  if (pn53x_check_ack_frame(pnd, pn53x_ack_frame, sizeof(pn53x_ack_frame)) < 0)
+    return pnd->last_error;
+  return NFC_SUCCESS;
+}
+
+static int
+pn53x_sim_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, int timeout)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+  const uint64_t uiTimeout = (timeout > 0) ? nfc_trace_now() + (uint64_t) timeout * 1000000ULL : 0;
+
+  pn53x_sim_lock(data);
+  for (;;) {
+    if (data->bAbort) {
+      data->bAbort = false;
+      pn53x_sim_unlock(data);
+      pn53x_sim_ack(pnd);
+      pnd->last_error = NFC_EOPABORTED;
+      return pnd->last_error;
+    }
+    if (!data->bAnswered && (data->uiFieldChanges != data->uiCommandFieldChanges)) {
+      // The command waited for the field to change
+      pn53x_sim_process(data);
+      pn53x_sim_set_deadline(data, nfc_trace_now(), 0);
+    }
+    const uint64_t uiNow = nfc_trace_now();
+    if (data->bAnswered && (uiNow >= data->uiReadyAt))
+      break;
+    if (uiTimeout && (uiNow >= uiTimeout)) {
+      pn53x_sim_unlock(data);
+      pn53x_sim_ack(pnd);
+      pnd->last_error = NFC_ETIMEOUT;
+      return pnd->last_error;
+    }
+    uint64_t uiWake = data->bAnswered ? data->uiReadyAt : 0;
+    if (uiTimeout && (!uiWake || (uiTimeout < uiWake)))
+      uiWake = uiTimeout;
+    pn53x_sim_wait(data, uiWake);
+  }
+  if (szFrame < data->szResponse + 1 + PN53x_EXTENDED_FRAME__OVERHEAD) {
+    pn53x_sim_unlock(data);
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
+  }
+  const size_t szResponseFrame = pn53x_sim_frame(data, pbtFrame);
+  pn53x_sim_unlock(data);
+
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, szResponseFrame);
+  return pn53x_decode_frame(pnd, pbtFrame, szResponseFrame, ppbtData);
+}
+
+static int
+pn53x_sim_abort_command(nfc_device *pnd)
+{
+  if (pnd) {
+    struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+    pn53x_sim_lock(data);
+    data->bAbort = true;
+    pn53x_sim_wake(data);
+    pn53x_sim_unlock(data);
+  }
+  return NFC_SUCCESS;
+}
+
+static void
+pn53x_sim_close(nfc_device *pnd)
+{
+  pn53x_idle(pnd);
+
+#ifndef _WIN32
+  pthread_cond_destroy(&DRIVER_DATA(pnd)->cond);
+  pthread_mutex_destroy(&DRIVER_DATA(pnd)->mutex);
+#endif
+  pn53x_data_free(pnd);
+  nfc_device_free(pnd);
+}
+
+// Connstring: pn53x_sim[:wire speed], a wire speed enables the latency model
+static nfc_device *
+pn53x_sim_open(const nfc_context *context, const nfc_connstring connstring)
+{
+  const size_t szName = strlen(PN53X_SIM_DRIVER_NAME);
+  uint32_t uiWireSpeed = 0;
+
+  if (strncmp(connstring, PN53X_SIM_DRIVER_NAME, szName) != 0)
+    return NULL;
+  if (connstring[szName] == ':') {
+    char *pcEnd;
+    const unsigned long ulSpeed = strtoul(connstring + szName + 1, &pcEnd, 10);
+    if ((pcEnd == connstring + szName + 1) || (*pcEnd != '\0') || (ulSpeed > UINT32_MAX)) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Invalid connstring: %s", connstring);
+      return NULL;
+    }
+    uiWireSpeed = (uint32_t) ulSpeed;
+  } else if (connstring[szName] != '\0') {
+    return NULL;
+  }
+
+  nfc_device *pnd = nfc_device_new(context, connstring);
+  if (!pnd) {
+    perror("malloc");
+    return NULL;
+  }
+  snprintf(pnd->name, sizeof(pnd->name), "%s", "PN532 simulator");
+
+  pnd->driver_data = calloc(1, sizeof(struct pn53x_sim_data));
+  if (!pnd->driver_data) {
+    perror("malloc");
+    nfc_device_free(pnd);
+    return NULL;
+  }
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+#ifndef _WIN32
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&data->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&data->mutex, NULL);
+#endif
+  data->uiWireSpeed = uiWireSpeed;
+  data->bRf = (uiWireSpeed != 0);
+  data->abtRegisters[PN53X_REG_CIU_TxMode] = SYMBOL_TX_CRC_ENABLE;
+  data->abtRegisters[PN53X_REG_CIU_RxMode] = SYMBOL_RX_CRC_ENABLE;
+  data->btParameters = PARAM_AUTO_ATR_RES | PARAM_AUTO_RATS;
+  data->btMxRtyPassiveActivation = 0xff;
+  data->btRetryTimeout = 0x0a;
+  data->aiTg[0] = data->aiTg[1] = PN53X_SIM_NO_TG;
+  data->iReadySlot = -1;
+  data->iPiccSlot = -1;
+
+  // Alloc and init chip's data
+  pn53x_data_new(pnd, &pn53x_sim_io);
+  CHIP_DATA(pnd)->type = PN532;
+  CHIP_DATA(pnd)->power_mode = NORMAL;
+  pnd->driver = &pn53x_sim_driver;
+
+  // Check communication using "Diagnose" command, with "Communication test" (0x00)
+  if (pn53x_check_communication(pnd) < 0) {
+    nfc_perror(pnd, "pn53x_check_communication");
+    pn53x_sim_close(pnd);
+    return NULL;
+  }
+
+  pn53x_init(pnd);
+  return pnd;
+}
+
+int
+pn53x_sim_add_target(nfc_device *pnd, struct nfc_emulator *emulator)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+  int iFree = -1;
+
+  if (!emulator || !emulator->target || !emulator->state_machine || !emulator->state_machine->io) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  switch (emulator->target->nm.nmt) {
+    case NMT_ISO14443A:
+    case NMT_ISO14443B:
+    case NMT_FELICA:
+    case NMT_DEP:
+      break;
+    default:
+      pnd->last_error = NFC_EDEVNOTSUPP;
+      return pnd->last_error;
+  }
+
+  pn53x_sim_lock(data);
+  for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+    if (data->aTargets[iSlot].emulator == emulator) {
+      pn53x_sim_unlock(data);
+      pnd->last_error = NFC_EINVARG;
+      return pnd->last_error;
+    }
+    if (!data->aTargets[iSlot].emulator && (iFree < 0))
+      iFree = iSlot;
+  }
+  if (iFree < 0) {
+    pn53x_sim_unlock(data);
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
+  }
+  struct pn53x_sim_target *pst = &data->aTargets[iFree];
+  memset(pst, 0, sizeof(*pst));
+  pst->emulator = emulator;
+  pst->state = PN53X_SIM_IDLE;
+  pst->szFsd = PN53X_SIM_FSD;
+  data->uiFieldChanges++;
+  pn53x_sim_wake(data);
+  pn53x_sim_unlock(data);
+  return NFC_SUCCESS;
+}
+
+int
+pn53x_sim_remove_target(nfc_device *pnd, const struct nfc_emulator *emulator)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+
+  pn53x_sim_lock(data);
+  for (int iSlot = 0; iSlot < PN53X_SIM_TARGETS_MAX; iSlot++) {
+    struct pn53x_sim_target *pst = &data->aTargets[iSlot];
+    if (!emulator || (pst->emulator != emulator))
+      continue;
+    pn53x_sim_deactivate(data, pst, PN53X_SIM_IDLE);
+    pst->emulator = NULL;
+    for (int n = 0; n < 2; n++) {
+      if (data->aiTg[n] == iSlot)
+        data->aiTg[n] = PN53X_SIM_GONE;
+    }
+    if (data->iReadySlot == iSlot)
+      data->iReadySlot = -1;
+    data->uiFieldChanges++;
+    pn53x_sim_wake(data);
+    pn53x_sim_unlock(data);
+    return NFC_SUCCESS;
+  }
+  pn53x_sim_unlock(data);
+  pnd->last_error = NFC_EINVARG;
+  return pnd->last_error;
+}
+
+int
+pn53x_sim_set_initiator(nfc_device *pnd, struct nfc_emulator *emulator)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+
+  if (emulator && (!emulator->target || !emulator->state_machine || !emulator->state_machine->io)) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  pn53x_sim_lock(data);
+  data->initiator = emulator;
+  data->bInitiatorActive = false;
+  data->uiFieldChanges++;
+  pn53x_sim_wake(data);
+  pn53x_sim_unlock(data);
+  return NFC_SUCCESS;
+}
+
+int
+pn53x_sim_set_latency(nfc_device *pnd, const uint32_t uiWireSpeed, const bool bRf)
+{
+  struct pn53x_sim_data *data = DRIVER_DATA(pnd);
+
+  pn53x_sim_lock(data);
+  data->uiWireSpeed = uiWireSpeed;
+  data->bRf = bRf;
+  pn53x_sim_unlock(data);
+  return NFC_SUCCESS;
+}
+
+const struct pn53x_io pn53x_sim_io = {
+  .send    = pn53x_sim_send,
+  .receive = pn53x_sim_receive,
+};
+
+const struct nfc_driver pn53x_sim_driver = {
+  .name                             = PN53X_SIM_DRIVER_NAME,
+  // Never listed, opened by its connstring only
+  .scan_type                        = NOT_AVAILABLE,
+  .scan                             = NULL,
+  .open                             = pn53x_sim_open,
+  .close                            = pn53x_sim_close,
+  .strerror                         = pn53x_strerror,
+
+  .initiator_init                   = pn53x_initiator_init,
+  .initiator_init_secure_element    = pn532_initiator_init_secure_element,
+  .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
+  .initiator_poll_target            = pn53x_initiator_poll_target,
+  .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
+  .initiator_deselect_target        = pn53x_initiator_deselect_target,
+  .initiator_transceive_bytes       = pn53x_initiator_transceive_bytes,
+  .initiator_transceive_bits        = pn53x_initiator_transceive_bits,
+  .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
+  .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
+  .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
+
+  .target_init           = pn53x_target_init,
+  .target_send_bytes     = pn53x_target_send_bytes,
+  .target_receive_bytes  = pn53x_target_receive_bytes,
+  .target_send_bits      = pn53x_target_send_bits,
+  .target_receive_bits   = pn53x_target_receive_bits,
+
+  .device_set_property_bool     = pn53x_set_property_bool,
+  .device_set_property_int      = pn53x_set_property_int,
+  .get_supported_modulation     = pn53x_get_supported_modulation,
+  .get_supported_baud_rate      = pn53x_get_supported_baud_rate,
+  .device_get_information_about = pn53x_get_information_about,
+
+  .abort_command  = pn53x_sim_abort_command,
+  .idle           = pn53x_idle,
+  .powerdown      = pn53x_PowerDown,
+};
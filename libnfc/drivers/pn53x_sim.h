@@ -0,0 +1,36 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file pn53x_sim.h
+ * @brief Driver for a PN532 simulated in software
+ */
+
+#ifndef __NFC_DRIVER_PN53X_SIM_H__
+#define __NFC_DRIVER_PN53X_SIM_H__
+
+#include <nfc/nfc-types.h>
+#include <nfc/nfc-emulation.h>
+
+extern const struct nfc_driver pn53x_sim_driver;
+
+int     pn53x_sim_add_target(nfc_device *pnd, struct nfc_emulator *emulator);
+int     pn53x_sim_remove_target(nfc_device *pnd, const struct nfc_emulator *emulator);
+int     pn53x_sim_set_initiator(nfc_device *pnd, struct nfc_emulator *emulator);
+int     pn53x_sim_set_latency(nfc_device *pnd, const uint32_t uiWireSpeed, const bool bRf);
+
+#endif // ! __NFC_DRIVER_PN53X_SIM_H__
@@ -35,26 +35,14 @@ Thanks to d18c7db and Okko for example code
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include <sys/select.h>
-#include <errno.h>
-
-#ifndef _WIN32
-// Under POSIX system, we use libusb (>= 0.1.12)
-#include <usb.h>
-#define USB_TIMEDOUT ETIMEDOUT
-#define _usb_strerror( X ) strerror(-X)
-#else
-// Under Windows we use libusb-win32 (>= 1.2.5)
-#include <lusb0_usb.h>
-#define USB_TIMEDOUT 116
-#define _usb_strerror( X ) usb_strerror()
-#endif
-
 #include <string.h>
 
+#include <libusb.h>
+
 #include <nfc/nfc.h>
 
 #include "nfc-internal.h"
+#include "buses/usbbus.h"
 #include "chips/pn53x.h"
 #include "chips/pn53x-internal.h"
 #include "drivers/pn53x_usb.h"
@@ -63,7 +51,7 @@ Thanks to d18c7db and Okko for example code
 #define LOG_CATEGORY "libnfc.driver.pn53x_usb"
 #define LOG_GROUP    NFC_LOG_GROUP_DRIVER
 
-#define USB_INFINITE_TIMEOUT   0
+#define PN53X_USB_BUFFER_LEN (PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53x_EXTENDED_FRAME__OVERHEAD)
 
 #define DRIVER_DATA(pnd) ((struct pn53x_usb_data*)(pnd->driver_data))
 
@@ -79,49 +67,22 @@ typedef enum {
 
 // Internal data structs
 struct pn53x_usb_data {
-  usb_dev_handle *pudh;
+  libusb_context *ctx;
+  libusb_device_handle *pudh;
+  struct usbbus_transport *transport;
   pn53x_usb_model model;
-  uint32_t uiEndPointIn;
-  uint32_t uiEndPointOut;
-  uint32_t uiMaxPacketSize;
-  volatile bool abort_flag;
+  uint8_t uiEndPointIn;
+  uint8_t uiEndPointOut;
+  uint16_t uiMaxPacketSize;
+  bool ack_pending;
 };
 
 const struct pn53x_io pn53x_usb_io;
 
 // Prototypes
-bool pn53x_usb_get_usb_device_name(struct usb_device *dev, usb_dev_handle *udev, char *buffer, size_t len);
+bool pn53x_usb_get_usb_device_name(libusb_device *dev, libusb_device_handle *udev, char *buffer, size_t len);
 int pn53x_usb_init(nfc_device *pnd);
 
-static int
-pn53x_usb_bulk_read(struct pn53x_usb_data *data, uint8_t abtRx[], const size_t szRx, const int timeout)
-{
-  int res = usb_bulk_read(data->pudh, data->uiEndPointIn, (char *) abtRx, szRx, timeout);
-  if (res > 0) {
-    LOG_HEX(NFC_LOG_GROUP_COM, "RX", abtRx, res);
-  } else if (res < 0) {
-    if (res != -USB_TIMEDOUT)
-      log_put(NFC_LOG_GROUP_COM, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to read from USB (%s)", _usb_strerror(res));
-  }
-  return res;
-}
-
-static int
-pn53x_usb_bulk_write(struct pn53x_usb_data *data, uint8_t abtTx[], const size_t szTx, const int timeout)
-{
-  LOG_HEX(NFC_LOG_GROUP_COM, "TX", abtTx, szTx);
-  int res = usb_bulk_write(data->pudh, data->uiEndPointOut, (char *) abtTx, szTx, timeout);
-  if (res > 0) {
-    // HACK This little hack is a well know problem of USB, see http://www.libusb.org/ticket/6 for more details
-    if ((res % data->uiMaxPacketSize) == 0) {
-      usb_bulk_write(data->pudh, data->uiEndPointOut, "\0", 0, timeout);
-    }
-  } else {
-    log_put(NFC_LOG_GROUP_COM, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to write to USB (%s)", _usb_strerror(res));
-  }
-  return res;
-}
-
 struct pn53x_usb_supported_device {
   uint16_t vendor_id;
   uint16_t product_id;
@@ -152,101 +113,24 @@ pn53x_usb_get_device_model(uint16_t vendor_id, uint16_t product_id)
 
 int  pn53x_usb_ack(nfc_device *pnd);
 
-// Find transfer endpoints for bulk transfers
-static void
-pn53x_usb_get_end_points(struct usb_device *dev, struct pn53x_usb_data *data)
-{
-  uint32_t uiIndex;
-  uint32_t uiEndPoint;
-  struct usb_interface_descriptor *puid = dev->config->interface->altsetting;
-
-  // 3 Endpoints maximum: Interrupt In, Bulk In, Bulk Out
-  for (uiIndex = 0; uiIndex < puid->bNumEndpoints; uiIndex++) {
-    // Only accept bulk transfer endpoints (ignore interrupt endpoints)
-    if (puid->endpoint[uiIndex].bmAttributes != USB_ENDPOINT_TYPE_BULK)
-      continue;
-
-    // Copy the endpoint to a local var, makes it more readable code
-    uiEndPoint = puid->endpoint[uiIndex].bEndpointAddress;
-
-    // Test if we dealing with a bulk IN endpoint
-    if ((uiEndPoint & USB_ENDPOINT_DIR_MASK) == USB_ENDPOINT_IN) {
-      data->uiEndPointIn = uiEndPoint;
-      data->uiMaxPacketSize = puid->endpoint[uiIndex].wMaxPacketSize;
-    }
-    // Test if we dealing with a bulk OUT endpoint
-    if ((uiEndPoint & USB_ENDPOINT_DIR_MASK) == USB_ENDPOINT_OUT) {
-      data->uiEndPointOut = uiEndPoint;
-      data->uiMaxPacketSize = puid->endpoint[uiIndex].wMaxPacketSize;
-    }
-  }
-}
-
 static size_t
 pn53x_usb_scan(const nfc_context *context, nfc_connstring connstrings[], const size_t connstrings_len)
 {
-  (void)context;
-  usb_init();
-  int res;
-  // usb_find_busses will find all of the busses on the system. Returns the
-  // number of changes since previous call to this function (total of new
-  // busses and busses removed).
-  if ((res = usb_find_busses()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB busses (%s)", _usb_strerror(res));
+  if (!context->usb_registry)
     return 0;
-  }
-  // usb_find_devices will find all of the devices on each bus. This should be
-  // called after usb_find_busses. Returns the number of changes since the
-  // previous call to this function (total of new device and devices removed).
-  if ((res = usb_find_devices()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", _usb_strerror(res));
-    return 0;
-  }
+
+  // Devices are not opened to be listed, the registry knows them already
+  struct usbbus_device devices[USBBUS_REGISTRY_LEN];
+  const size_t devices_count = usbbus_registry_list(context->usb_registry, devices, USBBUS_REGISTRY_LEN);
 
   size_t device_found = 0;
-  uint32_t uiBusIndex = 0;
-  struct usb_bus *bus;
-  for (bus = usb_get_busses(); bus; bus = bus->next) {
-    struct usb_device *dev;
-
-    for (dev = bus->devices; dev; dev = dev->next, uiBusIndex++) {
-      for (size_t n = 0; n < sizeof(pn53x_usb_supported_devices) / sizeof(struct pn53x_usb_supported_device); n++) {
-        if ((pn53x_usb_supported_devices[n].vendor_id == dev->descriptor.idVendor) &&
-            (pn53x_usb_supported_devices[n].product_id == dev->descriptor.idProduct)) {
-          // Make sure there are 2 endpoints available
-          // with libusb-win32 we got some null pointers so be robust before looking at endpoints:
-          if (dev->config == NULL || dev->config->interface == NULL || dev->config->interface->altsetting == NULL) {
-            // Nope, we maybe want the next one, let's try to find another
-            continue;
-          }
-          if (dev->config->interface->altsetting->bNumEndpoints < 2) {
-            // Nope, we maybe want the next one, let's try to find another
-            continue;
-          }
-
-          usb_dev_handle *udev = usb_open(dev);
-
-          // Set configuration
-          res = usb_set_configuration(udev, 1);
-          if (res < 0) {
-            log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set USB configuration (%s)", _usb_strerror(res));
-            usb_close(udev);
-            // we failed to use the device
-            continue;
-          }
-
-          // pn53x_usb_get_usb_device_name (dev, udev, pnddDevices[device_found].acDevice, sizeof (pnddDevices[device_found].acDevice));
-          log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "device found: Bus %s Device %s", bus->dirname, dev->filename);
-          usb_close(udev);
-          snprintf(connstrings[device_found], sizeof(nfc_connstring), "%s:%s:%s", PN53X_USB_DRIVER_NAME, bus->dirname, dev->filename);
-          device_found++;
-          // Test if we reach the maximum "wanted" devices
-          if (device_found == connstrings_len) {
-            return device_found;
-          }
-        }
-      }
-    }
+  for (size_t i = 0; (i < devices_count) && (device_found < connstrings_len); i++) {
+    if (pn53x_usb_get_device_model(devices[i].vendor_id, devices[i].product_id) == UNKNOWN)
+      continue;
+
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "device found: Bus %03d Device %03d", devices[i].bus, devices[i].address);
+    snprintf(connstrings[device_found], sizeof(nfc_connstring), "%s:%03d:%03d", PN53X_USB_DRIVER_NAME, devices[i].bus, devices[i].address);
+    device_found++;
   }
 
   return device_found;
@@ -285,23 +169,27 @@ pn53x_usb_connstring_decode(const nfc_connstring connstring, struct pn53x_usb_de
 }
 
 bool
-pn53x_usb_get_usb_device_name(struct usb_device *dev, usb_dev_handle *udev, char *buffer, size_t len)
+pn53x_usb_get_usb_device_name(libusb_device *dev, libusb_device_handle *udev, char *buffer, size_t len)
 {
+  struct libusb_device_descriptor descriptor;
   *buffer = '\0';
 
-  if (dev->descriptor.iManufacturer || dev->descriptor.iProduct) {
+  if (libusb_get_device_descriptor(dev, &descriptor) < 0)
+    return false;
+
+  if (descriptor.iManufacturer || descriptor.iProduct) {
     if (udev) {
-      usb_get_string_simple(udev, dev->descriptor.iManufacturer, buffer, len);
+      libusb_get_string_descriptor_ascii(udev, descriptor.iManufacturer, (unsigned char *) buffer, len);
       if (strlen(buffer) > 0)
         strcpy(buffer + strlen(buffer), " / ");
-      usb_get_string_simple(udev, dev->descriptor.iProduct, buffer + strlen(buffer), len - strlen(buffer));
+      libusb_get_string_descriptor_ascii(udev, descriptor.iProduct, (unsigned char *) buffer + strlen(buffer), len - strlen(buffer));
     }
   }
 
   if (!*buffer) {
     for (size_t n = 0; n < sizeof(pn53x_usb_supported_devices) / sizeof(struct pn53x_usb_supported_device); n++) {
-      if ((pn53x_usb_supported_devices[n].vendor_id == dev->descriptor.idVendor) &&
-          (pn53x_usb_supported_devices[n].product_id == dev->descriptor.idProduct)) {
+      if ((pn53x_usb_supported_devices[n].vendor_id == descriptor.idVendor) &&
+          (pn53x_usb_supported_devices[n].product_id == descriptor.idProduct)) {
         strncpy(buffer, pn53x_usb_supported_devices[n].name, len);
         return true;
       }
@@ -316,118 +204,136 @@ pn53x_usb_open(const nfc_context *context, const nfc_connstring connstring)
 {
   nfc_device *pnd = NULL;
   struct pn53x_usb_descriptor desc = { NULL, NULL };
+  libusb_device **devices = NULL;
   int connstring_decode_level = pn53x_usb_connstring_decode(connstring, &desc);
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%d element(s) have been decoded from \"%s\"", connstring_decode_level, connstring);
-  if (connstring_decode_level < 1) {
-    goto free_mem;
-  }
 
   struct pn53x_usb_data data = {
+    .ctx = NULL,
     .pudh = NULL,
+    .transport = NULL,
     .uiEndPointIn = 0,
     .uiEndPointOut = 0,
   };
-  struct usb_bus *bus;
-  struct usb_device *dev;
 
-  usb_init();
+  if (connstring_decode_level < 1) {
+    goto free_mem;
+  }
 
   int res;
-  // usb_find_busses will find all of the busses on the system. Returns the
-  // number of changes since previous call to this function (total of new
-  // busses and busses removed).
-  if ((res = usb_find_busses()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB busses (%s)", _usb_strerror(res));
+  if ((res = libusb_init(&data.ctx)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to initialize libusb (%s)", libusb_error_name(res));
+    data.ctx = NULL;
     goto free_mem;
   }
-  // usb_find_devices will find all of the devices on each bus. This should be
-  // called after usb_find_busses. Returns the number of changes since the
-  // previous call to this function (total of new device and devices removed).
-  if ((res = usb_find_devices()) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", _usb_strerror(res));
+  ssize_t devices_count = libusb_get_device_list(data.ctx, &devices);
+  if (devices_count < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to find USB devices (%s)", libusb_error_name(devices_count));
+    devices = NULL;
     goto free_mem;
   }
 
-  for (bus = usb_get_busses(); bus; bus = bus->next) {
+  for (ssize_t i = 0; i < devices_count; i++) {
+    libusb_device *dev = devices[i];
     if (connstring_decode_level > 1)  {
       // A specific bus have been specified
-      if (0 != strcmp(bus->dirname, desc.dirname))
+      if (libusb_get_bus_number(dev) != atoi(desc.dirname))
         continue;
     }
-    for (dev = bus->devices; dev; dev = dev->next) {
-      if (connstring_decode_level > 2)  {
-        // A specific dev have been specified
-        if (0 != strcmp(dev->filename, desc.filename))
-          continue;
-      }
-      // Open the USB device
-      data.pudh = usb_open(dev);
-      // Retrieve end points
-      pn53x_usb_get_end_points(dev, &data);
-      // Set configuration
-      res = usb_set_configuration(data.pudh, 1);
-      if (res < 0) {
-        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set USB configuration (%s)", _usb_strerror(res));
-        if (EPERM == -res) {
-          log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Warning: Please double check USB permissions for device %04x:%04x", dev->descriptor.idVendor, dev->descriptor.idProduct);
-        }
-        usb_close(data.pudh);
-        // we failed to use the specified device
-        goto free_mem;
-      }
+    if (connstring_decode_level > 2)  {
+      // A specific dev have been specified
+      if (libusb_get_device_address(dev) != atoi(desc.filename))
+        continue;
+    }
+    struct libusb_device_descriptor descriptor;
+    if (libusb_get_device_descriptor(dev, &descriptor) < 0)
+      continue;
+    if ((data.model = pn53x_usb_get_device_model(descriptor.idVendor, descriptor.idProduct)) == UNKNOWN)
+      continue;
 
-      res = usb_claim_interface(data.pudh, 0);
-      if (res < 0) {
-        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to claim USB interface (%s)", _usb_strerror(res));
-        usb_close(data.pudh);
-        // we failed to use the specified device
-        goto free_mem;
+    // Retrieve end points
+    if (usbbus_get_end_points(dev, &data.uiEndPointIn, &data.uiEndPointOut, &data.uiMaxPacketSize) < 0)
+      continue;
+    // Open the USB device
+    if ((res = libusb_open(dev, &data.pudh)) < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to open USB device (%s)", libusb_error_name(res));
+      if (LIBUSB_ERROR_ACCESS == res) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Warning: Please double check USB permissions for device %04x:%04x", descriptor.idVendor, descriptor.idProduct);
       }
-      data.model = pn53x_usb_get_device_model(dev->descriptor.idVendor, dev->descriptor.idProduct);
-      // Allocate memory for the device info and specification, fill it and return the info
-      pnd = nfc_device_new(context, connstring);
-      pn53x_usb_get_usb_device_name(dev, data.pudh, pnd->name, sizeof(pnd->name));
-
-      pnd->driver_data = malloc(sizeof(struct pn53x_usb_data));
-      *DRIVER_DATA(pnd) = data;
-
-      // Alloc and init chip's data
-      pn53x_data_new(pnd, &pn53x_usb_io);
-
-      switch (DRIVER_DATA(pnd)->model) {
-          // empirical tuning
-        case ASK_LOGO:
-          CHIP_DATA(pnd)->timer_correction = 50;
-          break;
-        case SCM_SCL3711:
-        case NXP_PN533:
-          CHIP_DATA(pnd)->timer_correction = 46;
-          break;
-        case NXP_PN531:
-          CHIP_DATA(pnd)->timer_correction = 50;
-          break;
-        case SONY_PN531:
-          CHIP_DATA(pnd)->timer_correction = 54;
-          break;
-        case SONY_RCS360:
-        case UNKNOWN:
-          CHIP_DATA(pnd)->timer_correction = 0;   // TODO: allow user to know if timed functions are available
-          break;
+      // we failed to use the specified device
+      goto free_mem;
+    }
+    // Set configuration
+    res = libusb_set_configuration(data.pudh, 1);
+    if (res < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to set USB configuration (%s)", libusb_error_name(res));
+      if (LIBUSB_ERROR_ACCESS == res) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_INFO, "Warning: Please double check USB permissions for device %04x:%04x", descriptor.idVendor, descriptor.idProduct);
       }
-      pnd->driver = &pn53x_usb_driver;
+      libusb_close(data.pudh);
+      // we failed to use the specified device
+      goto free_mem;
+    }
 
-      // HACK1: Send first an ACK as Abort command, to reset chip before talking to it:
-      pn53x_usb_ack(pnd);
+    res = libusb_claim_interface(data.pudh, 0);
+    if (res < 0) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to claim USB interface (%s)", libusb_error_name(res));
+      libusb_close(data.pudh);
+      // we failed to use the specified device
+      goto free_mem;
+    }
 
-      // HACK2: Then send a GetFirmware command to resync USB toggle bit between host & device
-      // in case host used set_configuration and expects the device to have reset its toggle bit, which PN53x doesn't do
-      if (pn53x_usb_init(pnd) < 0) {
-        usb_close(data.pudh);
-        goto error;
-      }
-      DRIVER_DATA(pnd)->abort_flag = false;
+    // From now on, what the PN53x sends is received as soon as it is sent
+    if (!(data.transport = usbbus_transport_new(data.ctx, data.pudh, data.uiEndPointIn, data.uiEndPointOut, data.uiMaxPacketSize, PN53X_USB_BUFFER_LEN))) {
+      libusb_release_interface(data.pudh, 0);
+      libusb_close(data.pudh);
       goto free_mem;
     }
+
+    // Allocate memory for the device info and specification, fill it and return the info
+    pnd = nfc_device_new(context, connstring);
+    pn53x_usb_get_usb_device_name(dev, data.pudh, pnd->name, sizeof(pnd->name));
+
+    pnd->driver_data = malloc(sizeof(struct pn53x_usb_data));
+    *DRIVER_DATA(pnd) = data;
+
+    // Alloc and init chip's data
+    pn53x_data_new(pnd, &pn53x_usb_io);
+
+    switch (DRIVER_DATA(pnd)->model) {
+        // empirical tuning
+      case ASK_LOGO:
+        CHIP_DATA(pnd)->timer_correction = 50;
+        break;
+      case SCM_SCL3711:
+      case NXP_PN533:
+        CHIP_DATA(pnd)->timer_correction = 46;
+        break;
+      case NXP_PN531:
+        CHIP_DATA(pnd)->timer_correction = 50;
+        break;
+      case SONY_PN531:
+        CHIP_DATA(pnd)->timer_correction = 54;
+        break;
+      case SONY_RCS360:
+      case UNKNOWN:
+        CHIP_DATA(pnd)->timer_correction = 0;   // TODO: allow user to know if timed functions are available
+        break;
+    }
+    pnd->driver = &pn53x_usb_driver;
+
+    // HACK1: Send first an ACK as Abort command, to reset chip before talking to it:
+    pn53x_usb_ack(pnd);
+
+    // HACK2: Then send a GetFirmware command to resync USB toggle bit between host & device
+    // in case host used set_configuration and expects the device to have reset its toggle bit, which PN53x doesn't do
+    if (pn53x_usb_init(pnd) < 0) {
+      usbbus_transport_free(data.transport);
+      libusb_release_interface(data.pudh, 0);
+      libusb_close(data.pudh);
+      goto error;
+    }
+    goto free_mem;
   }
   // We ran out of devices before the index required
   goto free_mem;
@@ -437,6 +343,10 @@ error:
   nfc_device_free(pnd);
   pnd = NULL;
 free_mem:
+  if (devices)
+    libusb_free_device_list(devices, 1);
+  if (!pnd && data.ctx)
+    libusb_exit(data.ctx);
   free(desc.dirname);
   free(desc.filename);
   return pnd;
@@ -455,204 +365,110 @@ pn53x_usb_close(nfc_device *pnd)
 
   pn53x_idle(pnd);
 
+  usbbus_transport_free(DRIVER_DATA(pnd)->transport);
+
   int res;
-  if ((res = usb_release_interface(DRIVER_DATA(pnd)->pudh, 0)) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to release USB interface (%s)", _usb_strerror(res));
+  if ((res = libusb_release_interface(DRIVER_DATA(pnd)->pudh, 0)) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to release USB interface (%s)", libusb_error_name(res));
   }
 
-  if ((res = usb_close(DRIVER_DATA(pnd)->pudh)) < 0) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to close USB connection (%s)", _usb_strerror(res));
-  }
+  libusb_close(DRIVER_DATA(pnd)->pudh);
+  libusb_exit(DRIVER_DATA(pnd)->ctx);
   pn53x_data_free(pnd);
   nfc_device_free(pnd);
 }
 
-#define PN53X_USB_BUFFER_LEN (PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53x_EXTENDED_FRAME__OVERHEAD)
-
 static int
-pn53x_usb_send(nfc_device *pnd, const uint8_t *pbtData, const size_t szData, const int timeout)
+pn53x_usb_send(nfc_device *pnd, uint8_t *pbtData, const size_t szData, const int timeout)
 {
-  uint8_t  abtFrame[PN53X_USB_BUFFER_LEN] = { 0x00, 0x00, 0xff };  // Every packet must start with "00 00 ff"
-  size_t szFrame = 0;
+  uint8_t *pbtFrame;
   int res = 0;
 
-  pn53x_build_frame(abtFrame, &szFrame, pbtData, szData);
-
-  if ((res = pn53x_usb_bulk_write(DRIVER_DATA(pnd), abtFrame, szFrame, timeout)) < 0) {
+  if ((res = pn53x_frame_in_place(pbtData, szData, &pbtFrame)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
 
-  uint8_t abtRxBuf[PN53X_USB_BUFFER_LEN];
-  if ((res = pn53x_usb_bulk_read(DRIVER_DATA(pnd), abtRxBuf, sizeof(abtRxBuf), timeout)) < 0) {
-    // try to interrupt current device state
-    pn53x_usb_ack(pnd);
+  // Whatever is still queued belongs to a previous command
+  usbbus_flush_input(DRIVER_DATA(pnd)->transport);
+
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pbtFrame, res);
+  if ((res = usbbus_write(DRIVER_DATA(pnd)->transport, pbtFrame, res, timeout)) < 0) {
     pnd->last_error = res;
     return pnd->last_error;
   }
 
-  if (pn53x_check_ack_frame(pnd, abtRxBuf, res) == 0) {
-    // The PN53x is running the sent command
-  } else {
-    // For some reasons (eg. send another command while a previous one is
-    // running), the PN533 sometimes directly replies the response packet
-    // instead of ACK frame, so we send a NACK frame to force PN533 to resend
-    // response packet. With this hack, the nextly executed function (ie.
-    // pn53x_usb_receive()) will be able to retreive the correct response
-    // packet.
-    // FIXME Sony reader is also affected by this bug but NACK is not supported
-    if ((res = pn53x_usb_bulk_write(DRIVER_DATA(pnd), (uint8_t *)pn53x_nack_frame, sizeof(pn53x_nack_frame), timeout)) < 0) {
-      pnd->last_error = res;
-      // try to interrupt current device state
-      pn53x_usb_ack(pnd);
-      return pnd->last_error;
-    }
-  }
-
+  // The ACK frame is checked by pn53x_usb_receive(), the IN transfer is
+  // already waiting for it
+  DRIVER_DATA(pnd)->ack_pending = true;
   return NFC_SUCCESS;
 }
 
-#define USB_TIMEOUT_PER_PASS 200
 static int
-pn53x_usb_receive(nfc_device *pnd, uint8_t *pbtData, const size_t szDataLen, const int timeout)
+pn53x_usb_receive(nfc_device *pnd, uint8_t *pbtFrame, const size_t szFrame, const uint8_t **ppbtData, const int timeout)
 {
-  size_t len;
-  off_t offset = 0;
-
-  uint8_t  abtRxBuf[PN53X_USB_BUFFER_LEN];
   int res;
 
-  /*
-   * If no timeout is specified but the command is blocking, force a 200ms (USB_TIMEOUT_PER_PASS)
-   * timeout to allow breaking the loop if the user wants to stop it.
-   */
-  int usb_timeout;
-  int remaining_time = timeout;
-read:
-  if (timeout == USB_INFINITE_TIMEOUT) {
-    usb_timeout = USB_TIMEOUT_PER_PASS;
-  } else {
-    // A user-provided timeout is set, we have to cut it in multiple chunk to be able to keep an nfc_abort_command() mecanism
-    remaining_time -= USB_TIMEOUT_PER_PASS;
-    if (remaining_time <= 0) {
-      pnd->last_error = NFC_ETIMEOUT;
+  if (DRIVER_DATA(pnd)->ack_pending) {
+    DRIVER_DATA(pnd)->ack_pending = false;
+    if ((res = usbbus_read(DRIVER_DATA(pnd)->transport, pbtFrame, szFrame, timeout)) < 0) {
+      // try to interrupt current device state
+      pn53x_usb_ack(pnd);
+      pnd->last_error = res;
       return pnd->last_error;
-    } else {
-      usb_timeout = MIN(remaining_time, USB_TIMEOUT_PER_PASS);
     }
-  }
+    nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, res);
 
-  res = pn53x_usb_bulk_read(DRIVER_DATA(pnd), abtRxBuf, sizeof(abtRxBuf), usb_timeout);
-
-  if (res == -USB_TIMEDOUT) {
-    if (DRIVER_DATA(pnd)->abort_flag) {
-      DRIVER_DATA(pnd)->abort_flag = false;
-      pn53x_usb_ack(pnd);
-      pnd->last_error = NFC_EOPABORTED;
-      return pnd->last_error;
+    if (pn53x_check_ack_frame(pnd, pbtFrame, res) == 0) {
+      // The PN53x is running the sent command
     } else {
-      goto read;
+      // For some reasons (eg. send another command while a previous one is
+      // running), the PN533 sometimes directly replies the response packet
+      // instead of ACK frame, so we send a NACK frame to force PN533 to resend
+      // response packet. With this hack, the next read will retreive the
+      // correct response packet.
+      // FIXME Sony reader is also affected by this bug but NACK is not supported
+      nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pn53x_nack_frame, sizeof(pn53x_nack_frame));
+      if ((res = usbbus_write(DRIVER_DATA(pnd)->transport, pn53x_nack_frame, sizeof(pn53x_nack_frame), timeout)) < 0) {
+        pnd->last_error = res;
+        // try to interrupt current device state
+        pn53x_usb_ack(pnd);
+        return pnd->last_error;
+      }
     }
   }
 
+  // nfc_abort_command() wakes this wait up right away, no need to slice it
+  res = usbbus_read(DRIVER_DATA(pnd)->transport, pbtFrame, szFrame, timeout);
+
   if (res < 0) {
     // try to interrupt current device state
     pn53x_usb_ack(pnd);
     pnd->last_error = res;
     return pnd->last_error;
   }
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_RX, pbtFrame, res);
 
-  const uint8_t pn53x_preamble[3] = { 0x00, 0x00, 0xff };
-  if (0 != (memcmp(abtRxBuf, pn53x_preamble, 3))) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame preamble+start code mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-  offset += 3;
-
-  if ((0x01 == abtRxBuf[offset]) && (0xff == abtRxBuf[offset + 1])) {
-    // Error frame
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Application level error detected");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  } else if ((0xff == abtRxBuf[offset]) && (0xff == abtRxBuf[offset + 1])) {
-    // Extended frame
-    offset += 2;
-
-    // (abtRxBuf[offset] << 8) + abtRxBuf[offset + 1] (LEN) include TFI + (CC+1)
-    len = (abtRxBuf[offset] << 8) + abtRxBuf[offset + 1] - 2;
-    if (((abtRxBuf[offset] + abtRxBuf[offset + 1] + abtRxBuf[offset + 2]) % 256) != 0) {
-      // TODO: Retry
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
-      pnd->last_error = NFC_EIO;
-      return pnd->last_error;
-    }
-    offset += 3;
-  } else {
-    // Normal frame
-    if (256 != (abtRxBuf[offset] + abtRxBuf[offset + 1])) {
-      // TODO: Retry
-      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Length checksum mismatch");
-      pnd->last_error = NFC_EIO;
-      return pnd->last_error;
-    }
-
-    // abtRxBuf[3] (LEN) include TFI + (CC+1)
-    len = abtRxBuf[offset] - 2;
-    offset += 2;
-  }
-
-  if (len > szDataLen) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unable to receive data: buffer too small. (szDataLen: %zu, len: %zu)", szDataLen, len);
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-
-  // TFI + PD0 (CC+1)
-  if (abtRxBuf[offset] != 0xD5) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "TFI Mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-  offset += 1;
-
-  if (abtRxBuf[offset] != CHIP_DATA(pnd)->last_command + 1) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Command Code verification failed");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
-  offset += 1;
-
-  memcpy(pbtData, abtRxBuf + offset, len);
-  offset += len;
-
-  uint8_t btDCS = (256 - 0xD5);
-  btDCS -= CHIP_DATA(pnd)->last_command + 1;
-  for (size_t szPos = 0; szPos < len; szPos++) {
-    btDCS -= pbtData[szPos];
-  }
-
-  if (btDCS != abtRxBuf[offset]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Data checksum mismatch");
+  // The whole frame comes in one transfer
+  int frame_len = pn53x_frame_length(pbtFrame, res);
+  if ((frame_len < 0) || (frame_len > res)) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Invalid or truncated frame");
     pnd->last_error = NFC_EIO;
     return pnd->last_error;
   }
-  offset += 1;
+  if ((res = pn53x_decode_frame(pnd, pbtFrame, frame_len, ppbtData)) < 0)
+    return res;
 
-  if (0x00 != abtRxBuf[offset]) {
-    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Frame postamble mismatch");
-    pnd->last_error = NFC_EIO;
-    return pnd->last_error;
-  }
   // The PN53x command is done and we successfully received the reply
   pnd->last_error = 0;
-  return len;
+  return res;
 }
 
 int
 pn53x_usb_ack(nfc_device *pnd)
 {
-  return pn53x_usb_bulk_write(DRIVER_DATA(pnd), (uint8_t *) pn53x_ack_frame, sizeof(pn53x_ack_frame), 1000);
+  nfc_trace_frame(pnd, NFC_TRACE_BUS, NFC_TRACE_TX, pn53x_ack_frame, sizeof(pn53x_ack_frame));
+  return usbbus_write(DRIVER_DATA(pnd)->transport, pn53x_ack_frame, sizeof(pn53x_ack_frame), 1000);
 }
 
 int
@@ -750,8 +566,7 @@ pn53x_usb_set_property_bool(nfc_device *pnd, const nfc_property property, const
 static int
 pn53x_usb_abort_command(nfc_device *pnd)
 {
-  DRIVER_DATA(pnd)->abort_flag = true;
-  return NFC_SUCCESS;
+  return usbbus_abort(DRIVER_DATA(pnd)->transport);
 }
 
 const struct pn53x_io pn53x_usb_io = {
@@ -769,6 +584,7 @@ const struct nfc_driver pn53x_usb_driver = {
   .initiator_init                   = pn53x_initiator_init,
   .initiator_init_secure_element    = NULL, // No secure-element support
   .initiator_select_passive_target  = pn53x_initiator_select_passive_target,
+  .initiator_list_passive_targets   = pn53x_initiator_list_passive_targets,
   .initiator_poll_target            = pn53x_initiator_poll_target,
   .initiator_select_dep_target      = pn53x_initiator_select_dep_target,
   .initiator_deselect_target        = pn53x_initiator_deselect_target,
@@ -777,6 +593,9 @@ const struct nfc_driver pn53x_usb_driver = {
   .initiator_transceive_bytes_timed = pn53x_initiator_transceive_bytes_timed,
   .initiator_transceive_bits_timed  = pn53x_initiator_transceive_bits_timed,
   .initiator_target_is_present      = pn53x_initiator_target_is_present,
+  .initiator_target_transceive_bytes = pn53x_initiator_target_transceive_bytes,
+  .initiator_target_deselect        = pn53x_initiator_target_deselect,
+  .initiator_target_release         = pn53x_initiator_target_release,
 
   .target_init           = pn53x_target_init,
   .target_send_bytes     = pn53x_target_send_bytes,
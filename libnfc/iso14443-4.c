@@ -0,0 +1,211 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+* @file iso14443-4.c
+* @brief ISO/IEC 14443-4 block transmission protocol, PCD side
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <limits.h>
+#include <string.h>
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+#include "iso14443-4.h"
+
+#define LOG_CATEGORY "libnfc.iso14443-4"
+#define LOG_GROUP    NFC_LOG_GROUP_GENERAL
+
+// How many times a missing or broken block is asked again
+#define ISO14443_4_RETRY_MAX 2
+
+static const size_t iso14443_4_frame_sizes[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+/**
+ * @brief Frame size the PICC accepts (FSC), 0 if the target does not speak ISO14443-4
+ * @see ISO/IEC 14443-4 (5.2.3 Format byte T0) and ISO/IEC 14443-3 (7.9.4 Protocol Info)
+ */
+size_t
+iso14443_4_fsc(const nfc_target *pnt)
+{
+  uint8_t fsci;
+
+  switch (pnt->nm.nmt) {
+    case NMT_ISO14443A:
+      if (!pnt->nti.nai.szAtsLen)
+        return ISO14443_4_FSC_DEFAULT;
+      fsci = pnt->nti.nai.abtAts[0] & 0x0f;
+      break;
+    case NMT_ISO14443B:
+      fsci = pnt->nti.nbi.abtProtocolInfo[1] >> 4;
+      break;
+    default:
+      return 0;
+  }
+  // RFU values are read as the largest frame size
+  return iso14443_4_frame_sizes[MIN(fsci, 8)];
+}
+
+/*
+ * Send a block then return the answer of the PICC, a waiting time extension
+ * request is granted on the way. When the answer is missing or broken the PICC
+ * is asked again with R(NAK), or with R(ACK) while it is chaining (bAck).
+ */
+static int
+iso14443_4_exchange(nfc_device *pnd, const uint8_t *pbtBlock, const size_t szBlock, uint8_t *pbtRx, const bool bAck, int timeout)
+{
+  uint8_t abtTx[2];
+  const uint8_t *pbtTx = pbtBlock;
+  size_t szTx = szBlock;
+  int wait = timeout;
+  int retries = 0;
+  int res;
+
+  for (;;) {
+    res = nfc_initiator_transceive_bytes(pnd, pbtTx, szTx, pbtRx, ISO14443_4_FS_MAX, wait);
+    wait = timeout;
+    if ((res == 0) || (res == NFC_ERFTRANS) || (res == NFC_ETIMEOUT)) {
+      if (retries++ == ISO14443_4_RETRY_MAX) {
+        pnd->last_error = (res == 0) ? NFC_ERFTRANS : res;
+        return pnd->last_error;
+      }
+      abtTx[0] = (bAck ? ISO14443_4_PCB_R_ACK : ISO14443_4_PCB_R_NAK) | pnd->btIso14443_4BlockNumber;
+      pbtTx = abtTx;
+      szTx = 1;
+      continue;
+    }
+    if (res < 0)
+      return res;
+    if (!ISO14443_4_IS_S_WTX(pbtRx[0]))
+      return res;
+    if (res < 2) {
+      pnd->last_error = NFC_ERFTRANS;
+      return pnd->last_error;
+    }
+    // The PICC needs more time, it gets what it asked for: the answer to the
+    // S(WTX) response is awaited WTXM times longer. No timeout (0) stays so and
+    // the default one (-1) is only known by the driver, it is left unchanged.
+    const int wtxm = MAX(pbtRx[1] & ISO14443_4_WTXM_MASK, 1);
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Waiting time extension, WTXM %d", wtxm);
+    if (timeout > 0)
+      wait = (timeout > INT_MAX / wtxm) ? INT_MAX : timeout * wtxm;
+    abtTx[0] = ISO14443_4_PCB_S_WTX;
+    abtTx[1] = pbtRx[1] & ISO14443_4_WTXM_MASK;
+    pbtTx = abtTx;
+    szTx = 2;
+  }
+}
+
+/**
+ * @brief Send a command made of szIovTx parts to the PICC then receive its response
+ * @return Returns received bytes count on success, otherwise returns libnfc's error code
+ *
+ * The command is packed in as few I-blocks as \a szFsc allows, chained when
+ * it does not fit in one. CID and NAD are not used. The device has to send
+ * the blocks as they are, only adding and checking the CRC.
+ */
+int
+iso14443_4_transceive(nfc_device *pnd, const size_t szFsc, const nfc_iovec aiovTx[], const size_t szIovTx,
+                      uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  uint8_t abtBlock[ISO14443_4_FS_MAX];
+  uint8_t abtRx[ISO14443_4_FS_MAX];
+  const size_t szInfMax = MIN(szFsc, ISO14443_4_FS_MAX) - ISO14443_4_BLOCK_OVERHEAD;
+  size_t szTx = 0;
+  size_t szSent = 0;
+  size_t iov = 0;
+  size_t szIovOffset = 0;
+  int res;
+
+  for (size_t n = 0; n < szIovTx; n++)
+    szTx += aiovTx[n].szData;
+
+  do {
+    size_t szInf = 0;
+    while ((szInf < szInfMax) && (iov < szIovTx)) {
+      const size_t szCopy = MIN(szInfMax - szInf, aiovTx[iov].szData - szIovOffset);
+      memcpy(abtBlock + 1 + szInf, aiovTx[iov].pbtData + szIovOffset, szCopy);
+      szInf += szCopy;
+      szIovOffset += szCopy;
+      if (szIovOffset == aiovTx[iov].szData) {
+        iov++;
+        szIovOffset = 0;
+      }
+    }
+    szSent += szInf;
+    const bool bChaining = szSent < szTx;
+    abtBlock[0] = ISO14443_4_PCB_I_BLOCK | pnd->btIso14443_4BlockNumber;
+    if (bChaining)
+      abtBlock[0] |= ISO14443_4_PCB_CHAINING;
+
+    int retries = 0;
+    for (;;) {
+      if ((res = iso14443_4_exchange(pnd, abtBlock, szInf + 1, abtRx, false, timeout)) < 0)
+        return res;
+      // R(ACK) with another block number: the I-block was lost on its way
+      if (!ISO14443_4_IS_R_ACK(abtRx[0]) || ((abtRx[0] & ISO14443_4_PCB_BLOCK_NUMBER) == pnd->btIso14443_4BlockNumber))
+        break;
+      if (retries++ == ISO14443_4_RETRY_MAX) {
+        pnd->last_error = NFC_ERFTRANS;
+        return pnd->last_error;
+      }
+    }
+    if (bChaining) {
+      if (!ISO14443_4_IS_R_ACK(abtRx[0])) {
+        log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unexpected block while chaining (PCB %02x)", abtRx[0]);
+        pnd->last_error = NFC_ERFTRANS;
+        return pnd->last_error;
+      }
+      pnd->btIso14443_4BlockNumber ^= ISO14443_4_PCB_BLOCK_NUMBER;
+    }
+  } while (szSent < szTx);
+
+  // The response may be chained too, each I-block is acknowledged. What does
+  // not fit in pbtRx is still received so the PICC is left ready
+  size_t szReceived = 0;
+  bool bOverflow = false;
+  for (;;) {
+    if (!ISO14443_4_IS_I_BLOCK(abtRx[0]) || ((abtRx[0] & ISO14443_4_PCB_BLOCK_NUMBER) != pnd->btIso14443_4BlockNumber)) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Unexpected block in response (PCB %02x)", abtRx[0]);
+      pnd->last_error = NFC_ERFTRANS;
+      return pnd->last_error;
+    }
+    pnd->btIso14443_4BlockNumber ^= ISO14443_4_PCB_BLOCK_NUMBER;
+    const size_t szPart = (size_t) res - 1;
+    if (szReceived + szPart > szRx) {
+      bOverflow = true;
+    } else if (pbtRx != NULL) {
+      memcpy(pbtRx + szReceived, abtRx + 1, szPart);
+    }
+    szReceived += szPart;
+    if (!(abtRx[0] & ISO14443_4_PCB_CHAINING))
+      break;
+    abtBlock[0] = ISO14443_4_PCB_R_ACK | pnd->btIso14443_4BlockNumber;
+    if ((res = iso14443_4_exchange(pnd, abtBlock, 1, abtRx, true, timeout)) < 0)
+      return res;
+  }
+  if (bOverflow) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "Buffer size is too short: %zuo available(s), %zuo needed", szRx, szReceived);
+    pnd->last_error = NFC_EOVFLOW;
+    return pnd->last_error;
+  }
+  return szReceived;
+}
@@ -0,0 +1,48 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+* @file iso14443-4.h
+* @brief Defines some macros extracted for ISO/IEC 14443-4 block transmission protocol
+*/
+
+#ifndef __LIBNFC_ISO14443_4_H__
+#define __LIBNFC_ISO14443_4_H__
+
+// Protocol Control Byte
+#define ISO14443_4_PCB_I_BLOCK          0x02
+#define ISO14443_4_PCB_R_ACK            0xa2
+#define ISO14443_4_PCB_R_NAK            0xb2
+#define ISO14443_4_PCB_S_WTX            0xf2
+#define ISO14443_4_PCB_CHAINING         0x10
+#define ISO14443_4_PCB_BLOCK_NUMBER     0x01
+
+#define ISO14443_4_IS_I_BLOCK(pcb)      (((pcb) & 0xe6) == ISO14443_4_PCB_I_BLOCK)
+#define ISO14443_4_IS_R_ACK(pcb)        (((pcb) & 0xf6) == ISO14443_4_PCB_R_ACK)
+#define ISO14443_4_IS_S_WTX(pcb)        (((pcb) & 0xf7) == ISO14443_4_PCB_S_WTX)
+
+// Waiting time extension multiplier, upper bits carry the power level indication
+#define ISO14443_4_WTXM_MASK            0x3f
+
+// PCB and CRC_A/CRC_B surround the information field
+#define ISO14443_4_BLOCK_OVERHEAD       3
+// Frame size for FSCI (and FSDI) 8, higher values are RFU in ISO/IEC 14443-4:2008
+#define ISO14443_4_FS_MAX               256
+// Frame size when the PICC did not tell, FSCI 2
+#define ISO14443_4_FSC_DEFAULT          32
+
+#endif /* !__LIBNFC_ISO14443_4_H__ */
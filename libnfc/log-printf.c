@@ -25,21 +25,51 @@
 #include <stdarg.h>
 #include <fcntl.h>
 
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
 #ifndef LOG
 // Leaving in a preprocessor error, as the build system should skip this
 // file otherwise.
 #error "No logging defined, but log-printf.c still compiled."
 #else // LOG
 
+#ifndef _WIN32
+// Each thread may be quiet
+static pthread_once_t log_quiet_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_quiet_key;
+#else
+static bool log_quiet_flag = false;
+#endif
+
+// Every group at the default level until a context is initialized
+#ifdef DEBUG
+uint32_t log_priorities = 0x00000fff;
+#else
+uint32_t log_priorities = 0x00000555;
+#endif
+
+#ifndef _WIN32
+static void
+log_quiet_key_create(void)
+{
+  pthread_key_create(&log_quiet_key, NULL);
+}
+#endif
+
+/*
+ * The log level is process-wide: the bus code logs without any context at
+ * hand, so the level of the last initialized context applies to all of them.
+ */
 void
 log_init(const nfc_context *context)
 {
-#ifdef ENVVARS
-  char str[32];
-  sprintf(str, "%"PRIu32, context->log_level);
-  setenv("LIBNFC_LOG_LEVEL", str, 1);
+  const uint32_t priorities = log_priorities_from_level(context->log_level);
+#if defined(__GNUC__)
+  __atomic_store_n(&log_priorities, priorities, __ATOMIC_RELAXED);
 #else
-  (void)context;
+  log_priorities = priorities;
 #endif
 }
 
@@ -49,36 +79,41 @@ log_exit(void)
 }
 
 void
-log_put(const uint8_t group, const char *category, const uint8_t priority, const char *format, ...)
+log_set_quiet(const bool quiet)
 {
-  char *env_log_level = NULL;
-#ifdef ENVVARS
-  env_log_level = getenv("LIBNFC_LOG_LEVEL");
+#ifndef _WIN32
+  pthread_once(&log_quiet_once, log_quiet_key_create);
+  pthread_setspecific(log_quiet_key, quiet ? &log_quiet_key : NULL);
+#else
+  log_quiet_flag = quiet;
 #endif
-  uint32_t log_level;
-  if (NULL == env_log_level) {
-    // LIBNFC_LOG_LEVEL is not set
-#ifdef DEBUG
-    log_level = 3;
+}
+
+static bool
+log_is_quiet(void)
+{
+#ifndef _WIN32
+  pthread_once(&log_quiet_once, log_quiet_key_create);
+  return pthread_getspecific(log_quiet_key) != NULL;
 #else
-    log_level = 1;
+  return log_quiet_flag;
 #endif
-  } else {
-    log_level = atoi(env_log_level);
-  }
+}
+
+// log_put() only calls it once the priority is known to be logged
+void
+log_put_message(const uint8_t group, const char *category, const uint8_t priority, const char *format, ...)
+{
+  (void) group;
+  if (log_is_quiet())
+    return;
 
-  //  printf("log_level = %"PRIu32" group = %"PRIu8" priority = %"PRIu8"\n", log_level, group, priority);
-  if (log_level) { // If log is not disabled by log_level=none
-    if (((log_level & 0x00000003) >= priority) ||   // Global log level
-        (((log_level >> (group * 2)) & 0x00000003) >= priority)) { // Group log level
-      va_list va;
-      va_start(va, format);
-      fprintf(stderr, "%s\t%s\t", log_priority_to_str(priority), category);
-      vfprintf(stderr, format, va);
-      fprintf(stderr, "\n");
-      va_end(va);
-    }
-  }
+  va_list va;
+  va_start(va, format);
+  fprintf(stderr, "%s\t%s\t", log_priority_to_str(priority), category);
+  vfprintf(stderr, format, va);
+  fprintf(stderr, "\n");
+  va_end(va);
 }
 
 #endif // LOG
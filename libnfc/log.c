@@ -70,3 +70,21 @@ log_priority_to_str(const int priority)
   return "unknown";
 }
 
+
+/*
+ * Each group gets the highest of its own priority and the global one, so a
+ * single lookup tells whether a message is printed. log_level=none gives 0.
+ */
+uint32_t
+log_priorities_from_level(const uint32_t log_level)
+{
+  uint32_t priorities = 0;
+
+  if (!log_level)
+    return 0;
+  for (uint32_t group = 0; group <= NFC_LOG_GROUP_COM; group++) {
+    const uint32_t priority = MAX(log_level & 0x00000003, (log_level >> (group * 2)) & 0x00000003);
+    priorities |= priority << (group * 2);
+  }
+  return priorities;
+}
@@ -52,6 +52,9 @@
 //int log_priority_to_int(const char* priority);
 const char *log_priority_to_str(const int priority);
 
+// Highest priority logged for each group, resolved from a log level
+uint32_t log_priorities_from_level(const uint32_t log_level);
+
 #if defined LOG
 
 #  ifndef __has_attribute
@@ -64,16 +67,50 @@ const char *log_priority_to_str(const int priority);
 
 void log_init(const nfc_context *context);
 void log_exit(void);
-void log_put(const uint8_t group, const char *category, const uint8_t priority, const char *format, ...)
+// Drop the messages of the calling thread until it is turned off
+void log_set_quiet(const bool quiet);
+void log_put_message(const uint8_t group, const char *category, const uint8_t priority, const char *format, ...)
 #  if __has_attribute_format
 __attribute__((format(printf, 4, 5)))
 #  endif
 ;
 
+// Process-wide priorities, from the log_level of the last initialized
+// context, 2 bits per group like log_level
+extern uint32_t log_priorities;
+
+#  if defined(__GNUC__)
+#    define log_load_priorities() __atomic_load_n(&log_priorities, __ATOMIC_RELAXED)
+#  else
+#    define log_load_priorities() (log_priorities)
+#  endif
+
+/*
+ * Tell whether a message would be printed, before anything is formatted.
+ * With LOG_NO_DEBUG, debug messages are compiled out.
+ */
+#  if defined LOG_NO_DEBUG
+#    define log_enabled(group, priority) \
+  (((priority) < NFC_LOG_PRIORITY_DEBUG) && log_priority_enabled(group, priority))
+#  else
+#    define log_enabled(group, priority) log_priority_enabled(group, priority)
+#  endif
+#  define log_priority_enabled(group, priority) \
+  (((priority) > NFC_LOG_PRIORITY_NONE) ? \
+   (((log_load_priorities() >> ((group) * 2)) & 0x00000003) >= (uint32_t)(priority)) : \
+   (log_load_priorities() != 0))
+
+// The arguments are only evaluated when the message is printed
+#  define log_put(group, category, priority, ...) do { \
+    if (log_enabled(group, priority)) \
+      log_put_message(group, category, priority, __VA_ARGS__); \
+  } while (0)
+
 #else
 // No logging
 #define log_init(nfc_context) ((void) 0)
 #define log_exit() ((void) 0)
+#define log_set_quiet(quiet) ((void) 0)
 #define log_put(group, category, priority, format, ...) do {} while (0)
 
 #endif // LOG
@@ -88,6 +125,8 @@ __attribute__((format(printf, 4, 5)))
     size_t	 __szPos; \
     char	 __acBuf[1024]; \
     size_t	 __szBuf = 0; \
+    if (!log_enabled(group, NFC_LOG_PRIORITY_DEBUG)) \
+      break; \
     if ((int)szBytes < 0) { \
       fprintf (stderr, "%s:%d: Attempt to print %d bytes!\n", __FILE__, __LINE__, (int)szBytes); \
       log_put (group, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s:%d: Attempt to print %d bytes!\n", __FILE__, __LINE__, (int)szBytes); \
@@ -96,11 +135,13 @@ __attribute__((format(printf, 4, 5)))
     } \
     snprintf (__acBuf + __szBuf, sizeof(__acBuf) - __szBuf, "%s: ", pcTag); \
     __szBuf += strlen (pcTag) + 2; \
-    for (__szPos=0; (__szPos < (size_t)(szBytes)) && (__szBuf < sizeof(__acBuf)); __szPos++) { \
-      snprintf (__acBuf + __szBuf, sizeof(__acBuf) - __szBuf, "%02x ",((uint8_t *)(pbtData))[__szPos]); \
-      __szBuf += 3; \
+    for (__szPos=0; (__szPos < (size_t)(szBytes)) && (__szBuf + 4 <= sizeof(__acBuf)); __szPos++) { \
+      __acBuf[__szBuf++] = "0123456789abcdef"[((uint8_t *)(pbtData))[__szPos] >> 4]; \
+      __acBuf[__szBuf++] = "0123456789abcdef"[((uint8_t *)(pbtData))[__szPos] & 0x0f]; \
+      __acBuf[__szBuf++] = ' '; \
     } \
-    log_put (group, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", __acBuf); \
+    __acBuf[__szBuf] = '\0'; \
+    log_put_message (group, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", __acBuf); \
   } while (0);
 #  else
 #    define LOG_HEX(group, pcTag, pbtData, szBytes) do { \
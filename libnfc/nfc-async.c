@@ -0,0 +1,661 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-async.c
+ * @brief Asynchronous requests, queued per device and run by its I/O thread or the caller's event loop
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <pthread.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+
+#define LOG_CATEGORY "libnfc.async"
+#define LOG_GROUP    NFC_LOG_GROUP_GENERAL
+
+struct nfc_async_request {
+  struct nfc_async_request *next;
+  /** Is the request for a given target (nt) */
+  bool bTarget;
+  nfc_target nt;
+  uint8_t *pbtRx;
+  size_t szRx;
+  int timeout;
+  nfc_completion_cb cb;
+  nfc_completion completion;
+  size_t szTx;
+  uint8_t abtTx[];
+};
+
+struct nfc_async_queue {
+  struct nfc_async_request *head;
+  struct nfc_async_request **tail;
+};
+
+/*
+ * Requests are run one after the other by the I/O thread, the completions
+ * without callback wait in the completion queue. Without POSIX threads
+ * (Windows) requests are run when submitted.
+ *
+ * In event mode, when the driver can run a request without waiting for the
+ * device, there is no I/O thread: the driver starts the request and carries
+ * it on each time nfc_device_process_events() is called, so one thread can
+ * serve as many devices as it can poll.
+ */
+struct nfc_async {
+#ifndef _WIN32
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  /** Signaled when a request is submitted or the thread has to stop */
+  pthread_cond_t submitted_cond;
+  /** Signaled when a completion is queued */
+  pthread_cond_t completed_cond;
+  /** Pipe holding one byte per queued completion, its read end is the pollable fd */
+  int pollfd[2];
+#endif
+  struct nfc_async_queue submitted;
+  struct nfc_async_queue completed;
+  /** A request is being run */
+  bool bBusy;
+  bool bStop;
+  /** Requests are run by the driver from nfc_device_process_events() */
+  bool bEvents;
+  /** Request the driver is running, in event mode */
+  struct nfc_async_request *current;
+};
+
+#ifndef _WIN32
+#  define nfc_async_lock(pa) pthread_mutex_lock(&(pa)->mutex)
+#  define nfc_async_unlock(pa) pthread_mutex_unlock(&(pa)->mutex)
+#else
+#  define nfc_async_lock(pa)
+#  define nfc_async_unlock(pa)
+#endif
+
+static void
+nfc_async_queue_init(struct nfc_async_queue *pq)
+{
+  pq->head = NULL;
+  pq->tail = &(pq->head);
+}
+
+static void
+nfc_async_queue_push(struct nfc_async_queue *pq, struct nfc_async_request *pr)
+{
+  pr->next = NULL;
+  *(pq->tail) = pr;
+  pq->tail = &(pr->next);
+}
+
+static struct nfc_async_request *
+nfc_async_queue_pop(struct nfc_async_queue *pq)
+{
+  struct nfc_async_request *pr = pq->head;
+  if (pr) {
+    pq->head = pr->next;
+    if (!pq->head)
+      pq->tail = &(pq->head);
+  }
+  return pr;
+}
+
+// Hand the outcome of a request over, called without the lock held
+static void
+nfc_async_complete(nfc_device *pnd, struct nfc_async_request *pr, const int res)
+{
+  struct nfc_async *pa = pnd->async;
+
+  pr->completion.res = res;
+  if (pr->cb) {
+    pr->cb(pnd, &(pr->completion));
+    free(pr);
+    return;
+  }
+  nfc_async_lock(pa);
+  nfc_async_queue_push(&(pa->completed), pr);
+#ifndef _WIN32
+  // A full pipe is readable anyway
+  const uint8_t btEvent = 0;
+  if (!pa->bEvents && (write(pa->pollfd[1], &btEvent, 1) < 0))
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Completion pipe is full");
+  pthread_cond_broadcast(&pa->completed_cond);
+#endif
+  nfc_async_unlock(pa);
+}
+
+static int
+nfc_async_run(nfc_device *pnd, struct nfc_async_request *pr)
+{
+  if (pr->bTarget)
+    return nfc_initiator_target_transceive_bytes(pnd, &(pr->nt), pr->abtTx, pr->szTx, pr->pbtRx, pr->szRx, pr->timeout);
+  return nfc_initiator_transceive_bytes(pnd, pr->abtTx, pr->szTx, pr->pbtRx, pr->szRx, pr->timeout);
+}
+
+#ifndef _WIN32
+static void *
+nfc_async_thread(void *arg)
+{
+  nfc_device *pnd = arg;
+  struct nfc_async *pa = pnd->async;
+
+  nfc_async_lock(pa);
+  for (;;) {
+    while (!pa->submitted.head && !pa->bStop)
+      pthread_cond_wait(&pa->submitted_cond, &pa->mutex);
+    struct nfc_async_request *pr = nfc_async_queue_pop(&(pa->submitted));
+    if (!pr)
+      break;
+    // Requests still queued when the device is closed are not run
+    const bool bRun = !pa->bStop;
+    pa->bBusy = bRun;
+    nfc_async_unlock(pa);
+    const int res = bRun ? nfc_async_run(pnd, pr) : NFC_EOPABORTED;
+    nfc_async_complete(pnd, pr, res);
+    nfc_async_lock(pa);
+    pa->bBusy = false;
+  }
+  nfc_async_unlock(pa);
+  return NULL;
+}
+#endif
+
+// Whether the driver can run the requests of the device from the caller's event loop
+static bool
+nfc_async_has_events(nfc_device *pnd)
+{
+  return pnd->driver->device_get_pollfd && pnd->driver->initiator_transceive_bytes_submit &&
+         pnd->driver->device_process_events && (pnd->driver->device_get_pollfd(pnd) >= 0);
+}
+
+// Have the driver start a request, in event mode
+static int
+nfc_async_start_request(nfc_device *pnd, struct nfc_async_request *pr)
+{
+  return pnd->driver->initiator_transceive_bytes_submit(pnd, pr->bTarget ? &(pr->nt) : NULL, pr->abtTx, pr->szTx,
+                                                        pr->pbtRx, pr->szRx, pr->timeout);
+}
+
+/*
+ * Carry the running request on, in event mode, and start the next queued
+ * ones as it gets done. With bAbort they are all completed with
+ * NFC_EOPABORTED instead. The completions are handed to cb when the request
+ * has no callback of its own and cb is given, otherwise as usual.
+ */
+static int
+nfc_async_process(nfc_device *pnd, const bool bAbort, nfc_completion_cb cb)
+{
+  struct nfc_async *pa = pnd->async;
+  struct nfc_async_queue finished;
+  struct nfc_async_request *pr;
+  int count = 0;
+  int res;
+
+  nfc_async_queue_init(&finished);
+  nfc_device_lock(pnd);
+  nfc_async_lock(pa);
+  for (;;) {
+    if (pa->current) {
+      bool bDone;
+      res = pnd->driver->device_process_events(pnd, bAbort, &bDone);
+      if (!bDone)
+        break;
+      pa->current->completion.res = res;
+      nfc_async_queue_push(&finished, pa->current);
+      pa->current = NULL;
+    }
+    // The next request is started before the callbacks are called, they may submit new ones
+    if (!(pr = nfc_async_queue_pop(&(pa->submitted))))
+      break;
+    if ((res = bAbort ? NFC_EOPABORTED : nfc_async_start_request(pnd, pr)) < 0) {
+      pr->completion.res = res;
+      nfc_async_queue_push(&finished, pr);
+    } else {
+      pa->current = pr;
+    }
+  }
+  nfc_async_unlock(pa);
+  nfc_device_unlock(pnd);
+
+  while ((pr = nfc_async_queue_pop(&finished))) {
+    if (!pr->cb && cb) {
+      cb(pnd, &(pr->completion));
+      free(pr);
+    } else {
+      nfc_async_complete(pnd, pr, pr->completion.res);
+    }
+    count++;
+  }
+  return count;
+}
+
+// Set the asynchronous machinery of a device up, on its first request
+static int
+nfc_async_start(nfc_device *pnd, const bool bEvents)
+{
+  struct nfc_async *pa = malloc(sizeof(struct nfc_async));
+  if (!pa) {
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  nfc_async_queue_init(&(pa->submitted));
+  nfc_async_queue_init(&(pa->completed));
+  pa->bBusy = false;
+  pa->bStop = false;
+  pa->bEvents = bEvents;
+  pa->current = NULL;
+#ifndef _WIN32
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&pa->mutex, NULL);
+  pthread_cond_init(&pa->submitted_cond, NULL);
+  pthread_cond_init(&pa->completed_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  if (bEvents) {
+    pnd->async = pa;
+    return NFC_SUCCESS;
+  }
+  if (pipe(pa->pollfd) < 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to create the completion pipe");
+    pthread_cond_destroy(&pa->completed_cond);
+    pthread_cond_destroy(&pa->submitted_cond);
+    pthread_mutex_destroy(&pa->mutex);
+    free(pa);
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(pa->pollfd[i], F_SETFL, fcntl(pa->pollfd[i], F_GETFL) | O_NONBLOCK);
+    fcntl(pa->pollfd[i], F_SETFD, FD_CLOEXEC);
+  }
+  pnd->async = pa;
+  if (pthread_create(&pa->thread, NULL, nfc_async_thread, pnd) != 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to start the I/O thread");
+    close(pa->pollfd[0]);
+    close(pa->pollfd[1]);
+    pthread_cond_destroy(&pa->completed_cond);
+    pthread_cond_destroy(&pa->submitted_cond);
+    pthread_mutex_destroy(&pa->mutex);
+    free(pa);
+    pnd->async = NULL;
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+#else
+  pnd->async = pa;
+#endif
+  return NFC_SUCCESS;
+}
+
+/*
+ * Stop the I/O thread of a device: the running request is aborted, the queued
+ * ones are completed with NFC_EOPABORTED and the completions nobody got are
+ * dropped.
+ */
+void
+nfc_async_free(nfc_device *pnd)
+{
+  struct nfc_async *pa = pnd->async;
+  if (!pa)
+    return;
+
+#ifndef _WIN32
+  if (pa->bEvents) {
+    // Only the caller's event loop runs the requests, they are aborted from here
+    nfc_async_process(pnd, true, NULL);
+  } else {
+    nfc_async_lock(pa);
+    pa->bStop = true;
+    const bool bBusy = pa->bBusy;
+    pthread_cond_broadcast(&pa->submitted_cond);
+    nfc_async_unlock(pa);
+    if (bBusy)
+      nfc_abort_command(pnd);
+    pthread_join(pa->thread, NULL);
+    close(pa->pollfd[0]);
+    close(pa->pollfd[1]);
+  }
+  pthread_cond_destroy(&pa->completed_cond);
+  pthread_cond_destroy(&pa->submitted_cond);
+  pthread_mutex_destroy(&pa->mutex);
+#endif
+  struct nfc_async_request *pr;
+  while ((pr = nfc_async_queue_pop(&(pa->completed))))
+    free(pr);
+  free(pa);
+  pnd->async = NULL;
+}
+
+static int
+nfc_async_submit(nfc_device *pnd, const bool bEvents, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                 uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data)
+{
+  int res;
+
+  // last_error is left alone, the I/O thread may be using it
+  if (!pnd->async && ((res = nfc_async_start(pnd, bEvents && nfc_async_has_events(pnd))) < 0))
+    return res;
+
+  // The data to send is kept with the request, the caller may reuse its buffer
+  struct nfc_async_request *pr = malloc(sizeof(struct nfc_async_request) + szTx);
+  if (!pr) {
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  pr->bTarget = (pnt != NULL);
+  if (pnt)
+    memcpy(&(pr->nt), pnt, sizeof(nfc_target));
+  pr->pbtRx = pbtRx;
+  pr->szRx = szRx;
+  pr->timeout = timeout;
+  pr->cb = cb;
+  pr->completion.res = 0;
+  pr->completion.pbtRx = pbtRx;
+  pr->completion.user_data = user_data;
+  pr->szTx = szTx;
+  if (szTx)
+    memcpy(pr->abtTx, pbtTx, szTx);
+
+#ifndef _WIN32
+  struct nfc_async *pa = pnd->async;
+  if (pa->bEvents) {
+    // Nothing runs when nothing is queued: the request is started at once
+    res = NFC_SUCCESS;
+    nfc_device_lock(pnd);
+    nfc_async_lock(pa);
+    if (pa->current) {
+      nfc_async_queue_push(&(pa->submitted), pr);
+    } else if ((res = nfc_async_start_request(pnd, pr)) < 0) {
+      free(pr);
+    } else {
+      pa->current = pr;
+    }
+    nfc_async_unlock(pa);
+    nfc_device_unlock(pnd);
+    return res;
+  }
+  nfc_async_lock(pa);
+  nfc_async_queue_push(&(pa->submitted), pr);
+  pthread_cond_signal(&pa->submitted_cond);
+  nfc_async_unlock(pa);
+#else
+  nfc_async_complete(pnd, pr, nfc_async_run(pnd, pr));
+#endif
+  return NFC_SUCCESS;
+}
+
+/** @ingroup initiator
+ * @brief Queue a nfc_initiator_transceive_bytes() request, to be run by the I/O thread of the device
+ * @return Returns 0 once the request is queued, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pbtTx contains a byte array of the frame that needs to be transmitted, copied before this function returns
+ * @param szTx contains the length in bytes.
+ * @param[out] pbtRx response from the target, has to stay available until the request is completed
+ * @param szRx size of \a pbtRx
+ * @param timeout in milliseconds, as for nfc_initiator_transceive_bytes()
+ * @param cb function called with the outcome, NULL to put it in the completion queue of the device instead
+ * @param user_data given back with the outcome
+ *
+ * Requests are run in the order they were queued. The callback is called from
+ * the I/O thread and should return quickly: the next request waits for it.
+ * Outcomes put in the completion queue are read with nfc_device_get_completion(),
+ * meanwhile the I/O thread already runs the next request.
+ * When the device already runs its requests from an event loop (see
+ * nfc_device_submit()), the request is queued there instead.
+ *
+ * @warning While requests are pending, no other function but nfc_abort_command()
+ * and nfc_device_get_completion() should be called on the device.
+ * Closing the device completes the pending requests with NFC_EOPABORTED.
+ */
+int
+nfc_initiator_transceive_bytes_async(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx,
+                                     const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data)
+{
+  return nfc_async_submit(pnd, false, NULL, pbtTx, szTx, pbtRx, szRx, timeout, cb, user_data);
+}
+
+/** @ingroup initiator
+ * @brief Queue a nfc_initiator_target_transceive_bytes() request, to be run by the I/O thread of the device
+ * @return Returns 0 once the request is queued, otherwise returns libnfc's error code
+ *
+ * @param pnt target to talk to, copied before this function returns
+ *
+ * The other parameters are the ones of nfc_initiator_transceive_bytes_async().
+ */
+int
+nfc_initiator_target_transceive_bytes_async(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                            uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data)
+{
+  if (!pnt) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  return nfc_async_submit(pnd, false, pnt, pbtTx, szTx, pbtRx, szRx, timeout, cb, user_data);
+}
+
+/** @ingroup initiator
+ * @brief Queue a transceive request, to be run from the caller's event loop
+ * @return Returns 0 once the request is queued, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnt target to talk to as nfc_initiator_target_transceive_bytes() does, copied before this function returns, or NULL to do as nfc_initiator_transceive_bytes()
+ *
+ * The other parameters are the ones of nfc_initiator_transceive_bytes_async().
+ *
+ * When the driver can run a request without waiting for the device (ie.
+ * pn532_uart on POSIX systems), there is no I/O thread: the command is sent
+ * when the request is started and its response is received by
+ * nfc_device_process_events(), which is to be called when the file descriptor
+ * given by nfc_device_get_pollfd() is readable or when the delay given by
+ * nfc_device_get_event_timeout() is over. One thread can so serve hundreds of
+ * devices with poll(), epoll, etc. The callbacks are called from
+ * nfc_device_process_events().
+ *
+ * Otherwise the request is run by the I/O thread of the device, as with
+ * nfc_initiator_transceive_bytes_async().
+ *
+ * @note Starting a request may still wait for the device when a setting
+ * changed since the previous one, or when the PN532 has to be woken up.
+ * nfc_abort_command() does not abort requests run from an event loop, closing
+ * the device does.
+ */
+int
+nfc_device_submit(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                  uint8_t *pbtRx, const size_t szRx, int timeout, nfc_completion_cb cb, void *user_data)
+{
+  return nfc_async_submit(pnd, true, pnt, pbtTx, szTx, pbtRx, szRx, timeout, cb, user_data);
+}
+
+/** @ingroup dev
+ * @brief Get the outcome of an asynchronous request queued without callback
+ * @return Returns 1 when \a pc is filled, 0 when no request got completed in time
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param[out] pc outcome of the oldest completed request
+ * @param timeout in milliseconds, 0 waits as long as needed and a negative value does not wait
+ *
+ * In event mode (see nfc_device_submit()) the requests are carried on while
+ * waiting.
+ */
+int
+nfc_device_get_completion(nfc_device *pnd, nfc_completion *pc, int timeout)
+{
+  struct nfc_async *pa = pnd->async;
+  if (!pa)
+    return 0;
+
+#ifndef _WIN32
+  if (pa->bEvents) {
+    const uint64_t deadline = nfc_trace_now() + (uint64_t)((timeout > 0) ? timeout : 0) * 1000000ULL;
+    struct pollfd pfd = { .fd = pnd->driver->device_get_pollfd(pnd), .events = POLLIN };
+    for (;;) {
+      nfc_async_process(pnd, false, NULL);
+      nfc_async_lock(pa);
+      const bool bCompleted = (pa->completed.head != NULL);
+      const bool bRunning = (pa->current != NULL);
+      nfc_async_unlock(pa);
+      if (bCompleted || !bRunning || (timeout < 0))
+        break;
+      int wait = nfc_device_get_event_timeout(pnd);
+      if (timeout > 0) {
+        const uint64_t now = nfc_trace_now();
+        if (now >= deadline)
+          break;
+        const int left = (int)((deadline - now + 999999) / 1000000);
+        if ((wait < 0) || (left < wait))
+          wait = left;
+      }
+      if ((poll(&pfd, 1, wait) < 0) && (errno != EINTR))
+        break;
+    }
+    timeout = -1;
+  }
+#endif
+
+  nfc_async_lock(pa);
+#ifndef _WIN32
+  struct timespec deadline;
+  if (timeout > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  while (!pa->completed.head && (timeout >= 0)) {
+    if (timeout == 0) {
+      pthread_cond_wait(&pa->completed_cond, &pa->mutex);
+    } else if (pthread_cond_timedwait(&pa->completed_cond, &pa->mutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+#endif
+  struct nfc_async_request *pr = nfc_async_queue_pop(&(pa->completed));
+#ifndef _WIN32
+  uint8_t btEvent;
+  if (pr && !pa->bEvents && (read(pa->pollfd[0], &btEvent, 1) < 0))
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%s", "Completion pipe is empty");
+#endif
+  nfc_async_unlock(pa);
+  if (!pr)
+    return 0;
+  *pc = pr->completion;
+  free(pr);
+  return 1;
+}
+
+/** @ingroup dev
+ * @brief File descriptor to wait on for the completions of asynchronous requests
+ * @return Returns a file descriptor, otherwise returns libnfc's error code (negative value)
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ *
+ * The file descriptor can be added to a poll(), epoll or io_uring event loop
+ * serving many devices from one thread. When it is readable,
+ * nfc_device_process_events() handles what happened without blocking. It
+ * must not be read nor closed by the caller, it stays valid until the device
+ * is closed.
+ *
+ * In event mode (see nfc_device_submit()), which is used when the driver
+ * allows it and no asynchronous request was queued before, it is the file
+ * descriptor of the device itself. Otherwise it is readable as long as
+ * completions wait in the completion queue of the device, the requests being
+ * run by the I/O thread of the device.
+ */
+int
+nfc_device_get_pollfd(nfc_device *pnd)
+{
+#ifndef _WIN32
+  int res;
+  if (!pnd->async && ((res = nfc_async_start(pnd, nfc_async_has_events(pnd))) < 0))
+    return res;
+  if (pnd->async->bEvents)
+    return pnd->driver->device_get_pollfd(pnd);
+  return pnd->async->pollfd[0];
+#else
+  pnd->last_error = NFC_ENOTIMPL;
+  return pnd->last_error;
+#endif
+}
+
+/** @ingroup dev
+ * @brief Delay after which nfc_device_process_events() is to be called anyway
+ * @return Returns a delay in milliseconds, -1 when there is none
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ *
+ * In event mode (see nfc_device_submit()) the running request times out when
+ * the device stays silent: the delay is meant to be given to poll() or taken
+ * in account for the timeout of the event loop.
+ */
+int
+nfc_device_get_event_timeout(nfc_device *pnd)
+{
+  struct nfc_async *pa = pnd->async;
+  if (!pa || !pa->bEvents || !pnd->driver->device_get_event_timeout)
+    return -1;
+  nfc_device_lock(pnd);
+  const int res = pnd->driver->device_get_event_timeout(pnd);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
+/** @ingroup dev
+ * @brief Hand the waiting completions over to a function, from the calling thread
+ * @return Returns the number of completions handled
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param cb function called with each completion without callback of its own, oldest first
+ *
+ * This never blocks, it is meant to be called when the file descriptor given
+ * by nfc_device_get_pollfd() is readable. In event mode (see
+ * nfc_device_submit()) it also receives what the device sent, completes the
+ * running request when it is done and starts the next one.
+ */
+int
+nfc_device_process_events(nfc_device *pnd, nfc_completion_cb cb)
+{
+  nfc_completion completion;
+  int count = 0;
+
+  if (pnd->async && pnd->async->bEvents)
+    count = nfc_async_process(pnd, false, cb);
+
+  while (nfc_device_get_completion(pnd, &completion, -1) == 1) {
+    cb(pnd, &completion);
+    count++;
+  }
+  return count;
+}
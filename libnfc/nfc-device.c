@@ -23,13 +23,13 @@
  * @brief Provide internal function to manipulate nfc_device type
  */
 
-#include <stdlib.h>
-#include <string.h>
-
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
 #endif // HAVE_CONFIG_H
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "nfc-internal.h"
 
 nfc_device *
@@ -52,10 +52,25 @@ nfc_device_new(const nfc_context *context, const nfc_connstring connstring)
   res->bPar = false;
   res->bEasyFraming    = false;
   res->bAutoIso14443_4 = false;
+  res->bAutoPps        = false;
+  res->btIso14443_4BlockNumber = 0;
   res->last_error  = 0;
   memcpy(res->connstring, connstring, sizeof(res->connstring));
   res->driver_data = NULL;
   res->chip_data   = NULL;
+  res->async       = NULL;
+  res->monitor     = NULL;
+  memset(&res->trace, 0, sizeof(res->trace));
+  memset(&res->stats, 0, sizeof(res->stats));
+
+#ifndef _WIN32
+  // The chip code takes it again when a command needs another one first
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&res->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+#endif
 
   return res;
 }
@@ -64,7 +79,35 @@ void
 nfc_device_free(nfc_device *dev)
 {
   if (dev) {
+#ifndef _WIN32
+    pthread_mutex_destroy(&dev->lock);
+#endif
     free(dev->driver_data);
     free(dev);
   }
 }
+
+/*
+ * Keep other threads away from the device during a call of the API. The lock
+ * is recursive, so calls made from inside another call go through. Aborting a
+ * command does not take the lock.
+ */
+void
+nfc_device_lock(nfc_device *dev)
+{
+#ifndef _WIN32
+  pthread_mutex_lock(&dev->lock);
+#else
+  (void) dev;
+#endif
+}
+
+void
+nfc_device_unlock(nfc_device *dev)
+{
+#ifndef _WIN32
+  pthread_mutex_unlock(&dev->lock);
+#else
+  (void) dev;
+#endif
+}
@@ -24,6 +24,7 @@
 
 #include <nfc/nfc.h>
 #include "nfc-internal.h"
+#include "drivers.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -33,6 +34,11 @@
 #include "conf.h"
 #endif
 
+#if defined(DRIVER_PN53X_USB_ENABLED) || defined(DRIVER_ACR122_USB_ENABLED)
+#  define USB_DRIVERS_ENABLED
+#  include "buses/usbbus.h"
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
@@ -79,6 +85,7 @@ nfc_context_new(void)
 #else
   res->log_level = 1;
 #endif
+  res->uart_max_speed = 0;
 
   // Clear user defined devices array
   for (int i = 0; i < MAX_USER_DEFINED_DEVICES; i++) {
@@ -88,6 +95,15 @@ nfc_context_new(void)
   }
   res->user_defined_device_count = 0;
 
+#ifdef USB_DRIVERS_ENABLED
+  // Devices are enumerated when first listed
+  res->usb_registry = usbbus_registry_new();
+#else
+  res->usb_registry = NULL;
+#endif
+  res->driver_list = NULL;
+  res->next = NULL;
+
 #ifdef ENVVARS
   // Load user defined device from environment variable at first
   char *envvar = getenv("LIBNFC_DEFAULT_DEVICE");
@@ -128,6 +144,7 @@ nfc_context_new(void)
 #endif
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "allow_autoscan is set to %s", (res->allow_autoscan) ? "true" : "false");
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "allow_intrusive_scan is set to %s", (res->allow_intrusive_scan) ? "true" : "false");
+  log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "uart_max_speed is set to %"PRIu32, res->uart_max_speed);
 
   log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "%d device(s) defined by user", res->user_defined_device_count);
   for (uint32_t i = 0; i < res->user_defined_device_count; i++) {
@@ -139,6 +156,15 @@ nfc_context_new(void)
 void
 nfc_context_free(nfc_context *context)
 {
+#ifdef USB_DRIVERS_ENABLED
+  if (context->usb_registry)
+    usbbus_registry_free(context->usb_registry);
+#endif
+  while (context->driver_list) {
+    struct nfc_driver_list *pndl = (struct nfc_driver_list *) context->driver_list;
+    context->driver_list = pndl->next;
+    free(pndl);
+  }
   log_exit();
   free(context);
 }
@@ -185,3 +211,60 @@ prepare_initiator_data(const nfc_modulation nm, uint8_t **ppbtInitiatorData, siz
       break;
   }
 }
+
+/*
+ * FNV-1a hash of the identifier of a target (UID, PUPI, NFCID2...), enough to
+ * tell apart the targets found in the field.
+ */
+uint32_t
+target_uid_hash(const nfc_target *pnt)
+{
+  const uint8_t *pbtUid;
+  size_t szUid;
+
+  switch (pnt->nm.nmt) {
+    case NMT_ISO14443A:
+      pbtUid = pnt->nti.nai.abtUid;
+      szUid = pnt->nti.nai.szUidLen;
+      break;
+    case NMT_ISO14443B:
+      pbtUid = pnt->nti.nbi.abtPupi;
+      szUid = sizeof(pnt->nti.nbi.abtPupi);
+      break;
+    case NMT_ISO14443BI:
+      pbtUid = pnt->nti.nii.abtDIV;
+      szUid = sizeof(pnt->nti.nii.abtDIV);
+      break;
+    case NMT_ISO14443B2SR:
+      pbtUid = pnt->nti.nsi.abtUID;
+      szUid = sizeof(pnt->nti.nsi.abtUID);
+      break;
+    case NMT_ISO14443B2CT:
+      pbtUid = pnt->nti.nci.abtUID;
+      szUid = sizeof(pnt->nti.nci.abtUID);
+      break;
+    case NMT_FELICA:
+      pbtUid = pnt->nti.nfi.abtId;
+      szUid = sizeof(pnt->nti.nfi.abtId);
+      break;
+    case NMT_JEWEL:
+      pbtUid = pnt->nti.nji.btId;
+      szUid = sizeof(pnt->nti.nji.btId);
+      break;
+    case NMT_DEP:
+    default:
+      pbtUid = pnt->nti.ndi.abtNFCID3;
+      szUid = sizeof(pnt->nti.ndi.abtNFCID3);
+      break;
+  }
+
+  uint32_t hash = 2166136261u ^ pnt->nm.nmt;
+  hash *= 16777619u;
+  hash ^= szUid;
+  hash *= 16777619u;
+  for (size_t n = 0; n < szUid; n++) {
+    hash ^= pbtUid[n];
+    hash *= 16777619u;
+  }
+  return hash;
+}
@@ -29,6 +29,9 @@
 #include <stdbool.h>
 #include <err.h>
 #  include <sys/time.h>
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
 
 #include "nfc/nfc.h"
 
@@ -36,14 +39,20 @@
 
 /**
  * @macro HAL
- * @brief Execute corresponding driver function if exists.
+ * @brief Execute corresponding driver function if exists, with the device locked.
  */
-#define HAL( FUNCTION, ... ) pnd->last_error = 0; \
-  if (pnd->driver->FUNCTION) { \
-    return pnd->driver->FUNCTION( __VA_ARGS__ ); \
-  } else { \
-    pnd->last_error = NFC_EDEVNOTSUPP; \
-    return false; \
+#define HAL( FUNCTION, ... ) { \
+    int hal_res; \
+    nfc_device_lock(pnd); \
+    pnd->last_error = 0; \
+    if (pnd->driver->FUNCTION) { \
+      hal_res = pnd->driver->FUNCTION( __VA_ARGS__ ); \
+    } else { \
+      pnd->last_error = NFC_EDEVNOTSUPP; \
+      hal_res = false; \
+    } \
+    nfc_device_unlock(pnd); \
+    return hal_res; \
   }
 
 #ifndef MIN
@@ -124,6 +133,7 @@ struct nfc_driver {
   int (*initiator_init)(struct nfc_device *pnd);
   int (*initiator_init_secure_element)(struct nfc_device *pnd);
   int (*initiator_select_passive_target)(struct nfc_device *pnd,  const nfc_modulation nm, const uint8_t *pbtInitData, const size_t szInitData, nfc_target *pnt);
+  int (*initiator_list_passive_targets)(struct nfc_device *pnd, const nfc_modulation nm, const uint8_t *pbtInitData, const size_t szInitData, nfc_target ant[], const size_t szTargets);
   int (*initiator_poll_target)(struct nfc_device *pnd, const nfc_modulation *pnmModulations, const size_t szModulations, const uint8_t uiPollNr, const uint8_t btPeriod, nfc_target *pnt);
   int (*initiator_select_dep_target)(struct nfc_device *pnd, const nfc_dep_mode ndm, const nfc_baud_rate nbr, const nfc_dep_info *pndiInitiator, nfc_target *pnt, const int timeout);
   int (*initiator_deselect_target)(struct nfc_device *pnd);
@@ -132,6 +142,9 @@ struct nfc_driver {
   int (*initiator_transceive_bytes_timed)(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, uint32_t *cycles);
   int (*initiator_transceive_bits_timed)(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTxBits, const uint8_t *pbtTxPar, uint8_t *pbtRx, uint8_t *pbtRxPar, uint32_t *cycles);
   int (*initiator_target_is_present)(struct nfc_device *pnd, const nfc_target nt);
+  int (*initiator_target_transceive_bytes)(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout);
+  int (*initiator_target_deselect)(struct nfc_device *pnd, const nfc_target *pnt);
+  int (*initiator_target_release)(struct nfc_device *pnd, const nfc_target *pnt);
 
   int (*target_init)(struct nfc_device *pnd, nfc_target *pnt, uint8_t *pbtRx, const size_t szRx, int timeout);
   int (*target_send_bytes)(struct nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx, int timeout);
@@ -148,6 +161,12 @@ struct nfc_driver {
   int (*abort_command)(struct nfc_device *pnd);
   int (*idle)(struct nfc_device *pnd);
   int (*powerdown)(struct nfc_device *pnd);
+
+  // Optional, nfc_device_submit() runs the requests from the caller's event loop with them
+  int (*device_get_pollfd)(struct nfc_device *pnd);
+  int (*initiator_transceive_bytes_submit)(struct nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx, uint8_t *pbtRx, const size_t szRx, int timeout);
+  int (*device_process_events)(struct nfc_device *pnd, const bool bAbort, bool *pbDone);
+  int (*device_get_event_timeout)(struct nfc_device *pnd);
 };
 
 #  define DEVICE_NAME_LENGTH  256
@@ -170,13 +189,81 @@ struct nfc_context {
   bool allow_autoscan;
   bool allow_intrusive_scan;
   uint32_t  log_level;
+  uint32_t  uart_max_speed;
   struct nfc_user_defined_device user_defined_devices[MAX_USER_DEFINED_DEVICES];
   unsigned int user_defined_device_count;
+  /** USB devices plugged in, NULL when no USB driver is built */
+  struct usbbus_registry *usb_registry;
+  /** Drivers nfc_open() and nfc_list_devices() go through */
+  const struct nfc_driver_list *driver_list;
+  /** Next initialized context, see nfc_register_driver() */
+  struct nfc_context *next;
 };
 
 nfc_context *nfc_context_new(void);
 void nfc_context_free(nfc_context *context);
 
+/** Frames kept by the trace of each device */
+#define NFC_TRACE_RING_LEN 64
+#define NFC_TRACE_DATA_WORDS ((NFC_TRACE_SNAPLEN + 7) / 8)
+
+/*
+ * Traced frame, seq is odd while it is written then 2 * index + 2, index
+ * being the position of the frame since the device was opened.
+ */
+struct nfc_trace_entry {
+  uint32_t seq;
+  /** Layer, direction and command, one byte each */
+  uint32_t info;
+  uint32_t szFrame;
+  uint64_t timestamp;
+  uint64_t abtData[NFC_TRACE_DATA_WORDS];
+};
+
+struct nfc_trace {
+  /** Index of the next frame */
+  uint32_t head;
+  /** Last command sent to the chip, bus frames belong to it */
+  uint8_t btCommand;
+  struct nfc_trace_entry entries[NFC_TRACE_RING_LEN];
+};
+
+/** Latency histogram of the statistics, see nfc_latency_stats */
+struct nfc_latency_counters {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[NFC_STATS_BUCKETS];
+};
+
+struct nfc_command_counters {
+  uint8_t btCommand;
+  uint32_t errors;
+  uint32_t timeouts;
+  struct nfc_latency_counters latency;
+};
+
+/*
+ * Statistics of a device, updated with atomic adds. Public types are packed,
+ * the counters have their own naturally aligned copy of nfc_device_stats.
+ */
+struct nfc_stats {
+  /** Position of each command in command_counters plus one, 0 until it is sent */
+  uint8_t abtCommandEntries[256];
+  size_t szCommands;
+  uint32_t commands;
+  uint32_t timeouts;
+  uint32_t io_errors;
+  uint32_t status_errors[NFC_STATS_STATUS_LEN];
+  uint64_t wire_tx_bytes;
+  uint64_t wire_rx_bytes;
+  uint64_t payload_tx_bytes;
+  uint64_t payload_rx_bytes;
+  struct nfc_latency_counters ack_wait;
+  struct nfc_command_counters command_counters[NFC_STATS_COMMANDS];
+};
+
 /**
  * @struct nfc_device
  * @brief NFC device information
@@ -200,19 +287,54 @@ struct nfc_device {
   /** Should the chip switch automatically activate ISO14443-4 when
       selecting tags supporting it? */
   bool    bAutoIso14443_4;
+  /** Should ISO14443-4A targets be switched to a higher bit rate once selected */
+  bool    bAutoPps;
+  /** ISO14443-4 block number of the selected target, when libnfc handles the
+      block protocol itself */
+  uint8_t  btIso14443_4BlockNumber;
   /** Supported modulation encoded in a byte */
   uint8_t  btSupportByte;
   /** Last reported error */
   int     last_error;
+  /** Queues and I/O thread of the asynchronous requests, NULL until the first one */
+  struct nfc_async *async;
+  /** Presence monitor thread, NULL when not started */
+  struct nfc_monitor *monitor;
+#ifndef _WIN32
+  /** Held while a command is exchanged with the device, recursive */
+  pthread_mutex_t lock;
+#endif
+  /** Last frames exchanged with the device */
+  struct nfc_trace trace;
+  /** Counters and latencies of the commands sent to the device */
+  struct nfc_stats stats;
 };
 
 nfc_device *nfc_device_new(const nfc_context *context, const nfc_connstring connstring);
 void        nfc_device_free(nfc_device *dev);
+void        nfc_device_lock(nfc_device *dev);
+void        nfc_device_unlock(nfc_device *dev);
+
+uint64_t nfc_trace_now(void);
+void nfc_trace_frame(nfc_device *pnd, const nfc_trace_layer layer, const nfc_trace_direction direction,
+                     const uint8_t *pbtFrame, const size_t szFrame);
+
+void nfc_stats_frame(nfc_device *pnd, const nfc_trace_layer layer, const nfc_trace_direction direction, const size_t szFrame);
+void nfc_stats_command(nfc_device *pnd, const uint8_t btCommand, const uint64_t start, const int res, const uint8_t btStatus);
+void nfc_stats_ack(nfc_device *pnd, const uint64_t start);
 
 void string_as_boolean(const char *s, bool *value);
 
 void iso14443_cascade_uid(const uint8_t abtUID[], const size_t szUID, uint8_t *pbtCascadedUID, size_t *pszCascadedUID);
 
+size_t iso14443_4_fsc(const nfc_target *pnt);
+int    iso14443_4_transceive(nfc_device *pnd, const size_t szFsc, const nfc_iovec aiovTx[], const size_t szIovTx,
+                             uint8_t *pbtRx, const size_t szRx, int timeout);
+
+void nfc_async_free(nfc_device *pnd);
+void nfc_monitor_free(nfc_device *pnd);
+
 void prepare_initiator_data(const nfc_modulation nm, uint8_t **ppbtInitiatorData, size_t *pszInitiatorData);
+uint32_t target_uid_hash(const nfc_target *pnt);
 
 #endif // __NFC_INTERNAL_H__
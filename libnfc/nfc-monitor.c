@@ -0,0 +1,247 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-monitor.c
+ * @brief Presence monitor, a thread of the device looking for targets coming and going
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <time.h>
+#endif
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+
+#define LOG_CATEGORY "libnfc.monitor"
+#define LOG_GROUP    NFC_LOG_GROUP_GENERAL
+
+#ifndef _WIN32
+/*
+ * While no target is there, the modulations are tried one after the other
+ * every period. Once one is selected, its presence is checked every period
+ * until it is gone.
+ */
+struct nfc_monitor {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  /** Signaled when the thread has to stop */
+  pthread_cond_t stop_cond;
+  bool bStop;
+  nfc_modulation *pnmModulations;
+  size_t szModulations;
+  int period;
+  nfc_presence_cb cb;
+  void *user_data;
+};
+
+// Look for a target, returns 1 when one is selected
+static int
+nfc_monitor_scan(nfc_device *pnd, const struct nfc_monitor *pm, nfc_target *pnt)
+{
+  for (size_t n = 0; n < pm->szModulations; n++) {
+    const int res = nfc_initiator_select_passive_target(pnd, pm->pnmModulations[n], NULL, 0, pnt);
+    if (res > 0)
+      return 1;
+    if (res < 0)
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_DEBUG, "Selection failed: %s", nfc_strerror(pnd));
+  }
+  return 0;
+}
+
+static void *
+nfc_monitor_thread(void *arg)
+{
+  nfc_device *pnd = arg;
+  struct nfc_monitor *pm = pnd->monitor;
+  nfc_target nt;
+  bool bPresent = false;
+
+  // Selection has to give up when there is nothing in the field
+  if (nfc_device_set_property_bool(pnd, NP_INFINITE_SELECT, false) < 0)
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to make selection finite");
+
+  pthread_mutex_lock(&pm->mutex);
+  while (!pm->bStop) {
+    pthread_mutex_unlock(&pm->mutex);
+    if (!bPresent) {
+      if (nfc_monitor_scan(pnd, pm, &nt) > 0) {
+        bPresent = true;
+        pm->cb(pnd, NFC_TARGET_ARRIVED, &nt, pm->user_data);
+      }
+    } else {
+      const int res = nfc_initiator_target_is_present(pnd, nt);
+      // A device too slow to answer tells nothing about the target, it is checked again next time
+      if ((res < 0) && (res != NFC_ETIMEOUT)) {
+        // Whatever the other reason, the target can not be reached anymore
+        if (res != NFC_ETGRELEASED)
+          nfc_initiator_deselect_target(pnd);
+        bPresent = false;
+        pm->cb(pnd, NFC_TARGET_REMOVED, &nt, pm->user_data);
+      }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += pm->period / 1000;
+    deadline.tv_nsec += (pm->period % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&pm->mutex);
+    while (!pm->bStop && (pthread_cond_timedwait(&pm->stop_cond, &pm->mutex, &deadline) == 0))
+      ;
+  }
+  pthread_mutex_unlock(&pm->mutex);
+  return NULL;
+}
+#endif
+
+/*
+ * Stop the presence monitor of a device, when it has one. The target it
+ * selected, if any, is left selected.
+ */
+void
+nfc_monitor_free(nfc_device *pnd)
+{
+#ifndef _WIN32
+  struct nfc_monitor *pm = pnd->monitor;
+  if (!pm)
+    return;
+
+  pthread_mutex_lock(&pm->mutex);
+  pm->bStop = true;
+  pthread_cond_broadcast(&pm->stop_cond);
+  pthread_mutex_unlock(&pm->mutex);
+  pthread_join(pm->thread, NULL);
+  pthread_cond_destroy(&pm->stop_cond);
+  pthread_mutex_destroy(&pm->mutex);
+  free(pm->pnmModulations);
+  free(pm);
+  pnd->monitor = NULL;
+#else
+  (void) pnd;
+#endif
+}
+
+/** @ingroup initiator
+ * @brief Start watching for targets coming into the field and leaving it
+ * @return Returns 0 once the monitor runs, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnmModulations desired modulations, tried in this order
+ * @param szModulations size of \a pnmModulations
+ * @param period time between two looks at the field, in milliseconds
+ * @param cb function called from the monitor thread when a target arrives or is removed
+ * @param user_data given back to \a cb
+ *
+ * The device has to be initialized as initiator first. A thread of the device
+ * then selects a target of the given modulations, and checks its presence
+ * with nfc_initiator_target_is_present() every \a period ms once it is there.
+ * One target is followed at a time: when it is removed the field is scanned
+ * again. NP_INFINITE_SELECT is turned off.
+ *
+ * The callback may exchange data with the target it is told about: it runs
+ * on the thread which owns the device, and the next look waits for it.
+ *
+ * @warning While the monitor runs, only its callback should use the device.
+ * The monitor is stopped by nfc_initiator_monitor_stop() or nfc_close(),
+ * never from its callback.
+ */
+int
+nfc_initiator_monitor_start(nfc_device *pnd, const nfc_modulation *pnmModulations, const size_t szModulations,
+                            const int period, nfc_presence_cb cb, void *user_data)
+{
+#ifndef _WIN32
+  if (pnd->monitor || !szModulations || (period <= 0) || !cb) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  struct nfc_monitor *pm = malloc(sizeof(struct nfc_monitor));
+  if (!pm) {
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  if (!(pm->pnmModulations = malloc(szModulations * sizeof(nfc_modulation)))) {
+    free(pm);
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  memcpy(pm->pnmModulations, pnmModulations, szModulations * sizeof(nfc_modulation));
+  pm->szModulations = szModulations;
+  pm->period = period;
+  pm->cb = cb;
+  pm->user_data = user_data;
+  pm->bStop = false;
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&pm->mutex, NULL);
+  pthread_cond_init(&pm->stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pnd->monitor = pm;
+  if (pthread_create(&pm->thread, NULL, nfc_monitor_thread, pnd) != 0) {
+    log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to start the monitor thread");
+    pthread_cond_destroy(&pm->stop_cond);
+    pthread_mutex_destroy(&pm->mutex);
+    free(pm->pnmModulations);
+    free(pm);
+    pnd->monitor = NULL;
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  return NFC_SUCCESS;
+#else
+  (void) pnmModulations;
+  (void) szModulations;
+  (void) period;
+  (void) cb;
+  (void) user_data;
+  pnd->last_error = NFC_ENOTIMPL;
+  return pnd->last_error;
+#endif
+}
+
+/** @ingroup initiator
+ * @brief Stop the presence monitor of the device
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ *
+ * Returns once the monitor thread is done, the callback is not called anymore.
+ * The target selected by the monitor, if any, is left selected.
+ */
+int
+nfc_initiator_monitor_stop(nfc_device *pnd)
+{
+  if (!pnd->monitor) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  nfc_monitor_free(pnd);
+  return NFC_SUCCESS;
+}
@@ -0,0 +1,349 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-sim.c
+ * @brief Virtual targets and initiators of the pn53x_sim driver
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <string.h>
+
+#include <nfc/nfc.h>
+#include <nfc/nfc-sim.h>
+#include "nfc-internal.h"
+
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+#  include "drivers/pn53x_sim.h"
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+
+#define MIFARE_BLOCK_LEN 16
+#define MIFARE_ULTRALIGHT_PAGE_LEN 4
+#define FELICA_BLOCK_LEN 16
+
+static bool
+sim_device_supported(nfc_device *pnd)
+{
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  if (pnd->driver == &pn53x_sim_driver)
+    return true;
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+  pnd->last_error = NFC_EDEVNOTSUPP;
+  return false;
+}
+
+/** @ingroup dev
+ * @brief Put a virtual target in the field of a pn53x_sim device
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents a pn53x_sim device
+ * @param emulator target to add, its \a target gives the modulation and what anticollision reports
+ *
+ * The state machine of the emulator gets each frame sent to the target, CRC
+ * excluded, and returns the length of its answer or a negative value to stay
+ * mute. ISO14443-4 targets (type A with SAK bit 0x20 and type B) get the
+ * commands, chaining and block numbers are handled by the driver. Targets
+ * may come and go from any thread, a command waiting for a target gets it.
+ */
+int
+nfc_sim_add_target(nfc_device *pnd, struct nfc_emulator *emulator)
+{
+  if (!sim_device_supported(pnd))
+    return pnd->last_error;
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  return pn53x_sim_add_target(pnd, emulator);
+#else
+  (void) emulator;
+  return pnd->last_error;
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+}
+
+/** @ingroup dev
+ * @brief Take a virtual target out of the field of a pn53x_sim device
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents a pn53x_sim device
+ * @param emulator target given to nfc_sim_add_target()
+ */
+int
+nfc_sim_remove_target(nfc_device *pnd, const struct nfc_emulator *emulator)
+{
+  if (!sim_device_supported(pnd))
+    return pnd->last_error;
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  return pn53x_sim_remove_target(pnd, emulator);
+#else
+  (void) emulator;
+  return pnd->last_error;
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+}
+
+/** @ingroup dev
+ * @brief Set the virtual initiator of a pn53x_sim device in target mode
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents a pn53x_sim device
+ * @param emulator initiator, NULL to remove it
+ *
+ * The \a target of the emulator gives the modulation the initiator uses and,
+ * for D.E.P., its ATR_REQ parameters. Its state machine gets what the device
+ * answered last, nothing at first, and returns the next command to send or a
+ * negative value to release the device.
+ */
+int
+nfc_sim_set_initiator(nfc_device *pnd, struct nfc_emulator *emulator)
+{
+  if (!sim_device_supported(pnd))
+    return pnd->last_error;
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  return pn53x_sim_set_initiator(pnd, emulator);
+#else
+  (void) emulator;
+  return pnd->last_error;
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+}
+
+/** @ingroup dev
+ * @brief Set the latency model of a pn53x_sim device
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents a pn53x_sim device
+ * @param wire_speed speed in bauds of the serial link to the chip, which then takes time to handle each command, 0 for none
+ * @param rf whether RF exchanges take the time they would on air
+ *
+ * Opening "pn53x_sim:<speed>" sets both.
+ */
+int
+nfc_sim_set_latency(nfc_device *pnd, const uint32_t wire_speed, const bool rf)
+{
+  if (!sim_device_supported(pnd))
+    return pnd->last_error;
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  return pn53x_sim_set_latency(pnd, wire_speed, rf);
+#else
+  (void) wire_speed;
+  (void) rf;
+  return pnd->last_error;
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+}
+
+static int
+sim_memory_block(const struct nfc_sim_memory *memory, const uint8_t btBlock, const size_t szBlockLen)
+{
+  return ((size_t)(btBlock + 1) * szBlockLen <= memory->data_len) ? btBlock * (int) szBlockLen : -1;
+}
+
+// MIFARE Ultralight: READ returns 4 pages, wrapping around, WRITE and COMPATIBILITY WRITE one page
+static int
+sim_ultralight_io(struct nfc_emulator *emulator, const uint8_t *data_in, const size_t data_in_len, uint8_t *data_out, const size_t data_out_len)
+{
+  struct nfc_sim_memory *memory = emulator->state_machine->data;
+  const size_t szPages = memory->data_len / MIFARE_ULTRALIGHT_PAGE_LEN;
+
+  if ((data_in_len < 2) || (data_in[1] >= szPages))
+    return NFC_EINVARG;
+  switch (data_in[0]) {
+    case 0x30:
+      if (data_out_len < MIFARE_BLOCK_LEN)
+        return NFC_EOVFLOW;
+      for (size_t n = 0; n < 4; n++)
+        memcpy(data_out + n * MIFARE_ULTRALIGHT_PAGE_LEN, memory->data + ((data_in[1] + n) % szPages) * MIFARE_ULTRALIGHT_PAGE_LEN,
+               MIFARE_ULTRALIGHT_PAGE_LEN);
+      return MIFARE_BLOCK_LEN;
+    case 0xa2:
+    case 0xa0:
+      if (data_in_len < 2 + MIFARE_ULTRALIGHT_PAGE_LEN)
+        return NFC_EINVARG;
+      memcpy(memory->data + data_in[1] * MIFARE_ULTRALIGHT_PAGE_LEN, data_in + 2, MIFARE_ULTRALIGHT_PAGE_LEN);
+      return 0;
+    default:
+      return NFC_EINVARG;
+  }
+}
+
+static int
+sim_classic_sector(const uint8_t btBlock)
+{
+  return (btBlock < 128) ? btBlock / 4 : 32 + (btBlock - 128) / 16;
+}
+
+static int
+sim_classic_trailer(const int iSector)
+{
+  return (iSector < 32) ? iSector * 4 + 3 : 128 + (iSector - 32) * 16 + 15;
+}
+
+/*
+ * MIFARE Classic: authentication checks the key against the sector trailer,
+ * then the blocks of that sector are read and written in plain, Crypto1 is
+ * not simulated. Key A reads back as zeros.
+ */
+static int
+sim_classic_io(struct nfc_emulator *emulator, const uint8_t *data_in, const size_t data_in_len, uint8_t *data_out, const size_t data_out_len)
+{
+  struct nfc_sim_memory *memory = emulator->state_machine->data;
+
+  if (data_in_len < 2)
+    return NFC_EINVARG;
+  const int iOffset = sim_memory_block(memory, data_in[1], MIFARE_BLOCK_LEN);
+  if (iOffset < 0)
+    return NFC_EINVARG;
+  const int iSector = sim_classic_sector(data_in[1]);
+
+  switch (data_in[0]) {
+    case 0x60:
+    case 0x61: {
+      const int iTrailer = sim_memory_block(memory, (uint8_t) sim_classic_trailer(iSector), MIFARE_BLOCK_LEN);
+      const uint8_t *pbtKey = memory->data + iTrailer + ((data_in[0] == 0x60) ? 0 : 10);
+      memory->sector = -1;
+      if ((iTrailer < 0) || (data_in_len < 8) || (memcmp(pbtKey, data_in + 2, 6) != 0))
+        return NFC_EMFCAUTHFAIL;
+      memory->sector = iSector;
+      return 0;
+    }
+    case 0x30:
+      if (iSector != memory->sector)
+        return NFC_EMFCAUTHFAIL;
+      if (data_out_len < MIFARE_BLOCK_LEN)
+        return NFC_EOVFLOW;
+      memcpy(data_out, memory->data + iOffset, MIFARE_BLOCK_LEN);
+      if (data_in[1] == sim_classic_trailer(iSector))
+        memset(data_out, 0, 6);
+      return MIFARE_BLOCK_LEN;
+    case 0xa0:
+      if (iSector != memory->sector)
+        return NFC_EMFCAUTHFAIL;
+      if (data_in_len < 2 + MIFARE_BLOCK_LEN)
+        return NFC_EINVARG;
+      memcpy(memory->data + iOffset, data_in + 2, MIFARE_BLOCK_LEN);
+      return 0;
+    default:
+      return NFC_EINVARG;
+  }
+}
+
+/*
+ * FeliCa: Request Response, Read and Write Without Encryption. Services are
+ * not told apart, block numbers are offsets in the memory.
+ */
+static int
+sim_felica_io(struct nfc_emulator *emulator, const uint8_t *data_in, const size_t data_in_len, uint8_t *data_out, const size_t data_out_len)
+{
+  struct nfc_sim_memory *memory = emulator->state_machine->data;
+  const nfc_felica_info *pnfi = &emulator->target->nti.nfi;
+
+  // LEN, command code, IDm
+  if ((data_in_len < 10) || (data_in[0] != data_in_len) || (memcmp(data_in + 2, pnfi->abtId, 8) != 0) || (data_out_len < 12))
+    return NFC_EINVARG;
+  data_out[1] = data_in[1] + 1;
+  memcpy(data_out + 2, pnfi->abtId, 8);
+
+  if (data_in[1] == 0x04) {
+    // Request Response: the mode
+    data_out[10] = 0x00;
+    data_out[0] = 11;
+    return 11;
+  }
+  if ((data_in[1] != 0x06) && (data_in[1] != 0x08))
+    return NFC_EINVARG;
+
+  // Services, then the block list: two bytes elements
+  if (data_in_len < 11)
+    return NFC_EINVARG;
+  size_t szPos = 11 + 2 * (size_t) data_in[10];
+  if (szPos >= data_in_len)
+    return NFC_EINVARG;
+  const size_t szBlocks = data_in[szPos++];
+  const bool bWrite = (data_in[1] == 0x08);
+  const size_t szData = szPos + 2 * szBlocks;
+  size_t szOut = 12;
+
+  data_out[10] = 0x00;
+  data_out[11] = 0x00;
+  if ((szData > data_in_len) || (bWrite && (szData + szBlocks * FELICA_BLOCK_LEN > data_in_len))) {
+    data_out[10] = 0xff;
+    data_out[11] = 0xa1;
+  } else {
+    for (size_t n = 0; n < szBlocks; n++) {
+      const int iOffset = sim_memory_block(memory, data_in[szPos + 2 * n + 1], FELICA_BLOCK_LEN);
+      if (iOffset < 0) {
+        data_out[10] = 0xff;
+        data_out[11] = 0xa8;
+        szOut = 12;
+        break;
+      }
+      if (bWrite) {
+        memcpy(memory->data + iOffset, data_in + szData + n * FELICA_BLOCK_LEN, FELICA_BLOCK_LEN);
+      } else {
+        if (szOut + 1 + (n + 1) * FELICA_BLOCK_LEN > data_out_len)
+          return NFC_EOVFLOW;
+        memcpy(data_out + 13 + n * FELICA_BLOCK_LEN, memory->data + iOffset, FELICA_BLOCK_LEN);
+      }
+    }
+    if (!bWrite && !data_out[10]) {
+      data_out[12] = (uint8_t) szBlocks;
+      szOut = 13 + szBlocks * FELICA_BLOCK_LEN;
+    }
+  }
+  data_out[0] = (uint8_t) szOut;
+  return (int) szOut;
+}
+
+/** @ingroup dev
+ * @brief Make a memory tag of an emulator
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param emulator emulator to set up, given to nfc_sim_add_target() afterwards
+ * @param memory state of the tag, kept as long as the emulator is used
+ * @param pnt the tag as anticollision reports it
+ * @param data memory image of the tag, read and written in place
+ * @param data_len length of \a data
+ *
+ * The tag is a MIFARE Ultralight when \a pnt is an ISO14443A target with a
+ * zero SAK, a MIFARE Classic for other ISO14443A targets, or a FeliCa tag
+ * with 16 bytes blocks.
+ */
+int
+nfc_sim_memory_init(struct nfc_emulator *emulator, struct nfc_sim_memory *memory, nfc_target *pnt,
+                    uint8_t *data, const size_t data_len)
+{
+  if (!emulator || !memory || !pnt || !data)
+    return NFC_EINVARG;
+  switch (pnt->nm.nmt) {
+    case NMT_ISO14443A:
+      if (pnt->nti.nai.btSak & 0x20)
+        return NFC_EDEVNOTSUPP;
+      memory->state_machine.io = (pnt->nti.nai.btSak == 0x00) ? sim_ultralight_io : sim_classic_io;
+      break;
+    case NMT_FELICA:
+      memory->state_machine.io = sim_felica_io;
+      break;
+    default:
+      return NFC_EDEVNOTSUPP;
+  }
+  memory->state_machine.data = memory;
+  memory->data = data;
+  memory->data_len = data_len;
+  memory->sector = -1;
+  emulator->target = pnt;
+  emulator->state_machine = &memory->state_machine;
+  emulator->user_data = NULL;
+  return NFC_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-stats.c
+ * @brief Device statistics, command counters and latency histograms
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <string.h>
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+
+/*
+ * Counters are only updated by the thread holding the device lock, except the
+ * byte counters nfc_abort_command() may add to. They are read and reset from
+ * any thread, so every access is atomic. Without the GCC atomic builtins,
+ * statistics are only reliable while the device is idle.
+ */
+#if defined(__GNUC__)
+#  define stats_load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#  define stats_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#  define stats_add(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#  define stats_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#  define stats_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#  define stats_load(p) (*(p))
+#  define stats_store(p, v) (*(p) = (v))
+#  define stats_add(p, v) (*(p) += (v))
+#  define stats_load_acquire(p) (*(p))
+#  define stats_store_release(p, v) (*(p) = (v))
+#endif
+
+// Latencies are kept with 8 buckets per power of two
+#define STATS_SUB_BUCKETS 8
+
+static size_t
+stats_bucket(uint64_t us)
+{
+  size_t octave = 0;
+
+  if (us < STATS_SUB_BUCKETS)
+    return (size_t) us;
+  while (us >= 2 * STATS_SUB_BUCKETS) {
+    us >>= 1;
+    octave++;
+  }
+  return MIN(STATS_SUB_BUCKETS * (octave + 1) + (size_t) us - STATS_SUB_BUCKETS, NFC_STATS_BUCKETS - 1);
+}
+
+// First latency of a bucket, in microseconds
+static uint64_t
+stats_bucket_start(const size_t bucket)
+{
+  if (bucket < STATS_SUB_BUCKETS)
+    return bucket;
+  return (uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << (bucket / STATS_SUB_BUCKETS - 1);
+}
+
+static void
+stats_latency_add(struct nfc_latency_counters *plc, const uint64_t start)
+{
+  const uint64_t us = (nfc_trace_now() - start) / 1000;
+  const uint32_t us32 = (uint32_t) MIN(us, UINT32_MAX);
+
+  // Only one thread adds latencies, min and max can not change meanwhile
+  if (!stats_load(&plc->count) || (us32 < stats_load(&plc->min_us)))
+    stats_store(&plc->min_us, us32);
+  if (us32 > stats_load(&plc->max_us))
+    stats_store(&plc->max_us, us32);
+  stats_add(&plc->total_us, us);
+  stats_add(&plc->buckets[stats_bucket(us)], 1);
+  stats_add(&plc->count, 1);
+}
+
+static void
+stats_latency_reset(struct nfc_latency_counters *plc)
+{
+  stats_store(&plc->count, 0);
+  stats_store(&plc->min_us, 0);
+  stats_store(&plc->max_us, 0);
+  stats_store(&plc->total_us, 0);
+  for (size_t n = 0; n < NFC_STATS_BUCKETS; n++)
+    stats_store(&plc->buckets[n], 0);
+}
+
+// Last latency of the bucket holding the given fraction of the samples
+static uint32_t
+stats_percentile(const nfc_latency_stats *pls, const uint64_t count, const double fraction)
+{
+  const uint64_t rank = (uint64_t)(fraction * count + 0.5);
+  uint64_t seen = 0;
+
+  for (size_t n = 0; n < NFC_STATS_BUCKETS; n++) {
+    seen += pls->buckets[n];
+    if (seen && (seen >= rank)) {
+      const uint64_t last = stats_bucket_start(n + 1) - 1;
+      return (uint32_t) MAX(MIN(last, pls->max_us), pls->min_us);
+    }
+  }
+  return pls->max_us;
+}
+
+static void
+stats_latency_copy(nfc_latency_stats *pdst, const struct nfc_latency_counters *psrc)
+{
+  uint64_t count = 0;
+
+  pdst->min_us = stats_load(&psrc->min_us);
+  pdst->max_us = stats_load(&psrc->max_us);
+  pdst->total_us = stats_load(&psrc->total_us);
+  for (size_t n = 0; n < NFC_STATS_BUCKETS; n++) {
+    pdst->buckets[n] = stats_load(&psrc->buckets[n]);
+    count += pdst->buckets[n];
+  }
+  // Counted from the buckets, the percentiles stay within the samples copied
+  pdst->count = (uint32_t) count;
+  pdst->p50_us = count ? stats_percentile(pdst, count, 0.50) : 0;
+  pdst->p90_us = count ? stats_percentile(pdst, count, 0.90) : 0;
+  pdst->p99_us = count ? stats_percentile(pdst, count, 0.99) : 0;
+}
+
+/*
+ * Count the bytes of a frame, bus frames are counted as they are on the wire
+ * and chip frames as the PN53x command or response they carry.
+ */
+void
+nfc_stats_frame(nfc_device *pnd, const nfc_trace_layer layer, const nfc_trace_direction direction, const size_t szFrame)
+{
+  struct nfc_stats *pst = &pnd->stats;
+
+  if (layer == NFC_TRACE_BUS)
+    stats_add((direction == NFC_TRACE_TX) ? &pst->wire_tx_bytes : &pst->wire_rx_bytes, szFrame);
+  else
+    stats_add((direction == NFC_TRACE_TX) ? &pst->payload_tx_bytes : &pst->payload_rx_bytes, szFrame);
+}
+
+/*
+ * Account for a command sent at start. res is what the driver returned, the
+ * length of the answer or an error, btStatus the error status of the answer.
+ */
+void
+nfc_stats_command(nfc_device *pnd, const uint8_t btCommand, const uint64_t start, const int res, const uint8_t btStatus)
+{
+  struct nfc_stats *pst = &pnd->stats;
+  struct nfc_command_counters *pcc = NULL;
+
+  if (!pst->abtCommandEntries[btCommand]) {
+    const size_t szCommands = stats_load(&pst->szCommands);
+    // A full table leaves the command to the device counters
+    if (szCommands < NFC_STATS_COMMANDS) {
+      pst->command_counters[szCommands].btCommand = btCommand;
+      pst->abtCommandEntries[btCommand] = (uint8_t)(szCommands + 1);
+      stats_store_release(&pst->szCommands, szCommands + 1);
+    }
+  }
+  if (pst->abtCommandEntries[btCommand])
+    pcc = &pst->command_counters[pst->abtCommandEntries[btCommand] - 1];
+
+  stats_add(&pst->commands, 1);
+  if (res == NFC_ETIMEOUT) {
+    stats_add(&pst->timeouts, 1);
+    if (pcc)
+      stats_add(&pcc->timeouts, 1);
+  } else if (res < 0) {
+    // An aborted command was not lost
+    if (res != NFC_EOPABORTED)
+      stats_add(&pst->io_errors, 1);
+  } else {
+    if (btStatus) {
+      stats_add(&pst->status_errors[btStatus % NFC_STATS_STATUS_LEN], 1);
+      if (pcc)
+        stats_add(&pcc->errors, 1);
+    }
+    if (pcc)
+      stats_latency_add(&pcc->latency, start);
+  }
+}
+
+// The chip acknowledged the command sent at start
+void
+nfc_stats_ack(nfc_device *pnd, const uint64_t start)
+{
+  stats_latency_add(&pnd->stats.ack_wait, start);
+}
+
+/** @ingroup dev
+ * @brief Get the statistics of the device
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param stats where the statistics are copied
+ *
+ * Each device counts the commands sent to its chip, their errors and bytes,
+ * and keeps a latency histogram of each PN53x command, whatever the log
+ * level. Latencies go from the command sent to its answer received, or to
+ * the ACK frame for \a ack_wait. Histograms of several devices may be summed
+ * bucket by bucket.
+ *
+ * This function may be called from any thread while the device is used, the
+ * command running meanwhile may be partly counted.
+ */
+void
+nfc_device_get_stats(nfc_device *pnd, nfc_device_stats *stats)
+{
+  const struct nfc_stats *pst = &pnd->stats;
+
+  stats->szCommands = stats_load_acquire(&pst->szCommands);
+  stats->commands = stats_load(&pst->commands);
+  stats->timeouts = stats_load(&pst->timeouts);
+  stats->io_errors = stats_load(&pst->io_errors);
+  for (size_t n = 0; n < NFC_STATS_STATUS_LEN; n++)
+    stats->status_errors[n] = stats_load(&pst->status_errors[n]);
+  stats->wire_tx_bytes = stats_load(&pst->wire_tx_bytes);
+  stats->wire_rx_bytes = stats_load(&pst->wire_rx_bytes);
+  stats->payload_tx_bytes = stats_load(&pst->payload_tx_bytes);
+  stats->payload_rx_bytes = stats_load(&pst->payload_rx_bytes);
+  stats_latency_copy(&stats->ack_wait, &pst->ack_wait);
+  for (size_t n = 0; n < stats->szCommands; n++) {
+    nfc_command_stats *pcs = &stats->command_stats[n];
+    pcs->btCommand = pst->command_counters[n].btCommand;
+    pcs->errors = stats_load(&pst->command_counters[n].errors);
+    pcs->timeouts = stats_load(&pst->command_counters[n].timeouts);
+    stats_latency_copy(&pcs->latency, &pst->command_counters[n].latency);
+  }
+  memset(stats->command_stats + stats->szCommands, 0, (NFC_STATS_COMMANDS - stats->szCommands) * sizeof(nfc_command_stats));
+}
+
+/** @ingroup dev
+ * @brief Set the statistics of the device back to zero
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ *
+ * Commands already sent stay listed in \a command_stats, with zero counters.
+ */
+void
+nfc_device_reset_stats(nfc_device *pnd)
+{
+  struct nfc_stats *pst = &pnd->stats;
+  const size_t szCommands = stats_load_acquire(&pst->szCommands);
+
+  stats_store(&pst->commands, 0);
+  stats_store(&pst->timeouts, 0);
+  stats_store(&pst->io_errors, 0);
+  for (size_t n = 0; n < NFC_STATS_STATUS_LEN; n++)
+    stats_store(&pst->status_errors[n], 0);
+  stats_store(&pst->wire_tx_bytes, 0);
+  stats_store(&pst->wire_rx_bytes, 0);
+  stats_store(&pst->payload_tx_bytes, 0);
+  stats_store(&pst->payload_rx_bytes, 0);
+  stats_latency_reset(&pst->ack_wait);
+  for (size_t n = 0; n < szCommands; n++) {
+    stats_store(&pst->command_counters[n].errors, 0);
+    stats_store(&pst->command_counters[n].timeouts, 0);
+    stats_latency_reset(&pst->command_counters[n].latency);
+  }
+}
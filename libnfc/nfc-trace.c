@@ -0,0 +1,272 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file nfc-trace.c
+ * @brief Frame trace, a ring of the last frames exchanged with each device
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <time.h>
+#else
+#  include <windows.h>
+#endif
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+
+#define LOG_CATEGORY "libnfc.trace"
+#define LOG_GROUP    NFC_LOG_GROUP_GENERAL
+
+/*
+ * Entries are written without lock by the thread exchanging frames and read
+ * the same way by nfc_device_get_trace(), every field is accessed atomically.
+ * Without the GCC atomic builtins, a snapshot is only reliable while the
+ * device is idle.
+ */
+#if defined(__GNUC__)
+#  define trace_load(p, order) __atomic_load_n(p, order)
+#  define trace_store(p, v, order) __atomic_store_n(p, v, order)
+#  define trace_fetch_inc(p) __atomic_fetch_add(p, 1, __ATOMIC_RELAXED)
+#  define trace_fence(order) __atomic_thread_fence(order)
+#else
+#  define trace_load(p, order) (*(p))
+#  define trace_store(p, v, order) (*(p) = (v))
+#  define trace_fetch_inc(p) ((*(p))++)
+#  define trace_fence(order) ((void) 0)
+#endif
+
+// pcapng block types and the link type of the frames, see
+// https://www.tcpdump.org/linktypes.html (LINKTYPE_USER0)
+#define PCAPNG_SECTION_HEADER_BLOCK     0x0a0d0d0a
+#define PCAPNG_INTERFACE_DESCRIPTION_BLOCK 0x00000001
+#define PCAPNG_ENHANCED_PACKET_BLOCK    0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC         0x1a2b3c4d
+#define PCAPNG_OPTION_IF_TSRESOL        9
+#define PCAPNG_LINKTYPE_LIBNFC          147
+// January 1, 1970 in FILETIME 100 ns intervals
+#define PCAPNG_FILETIME_UNIX_EPOCH      116444736000000000ULL
+// Layer, direction, command and a padding byte come before each frame
+#define PCAPNG_FRAME_HEADER_LEN         4
+
+#define TRACE_INFO(layer, direction, command) ((uint32_t)(layer) | ((uint32_t)(direction) << 8) | ((uint32_t)(command) << 16))
+
+// Monotonic time in nanoseconds, the clock of the trace and of the statistics
+uint64_t
+nfc_trace_now(void)
+{
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#else
+  return (uint64_t) GetTickCount64() * 1000000ULL;
+#endif
+}
+
+/*
+ * Keep a frame in the ring of the device, overwriting the oldest one. Bus
+ * frames are given the command of the last chip command sent. Every frame
+ * goes through here, the statistics count their bytes here too.
+ */
+void
+nfc_trace_frame(nfc_device *pnd, const nfc_trace_layer layer, const nfc_trace_direction direction,
+                const uint8_t *pbtFrame, const size_t szFrame)
+{
+  struct nfc_trace *pt = &pnd->trace;
+  uint64_t abtData[NFC_TRACE_DATA_WORDS];
+  const size_t szData = MIN(szFrame, NFC_TRACE_SNAPLEN);
+
+  if ((layer == NFC_TRACE_CHIP) && (direction == NFC_TRACE_TX) && szFrame)
+    trace_store(&pt->btCommand, pbtFrame[0], __ATOMIC_RELAXED);
+  const uint32_t command = trace_load(&pt->btCommand, __ATOMIC_RELAXED);
+  const uint64_t timestamp = nfc_trace_now();
+  memcpy(abtData, pbtFrame, szData);
+
+  const uint32_t index = trace_fetch_inc(&pt->head);
+  struct nfc_trace_entry *pe = &pt->entries[index % NFC_TRACE_RING_LEN];
+  trace_store(&pe->seq, 2 * index + 1, __ATOMIC_RELAXED);
+  trace_fence(__ATOMIC_RELEASE);
+  trace_store(&pe->info, TRACE_INFO(layer, direction, command), __ATOMIC_RELAXED);
+  trace_store(&pe->szFrame, (uint32_t) szFrame, __ATOMIC_RELAXED);
+  trace_store(&pe->timestamp, timestamp, __ATOMIC_RELAXED);
+  for (size_t n = 0; n < (szData + 7) / 8; n++)
+    trace_store(&pe->abtData[n], abtData[n], __ATOMIC_RELAXED);
+  trace_store(&pe->seq, 2 * index + 2, __ATOMIC_RELEASE);
+
+  nfc_stats_frame(pnd, layer, direction, szFrame);
+}
+
+/** @ingroup dev
+ * @brief Get the last frames exchanged with the device
+ * @return Returns the number of records copied to \a records, oldest first
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param records array of \a nfc_trace_record
+ * @param records_len size of the \a records array
+ *
+ * Each device keeps its last frames, as seen on the bus and as PN53x commands
+ * and responses, whatever the log level. This function may be called from
+ * any thread while the device is used, frames overwritten while they are
+ * copied are left out.
+ */
+size_t
+nfc_device_get_trace(nfc_device *pnd, nfc_trace_record records[], const size_t records_len)
+{
+  const struct nfc_trace *pt = &pnd->trace;
+  const uint32_t head = trace_load(&pt->head, __ATOMIC_ACQUIRE);
+  uint32_t count = MIN(head, NFC_TRACE_RING_LEN);
+  if (count > records_len)
+    count = (uint32_t) records_len;
+  size_t copied = 0;
+
+  for (uint32_t index = head - count; index != head; index++) {
+    const struct nfc_trace_entry *pe = &pt->entries[index % NFC_TRACE_RING_LEN];
+    const uint32_t seq = trace_load(&pe->seq, __ATOMIC_ACQUIRE);
+    if (seq != 2 * index + 2)
+      continue;
+
+    uint64_t abtData[NFC_TRACE_DATA_WORDS];
+    const uint32_t info = trace_load(&pe->info, __ATOMIC_RELAXED);
+    const uint32_t szFrame = trace_load(&pe->szFrame, __ATOMIC_RELAXED);
+    const uint64_t timestamp = trace_load(&pe->timestamp, __ATOMIC_RELAXED);
+    const size_t szData = MIN(szFrame, NFC_TRACE_SNAPLEN);
+    for (size_t n = 0; n < (szData + 7) / 8; n++)
+      abtData[n] = trace_load(&pe->abtData[n], __ATOMIC_RELAXED);
+    trace_fence(__ATOMIC_ACQUIRE);
+    if (trace_load(&pe->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+
+    nfc_trace_record *pr = &records[copied++];
+    pr->timestamp = timestamp;
+    pr->layer = (nfc_trace_layer)(info & 0xff);
+    pr->direction = (nfc_trace_direction)((info >> 8) & 0xff);
+    pr->btCommand = (uint8_t)(info >> 16);
+    pr->szFrame = szFrame;
+    pr->szData = szData;
+    memcpy(pr->abtData, abtData, szData);
+  }
+  return copied;
+}
+
+static int
+pcapng_write(FILE *stream, const void *pData, const size_t szData)
+{
+  return (fwrite(pData, 1, szData, stream) == szData) ? NFC_SUCCESS : NFC_EIO;
+}
+
+/** @ingroup dev
+ * @brief Write trace records as a pcapng capture
+ * @return Returns 0 on success, otherwise returns libnfc's error code
+ *
+ * @param stream where the capture is written, from its start
+ * @param records records given by nfc_device_get_trace()
+ * @param records_count number of records
+ *
+ * Frames use the LINKTYPE_USER0 (147) link type. Each one is preceded by
+ * four bytes: the \a nfc_trace_layer, the \a nfc_trace_direction, the PN53x
+ * command and a zero byte. The capture is in the byte order of the host.
+ * Timestamps are turned into wall clock time.
+ */
+int
+nfc_trace_write_pcapng(FILE *stream, const nfc_trace_record records[], const size_t records_count)
+{
+  uint64_t offset = 0;
+  int res;
+
+  // Records are stamped with the monotonic clock
+#ifndef _WIN32
+  struct timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  offset = (uint64_t) realtime.tv_sec * 1000000000ULL + (uint64_t) realtime.tv_nsec - nfc_trace_now();
+#else
+  // FILETIME counts 100 ns intervals since January 1, 1601
+  FILETIME ft;
+  GetSystemTimeAsFileTime(&ft);
+  const uint64_t intervals = ((uint64_t) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+  offset = (intervals - PCAPNG_FILETIME_UNIX_EPOCH) * 100ULL - nfc_trace_now();
+#endif
+
+  // Fields are laid out so that the structs have no padding
+  const struct {
+    uint32_t uiType, uiLength, uiMagic;
+    uint16_t uiMajor, uiMinor;
+    uint32_t auiSectionLength[2];
+    uint32_t uiLengthAgain;
+  } sectionHeader = {
+    PCAPNG_SECTION_HEADER_BLOCK, 28, PCAPNG_BYTE_ORDER_MAGIC,
+    1, 0,
+    { 0xffffffff, 0xffffffff }, // section length not specified
+    28
+  };
+  if ((res = pcapng_write(stream, &sectionHeader, sizeof(sectionHeader))) < 0)
+    return res;
+
+  const struct {
+    uint32_t uiType, uiLength;
+    uint16_t uiLinkType, uiReserved;
+    uint32_t uiSnapLen;
+    uint16_t uiOptionCode, uiOptionLength;
+    uint8_t  abtOptionValue[4];
+    uint16_t uiEndOfOptions, uiEndOfOptionsLength;
+    uint32_t uiLengthAgain;
+  } interfaceDescription = {
+    PCAPNG_INTERFACE_DESCRIPTION_BLOCK, 32,
+    PCAPNG_LINKTYPE_LIBNFC, 0,
+    PCAPNG_FRAME_HEADER_LEN + NFC_TRACE_SNAPLEN,
+    // if_tsresol: nanoseconds, padded to 32 bits
+    PCAPNG_OPTION_IF_TSRESOL, 1,
+    { 9, 0, 0, 0 },
+    0, 0,
+    32
+  };
+  if ((res = pcapng_write(stream, &interfaceDescription, sizeof(interfaceDescription))) < 0)
+    return res;
+
+  for (size_t n = 0; n < records_count; n++) {
+    const nfc_trace_record *pr = &records[n];
+    const uint32_t szCaptured = PCAPNG_FRAME_HEADER_LEN + pr->szData;
+    const uint32_t szPadded = (szCaptured + 3) & ~3;
+    const uint64_t timestamp = pr->timestamp + offset;
+    const uint32_t abtPacketHeader[] = {
+      PCAPNG_ENHANCED_PACKET_BLOCK, 32 + szPadded,
+      0, // interface
+      (uint32_t)(timestamp >> 32), (uint32_t) timestamp,
+      szCaptured, PCAPNG_FRAME_HEADER_LEN + pr->szFrame
+    };
+    const uint8_t abtFrameHeader[PCAPNG_FRAME_HEADER_LEN] = { pr->layer, pr->direction, pr->btCommand, 0 };
+    const uint8_t abtPadding[3] = { 0, 0, 0 };
+    const uint32_t szBlock = 32 + szPadded;
+
+    if (((res = pcapng_write(stream, abtPacketHeader, sizeof(abtPacketHeader))) < 0) ||
+        ((res = pcapng_write(stream, abtFrameHeader, sizeof(abtFrameHeader))) < 0) ||
+        ((res = pcapng_write(stream, pr->abtData, pr->szData)) < 0) ||
+        ((res = pcapng_write(stream, abtPadding, szPadded - szCaptured)) < 0) ||
+        ((res = pcapng_write(stream, &szBlock, sizeof(szBlock))) < 0)) {
+      log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to write the capture");
+      return res;
+    }
+  }
+  return fflush(stream) == 0 ? NFC_SUCCESS : NFC_EIO;
+}
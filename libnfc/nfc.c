@@ -28,6 +28,22 @@
  * This page details how to initialize and deinitialize libnfc. Initialization
  * must be performed before using any libnfc functionality, and similarly you
  * must not call any libnfc functions after deinitialization.
+ *
+ * Thread safety (POSIX builds):
+ * - Contexts are independent from each other, each one has its own drivers.
+ *   A context can be used from several threads once its drivers are
+ *   registered, to list and open devices; nfc_exit() comes after its
+ *   devices are closed and the other threads are done with it.
+ * - Devices are independent from each other, several threads can each
+ *   drive their own device without any locking.
+ * - A device is locked for the whole of each call made on it, so several
+ *   threads can share a device: their calls are run one after the other and
+ *   the device settings, its selected target and its last error are never
+ *   changed halfway by another thread. nfc_abort_command() does not wait for
+ *   the lock, it is meant to be called from another thread.
+ * - libnfc does not change the environment. The log level is not kept per
+ *   context: the one of the last initialized context applies to the whole
+ *   process, all contexts and devices included.
  */
 /**
  * @defgroup dev NFC Device/Hardware manipulation
@@ -105,50 +121,106 @@
 #  include "drivers/pn532_uart.h"
 #endif /* DRIVER_PN532_UART_ENABLED */
 
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+#  include "drivers/pn53x_sim.h"
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+
 
 #define LOG_CATEGORY "libnfc.general"
 #define LOG_GROUP    NFC_LOG_GROUP_GENERAL
 
-struct nfc_driver_list {
-  const struct nfc_driver_list *next;
-  const struct nfc_driver *driver;
-};
-
-const struct nfc_driver_list *nfc_drivers = NULL;
-
 static void
-nfc_drivers_init()
+nfc_drivers_init(nfc_context *context)
 {
 #if defined (DRIVER_PN53X_USB_ENABLED)
-  nfc_register_driver(&pn53x_usb_driver);
+  nfc_context_register_driver(context, &pn53x_usb_driver);
 #endif /* DRIVER_PN53X_USB_ENABLED */
 #if defined (DRIVER_ACR122_PCSC_ENABLED)
-  nfc_register_driver(&acr122_pcsc_driver);
+  nfc_context_register_driver(context, &acr122_pcsc_driver);
 #endif /* DRIVER_ACR122_PCSC_ENABLED */
 #if defined (DRIVER_ACR122_USB_ENABLED)
-  nfc_register_driver(&acr122_usb_driver);
+  nfc_context_register_driver(context, &acr122_usb_driver);
 #endif /* DRIVER_ACR122_USB_ENABLED */
 #if defined (DRIVER_ACR122S_ENABLED)
-  nfc_register_driver(&acr122s_driver);
+  nfc_context_register_driver(context, &acr122s_driver);
 #endif /* DRIVER_ACR122S_ENABLED */
 #if defined (DRIVER_PN532_UART_ENABLED)
-  nfc_register_driver(&pn532_uart_driver);
+  nfc_context_register_driver(context, &pn532_uart_driver);
 #endif /* DRIVER_PN532_UART_ENABLED */
 #if defined (DRIVER_ARYGON_ENABLED)
-  nfc_register_driver(&arygon_driver);
+  nfc_context_register_driver(context, &arygon_driver);
 #endif /* DRIVER_ARYGON_ENABLED */
+#if defined (DRIVER_PN53X_SIM_ENABLED)
+  nfc_context_register_driver(context, &pn53x_sim_driver);
+#endif /* DRIVER_PN53X_SIM_ENABLED */
+}
+
+/** @ingroup lib
+ * @brief Register an NFC device driver with a libnfc context.
+ * This function registers a driver with the given context only, the caller is responsible of managing the lifetime of the
+ * driver and make sure that any resources associated with the driver are available until the context is deinitialized.
+ * Drivers have to be registered before the context is used by other threads.
+ * @param context The context to register the driver with.
+ * @param ndr Pointer to an NFC device driver to be registered.
+ * @retval NFC_SUCCESS If the driver registration succeeds.
+ */
+int
+nfc_context_register_driver(nfc_context *context, const struct nfc_driver *ndr)
+{
+  if (!context || !ndr)
+    return NFC_EINVARG;
+
+  struct nfc_driver_list *pndl = (struct nfc_driver_list *)malloc(sizeof(struct nfc_driver_list));
+  if (!pndl)
+    return NFC_ESOFT;
+
+  pndl->driver = ndr;
+  pndl->next = context->driver_list;
+  context->driver_list = pndl;
+
+  return NFC_SUCCESS;
+}
+
+// Drivers registered with nfc_register_driver(), handed to every context, and
+// the contexts initialized so far
+static const struct nfc_driver_list *nfc_drivers = NULL;
+static nfc_context *nfc_contexts = NULL;
+#ifndef _WIN32
+static pthread_mutex_t nfc_drivers_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void
+nfc_drivers_lock(void)
+{
+#ifndef _WIN32
+  pthread_mutex_lock(&nfc_drivers_mutex);
+#endif
+}
+
+static void
+nfc_drivers_unlock(void)
+{
+#ifndef _WIN32
+  pthread_mutex_unlock(&nfc_drivers_mutex);
+#endif
 }
 
 /** @ingroup lib
  * @brief Register an NFC device driver with libnfc.
- * This function registers a driver with libnfc, the caller is responsible of managing the lifetime of the
- * driver and make sure that any resources associated with the driver are available after registration.
- * @param pnd Pointer to an NFC device driver to be registered.
+ * This function registers a driver with every context, the ones already initialized and the ones initialized
+ * afterwards, the caller is responsible of managing the lifetime of the driver and make sure that any resources
+ * associated with the driver are available after registration.
+ * Drivers have to be registered before the contexts are used by other threads.
+ * Once the last context is deinitialized, drivers have to be registered again.
+ * @param ndr Pointer to an NFC device driver to be registered.
  * @retval NFC_SUCCESS If the driver registration succeeds.
+ * @see nfc_context_register_driver() to register a driver with one context only
  */
 int
 nfc_register_driver(const struct nfc_driver *ndr)
 {
+  int res = NFC_SUCCESS;
+
   if (!ndr)
     return NFC_EINVARG;
 
@@ -157,10 +229,14 @@ nfc_register_driver(const struct nfc_driver *ndr)
     return NFC_ESOFT;
 
   pndl->driver = ndr;
+  nfc_drivers_lock();
   pndl->next = nfc_drivers;
   nfc_drivers = pndl;
+  for (nfc_context *context = nfc_contexts; context && (res == NFC_SUCCESS); context = context->next)
+    res = nfc_context_register_driver(context, ndr);
+  nfc_drivers_unlock();
 
-  return NFC_SUCCESS;
+  return res;
 }
 
 /** @ingroup lib
@@ -172,9 +248,14 @@ void
 nfc_init(nfc_context **context)
 {
   *context = nfc_context_new();
-
-  if (!nfc_drivers)
-    nfc_drivers_init();
+  nfc_drivers_init(*context);
+
+  nfc_drivers_lock();
+  for (const struct nfc_driver_list *pndl = nfc_drivers; pndl; pndl = pndl->next)
+    nfc_context_register_driver(*context, pndl->driver);
+  (*context)->next = nfc_contexts;
+  nfc_contexts = *context;
+  nfc_drivers_unlock();
 }
 
 /** @ingroup lib
@@ -185,11 +266,22 @@ nfc_init(nfc_context **context)
 void
 nfc_exit(nfc_context *context)
 {
-  while (nfc_drivers) {
-    struct nfc_driver_list *pndl = (struct nfc_driver_list *) nfc_drivers;
-    nfc_drivers = pndl->next;
-    free(pndl);
+  nfc_drivers_lock();
+  for (nfc_context **ppc = &nfc_contexts; *ppc; ppc = &((*ppc)->next)) {
+    if (*ppc == context) {
+      *ppc = context->next;
+      break;
+    }
   }
+  // The last context takes the drivers registered with nfc_register_driver() along
+  if (!nfc_contexts) {
+    while (nfc_drivers) {
+      struct nfc_driver_list *pndl = (struct nfc_driver_list *) nfc_drivers;
+      nfc_drivers = pndl->next;
+      free(pndl);
+    }
+  }
+  nfc_drivers_unlock();
 
   nfc_context_free(context);
 }
@@ -226,7 +318,7 @@ nfc_open(nfc_context *context, const nfc_connstring connstring)
   }
 
   // Search through the device list for an available device
-  const struct nfc_driver_list *pndl = nfc_drivers;
+  const struct nfc_driver_list *pndl = context->driver_list;
   while (pndl) {
     const struct nfc_driver *ndr = pndl->driver;
 
@@ -276,6 +368,9 @@ void
 nfc_close(nfc_device *pnd)
 {
   if (pnd) {
+    // The presence monitor is stopped, pending asynchronous requests are aborted
+    nfc_monitor_free(pnd);
+    nfc_async_free(pnd);
     // Close, clean up and release the device
     pnd->driver->close(pnd);
   }
@@ -302,30 +397,10 @@ nfc_list_devices(nfc_context *context, nfc_connstring connstrings[], const size_
       // let's make sure the device exists
       nfc_device *pnd = NULL;
 
-#ifdef ENVVARS
-      char *env_log_level = getenv("LIBNFC_LOG_LEVEL");
-      char *old_env_log_level = NULL;
-      // do it silently
-      if (env_log_level) {
-        if ((old_env_log_level = malloc(strlen(env_log_level) + 1)) == NULL) {
-          log_put(LOG_GROUP, LOG_CATEGORY, NFC_LOG_PRIORITY_ERROR, "%s", "Unable to malloc()");
-          return 0;
-        }
-        strcpy(old_env_log_level, env_log_level);
-      }
-      setenv("LIBNFC_LOG_LEVEL", "0", 1);
-#endif // ENVVARS
-
+      // do it silently, other threads keep logging
+      log_set_quiet(true);
       pnd = nfc_open(context, context->user_defined_devices[i].connstring);
-
-#ifdef ENVVARS
-      if (old_env_log_level) {
-        setenv("LIBNFC_LOG_LEVEL", old_env_log_level, 1);
-        free(old_env_log_level);
-      } else {
-        unsetenv("LIBNFC_LOG_LEVEL");
-      }
-#endif // ENVVARS
+      log_set_quiet(false);
 
       if (pnd) {
         nfc_close(pnd);
@@ -347,7 +422,7 @@ nfc_list_devices(nfc_context *context, nfc_connstring connstrings[], const size_
 
   // Device auto-detection
   if (context->allow_autoscan) {
-    const struct nfc_driver_list *pndl = nfc_drivers;
+    const struct nfc_driver_list *pndl = context->driver_list;
     while (pndl) {
       const struct nfc_driver *ndr = pndl->driver;
       size_t _device_found = 0;
@@ -405,28 +480,8 @@ nfc_device_set_property_bool(nfc_device *pnd, const nfc_property property, const
   HAL(device_set_property_bool, pnd, property, bEnable);
 }
 
-/** @ingroup initiator
- * @brief Initialize NFC device as initiator (reader)
- * @return Returns 0 on success, otherwise returns libnfc's error code (negative value)
- * @param pnd \a nfc_device struct pointer that represent currently used device
- *
- * The NFC device is configured to function as RFID reader.
- * After initialization it can be used to communicate to passive RFID tags and active NFC devices.
- * The reader will act as initiator to communicate peer 2 peer (NFCIP) to other active NFC devices.
- * - Crc is handled by the device (NP_HANDLE_CRC = true)
- * - Parity is handled the device (NP_HANDLE_PARITY = true)
- * - Cryto1 cipher is disabled (NP_ACTIVATE_CRYPTO1 = false)
- * - Easy framing is enabled (NP_EASY_FRAMING = true)
- * - Auto-switching in ISO14443-4 mode is enabled (NP_AUTO_ISO14443_4 = true)
- * - Invalid frames are not accepted (NP_ACCEPT_INVALID_FRAMES = false)
- * - Multiple frames are not accepted (NP_ACCEPT_MULTIPLE_FRAMES = false)
- * - 14443-A mode is activated (NP_FORCE_ISO14443_A = true)
- * - speed is set to 106 kbps (NP_FORCE_SPEED_106 = true)
- * - Let the device try forever to find a target (NP_INFINITE_SELECT = true)
- * - RF field is shortly dropped (if it was enabled) then activated again
- */
-int
-nfc_initiator_init(nfc_device *pnd)
+static int
+initiator_init(nfc_device *pnd)
 {
   int res = 0;
   // Drop the field for a while
@@ -441,6 +496,9 @@ nfc_initiator_init(nfc_device *pnd)
   // Activate auto ISO14443-4 switching by default
   if ((res = nfc_device_set_property_bool(pnd, NP_AUTO_ISO14443_4, true)) < 0)
     return res;
+  // Leave ISO14443-4A targets at 106 kbps, callers opt in to the bit rate negotiation
+  if ((res = nfc_device_set_property_bool(pnd, NP_AUTO_PPS, false)) < 0)
+    return res;
   // Force 14443-A mode
   if ((res = nfc_device_set_property_bool(pnd, NP_FORCE_ISO14443_A, true)) < 0)
     return res;
@@ -453,9 +511,40 @@ nfc_initiator_init(nfc_device *pnd)
   // Disallow multiple frames
   if ((res = nfc_device_set_property_bool(pnd, NP_ACCEPT_MULTIPLE_FRAMES, false)) < 0)
     return res;
+  pnd->btIso14443_4BlockNumber = 0;
   HAL(initiator_init, pnd);
 }
 
+/** @ingroup initiator
+ * @brief Initialize NFC device as initiator (reader)
+ * @return Returns 0 on success, otherwise returns libnfc's error code (negative value)
+ * @param pnd \a nfc_device struct pointer that represent currently used device
+ *
+ * The NFC device is configured to function as RFID reader.
+ * After initialization it can be used to communicate to passive RFID tags and active NFC devices.
+ * The reader will act as initiator to communicate peer 2 peer (NFCIP) to other active NFC devices.
+ * - Crc is handled by the device (NP_HANDLE_CRC = true)
+ * - Parity is handled the device (NP_HANDLE_PARITY = true)
+ * - Cryto1 cipher is disabled (NP_ACTIVATE_CRYPTO1 = false)
+ * - Easy framing is enabled (NP_EASY_FRAMING = true)
+ * - Auto-switching in ISO14443-4 mode is enabled (NP_AUTO_ISO14443_4 = true)
+ * - ISO14443-4A targets are left at 106 kbps (NP_AUTO_PPS = false)
+ * - Invalid frames are not accepted (NP_ACCEPT_INVALID_FRAMES = false)
+ * - Multiple frames are not accepted (NP_ACCEPT_MULTIPLE_FRAMES = false)
+ * - 14443-A mode is activated (NP_FORCE_ISO14443_A = true)
+ * - speed is set to 106 kbps (NP_FORCE_SPEED_106 = true)
+ * - Let the device try forever to find a target (NP_INFINITE_SELECT = true)
+ * - RF field is shortly dropped (if it was enabled) then activated again
+ */
+int
+nfc_initiator_init(nfc_device *pnd)
+{
+  nfc_device_lock(pnd);
+  const int res = initiator_init(pnd);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
 /** @ingroup initiator
  * @brief Initialize NFC device as initiator with its secure element initiator (reader)
  * @return Returns 0 on success, otherwise returns libnfc's error code (negative value)
@@ -471,31 +560,11 @@ nfc_initiator_init_secure_element(nfc_device *pnd)
   HAL(initiator_init_secure_element, pnd);
 }
 
-/** @ingroup initiator
- * @brief Select a passive or emulated tag
- * @return Returns selected passive target count on success, otherwise returns libnfc's error code (negative value)
- *
- * @param pnd \a nfc_device struct pointer that represent currently used device
- * @param nm desired modulation
- * @param pbtInitData optional initiator data used for Felica, ISO14443B, Topaz polling or to select a specific UID in ISO14443A.
- * @param szInitData length of initiator data \a pbtInitData.
- * @note pbtInitData is used with different kind of data depending on modulation type:
- * - for an ISO/IEC 14443 type A modulation, pbbInitData contains the UID you want to select;
- * - for an ISO/IEC 14443 type B modulation, pbbInitData contains Application Family Identifier (AFI) (see ISO/IEC 14443-3);
- * - for a FeliCa modulation, pbbInitData contains polling payload (see ISO/IEC 18092 11.2.2.5).
- *
- * @param[out] pnt \a nfc_target struct pointer which will filled if available
- *
- * The NFC device will try to find one available passive tag or emulated tag.
- *
- * The chip needs to know with what kind of tag it is dealing with, therefore
- * the initial modulation and speed (106, 212 or 424 kbps) should be supplied.
- */
-int
-nfc_initiator_select_passive_target(nfc_device *pnd,
-                                    const nfc_modulation nm,
-                                    const uint8_t *pbtInitData, const size_t szInitData,
-                                    nfc_target *pnt)
+static int
+initiator_select_passive_target(nfc_device *pnd,
+                                const nfc_modulation nm,
+                                const uint8_t *pbtInitData, const size_t szInitData,
+                                nfc_target *pnt)
 {
   uint8_t  abtInit[MAX(12, szInitData)];
   size_t  szInit;
@@ -517,29 +586,47 @@ nfc_initiator_select_passive_target(nfc_device *pnd,
       break;
   }
 
+  // A freshly activated PICC starts with block number 0
+  pnd->btIso14443_4BlockNumber = 0;
   HAL(initiator_select_passive_target, pnd, nm, abtInit, szInit, pnt);
 }
 
 /** @ingroup initiator
- * @brief List passive or emulated tags
- * @return Returns the number of targets found on success, otherwise returns libnfc's error code (negative value)
+ * @brief Select a passive or emulated tag
+ * @return Returns selected passive target count on success, otherwise returns libnfc's error code (negative value)
  *
  * @param pnd \a nfc_device struct pointer that represent currently used device
  * @param nm desired modulation
- * @param[out] ant array of \a nfc_target that will be filled with targets info
- * @param szTargets size of \a ant (will be the max targets listed)
+ * @param pbtInitData optional initiator data used for Felica, ISO14443B, Topaz polling or to select a specific UID in ISO14443A.
+ * @param szInitData length of initiator data \a pbtInitData.
+ * @note pbtInitData is used with different kind of data depending on modulation type:
+ * - for an ISO/IEC 14443 type A modulation, pbbInitData contains the UID you want to select;
+ * - for an ISO/IEC 14443 type B modulation, pbbInitData contains Application Family Identifier (AFI) (see ISO/IEC 14443-3);
+ * - for a FeliCa modulation, pbbInitData contains polling payload (see ISO/IEC 18092 11.2.2.5).
  *
- * The NFC device will try to find the available passive tags. Some NFC devices
- * are capable to emulate passive tags. The standards (ISO18092 and ECMA-340)
- * describe the modulation that can be used for reader to passive
- * communications. The chip needs to know with what kind of tag it is dealing
- * with, therefore the initial modulation and speed (106, 212 or 424 kbps)
- * should be supplied.
+ * @param[out] pnt \a nfc_target struct pointer which will filled if available
+ *
+ * The NFC device will try to find one available passive tag or emulated tag.
+ *
+ * The chip needs to know with what kind of tag it is dealing with, therefore
+ * the initial modulation and speed (106, 212 or 424 kbps) should be supplied.
  */
 int
-nfc_initiator_list_passive_targets(nfc_device *pnd,
-                                   const nfc_modulation nm,
-                                   nfc_target ant[], const size_t szTargets)
+nfc_initiator_select_passive_target(nfc_device *pnd,
+                                    const nfc_modulation nm,
+                                    const uint8_t *pbtInitData, const size_t szInitData,
+                                    nfc_target *pnt)
+{
+  nfc_device_lock(pnd);
+  const int res = initiator_select_passive_target(pnd, nm, pbtInitData, szInitData, pnt);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
+static int
+initiator_list_passive_targets(nfc_device *pnd,
+                               const nfc_modulation nm,
+                               nfc_target ant[], const size_t szTargets)
 {
   nfc_target nt;
   size_t  szTargetFound = 0;
@@ -556,12 +643,21 @@ nfc_initiator_list_passive_targets(nfc_device *pnd,
 
   prepare_initiator_data(nm, &pbtInitData, &szInitDataLen);
 
+  pnd->btIso14443_4BlockNumber = 0;
+  if (pnd->driver->initiator_list_passive_targets) {
+    // The device may find several targets in a single round trip
+    if ((res = pnd->driver->initiator_list_passive_targets(pnd, nm, pbtInitData, szInitDataLen, ant, szTargets)) != NFC_ENOTIMPL)
+      return res;
+    pnd->last_error = 0;
+  }
+
   while (nfc_initiator_select_passive_target(pnd, nm, pbtInitData, szInitDataLen, &nt) > 0) {
     size_t i;
     bool seen = false;
     // Check if we've already seen this tag
+    const uint32_t uiHash = target_uid_hash(&nt);
     for (i = 0; i < szTargetFound; i++) {
-      if (memcmp(&(ant[i]), &nt, sizeof(nfc_target)) == 0) {
+      if (target_uid_hash(&(ant[i])) == uiHash) {
         seen = true;
       }
     }
@@ -583,6 +679,47 @@ nfc_initiator_list_passive_targets(nfc_device *pnd,
   return szTargetFound;
 }
 
+/** @ingroup initiator
+ * @brief List passive or emulated tags
+ * @return Returns the number of targets found on success, otherwise returns libnfc's error code (negative value)
+ *
+ * @param pnd \a nfc_device struct pointer that represent currently used device
+ * @param nm desired modulation
+ * @param[out] ant array of \a nfc_target that will be filled with targets info
+ * @param szTargets size of \a ant (will be the max targets listed)
+ *
+ * The NFC device will try to find the available passive tags. Some NFC devices
+ * are capable to emulate passive tags. The standards (ISO18092 and ECMA-340)
+ * describe the modulation that can be used for reader to passive
+ * communications. The chip needs to know with what kind of tag it is dealing
+ * with, therefore the initial modulation and speed (106, 212 or 424 kbps)
+ * should be supplied.
+ *
+ * The targets found last are left activated. A \e PN53x activates up to two
+ * targets at once, so when \a szTargets is 2 or less all the listed targets
+ * can be used with nfc_initiator_target_transceive_bytes() afterwards.
+ */
+int
+nfc_initiator_list_passive_targets(nfc_device *pnd,
+                                   const nfc_modulation nm,
+                                   nfc_target ant[], const size_t szTargets)
+{
+  nfc_device_lock(pnd);
+  const int res = initiator_list_passive_targets(pnd, nm, ant, szTargets);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
+static int
+initiator_poll_target(nfc_device *pnd,
+                      const nfc_modulation *pnmModulations, const size_t szModulations,
+                      const uint8_t uiPollNr, const uint8_t uiPeriod,
+                      nfc_target *pnt)
+{
+  pnd->btIso14443_4BlockNumber = 0;
+  HAL(initiator_poll_target, pnd, pnmModulations, szModulations, uiPollNr, uiPeriod, pnt);
+}
+
 /** @ingroup initiator
  * @brief Polling for NFC targets
  * @return Returns polled targets count, otherwise returns libnfc's error code (negative value).
@@ -602,7 +739,10 @@ nfc_initiator_poll_target(nfc_device *pnd,
                           const uint8_t uiPollNr, const uint8_t uiPeriod,
                           nfc_target *pnt)
 {
-  HAL(initiator_poll_target, pnd, pnmModulations, szModulations, uiPollNr, uiPeriod, pnt);
+  nfc_device_lock(pnd);
+  const int res = initiator_poll_target(pnd, pnmModulations, szModulations, uiPollNr, uiPeriod, pnt);
+  nfc_device_unlock(pnd);
+  return res;
 }
 
 
@@ -634,6 +774,30 @@ nfc_initiator_select_dep_target(nfc_device *pnd,
   HAL(initiator_select_dep_target, pnd, ndm, nbr, pndiInitiator, pnt, timeout);
 }
 
+static int
+initiator_poll_dep_target(struct nfc_device *pnd,
+                          const nfc_dep_mode ndm, const nfc_baud_rate nbr,
+                          const nfc_dep_info *pndiInitiator,
+                          nfc_target *pnt,
+                          const int timeout)
+{
+  const int period = 300;
+  int remaining_time = timeout;
+  int res;
+  if ((res = nfc_device_set_property_bool(pnd, NP_INFINITE_SELECT, true)) < 0)
+    return res;
+  while (remaining_time > 0) {
+    if ((res = nfc_initiator_select_dep_target(pnd, ndm, nbr, pndiInitiator, pnt, period)) < 0) {
+      if (res != NFC_ETIMEOUT)
+        return res;
+    }
+    if (res == 1)
+      return res;
+    remaining_time -= period;
+  }
+  return 0;
+}
+
 /** @ingroup initiator
  * @brief Poll a target and request active or passive mode for D.E.P. (Data Exchange Protocol)
  * @return Returns selected D.E.P targets count on success, otherwise returns libnfc's error code (negative value).
@@ -658,21 +822,17 @@ nfc_initiator_poll_dep_target(struct nfc_device *pnd,
                               nfc_target *pnt,
                               const int timeout)
 {
-  const int period = 300;
-  int remaining_time = timeout;
-  int res;
-  if ((res = nfc_device_set_property_bool(pnd, NP_INFINITE_SELECT, true)) < 0)
-    return res;
-  while (remaining_time > 0) {
-    if ((res = nfc_initiator_select_dep_target(pnd, ndm, nbr, pndiInitiator, pnt, period)) < 0) {
-      if (res != NFC_ETIMEOUT)
-        return res;
-    }
-    if (res == 1)
-      return res;
-    remaining_time -= period;
-  }
-  return 0;
+  nfc_device_lock(pnd);
+  const int res = initiator_poll_dep_target(pnd, ndm, nbr, pndiInitiator, pnt, timeout);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
+static int
+initiator_deselect_target(nfc_device *pnd)
+{
+  pnd->btIso14443_4BlockNumber = 0;
+  HAL(initiator_deselect_target, pnd);
 }
 
 /** @ingroup initiator
@@ -690,7 +850,10 @@ nfc_initiator_poll_dep_target(struct nfc_device *pnd,
 int
 nfc_initiator_deselect_target(nfc_device *pnd)
 {
-  HAL(initiator_deselect_target, pnd);
+  nfc_device_lock(pnd);
+  const int res = initiator_deselect_target(pnd);
+  nfc_device_unlock(pnd);
+  return res;
 }
 
 /** @ingroup initiator
@@ -708,6 +871,7 @@ nfc_initiator_deselect_target(nfc_device *pnd)
  * It waits for the response and stores the received bytes in the \a pbtRx byte array.
  *
  * If \a NP_EASY_FRAMING option is disabled the frames will sent and received in raw mode: \e PN53x will not handle input neither output data.
+ * Otherwise data larger than a chip frame is chained (MI bit) frame by frame, both ways, so \a szTx and \a szRx are not bound to the frame size.
  *
  * The parity bits are handled by the \e PN53x chip. The CRC can be generated automatically or handled manually.
  * Using this function, frames can be communicated very fast via the NFC initiator to the tag.
@@ -728,6 +892,85 @@ nfc_initiator_transceive_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size
   HAL(initiator_transceive_bytes, pnd, pbtTx, szTx, pbtRx, szRx, timeout)
 }
 
+static int
+initiator_transceive_apdu(nfc_device *pnd, const nfc_target *pnt, const nfc_iovec aiovTx[], const size_t szIovTx,
+                          uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  pnd->last_error = 0;
+  if (!pnt) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+  const size_t szFsc = iso14443_4_fsc(pnt);
+  if (!szFsc) {
+    pnd->last_error = NFC_EINVARG;
+    return pnd->last_error;
+  }
+
+  if (!pnd->bEasyFraming) {
+    if (!pnd->bCrc) {
+      pnd->last_error = NFC_EINVARG;
+      return pnd->last_error;
+    }
+    return iso14443_4_transceive(pnd, szFsc, aiovTx, szIovTx, pbtRx, szRx, timeout);
+  }
+
+  if (szIovTx == 1)
+    return nfc_initiator_transceive_bytes(pnd, aiovTx[0].pbtData, aiovTx[0].szData, pbtRx, szRx, timeout);
+
+  size_t szTx = 0;
+  for (size_t n = 0; n < szIovTx; n++)
+    szTx += aiovTx[n].szData;
+  uint8_t *pbtTx = malloc(MAX(szTx, 1));
+  if (!pbtTx) {
+    pnd->last_error = NFC_ESOFT;
+    return pnd->last_error;
+  }
+  size_t szOffset = 0;
+  for (size_t n = 0; n < szIovTx; n++) {
+    memcpy(pbtTx + szOffset, aiovTx[n].pbtData, aiovTx[n].szData);
+    szOffset += aiovTx[n].szData;
+  }
+  const int res = nfc_initiator_transceive_bytes(pnd, pbtTx, szTx, pbtRx, szRx, timeout);
+  free(pbtTx);
+  return res;
+}
+
+/** @ingroup initiator
+ * @brief Send an APDU to an ISO14443-4 target then retrieve its response
+ * @return Returns received bytes count on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnt selected target, its ATS (type A) or ATQB (type B) tells the frame size it accepts
+ * @param aiovTx parts of the command APDU, sent one after the other as a single APDU
+ * @param szIovTx count of parts in \a aiovTx
+ * @param[out] pbtRx response APDU, status word included
+ * @param szRx size of \a pbtRx (Will return NFC_EOVFLOW if RX exceeds this size)
+ * @param timeout in milliseconds, for each block exchanged
+ *
+ * Extended length APDUs (up to 64 KB of data) are split in as few frames as the target accepts.
+ *
+ * If \a NP_EASY_FRAMING option is enabled the \e PN53x handles the ISO14443-4 block protocol, this is then
+ * the same as nfc_initiator_transceive_bytes() with the parts put together.
+ * Otherwise libnfc does it: the command is packed in I-blocks filled up to the frame size of the target,
+ * chained when needed, a lost or broken block is asked again and waiting time extensions are granted.
+ * The block numbering starts over with each target selection.
+ *
+ * @warning When \a NP_EASY_FRAMING option is disabled, \a NP_HANDLE_CRC must be set to \c true (the default value).
+ *
+ * If timeout equals to 0, the function blocks indefinitely (until an error is raised or function is completed)
+ * If timeout equals to -1, the default timeout will be used
+ */
+int
+nfc_initiator_transceive_apdu(nfc_device *pnd, const nfc_target *pnt, const nfc_iovec aiovTx[], const size_t szIovTx,
+                              uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  nfc_device_lock(pnd);
+  const int res = initiator_transceive_apdu(pnd, pnt, aiovTx, szIovTx, pbtRx, szRx, timeout);
+  nfc_device_unlock(pnd);
+  return res;
+}
+
 /** @ingroup initiator
  * @brief Transceive raw bit-frames to a target
  * @return Returns received bits count on success, otherwise returns libnfc's error code
@@ -814,7 +1057,12 @@ nfc_initiator_transceive_bytes_timed(nfc_device *pnd,
  * @return Returns 0 on success, otherwise returns libnfc's error code.
  *
  * This function tests if \a nfc_target is currently present on NFC device.
- * @warning The target have to be selected before check its presence
+ * The cheapest command its type allows is sent, with a timeout which follows
+ * how fast the previous checks were answered. A target which is gone is
+ * released and NFC_ETGRELEASED is returned. NFC_ETIMEOUT means the device did
+ * not answer in time, the target is kept: the check can be run again.
+ * @warning The target have to be selected before check its presence, any of
+ * the targets activated together by nfc_initiator_list_passive_targets() will do
  * @warning To run the test, one or more commands will be sent to target
 */
 int
@@ -823,6 +1071,61 @@ nfc_initiator_target_is_present(nfc_device *pnd, const nfc_target nt)
   HAL(initiator_target_is_present, pnd, nt);
 }
 
+/** @ingroup initiator
+ * @brief Send data to one of the activated targets then retrieve data from it
+ * @return Returns received bytes count on success, otherwise returns libnfc's error code
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnt target to talk to, as returned by nfc_initiator_list_passive_targets()
+ * @param pbtTx contains a byte array of the frame that needs to be transmitted.
+ * @param szTx contains the length in bytes.
+ * @param[out] pbtRx response from the target
+ * @param szRx size of \a pbtRx (Will return NFC_EOVFLOW if RX exceeds this size)
+ * @param timeout in milliseconds
+ *
+ * This is nfc_initiator_transceive_bytes() for a given target when the device
+ * holds several of them activated, e.g. a phone and a card: traffic with
+ * both can be interleaved without selecting them again.
+ * NFC_ETGRELEASED is returned when \a pnt is not activated anymore.
+ *
+ * @warning The configuration option \a NP_EASY_FRAMING must be set to \c true (the default value).
+ */
+int
+nfc_initiator_target_transceive_bytes(nfc_device *pnd, const nfc_target *pnt, const uint8_t *pbtTx, const size_t szTx,
+                                      uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  HAL(initiator_target_transceive_bytes, pnd, pnt, pbtTx, szTx, pbtRx, szRx, timeout);
+}
+
+/** @ingroup initiator
+ * @brief Deselect one of the activated targets
+ * @return Returns 0 on success, otherwise returns libnfc's error code (negative value).
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnt target to deselect, the other activated targets are left as they are
+ */
+int
+nfc_initiator_target_deselect(nfc_device *pnd, const nfc_target *pnt)
+{
+  HAL(initiator_target_deselect, pnd, pnt);
+}
+
+/** @ingroup initiator
+ * @brief Release one of the activated targets
+ * @return Returns 0 on success, otherwise returns libnfc's error code (negative value).
+ *
+ * @param pnd \a nfc_device struct pointer that represents currently used device
+ * @param pnt target to release, the other activated targets are left as they are
+ *
+ * Unlike nfc_initiator_target_deselect(), the device forgets the target which
+ * has to be listed again to be used.
+ */
+int
+nfc_initiator_target_release(nfc_device *pnd, const nfc_target *pnt)
+{
+  HAL(initiator_target_release, pnd, pnt);
+}
+
 /** @ingroup initiator
  * @brief Transceive raw bit-frames to a target
  * @return Returns received bits count on success, otherwise returns libnfc's error code
@@ -855,6 +1158,37 @@ nfc_initiator_transceive_bits_timed(nfc_device *pnd,
   HAL(initiator_transceive_bits_timed, pnd, pbtTx, szTxBits, pbtTxPar, pbtRx, pbtRxPar, cycles);
 }
 
+static int
+target_init(nfc_device *pnd, nfc_target *pnt, uint8_t *pbtRx, const size_t szRx, int timeout)
+{
+  int res = 0;
+  // Disallow invalid frame
+  if ((res = nfc_device_set_property_bool(pnd, NP_ACCEPT_INVALID_FRAMES, false)) < 0)
+    return res;
+  // Disallow multiple frames
+  if ((res = nfc_device_set_property_bool(pnd, NP_ACCEPT_MULTIPLE_FRAMES, false)) < 0)
+    return res;
+  // Make sure we reset the CRC and parity to chip handling.
+  if ((res = nfc_device_set_property_bool(pnd, NP_HANDLE_CRC, true)) < 0)
+    return res;
+  if ((res = nfc_device_set_property_bool(pnd, NP_HANDLE_PARITY, true)) < 0)
+    return res;
+  // Activate auto ISO14443-4 switching by default
+  if ((res = nfc_device_set_property_bool(pnd, NP_AUTO_ISO14443_4, true)) < 0)
+    return res;
+  // Activate "easy framing" feature by default
+  if ((res = nfc_device_set_property_bool(pnd, NP_EASY_FRAMING, true)) < 0)
+    return res;
+  // Deactivate the CRYPTO1 cipher, it may could cause problems when still active
+  if ((res = nfc_device_set_property_bool(pnd, NP_ACTIVATE_CRYPTO1, false)) < 0)
+    return res;
+  // Drop explicitely the field
+  if ((res = nfc_device_set_property_bool(pnd, NP_ACTIVATE_FIELD, false)) < 0)
+    return res;
+
+  HAL(target_init, pnd, pnt, pbtRx, szRx, timeout);
+}
+
 /** @ingroup target
  * @brief Initialize NFC device as an emulated tag
  * @return Returns received bytes count on success, otherwise returns libnfc's error code
@@ -891,32 +1225,10 @@ nfc_initiator_transceive_bits_timed(nfc_device *pnd,
 int
 nfc_target_init(nfc_device *pnd, nfc_target *pnt, uint8_t *pbtRx, const size_t szRx, int timeout)
 {
-  int res = 0;
-  // Disallow invalid frame
-  if ((res = nfc_device_set_property_bool(pnd, NP_ACCEPT_INVALID_FRAMES, false)) < 0)
-    return res;
-  // Disallow multiple frames
-  if ((res = nfc_device_set_property_bool(pnd, NP_ACCEPT_MULTIPLE_FRAMES, false)) < 0)
-    return res;
-  // Make sure we reset the CRC and parity to chip handling.
-  if ((res = nfc_device_set_property_bool(pnd, NP_HANDLE_CRC, true)) < 0)
-    return res;
-  if ((res = nfc_device_set_property_bool(pnd, NP_HANDLE_PARITY, true)) < 0)
-    return res;
-  // Activate auto ISO14443-4 switching by default
-  if ((res = nfc_device_set_property_bool(pnd, NP_AUTO_ISO14443_4, true)) < 0)
-    return res;
-  // Activate "easy framing" feature by default
-  if ((res = nfc_device_set_property_bool(pnd, NP_EASY_FRAMING, true)) < 0)
-    return res;
-  // Deactivate the CRYPTO1 cipher, it may could cause problems when still active
-  if ((res = nfc_device_set_property_bool(pnd, NP_ACTIVATE_CRYPTO1, false)) < 0)
-    return res;
-  // Drop explicitely the field
-  if ((res = nfc_device_set_property_bool(pnd, NP_ACTIVATE_FIELD, false)) < 0)
-    return res;
-
-  HAL(target_init, pnd, pnt, pbtRx, szRx, timeout);
+  nfc_device_lock(pnd);
+  const int res = target_init(pnd, pnt, pbtRx, szRx, timeout);
+  nfc_device_unlock(pnd);
+  return res;
 }
 
 /** @ingroup dev
@@ -949,7 +1261,11 @@ nfc_idle(nfc_device *pnd)
 int
 nfc_abort_command(nfc_device *pnd)
 {
-  HAL(abort_command, pnd);
+  // Usually called from another thread than the one running the command:
+  // last_error belongs to the latter
+  if (!pnd->driver->abort_command)
+    return NFC_EDEVNOTSUPP;
+  return pnd->driver->abort_command(pnd);
 }
 
 /** @ingroup target
@@ -963,6 +1279,7 @@ nfc_abort_command(nfc_device *pnd)
  *
  * This function make the NFC device (configured as \e target) send byte frames
  * (e.g. APDU responses) to the \e initiator.
+ * With \a NP_EASY_FRAMING, data larger than a chip frame is chained (MI bit) frame by frame.
  *
  * If timeout equals to 0, the function blocks indefinitely (until an error is raised or function is completed)
  * If timeout equals to -1, the default timeout will be used
@@ -983,6 +1300,7 @@ nfc_target_send_bytes(nfc_device *pnd, const uint8_t *pbtTx, const size_t szTx,
  * @param timeout in milliseconds
  *
  * This function retrieves bytes frames (e.g. ADPU) sent by the \e initiator to the NFC device (configured as \e target).
+ * With \a NP_EASY_FRAMING, data chained by the \e initiator is gathered in \a pbtRx.
  *
  * If timeout equals to 0, the function blocks indefinitely (until an error is raised or function is completed)
  * If timeout equals to -1, the default timeout will be used
@@ -0,0 +1,60 @@
+/*-
+ * Public platform independent Near Field Communication (NFC) library
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file probes.h
+ * @brief USDT probes of the libnfc provider
+ *
+ * Built with --enable-usdt (or LIBNFC_USDT in CMake), each probe is a nop
+ * instruction until a tracer attaches to it, e.g.
+ *   bpftrace -e 'usdt:/usr/lib/libnfc.so:libnfc:pn53x__command__done { @[arg0] = count(); }'
+ * Otherwise probes are compiled out, their arguments are not evaluated.
+ *
+ * The driver probes fire when the send and receive functions of the driver
+ * return, most drivers have received the ACK frame when send returns.
+ *
+ * Probes and their arguments:
+ *   pn53x__command__start  command, command length, timeout (ms)
+ *   pn53x__command__done   command, response length or libnfc error, PN53x status byte
+ *   pn53x__writeback       registers to write back, bit n is PN53X_CACHE_REGISTER_MIN_ADDRESS + n
+ *   driver__send           driver name, command, 0 or libnfc error, timeout (ms)
+ *   driver__receive        driver name, command, response length or libnfc error, timeout (ms)
+ *   uart__wakeup           select() result, timeout (ms)
+ *   uart__read             bytes read, bytes buffered
+ */
+
+#ifndef __NFC_PROBES_H__
+#define __NFC_PROBES_H__
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif // HAVE_CONFIG_H
+
+#ifdef ENABLE_USDT
+#  include <sys/sdt.h>
+#  define PROBE1(name, a1) DTRACE_PROBE1(libnfc, name, a1)
+#  define PROBE2(name, a1, a2) DTRACE_PROBE2(libnfc, name, a1, a2)
+#  define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(libnfc, name, a1, a2, a3)
+#  define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(libnfc, name, a1, a2, a3, a4)
+#else
+#  define PROBE1(name, a1) ((void) 0)
+#  define PROBE2(name, a1, a2) ((void) 0)
+#  define PROBE3(name, a1, a2, a3) ((void) 0)
+#  define PROBE4(name, a1, a2, a3, a4) ((void) 0)
+#endif
+
+#endif // __NFC_PROBES_H__
@@ -2,15 +2,16 @@
 
 WITH_USB=1
 
-LIBUSB_WIN32_BIN_VERSION="1.2.6.0"
-LIBUSB_WIN32_BIN_ARCHIVE="libusb-win32-bin-$LIBUSB_WIN32_BIN_VERSION.zip"
-LIBUSB_WIN32_BIN_URL="http://freefr.dl.sourceforge.net/project/libusb-win32/libusb-win32-releases/$LIBUSB_WIN32_BIN_VERSION/$LIBUSB_WIN32_BIN_ARCHIVE"
-LIBUSB_WIN32_BIN_DIR="libusb-win32-bin-$LIBUSB_WIN32_BIN_VERSION"
+# Where libusb-1.0 Windows binaries (http://libusb.info) have been extracted,
+# it must contain include/libusb-1.0/libusb.h and lib/libusb-1.0.a
+LIBUSB_DIR="${LIBUSB_DIR:=$PWD/libusb-1.0}"
 
 if [ "$WITH_USB" = "1" ]; then
-  if [ ! -d $LIBUSB_WIN32_BIN_DIR ]; then
-    wget -c $LIBUSB_WIN32_BIN_URL
-    unzip $LIBUSB_WIN32_BIN_ARCHIVE
+  if [ ! -f $LIBUSB_DIR/include/libusb-1.0/libusb.h ]; then
+    echo "Error __________________________________________"
+    echo "libusb-1.0 not found in $LIBUSB_DIR, please set"
+    echo "LIBUSB_DIR to libusb-1.0 Windows binaries."
+    exit 1
   fi
 fi
 
@@ -68,7 +69,7 @@ fi
 
 ## Configure to cross-compile using mingw32msvc
 if [ "$WITH_USB" = "1" ]; then
-  # with direct-USB drivers (use libusb-win32)
+  # with direct-USB drivers (use libusb-1.0)
   DRIVERS="all"
 else
   # with UART divers only (can be tested under wine)
@@ -81,7 +82,7 @@ fi
 
 ./configure --target=$MINGW --host=$MINGW \
   --with-drivers=$DRIVERS \
-  --with-libusb-win32=$PWD/$LIBUSB_WIN32_BIN_DIR \
+  --with-libusb=$LIBUSB_DIR \
   $*
 
 if [ "$MINGW" = "i686-w64-mingw32" ]; then
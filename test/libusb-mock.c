@@ -0,0 +1,956 @@
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+#include "libusb-mock.h"
+
+#define MOCK_PACKET_LEN 512
+#define MOCK_QUEUE_LEN 8
+#define MOCK_MAX_TRANSFERS 8
+#define MOCK_EP_IN 0x84
+#define MOCK_EP_OUT 0x04
+#define MOCK_MAX_PACKET_SIZE 64
+#define MOCK_MAX_HOTPLUG_CALLBACKS 4
+#define MOCK_DEP_LEN 65536
+#define MOCK_DEP_PART_LEN 262
+#define MOCK_CARD_INF_LEN 61
+#define MOCK_CARDS_MAX 8
+
+struct libusb_context {
+  int unused;
+};
+
+struct libusb_device {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  bool plugged;
+};
+
+struct libusb_device_handle {
+  struct libusb_device *dev;
+};
+
+// Hotplug notifications are delivered by the event loop of their context
+struct mock_hotplug_callback {
+  libusb_context *ctx;
+  libusb_hotplug_callback_fn callback;
+  void *user_data;
+  bool arrived;
+  bool left;
+};
+
+struct mock_packet {
+  uint8_t data[MOCK_PACKET_LEN];
+  size_t len;
+};
+
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mock_cond = PTHREAD_COND_INITIALIZER;
+
+static struct libusb_device mock_device;
+static struct libusb_mock_stats mock_stats;
+
+// Packets the device has to send, oldest first
+static struct mock_packet mock_queue[MOCK_QUEUE_LEN];
+static size_t mock_queue_head, mock_queue_count;
+static struct mock_packet mock_last_response;
+
+// Submitted transfers, a cancelled one is given back by the event loop
+static struct libusb_transfer *mock_transfers[MOCK_MAX_TRANSFERS];
+static bool mock_cancelled[MOCK_MAX_TRANSFERS];
+
+static uint8_t mock_registers[0x10000];
+
+// Data chained by the host, echoed back by the target once complete
+static uint8_t mock_dep_data[MOCK_DEP_LEN];
+static size_t mock_dep_len, mock_dep_sent;
+static bool mock_dep_receiving = true;
+
+// APDU sent by the host in ISO14443-4 blocks, echoed back by the card
+static uint8_t mock_card_data[MOCK_DEP_LEN];
+static size_t mock_card_len, mock_card_sent;
+static bool mock_card_receiving;
+static uint8_t mock_card_block_number;
+// Waiting time extension the card asks for before answering the next APDU, 0 for none
+static uint8_t mock_card_wtxm;
+// Timeout of the bulk OUT transfer being processed
+static unsigned int mock_out_timeout;
+
+// ISO14443-4A cards in the field, a deselected card keeps quiet until it is put back
+enum mock_card_state { MOCK_CARD_IDLE, MOCK_CARD_ACTIVE, MOCK_CARD_HALTED };
+static size_t mock_cards_count;
+static uint8_t mock_cards_ta1;
+static enum mock_card_state mock_cards_state[MOCK_CARDS_MAX];
+static uint8_t mock_cards_tg[MOCK_CARDS_MAX];
+
+// Commands left to ACK without answering them
+static size_t mock_mute_count;
+
+static struct mock_hotplug_callback mock_hotplug_callbacks[MOCK_MAX_HOTPLUG_CALLBACKS];
+
+// Readable while the event loop has something to do, as libusb file descriptors are
+static int mock_event_fds[2] = { -1, -1 };
+static struct libusb_pollfd mock_pollfd;
+
+static const struct libusb_endpoint_descriptor mock_endpoints[] = {
+  { .bLength = 7, .bDescriptorType = 5, .bEndpointAddress = MOCK_EP_IN, .bmAttributes = LIBUSB_TRANSFER_TYPE_BULK, .wMaxPacketSize = MOCK_MAX_PACKET_SIZE },
+  { .bLength = 7, .bDescriptorType = 5, .bEndpointAddress = MOCK_EP_OUT, .bmAttributes = LIBUSB_TRANSFER_TYPE_BULK, .wMaxPacketSize = MOCK_MAX_PACKET_SIZE },
+};
+static const struct libusb_interface_descriptor mock_altsetting = {
+  .bLength = 9, .bDescriptorType = 4, .bNumEndpoints = 2, .bInterfaceClass = 0xff, .endpoint = mock_endpoints,
+};
+static const struct libusb_interface mock_interface = {
+  .altsetting = &mock_altsetting, .num_altsetting = 1,
+};
+static struct libusb_config_descriptor mock_config = {
+  .bLength = 9, .bDescriptorType = 2, .bNumInterfaces = 1, .bConfigurationValue = 1, .interface = &mock_interface,
+};
+
+// Called with the mutex held whenever transfers or queued packets change
+static void
+mock_sync_event_fd(void)
+{
+  bool pending = false;
+  for (size_t i = 0; i < MOCK_MAX_TRANSFERS; i++) {
+    if (mock_transfers[i] && (mock_cancelled[i] || !mock_device.plugged || mock_queue_count))
+      pending = true;
+  }
+  if (mock_event_fds[0] < 0)
+    return;
+  uint8_t b = 0;
+  while (read(mock_event_fds[0], &b, 1) > 0)
+    ;
+  if (pending) {
+    ssize_t n = write(mock_event_fds[1], &b, 1);
+    (void) n;
+  }
+}
+
+void
+libusb_mock_reset(uint16_t vendor_id, uint16_t product_id)
+{
+  pthread_mutex_lock(&mock_mutex);
+  mock_device.vendor_id = vendor_id;
+  mock_device.product_id = product_id;
+  if (!mock_device.plugged) {
+    for (size_t i = 0; i < MOCK_MAX_HOTPLUG_CALLBACKS; i++)
+      mock_hotplug_callbacks[i].arrived = true;
+  }
+  mock_device.plugged = true;
+  memset(&mock_stats, 0, sizeof(mock_stats));
+  mock_queue_head = mock_queue_count = 0;
+  mock_dep_len = mock_dep_sent = 0;
+  mock_dep_receiving = true;
+  mock_card_len = mock_card_sent = 0;
+  mock_card_receiving = false;
+  mock_card_block_number = 1;
+  mock_card_wtxm = 0;
+  mock_cards_count = 0;
+  mock_mute_count = 0;
+  if ((mock_event_fds[0] < 0) && (pipe(mock_event_fds) == 0)) {
+    fcntl(mock_event_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(mock_event_fds[1], F_SETFL, O_NONBLOCK);
+    mock_pollfd.fd = mock_event_fds[0];
+    mock_pollfd.events = POLLIN;
+  }
+  mock_sync_event_fd();
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+void
+libusb_mock_unplug(void)
+{
+  pthread_mutex_lock(&mock_mutex);
+  if (mock_device.plugged) {
+    for (size_t i = 0; i < MOCK_MAX_HOTPLUG_CALLBACKS; i++)
+      mock_hotplug_callbacks[i].left = true;
+  }
+  mock_device.plugged = false;
+  mock_sync_event_fd();
+  pthread_cond_broadcast(&mock_cond);
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+void
+libusb_mock_cards(size_t count, uint8_t ta1)
+{
+  pthread_mutex_lock(&mock_mutex);
+  mock_cards_count = (count < MOCK_CARDS_MAX) ? count : MOCK_CARDS_MAX;
+  mock_cards_ta1 = ta1;
+  for (size_t n = 0; n < MOCK_CARDS_MAX; n++)
+    mock_cards_state[n] = MOCK_CARD_IDLE;
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+void
+libusb_mock_card_wtx(uint8_t wtxm)
+{
+  pthread_mutex_lock(&mock_mutex);
+  mock_card_wtxm = wtxm;
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+void
+libusb_mock_mute(size_t count)
+{
+  pthread_mutex_lock(&mock_mutex);
+  mock_mute_count = count;
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+const struct libusb_mock_stats *
+libusb_mock_stats(void)
+{
+  return &mock_stats;
+}
+
+static void
+mock_queue_packet(const uint8_t *data, size_t len)
+{
+  if (mock_queue_count == MOCK_QUEUE_LEN)
+    return;
+  struct mock_packet *packet = &mock_queue[(mock_queue_head + mock_queue_count) % MOCK_QUEUE_LEN];
+  memcpy(packet->data, data, len);
+  packet->len = len;
+  mock_queue_count++;
+  mock_sync_event_fd();
+  pthread_cond_broadcast(&mock_cond);
+}
+
+static void
+mock_reply(uint8_t command, const uint8_t *data, size_t len)
+{
+  static const uint8_t ack[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+  struct mock_packet *res = &mock_last_response;
+  const size_t frame_len = len + 2;  // TFI + CC+1
+  size_t off;
+
+  res->data[0] = 0x00;
+  res->data[1] = 0x00;
+  res->data[2] = 0xff;
+  if (frame_len <= 255) {
+    res->data[3] = frame_len;
+    res->data[4] = 256 - frame_len;
+    off = 5;
+  } else {
+    res->data[3] = 0xff;
+    res->data[4] = 0xff;
+    res->data[5] = frame_len >> 8;
+    res->data[6] = frame_len & 0xff;
+    res->data[7] = 256 - ((res->data[5] + res->data[6]) & 0xff);
+    off = 8;
+  }
+  res->data[off] = 0xd5;
+  res->data[off + 1] = command + 1;
+  memcpy(res->data + off + 2, data, len);
+  uint8_t dcs = 256 - 0xd5 - (command + 1);
+  for (size_t i = 0; i < len; i++)
+    dcs -= data[i];
+  res->data[off + 2 + len] = dcs;
+  res->data[off + 3 + len] = 0x00;
+  res->len = off + 4 + len;
+
+  mock_queue_packet(ack, sizeof(ack));
+  mock_queue_packet(res->data, res->len);
+}
+
+// ISO14443-4 card behind InCommunicateThru, the answer starts with the status byte
+static size_t
+mock_card_process(const uint8_t *block, size_t len, uint8_t *res)
+{
+  res[0] = 0x00; // Status: success
+  if ((block[0] & 0xe2) == 0x02) { // I-block
+    mock_card_block_number = block[0] & 0x01;
+    if (!mock_card_receiving)
+      mock_card_len = 0;
+    mock_card_receiving = true;
+    len--;
+    if (mock_card_len + len > MOCK_DEP_LEN)
+      len = MOCK_DEP_LEN - mock_card_len;
+    memcpy(mock_card_data + mock_card_len, block + 1, len);
+    mock_card_len += len;
+    if (block[0] & 0x10) {
+      res[1] = 0xa2 | mock_card_block_number; // R(ACK), send the next block
+      return 2;
+    }
+    mock_card_receiving = false;
+    mock_card_sent = 0;
+    if (mock_card_wtxm) {
+      res[1] = 0xf2; // S(WTX), the response comes once it is granted
+      res[2] = mock_card_wtxm;
+      mock_card_wtxm = 0;
+      return 3;
+    }
+  } else if ((block[0] & 0xf7) == 0xf2) {
+    // S(WTX) response: the extension is granted, the response can go
+    mock_stats.wtx_timeout = mock_out_timeout;
+  } else {
+    // R(ACK) for the last block of the response: the next one
+    mock_card_block_number ^= 0x01;
+  }
+  size_t len_inf = mock_card_len - mock_card_sent;
+  if (len_inf > MOCK_CARD_INF_LEN)
+    len_inf = MOCK_CARD_INF_LEN;
+  res[1] = 0x02 | mock_card_block_number;
+  if (mock_card_sent + len_inf < mock_card_len)
+    res[1] |= 0x10; // Chaining
+  memcpy(res + 2, mock_card_data + mock_card_sent, len_inf);
+  mock_card_sent += len_inf;
+  return len_inf + 2;
+}
+
+// What the simulated PN533 does with a frame written by the host
+static void
+mock_process(const uint8_t *frame, size_t len)
+{
+  uint8_t res[MOCK_PACKET_LEN];
+  size_t res_len = 0;
+
+  if ((len < 6) || (frame[0] != 0x00) || (frame[1] != 0x00) || (frame[2] != 0xff))
+    return;
+  if ((frame[3] == 0x00) && (frame[4] == 0xff))
+    return; // ACK: abort the running command, nothing is running here
+  if ((frame[3] == 0xff) && (frame[4] == 0x00)) {
+    // NACK: send the last response again
+    mock_queue_packet(mock_last_response.data, mock_last_response.len);
+    return;
+  }
+
+  const uint8_t *cmd;
+  size_t cmd_len;
+  if ((frame[3] == 0xff) && (frame[4] == 0xff)) {
+    cmd_len = (frame[5] << 8) | frame[6];
+    cmd = frame + 8;
+  } else {
+    cmd_len = frame[3];
+    cmd = frame + 5;
+  }
+  if ((cmd_len < 2) || (cmd + cmd_len > frame + len))
+    return;
+  cmd++; // TFI
+  cmd_len--;
+
+  mock_stats.commands++;
+  if (mock_mute_count) {
+    static const uint8_t ack[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+    mock_mute_count--;
+    mock_queue_packet(ack, sizeof(ack));
+    return;
+  }
+  switch (cmd[0]) {
+    case 0x8c: { // TgInitAsTarget: no initiator ever shows up, only ACK it
+      static const uint8_t ack[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+      mock_queue_packet(ack, sizeof(ack));
+      return;
+    }
+    case 0x00: // Diagnose: echo test data
+      memcpy(res, cmd + 1, cmd_len - 1);
+      res_len = cmd_len - 1;
+      break;
+    case 0x02: // GetFirmwareVersion: PN533 v2.7
+      res[0] = 0x33;
+      res[1] = 0x02;
+      res[2] = 0x07;
+      res[3] = 0x07;
+      res_len = 4;
+      break;
+    case 0x06: // ReadRegister, PN533 prepends its answer by a status byte
+      mock_stats.register_reads++;
+      res[res_len++] = 0x00;
+      for (size_t i = 1; i + 1 < cmd_len; i += 2)
+        res[res_len++] = mock_registers[(cmd[i] << 8) | cmd[i + 1]];
+      break;
+    case 0x08: // WriteRegister
+      mock_stats.register_writes++;
+      for (size_t i = 1; i + 2 < cmd_len; i += 3)
+        mock_registers[(cmd[i] << 8) | cmd[i + 1]] = cmd[i + 2];
+      res[res_len++] = 0x00;
+      break;
+    case 0x42: { // InCommunicateThru: an ISO14443-4 card, it answers other frames with its ATQB
+      static const uint8_t atqb[] = { 0x00, 0x50, 0x01, 0x02, 0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x81, 0x81 };
+      if ((cmd_len > 1) && ((cmd[1] & 0xf6) == 0xb2) && mock_cards_count) {
+        // R(NAK) to the cards in the field: an activated one answers R(ACK)
+        mock_stats.presence_probes++;
+        res[res_len++] = 0x01; // Status: timeout
+        for (size_t n = 0; n < mock_cards_count; n++) {
+          if ((mock_cards_state[n] == MOCK_CARD_ACTIVE) && (res_len == 1)) {
+            res[0] = 0x00;
+            res[res_len++] = 0xa2 | (cmd[1] & 0x01);
+          }
+        }
+        break;
+      }
+      if ((cmd_len > 1) && (((cmd[1] & 0xe2) == 0x02) || ((cmd[1] & 0xf6) == 0xa2) || ((cmd[1] & 0xf7) == 0xf2))) {
+        res_len = mock_card_process(cmd + 1, cmd_len - 1, res);
+        break;
+      }
+      memcpy(res, atqb, sizeof(atqb));
+      res_len = sizeof(atqb);
+      break;
+    }
+    case 0x32: // RFConfiguration
+      mock_stats.rf_configurations++;
+      break;
+    case 0x4a: { // InListPassiveTarget: up to MaxTg idle cards, at 106 kbps type A
+      uint8_t count = 0;
+      mock_stats.list_requests++;
+      res_len = 1;
+      for (size_t n = 0; n < mock_cards_count; n++) {
+        if (mock_cards_state[n] == MOCK_CARD_ACTIVE)
+          mock_cards_state[n] = MOCK_CARD_HALTED;
+      }
+      for (size_t n = 0; (cmd[2] == 0x00) && (n < mock_cards_count) && (count < cmd[1]); n++) {
+        if (mock_cards_state[n] != MOCK_CARD_IDLE)
+          continue;
+        const uint8_t target[] = {
+          count + 1, 0x00, 0x04, 0x20, 0x04, 0x08, 0x01, 0x02, n,  // Tg, SENS_RES, SEL_RES, NFCID1
+          0x05, 0x78, mock_cards_ta1, 0x81, 0x02                   // ATS: FSCI 8, TA(1), TB(1), TC(1)
+        };
+        memcpy(res + res_len, target, sizeof(target));
+        res_len += sizeof(target);
+        mock_cards_state[n] = MOCK_CARD_ACTIVE;
+        mock_cards_tg[n] = count + 1;
+        count++;
+      }
+      res[0] = count; // NbTg
+      break;
+    }
+    case 0x4e: { // InPSL: the CIU is moved to the new rates
+      static const uint16_t tx_mode = 0x6302, rx_mode = 0x6303;
+      mock_stats.psl_requests++;
+      mock_registers[tx_mode] = (mock_registers[tx_mode] & 0x8f) | (cmd[2] << 4);
+      mock_registers[rx_mode] = (mock_registers[rx_mode] & 0x8f) | (cmd[3] << 4);
+      res[0] = 0x00; // Status: success
+      res_len = 1;
+      break;
+    }
+    case 0x40: // InDataExchange: the target echoes what it gets, both ways chained by MI
+      if (mock_cards_count) {
+        // A card in the field answers with its number, if it is activated as Tg
+        res[res_len++] = 0x29; // Status: target released
+        for (size_t n = 0; n < mock_cards_count; n++) {
+          if ((mock_cards_state[n] == MOCK_CARD_ACTIVE) && (mock_cards_tg[n] == (cmd[1] & 0x0f))) {
+            res[0] = 0x00;
+            res[res_len++] = n;
+          }
+        }
+        break;
+      }
+      if (!mock_dep_receiving && (cmd_len == 2)) {
+        // Next part of the response
+      } else {
+        if (!mock_dep_receiving)
+          mock_dep_len = 0;
+        mock_dep_receiving = true;
+        size_t len = cmd_len - 2;
+        if (mock_dep_len + len > MOCK_DEP_LEN)
+          len = MOCK_DEP_LEN - mock_dep_len;
+        memcpy(mock_dep_data + mock_dep_len, cmd + 2, len);
+        mock_dep_len += len;
+        if (cmd[1] & 0x40) {
+          res[res_len++] = 0x00; // Status: success, send the next part
+          break;
+        }
+        mock_dep_receiving = false;
+        mock_dep_sent = 0;
+      }
+      {
+        size_t len = mock_dep_len - mock_dep_sent;
+        if (len > MOCK_DEP_PART_LEN)
+          len = MOCK_DEP_PART_LEN;
+        res[res_len++] = (mock_dep_sent + len < mock_dep_len) ? 0x40 : 0x00; // Status: MI or success
+        memcpy(res + res_len, mock_dep_data + mock_dep_sent, len);
+        res_len += len;
+        mock_dep_sent += len;
+        if (mock_dep_sent == mock_dep_len) {
+          mock_dep_receiving = true;
+          mock_dep_len = 0;
+        }
+      }
+      break;
+    case 0x44: // InDeselect
+    case 0x52: // InRelease: Tg 0 is for all the activated targets
+      for (size_t n = 0; n < mock_cards_count; n++) {
+        if ((mock_cards_state[n] == MOCK_CARD_ACTIVE) && ((cmd[1] == 0x00) || (cmd[1] == mock_cards_tg[n])))
+          mock_cards_state[n] = MOCK_CARD_HALTED;
+      }
+      res[0] = 0x00; // Status: success
+      res_len = 1;
+      break;
+    case 0x16: // PowerDown
+      res[0] = 0x00; // Status: success
+      res_len = 1;
+      break;
+    default:
+      break;
+  }
+  mock_reply(cmd[0], res, res_len);
+}
+
+// Complete what can be, called with the mutex held
+static bool
+mock_complete_transfers(void)
+{
+  bool done = false;
+  for (size_t i = 0; i < MOCK_MAX_TRANSFERS; i++) {
+    struct libusb_transfer *transfer = mock_transfers[i];
+    if (!transfer)
+      continue;
+    if (mock_cancelled[i]) {
+      transfer->status = LIBUSB_TRANSFER_CANCELLED;
+      transfer->actual_length = 0;
+    } else if (!mock_device.plugged) {
+      transfer->status = LIBUSB_TRANSFER_NO_DEVICE;
+      transfer->actual_length = 0;
+    } else if (mock_queue_count) {
+      struct mock_packet *packet = &mock_queue[mock_queue_head];
+      if (packet->len > (size_t) transfer->length) {
+        transfer->status = LIBUSB_TRANSFER_OVERFLOW;
+        transfer->actual_length = 0;
+      } else {
+        memcpy(transfer->buffer, packet->data, packet->len);
+        transfer->status = LIBUSB_TRANSFER_COMPLETED;
+        transfer->actual_length = packet->len;
+      }
+      mock_queue_head = (mock_queue_head + 1) % MOCK_QUEUE_LEN;
+      mock_queue_count--;
+    } else {
+      continue;
+    }
+    mock_transfers[i] = NULL;
+    mock_cancelled[i] = false;
+    // The callback may submit again
+    pthread_mutex_unlock(&mock_mutex);
+    transfer->callback(transfer);
+    pthread_mutex_lock(&mock_mutex);
+    done = true;
+  }
+  return done;
+}
+
+static bool
+mock_in_pending(void)
+{
+  for (size_t i = 0; i < MOCK_MAX_TRANSFERS; i++) {
+    if (mock_transfers[i])
+      return true;
+  }
+  return false;
+}
+
+int
+libusb_init(libusb_context **ctx)
+{
+  if (ctx && !(*ctx = malloc(sizeof(libusb_context))))
+    return LIBUSB_ERROR_NO_MEM;
+  return LIBUSB_SUCCESS;
+}
+
+void
+libusb_exit(libusb_context *ctx)
+{
+  free(ctx);
+}
+
+int
+libusb_has_capability(uint32_t capability)
+{
+  return capability == LIBUSB_CAP_HAS_HOTPLUG;
+}
+
+#if LIBUSB_API_VERSION >= 0x01000108
+int
+libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+#else
+int
+libusb_hotplug_register_callback(libusb_context *ctx, libusb_hotplug_event events, libusb_hotplug_flag flags, int vendor_id, int product_id, int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+#endif
+{
+  // The simulated device matches whatever is asked
+  (void) events;
+  (void) vendor_id;
+  (void) product_id;
+  (void) dev_class;
+  pthread_mutex_lock(&mock_mutex);
+  size_t i;
+  for (i = 0; (i < MOCK_MAX_HOTPLUG_CALLBACKS) && mock_hotplug_callbacks[i].callback; i++)
+    ;
+  if (i == MOCK_MAX_HOTPLUG_CALLBACKS) {
+    pthread_mutex_unlock(&mock_mutex);
+    return LIBUSB_ERROR_NO_MEM;
+  }
+  mock_hotplug_callbacks[i] = (struct mock_hotplug_callback) { .ctx = ctx, .callback = cb_fn, .user_data = user_data };
+  const bool plugged = mock_device.plugged;
+  pthread_mutex_unlock(&mock_mutex);
+
+  if ((flags & LIBUSB_HOTPLUG_ENUMERATE) && plugged)
+    cb_fn(ctx, &mock_device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data);
+  if (callback_handle)
+    *callback_handle = i;
+  return LIBUSB_SUCCESS;
+}
+
+void
+libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+  (void) ctx;
+  pthread_mutex_lock(&mock_mutex);
+  memset(&mock_hotplug_callbacks[callback_handle], 0, sizeof(struct mock_hotplug_callback));
+  pthread_mutex_unlock(&mock_mutex);
+}
+
+static void
+mock_deliver_hotplug(libusb_context *ctx)
+{
+  for (size_t i = 0; i < MOCK_MAX_HOTPLUG_CALLBACKS; i++) {
+    pthread_mutex_lock(&mock_mutex);
+    struct mock_hotplug_callback callback = mock_hotplug_callbacks[i];
+    if (callback.ctx == ctx)
+      mock_hotplug_callbacks[i].arrived = mock_hotplug_callbacks[i].left = false;
+    pthread_mutex_unlock(&mock_mutex);
+    if (!callback.callback || (callback.ctx != ctx))
+      continue;
+    if (callback.left)
+      callback.callback(ctx, &mock_device, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, callback.user_data);
+    if (callback.arrived)
+      callback.callback(ctx, &mock_device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, callback.user_data);
+  }
+}
+
+const char *
+libusb_error_name(int errcode)
+{
+  switch (errcode) {
+    case LIBUSB_ERROR_TIMEOUT:
+      return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_NO_DEVICE:
+      return "LIBUSB_ERROR_NO_DEVICE";
+    case LIBUSB_ERROR_NOT_FOUND:
+      return "LIBUSB_ERROR_NOT_FOUND";
+    default:
+      return "LIBUSB_ERROR";
+  }
+}
+
+ssize_t
+libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+  (void) ctx;
+  mock_stats.device_lists++;
+  size_t count = mock_device.plugged ? 1 : 0;
+  *list = calloc(count + 1, sizeof(libusb_device *));
+  if (!*list)
+    return LIBUSB_ERROR_NO_MEM;
+  if (count)
+    (*list)[0] = &mock_device;
+  return count;
+}
+
+void
+libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+  (void) unref_devices;
+  free(list);
+}
+
+libusb_device *
+libusb_ref_device(libusb_device *dev)
+{
+  return dev;
+}
+
+void
+libusb_unref_device(libusb_device *dev)
+{
+  (void) dev;
+}
+
+uint8_t
+libusb_get_bus_number(libusb_device *dev)
+{
+  (void) dev;
+  return 1;
+}
+
+uint8_t
+libusb_get_device_address(libusb_device *dev)
+{
+  (void) dev;
+  return 2;
+}
+
+int
+libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+  memset(desc, 0, sizeof(*desc));
+  desc->bLength = 18;
+  desc->bDescriptorType = 1;
+  desc->bcdUSB = 0x0200;
+  desc->bMaxPacketSize0 = 64;
+  desc->idVendor = dev->vendor_id;
+  desc->idProduct = dev->product_id;
+  desc->bNumConfigurations = 1;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config)
+{
+  (void) dev;
+  *config = &mock_config;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
+{
+  (void) config_index;
+  return libusb_get_active_config_descriptor(dev, config);
+}
+
+void
+libusb_free_config_descriptor(struct libusb_config_descriptor *config)
+{
+  (void) config;
+}
+
+int
+libusb_open(libusb_device *dev, libusb_device_handle **handle)
+{
+  mock_stats.opens++;
+  if (!dev->plugged)
+    return LIBUSB_ERROR_NO_DEVICE;
+  if (!(*handle = malloc(sizeof(libusb_device_handle))))
+    return LIBUSB_ERROR_NO_MEM;
+  (*handle)->dev = dev;
+  return LIBUSB_SUCCESS;
+}
+
+void
+libusb_close(libusb_device_handle *dev_handle)
+{
+  free(dev_handle);
+}
+
+libusb_device *
+libusb_get_device(libusb_device_handle *dev_handle)
+{
+  return dev_handle->dev;
+}
+
+int
+libusb_set_configuration(libusb_device_handle *dev, int configuration)
+{
+  (void) dev;
+  (void) configuration;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_claim_interface(libusb_device_handle *dev, int interface_number)
+{
+  (void) dev;
+  (void) interface_number;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_release_interface(libusb_device_handle *dev, int interface_number)
+{
+  (void) dev;
+  (void) interface_number;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_set_interface_alt_setting(libusb_device_handle *dev, int interface_number, int alternate_setting)
+{
+  (void) dev;
+  (void) interface_number;
+  (void) alternate_setting;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_reset_device(libusb_device_handle *dev)
+{
+  (void) dev;
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_get_string_descriptor_ascii(libusb_device_handle *dev, uint8_t desc_index, unsigned char *data, int length)
+{
+  (void) dev;
+  (void) desc_index;
+  (void) data;
+  (void) length;
+  return LIBUSB_ERROR_INVALID_PARAM;
+}
+
+int
+libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout)
+{
+  pthread_mutex_lock(&mock_mutex);
+  if (!dev_handle->dev->plugged) {
+    pthread_mutex_unlock(&mock_mutex);
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+  if ((endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+    // The simulated chip answers right away, no need to wait
+    mock_stats.sync_in_transfers++;
+    if (!mock_queue_count) {
+      pthread_mutex_unlock(&mock_mutex);
+      return LIBUSB_ERROR_TIMEOUT;
+    }
+    struct mock_packet *packet = &mock_queue[mock_queue_head];
+    *actual_length = ((int) packet->len < length) ? (int) packet->len : length;
+    memcpy(data, packet->data, *actual_length);
+    mock_queue_head = (mock_queue_head + 1) % MOCK_QUEUE_LEN;
+    mock_queue_count--;
+    mock_sync_event_fd();
+  } else {
+    if (length > 0) {
+      mock_stats.out_transfers++;
+      if (!mock_in_pending())
+        mock_stats.out_without_in_pending++;
+      mock_out_timeout = timeout;
+      mock_process(data, length);
+    }
+    *actual_length = length;
+  }
+  pthread_mutex_unlock(&mock_mutex);
+  return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer *
+libusb_alloc_transfer(int iso_packets)
+{
+  (void) iso_packets;
+  return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void
+libusb_free_transfer(struct libusb_transfer *transfer)
+{
+  free(transfer);
+}
+
+int
+libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+  int res = LIBUSB_ERROR_BUSY;
+  pthread_mutex_lock(&mock_mutex);
+  if (!mock_device.plugged) {
+    res = LIBUSB_ERROR_NO_DEVICE;
+  } else {
+    for (size_t i = 0; i < MOCK_MAX_TRANSFERS; i++) {
+      if (!mock_transfers[i]) {
+        mock_transfers[i] = transfer;
+        mock_cancelled[i] = false;
+        mock_stats.in_submits++;
+        res = LIBUSB_SUCCESS;
+        break;
+      }
+    }
+  }
+  mock_sync_event_fd();
+  pthread_cond_broadcast(&mock_cond);
+  pthread_mutex_unlock(&mock_mutex);
+  return res;
+}
+
+int
+libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+  int res = LIBUSB_ERROR_NOT_FOUND;
+  pthread_mutex_lock(&mock_mutex);
+  for (size_t i = 0; i < MOCK_MAX_TRANSFERS; i++) {
+    if (mock_transfers[i] == transfer) {
+      mock_cancelled[i] = true;
+      res = LIBUSB_SUCCESS;
+    }
+  }
+  mock_sync_event_fd();
+  pthread_cond_broadcast(&mock_cond);
+  pthread_mutex_unlock(&mock_mutex);
+  return res;
+}
+
+int
+libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+  mock_deliver_hotplug(ctx);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += tv->tv_sec;
+  deadline.tv_nsec += tv->tv_usec * 1000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&mock_mutex);
+  mock_stats.event_handling++;
+  while (!mock_complete_transfers() && !(completed && *completed)) {
+    if (pthread_cond_timedwait(&mock_cond, &mock_mutex, &deadline) == ETIMEDOUT)
+      break;
+  }
+  mock_sync_event_fd();
+  pthread_mutex_unlock(&mock_mutex);
+  return LIBUSB_SUCCESS;
+}
+
+int
+libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
+{
+  return libusb_handle_events_timeout_completed(ctx, tv, NULL);
+}
+
+int
+libusb_handle_events_completed(libusb_context *ctx, int *completed)
+{
+  struct timeval tv = { .tv_sec = 60, .tv_usec = 0 };
+  return libusb_handle_events_timeout_completed(ctx, &tv, completed);
+}
+
+int
+libusb_handle_events(libusb_context *ctx)
+{
+  return libusb_handle_events_completed(ctx, NULL);
+}
+
+const struct libusb_pollfd **
+libusb_get_pollfds(libusb_context *ctx)
+{
+  (void) ctx;
+  const struct libusb_pollfd **fds = calloc(2, sizeof(struct libusb_pollfd *));
+  if (fds && (mock_event_fds[0] >= 0))
+    fds[0] = &mock_pollfd;
+  return fds;
+}
+
+void
+libusb_free_pollfds(const struct libusb_pollfd **pollfds)
+{
+  free(pollfds);
+}
+
+int
+libusb_get_next_timeout(libusb_context *ctx, struct timeval *tv)
+{
+  (void) ctx;
+  (void) tv;
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _LIBUSB_MOCK_H_
+#define _LIBUSB_MOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Stand-in for libusb-1.0 with a single PN533 behind it.
+ * Linking it into a test module takes precedence over the real libusb for
+ * libnfc, the pn53x_usb driver then talks to the simulated chip which
+ * answers right away, so only the host side is measured.
+ */
+struct libusb_mock_stats {
+  size_t out_transfers;          // bulk OUT transfers, zero length packets excluded
+  size_t out_without_in_pending; // bulk OUT transfers while no IN transfer was submitted
+  size_t in_submits;             // asynchronous IN transfers submitted
+  size_t sync_in_transfers;      // blocking bulk IN transfers
+  size_t commands;               // PN53x commands the simulated chip received
+  size_t register_reads;         // ReadRegister commands
+  size_t register_writes;        // WriteRegister commands
+  size_t rf_configurations;      // RFConfiguration commands
+  size_t event_handling;         // libusb_handle_events*() calls
+  size_t device_lists;           // libusb_get_device_list() calls
+  size_t opens;                  // libusb_open() calls
+  size_t psl_requests;           // InPSL commands
+  size_t list_requests;          // InListPassiveTarget commands
+  size_t presence_probes;        // R(NAK) blocks sent to the cards
+  unsigned int wtx_timeout;      // timeout of the bulk OUT transfer with the last S(WTX) response
+};
+
+// Plug the simulated device (bus 1, address 2) and clear the statistics
+void        libusb_mock_reset(uint16_t vendor_id, uint16_t product_id);
+// Unplug it, hotplug callbacks are notified by their context event loop
+void        libusb_mock_unplug(void);
+
+// Put count ISO14443-4A cards in the field, TA(1) of their ATS is ta1. Cards
+// get out of the halt state they were deselected in, 0 takes them all away
+void        libusb_mock_cards(size_t count, uint8_t ta1);
+
+// Have the card ask for a waiting time extension of wtxm before answering the
+// next APDU sent with InCommunicateThru
+void        libusb_mock_card_wtx(uint8_t wtxm);
+
+// ACK the next count commands but never answer them, as if the host was too
+// slow to get the answers
+void        libusb_mock_mute(size_t count);
+
+const struct libusb_mock_stats *libusb_mock_stats(void);
+
+#endif /* _LIBUSB_MOCK_H_ */
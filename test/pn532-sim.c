@@ -0,0 +1,376 @@
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pn532-sim.h"
+
+#define PN532_SIM_BUFFER_LEN 1024
+#define PN532_SIM_DEFAULT_SPEED 115200
+
+#if defined(TCGETS2) && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__))
+#  define PN532_SIM_TERMIOS2
+// Same layout as the asm-generic and x86 kernel one, <asm/termbits.h> clashes with <termios.h>
+struct termios2 {
+  tcflag_t c_iflag;
+  tcflag_t c_oflag;
+  tcflag_t c_cflag;
+  tcflag_t c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed;
+  speed_t c_ospeed;
+};
+#endif
+
+static const uint32_t pn532_sim_hsu_speeds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1288000 };
+
+struct pn532_sim {
+  int master_fd;
+  int stop_fds[2];
+  pthread_t thread;
+  char port[64];
+  char connstring[128];
+  // Guards what the test reads and sets while the simulator thread runs
+  pthread_mutex_t mutex;
+  bool fragmented;
+  size_t command_count;
+  uint32_t speed;
+  uint32_t pending_speed;
+  bool speed_locked;
+  uint32_t drop_speed;
+  uint8_t rx[PN532_SIM_BUFFER_LEN];
+  size_t rx_len;
+  uint8_t registers[0x10000];
+};
+
+static const uint8_t pn532_sim_ack_frame[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+
+static void
+pn532_sim_write(struct pn532_sim *sim, const uint8_t *data, size_t len)
+{
+  pthread_mutex_lock(&sim->mutex);
+  size_t chunk = sim->fragmented ? 1 : len;
+  pthread_mutex_unlock(&sim->mutex);
+  while (len) {
+    ssize_t res = write(sim->master_fd, data, (chunk < len) ? chunk : len);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    data += res;
+    len -= res;
+  }
+}
+
+static void
+pn532_sim_reply(struct pn532_sim *sim, uint8_t command, const uint8_t *data, size_t len)
+{
+  uint8_t frame[PN532_SIM_BUFFER_LEN];
+  size_t off;
+  const size_t frame_len = len + 2;  // TFI + CC+1
+
+  frame[0] = 0x00;
+  frame[1] = 0x00;
+  frame[2] = 0xff;
+  if (frame_len <= 255) {
+    frame[3] = frame_len;
+    frame[4] = 256 - frame_len;
+    off = 5;
+  } else {
+    frame[3] = 0xff;
+    frame[4] = 0xff;
+    frame[5] = frame_len >> 8;
+    frame[6] = frame_len & 0xff;
+    frame[7] = 256 - ((frame[5] + frame[6]) & 0xff);
+    off = 8;
+  }
+  frame[off] = 0xd5;
+  frame[off + 1] = command + 1;
+  memcpy(frame + off + 2, data, len);
+  uint8_t dcs = 256 - 0xd5 - (command + 1);
+  for (size_t i = 0; i < len; i++)
+    dcs -= data[i];
+  frame[off + 2 + len] = dcs;
+  frame[off + 3 + len] = 0x00;
+
+  pn532_sim_write(sim, pn532_sim_ack_frame, sizeof(pn532_sim_ack_frame));
+  pn532_sim_write(sim, frame, off + 4 + len);
+}
+
+// Bit rate the host did set on its side of the pty, 0 if unknown
+static uint32_t
+pn532_sim_host_speed(struct pn532_sim *sim)
+{
+#ifdef PN532_SIM_TERMIOS2
+  struct termios2 tio2;
+  // On a pty master, termios ioctls act on the slave side
+  if (ioctl(sim->master_fd, TCGETS2, &tio2) == 0)
+    return tio2.c_ospeed;
+#endif
+  (void) sim;
+  return 0;
+}
+
+static void
+pn532_sim_process(struct pn532_sim *sim, const uint8_t *cmd, size_t len)
+{
+  uint8_t res[PN532_SIM_BUFFER_LEN];
+  size_t res_len = 0;
+
+  // A real PN532 would only receive garbage
+  uint32_t host_speed = pn532_sim_host_speed(sim);
+  pthread_mutex_lock(&sim->mutex);
+  if (host_speed && (host_speed != sim->speed)) {
+    pthread_mutex_unlock(&sim->mutex);
+    return;
+  }
+  if (sim->drop_speed && (sim->drop_speed == sim->speed)) {
+    sim->drop_speed = 0;
+    pthread_mutex_unlock(&sim->mutex);
+    return;
+  }
+  sim->command_count++;
+  const bool speed_locked = sim->speed_locked;
+  pthread_mutex_unlock(&sim->mutex);
+
+  switch (cmd[0]) {
+    case 0x00: // Diagnose: echo test data
+      memcpy(res, cmd + 1, len - 1);
+      res_len = len - 1;
+      break;
+    case 0x02: // GetFirmwareVersion: PN532 v1.6, ISO14443A/B and ISO18092
+      res[0] = 0x32;
+      res[1] = 0x01;
+      res[2] = 0x06;
+      res[3] = 0x07;
+      res_len = 4;
+      break;
+    case 0x06: // ReadRegister
+      for (size_t i = 1; i + 1 < len; i += 2)
+        res[res_len++] = sim->registers[(cmd[i] << 8) | cmd[i + 1]];
+      break;
+    case 0x08: // WriteRegister
+      for (size_t i = 1; i + 2 < len; i += 3)
+        sim->registers[(cmd[i] << 8) | cmd[i + 1]] = cmd[i + 2];
+      break;
+    case 0x10: // SetSerialBaudRate: switch once the host sent its ACK
+      if ((len < 2) || (cmd[1] >= sizeof(pn532_sim_hsu_speeds) / sizeof(pn532_sim_hsu_speeds[0])))
+        return;
+      if (!speed_locked)
+        sim->pending_speed = pn532_sim_hsu_speeds[cmd[1]];
+      break;
+    case 0x40: // InDataExchange: the target echoes the data
+      if (len < 2)
+        return;
+      res[0] = 0x00; // Status: success
+      memcpy(res + 1, cmd + 2, len - 2);
+      res_len = len - 1;
+      break;
+    case 0x16: // PowerDown
+    case 0x42: // InCommunicateThru
+    case 0x44: // InDeselect
+    case 0x52: // InRelease
+      res[0] = 0x00; // Status: success
+      res_len = 1;
+      break;
+    default:
+      break;
+  }
+  pn532_sim_reply(sim, cmd[0], res, res_len);
+}
+
+// Consume complete host frames from the receive buffer
+static void
+pn532_sim_parse(struct pn532_sim *sim)
+{
+  for (;;) {
+    size_t start = 0;
+    // Skip wake-up bytes (0x55) and preambles until the start code
+    while ((start + 1 < sim->rx_len) && !((sim->rx[start] == 0x00) && (sim->rx[start + 1] == 0xff)))
+      start++;
+    if (start + 4 > sim->rx_len) {
+      memmove(sim->rx, sim->rx + start, sim->rx_len - start);
+      sim->rx_len -= start;
+      return;
+    }
+    const uint8_t *p = sim->rx + start + 2;
+    size_t header, len;
+    if ((p[0] == 0x00) && (p[1] == 0xff)) {
+      // ACK from host (abort or SetSerialBaudRate acknowledgement)
+      header = 2;
+      len = 0;
+      if (sim->pending_speed) {
+        pthread_mutex_lock(&sim->mutex);
+        sim->speed = sim->pending_speed;
+        pthread_mutex_unlock(&sim->mutex);
+        sim->pending_speed = 0;
+      }
+    } else if ((p[0] == 0xff) && (p[1] == 0xff)) {
+      if (start + 2 + 5 > sim->rx_len)
+        return;
+      header = 5;
+      len = (p[2] << 8) | p[3];
+    } else {
+      header = 2;
+      len = p[0];
+    }
+    size_t total = 2 + header + len + ((len) ? 2 : 1);
+    if (start + total > sim->rx_len)
+      return;
+    if (len >= 2)
+      pn532_sim_process(sim, p + header + 1, len - 1);
+    memmove(sim->rx, sim->rx + start + total, sim->rx_len - start - total);
+    sim->rx_len -= start + total;
+  }
+}
+
+static void *
+pn532_sim_thread(void *arg)
+{
+  struct pn532_sim *sim = arg;
+  struct pollfd fds[2] = {
+    { .fd = sim->master_fd, .events = POLLIN },
+    { .fd = sim->stop_fds[0], .events = POLLIN },
+  };
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+    if (fds[0].revents & POLLIN) {
+      ssize_t res = read(sim->master_fd, sim->rx + sim->rx_len, sizeof(sim->rx) - sim->rx_len);
+      if (res <= 0)
+        continue;
+      sim->rx_len += res;
+      pn532_sim_parse(sim);
+      if (sim->rx_len == sizeof(sim->rx))
+        sim->rx_len = 0;
+    }
+  }
+  return NULL;
+}
+
+struct pn532_sim *
+pn532_sim_new(void)
+{
+  struct pn532_sim *sim = calloc(1, sizeof(struct pn532_sim));
+  if (!sim)
+    return NULL;
+  pthread_mutex_init(&sim->mutex, NULL);
+
+  if ((sim->master_fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+    goto error;
+  if ((grantpt(sim->master_fd) < 0) || (unlockpt(sim->master_fd) < 0))
+    goto error;
+  const char *name = ptsname(sim->master_fd);
+  if (!name)
+    goto error;
+  snprintf(sim->port, sizeof(sim->port), "%s", name);
+  snprintf(sim->connstring, sizeof(sim->connstring), "pn532_uart:%s", sim->port);
+  sim->speed = PN532_SIM_DEFAULT_SPEED;
+
+  // No echo nor line processing on the simulated wire
+  struct termios tio;
+  if (tcgetattr(sim->master_fd, &tio) == 0) {
+    tio.c_iflag = 0;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CLOCAL | CREAD;
+    tcsetattr(sim->master_fd, TCSANOW, &tio);
+  }
+
+  if (pipe(sim->stop_fds) < 0)
+    goto error;
+  if (pthread_create(&sim->thread, NULL, pn532_sim_thread, sim) != 0) {
+    close(sim->stop_fds[0]);
+    close(sim->stop_fds[1]);
+    goto error;
+  }
+  return sim;
+
+error:
+  if (sim->master_fd >= 0)
+    close(sim->master_fd);
+  pthread_mutex_destroy(&sim->mutex);
+  free(sim);
+  return NULL;
+}
+
+void
+pn532_sim_free(struct pn532_sim *sim)
+{
+  if (write(sim->stop_fds[1], "", 1) == 1)
+    pthread_join(sim->thread, NULL);
+  close(sim->stop_fds[0]);
+  close(sim->stop_fds[1]);
+  close(sim->master_fd);
+  pthread_mutex_destroy(&sim->mutex);
+  free(sim);
+}
+
+const char *
+pn532_sim_port(const struct pn532_sim *sim)
+{
+  return sim->port;
+}
+
+const char *
+pn532_sim_connstring(const struct pn532_sim *sim)
+{
+  return sim->connstring;
+}
+
+void
+pn532_sim_set_fragmented(struct pn532_sim *sim, bool fragmented)
+{
+  pthread_mutex_lock(&sim->mutex);
+  sim->fragmented = fragmented;
+  pthread_mutex_unlock(&sim->mutex);
+}
+
+size_t
+pn532_sim_command_count(const struct pn532_sim *sim)
+{
+  pthread_mutex_lock((pthread_mutex_t *) &sim->mutex);
+  const size_t count = sim->command_count;
+  pthread_mutex_unlock((pthread_mutex_t *) &sim->mutex);
+  return count;
+}
+
+uint32_t
+pn532_sim_speed(const struct pn532_sim *sim)
+{
+  pthread_mutex_lock((pthread_mutex_t *) &sim->mutex);
+  const uint32_t speed = sim->speed;
+  pthread_mutex_unlock((pthread_mutex_t *) &sim->mutex);
+  return speed;
+}
+
+void
+pn532_sim_set_speed_locked(struct pn532_sim *sim, bool locked)
+{
+  pthread_mutex_lock(&sim->mutex);
+  sim->speed_locked = locked;
+  pthread_mutex_unlock(&sim->mutex);
+}
+
+void
+pn532_sim_drop_first_frame_at(struct pn532_sim *sim, uint32_t speed)
+{
+  pthread_mutex_lock(&sim->mutex);
+  sim->drop_speed = speed;
+  pthread_mutex_unlock(&sim->mutex);
+}
@@ -0,0 +1,32 @@
+#ifndef _PN532_SIM_H_
+#define _PN532_SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Minimal PN532 HSU (High Speed UART) simulator running on a pseudo-terminal.
+ * The slave side of the pty can be handed to the pn532_uart driver, the
+ * simulator thread answers from the master side.
+ */
+struct pn532_sim;
+
+struct pn532_sim *pn532_sim_new(void);
+void        pn532_sim_free(struct pn532_sim *sim);
+
+const char *pn532_sim_port(const struct pn532_sim *sim);
+const char *pn532_sim_connstring(const struct pn532_sim *sim);
+
+// Send each reply one byte at a time instead of in one write
+void        pn532_sim_set_fragmented(struct pn532_sim *sim, bool fragmented);
+
+size_t      pn532_sim_command_count(const struct pn532_sim *sim);
+
+// Current HSU bit rate, SetSerialBaudRate is acknowledged but ignored when locked
+uint32_t    pn532_sim_speed(const struct pn532_sim *sim);
+void        pn532_sim_set_speed_locked(struct pn532_sim *sim, bool locked);
+// Drop the first command received once switched to speed, as a glitch on the new link would
+void        pn532_sim_drop_first_frame_at(struct pn532_sim *sim, uint32_t speed);
+
+#endif /* _PN532_SIM_H_ */
@@ -0,0 +1,528 @@
+#define _XOPEN_SOURCE 600
+
+#include <cutter.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <nfc/nfc.h>
+#include "nfc-internal.h"
+#include "chips/pn53x.h"
+
+#include "pn532-sim.h"
+
+#define DIAGNOSE_COUNT 100
+#define THREADS_COUNT 4
+#define EVENT_READERS_COUNT 16
+#define EVENT_ROUNDS 20
+
+void test_pn532_uart_frame_reader(void);
+void test_pn532_uart_fragmented_frames(void);
+void test_pn532_uart_extended_frame(void);
+void test_pn532_uart_speed_negotiation(void);
+void test_pn532_uart_speed_fallback(void);
+void test_pn532_uart_speed_glitch(void);
+void test_pn532_uart_threads(void);
+void test_pn532_uart_register_driver(void);
+void test_pn532_uart_event_loop(void);
+
+static long
+thread_read_syscalls(void)
+{
+  long syscr = -1;
+  char line[64];
+  FILE *f = fopen("/proc/thread-self/io", "r");
+  if (!f)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "syscr: %ld", &syscr) == 1)
+      break;
+  }
+  fclose(f);
+  return syscr;
+}
+
+static int
+diagnose_pattern(nfc_device *device, size_t szPayload, uint8_t btFirst)
+{
+  uint8_t abtCmd[PN53x_EXTENDED_FRAME__DATA_MAX_LEN] = { Diagnose, 0x00 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  for (size_t n = 0; n < szPayload; n++)
+    abtCmd[2 + n] = (uint8_t)(btFirst + n);
+
+  int res = pn53x_transceive(device, abtCmd, 2 + szPayload, abtRx, sizeof(abtRx), 500);
+  if (res < 0)
+    return res;
+  if (((size_t) res != 1 + szPayload) || memcmp(abtRx, abtCmd + 1, res))
+    return NFC_EIO;
+  return res;
+}
+
+static int
+diagnose(nfc_device *device, size_t szPayload)
+{
+  return diagnose_pattern(device, szPayload, 0);
+}
+
+struct reader_thread {
+  pthread_t thread;
+  nfc_context *context;
+  struct pn532_sim *sim;
+  nfc_device *device;
+  uint8_t btFirst;
+  int failures;
+};
+
+// Open its own reader from the shared context, with another context around
+static void *
+reader_thread(void *arg)
+{
+  struct reader_thread *prt = arg;
+  nfc_context *private_context;
+
+  nfc_init(&private_context);
+  prt->device = nfc_open(prt->context, pn532_sim_connstring(prt->sim));
+  nfc_exit(private_context);
+  if (!prt->device) {
+    prt->failures++;
+    return NULL;
+  }
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    if (diagnose_pattern(prt->device, 16, prt->btFirst) != 17)
+      prt->failures++;
+  }
+  nfc_close(prt->device);
+  return NULL;
+}
+
+// Share a reader with the other threads, each command has to stay whole
+static void *
+shared_reader_thread(void *arg)
+{
+  struct reader_thread *prt = arg;
+
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    if (diagnose_pattern(prt->device, 16, prt->btFirst) != 17)
+      prt->failures++;
+  }
+  return NULL;
+}
+
+// Share a reader with the other threads, changing its settings between frames
+static void *
+shared_settings_thread(void *arg)
+{
+  struct reader_thread *prt = arg;
+  const uint8_t abtTx[] = { 0x30, 0x00 };
+  uint8_t abtRx[16];
+
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    const bool bEnable = (i & 1);
+    if (nfc_device_set_property_bool(prt->device, NP_HANDLE_CRC, bEnable) < 0)
+      prt->failures++;
+    if (nfc_device_set_property_bool(prt->device, NP_ACCEPT_INVALID_FRAMES, bEnable) < 0)
+      prt->failures++;
+    if (nfc_device_set_property_int(prt->device, NP_TIMEOUT_COMMAND, 500) < 0)
+      prt->failures++;
+    if (nfc_initiator_transceive_bytes(prt->device, abtTx, sizeof(abtTx), abtRx, sizeof(abtRx), 500) < 0)
+      prt->failures++;
+  }
+  return NULL;
+}
+
+void
+test_pn532_uart_frame_reader(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+
+  nfc_device *device = nfc_open(context, pn532_sim_connstring(sim));
+  if (!device) {
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("pn532_uart driver not available");
+  }
+
+  long syscr = thread_read_syscalls();
+  if (syscr < 0) {
+    nfc_close(device);
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("Per-thread I/O accounting not available");
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose #%d", i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  syscr = thread_read_syscalls() - syscr;
+
+  double latency_us = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / DIAGNOSE_COUNT;
+  cut_notify("%.1f read(2) and %.1f us per command", (double) syscr / DIAGNOSE_COUNT, latency_us);
+
+  // One read for the ACK, one for the reply (both often come in the same read)
+  cut_assert_operator_int(syscr, <=, 2 * DIAGNOSE_COUNT + 2, cut_message("read(2) syscalls count"));
+
+  nfc_close(device);
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_fragmented_frames(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+  pn532_sim_set_fragmented(sim, true);
+
+  nfc_device *device = nfc_open(context, pn532_sim_connstring(sim));
+  if (!device) {
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("pn532_uart driver not available");
+  }
+
+  for (int i = 0; i < 10; i++) {
+    cut_assert_equal_int(33, diagnose(device, 32), cut_message("Diagnose #%d", i));
+  }
+
+  nfc_close(device);
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_extended_frame(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+
+  nfc_device *device = nfc_open(context, pn532_sim_connstring(sim));
+  if (!device) {
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("pn532_uart driver not available");
+  }
+
+  // 262 bytes payload does not fit in a normal frame, neither way
+  cut_assert_equal_int(263, diagnose(device, 262), cut_message("Diagnose with extended frames"));
+  // And normal frames still work afterwards
+  cut_assert_equal_int(5, diagnose(device, 4), cut_message("Diagnose with normal frames"));
+
+  nfc_close(device);
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_speed_negotiation(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+
+  nfc_connstring connstring;
+  snprintf(connstring, sizeof(connstring), "%s:115200:1288000", pn532_sim_connstring(sim));
+  nfc_device *device = nfc_open(context, connstring);
+  if (!device) {
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("pn532_uart driver not available");
+  }
+
+  if (pn532_sim_speed(sim) == 115200) {
+    nfc_close(device);
+    pn532_sim_free(sim);
+    nfc_exit(context);
+    cut_omit("Arbitrary serial bit rates not supported");
+  }
+  cut_assert_equal_int(1288000, pn532_sim_speed(sim), cut_message("PN532 HSU bit rate"));
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after negotiation"));
+
+  // The PN532 is given back its initial bit rate
+  nfc_close(device);
+  cut_assert_equal_int(115200, pn532_sim_speed(sim), cut_message("PN532 HSU bit rate after close"));
+
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_speed_fallback(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+  // The PN532 acknowledges SetSerialBaudRate but keeps running at 115200 bauds
+  pn532_sim_set_speed_locked(sim, true);
+
+  nfc_connstring connstring;
+  snprintf(connstring, sizeof(connstring), "%s:115200:921600", pn532_sim_connstring(sim));
+  nfc_device *device = nfc_open(context, connstring);
+  cut_assert_not_null(device, cut_message("nfc_open with a PN532 unable to switch"));
+
+  cut_assert_equal_int(115200, pn532_sim_speed(sim), cut_message("PN532 HSU bit rate"));
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after fallback"));
+
+  nfc_close(device);
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_speed_glitch(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  struct pn532_sim *sim = pn532_sim_new();
+  cut_assert_not_null(sim, cut_message("pn532_sim_new"));
+  // The PN532 switches to 921600 bauds, but the first frame sent there is lost
+  pn532_sim_drop_first_frame_at(sim, 921600);
+
+  nfc_connstring connstring;
+  snprintf(connstring, sizeof(connstring), "%s:115200:921600", pn532_sim_connstring(sim));
+  nfc_device *device = nfc_open(context, connstring);
+  cut_assert_not_null(device, cut_message("nfc_open with a glitch at 921600 bauds"));
+
+  // It was switched back, then on to the next lower rate
+  cut_assert_equal_int(460800, pn532_sim_speed(sim), cut_message("PN532 HSU bit rate"));
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after fallback"));
+
+  nfc_close(device);
+  cut_assert_equal_int(115200, pn532_sim_speed(sim), cut_message("PN532 HSU bit rate after close"));
+
+  pn532_sim_free(sim);
+  nfc_exit(context);
+}
+
+void
+test_pn532_uart_threads(void)
+{
+  struct reader_thread art[THREADS_COUNT];
+  nfc_context *context;
+  nfc_init(&context);
+
+  // One reader per thread
+  for (size_t n = 0; n < THREADS_COUNT; n++) {
+    art[n].context = context;
+    art[n].sim = pn532_sim_new();
+    cut_assert_not_null(art[n].sim, cut_message("pn532_sim_new #%zu", n));
+    art[n].btFirst = (uint8_t)(n * 0x20);
+    art[n].failures = 0;
+  }
+  for (size_t n = 0; n < THREADS_COUNT; n++)
+    cut_assert_equal_int(0, pthread_create(&art[n].thread, NULL, reader_thread, &art[n]));
+  for (size_t n = 0; n < THREADS_COUNT; n++) {
+    pthread_join(art[n].thread, NULL);
+    cut_assert_equal_int(0, art[n].failures, cut_message("Failures of reader #%zu", n));
+  }
+
+  // All the threads on one reader
+  nfc_device *device = nfc_open(context, pn532_sim_connstring(art[0].sim));
+  cut_assert_not_null(device, cut_message("nfc_open"));
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+  for (size_t n = 0; n < THREADS_COUNT; n++) {
+    art[n].device = device;
+    cut_assert_equal_int(0, pthread_create(&art[n].thread, NULL, (n & 1) ? shared_settings_thread : shared_reader_thread, &art[n]));
+  }
+  for (size_t n = 0; n < THREADS_COUNT; n++) {
+    pthread_join(art[n].thread, NULL);
+    cut_assert_equal_int(0, art[n].failures, cut_message("Failures of thread #%zu on the shared reader", n));
+  }
+  nfc_close(device);
+
+  for (size_t n = 0; n < THREADS_COUNT; n++)
+    pn532_sim_free(art[n].sim);
+  nfc_exit(context);
+}
+
+// Counts the devices it is asked to open, without opening any
+static int fake_driver_opened;
+
+static nfc_device *
+fake_driver_open(const nfc_context *context, const nfc_connstring connstring)
+{
+  (void) context;
+  (void) connstring;
+  fake_driver_opened++;
+  return NULL;
+}
+
+static const struct nfc_driver fake_driver = {
+  .name = "fake_driver",
+  .scan_type = NOT_INTRUSIVE,
+  .open = fake_driver_open,
+};
+
+void
+test_pn532_uart_register_driver(void)
+{
+  const nfc_connstring connstring = "fake_driver:0";
+  nfc_context *before, *after, *other;
+
+  // Registered with the contexts already there and the next ones
+  nfc_init(&before);
+  fake_driver_opened = 0;
+  cut_assert_equal_int(0, nfc_register_driver(&fake_driver));
+  nfc_open(before, connstring);
+  cut_assert_equal_int(1, fake_driver_opened, cut_message("driver registered after nfc_init()"));
+  nfc_init(&after);
+  nfc_open(after, connstring);
+  cut_assert_equal_int(2, fake_driver_opened, cut_message("driver registered before nfc_init()"));
+  nfc_exit(before);
+  nfc_exit(after);
+
+  // Gone with the last context, unless registered with one context only
+  nfc_init(&other);
+  nfc_open(other, connstring);
+  cut_assert_equal_int(2, fake_driver_opened, cut_message("driver dropped by the last nfc_exit()"));
+  cut_assert_equal_int(0, nfc_context_register_driver(other, &fake_driver));
+  nfc_open(other, connstring);
+  cut_assert_equal_int(3, fake_driver_opened, cut_message("driver registered with the context"));
+  nfc_exit(other);
+}
+
+static int
+process_threads(void)
+{
+  int threads = -1;
+  char line[64];
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "Threads: %d", &threads) == 1)
+      break;
+  }
+  fclose(f);
+  return threads;
+}
+
+struct event_reader {
+  struct pn532_sim *sim;
+  nfc_device *device;
+  uint8_t btFirst;
+  uint8_t abtTx[32];
+  uint8_t abtRx[32];
+  int completed;
+  int failures;
+  int last_res;
+};
+
+static int
+event_submit(nfc_device *pnd, struct event_reader *per, int timeout)
+{
+  for (size_t n = 0; n < sizeof(per->abtTx); n++)
+    per->abtTx[n] = (uint8_t)(per->btFirst + per->completed + n);
+  return nfc_device_submit(pnd, NULL, per->abtTx, sizeof(per->abtTx), per->abtRx, sizeof(per->abtRx), timeout, NULL, per);
+}
+
+// The simulated target echoes the data, the next request is submitted from the callback
+static void
+event_completion(nfc_device *pnd, const nfc_completion *pc)
+{
+  struct event_reader *per = pc->user_data;
+
+  per->last_res = pc->res;
+  if ((pc->res != (int) sizeof(per->abtTx)) || memcmp(pc->pbtRx, per->abtTx, sizeof(per->abtTx)))
+    per->failures++;
+  if ((++per->completed < EVENT_ROUNDS) && (event_submit(pnd, per, 500) < 0))
+    per->failures++;
+}
+
+// Serve all the readers from this thread until none has a request running
+static void
+event_loop(struct event_reader aer[], const size_t szReaders)
+{
+  struct pollfd apfd[EVENT_READERS_COUNT];
+  const time_t deadline = time(NULL) + 10;
+
+  for (size_t n = 0; n < szReaders; n++) {
+    apfd[n].fd = nfc_device_get_pollfd(aer[n].device);
+    apfd[n].events = POLLIN;
+  }
+  for (;;) {
+    int timeout = -1;
+    bool bRunning = false;
+    for (size_t n = 0; n < szReaders; n++) {
+      const int t = nfc_device_get_event_timeout(aer[n].device);
+      if (t >= 0) {
+        bRunning = true;
+        timeout = ((timeout < 0) || (t < timeout)) ? t : timeout;
+      }
+    }
+    if (!bRunning || (time(NULL) > deadline))
+      break;
+    poll(apfd, szReaders, timeout);
+    for (size_t n = 0; n < szReaders; n++)
+      nfc_device_process_events(aer[n].device, event_completion);
+  }
+}
+
+void
+test_pn532_uart_event_loop(void)
+{
+  nfc_context *context;
+  struct event_reader aer[EVENT_READERS_COUNT];
+
+  nfc_init(&context);
+  for (size_t n = 0; n < EVENT_READERS_COUNT; n++) {
+    memset(&aer[n], 0, sizeof(aer[n]));
+    aer[n].btFirst = (uint8_t)(n * 16);
+    aer[n].sim = pn532_sim_new();
+    cut_assert_not_null(aer[n].sim, cut_message("pn532_sim_new #%zu", n));
+    aer[n].device = nfc_open(context, pn532_sim_connstring(aer[n].sim));
+    cut_assert_not_null(aer[n].device, cut_message("nfc_open #%zu", n));
+    cut_assert_operator_int(nfc_initiator_init(aer[n].device), >=, 0, cut_message("nfc_initiator_init #%zu", n));
+  }
+
+  // No thread is started to run the requests
+  const int threads = process_threads();
+  for (size_t n = 0; n < EVENT_READERS_COUNT; n++) {
+    cut_assert_operator_int(nfc_device_get_pollfd(aer[n].device), >=, 0, cut_message("nfc_device_get_pollfd #%zu", n));
+    cut_assert_equal_int(0, event_submit(aer[n].device, &aer[n], 500), cut_message("nfc_device_submit #%zu", n));
+  }
+  cut_assert_equal_int(threads, process_threads(), cut_message("threads running the requests"));
+  event_loop(aer, EVENT_READERS_COUNT);
+  for (size_t n = 0; n < EVENT_READERS_COUNT; n++) {
+    cut_assert_equal_int(EVENT_ROUNDS, aer[n].completed, cut_message("Requests completed on reader #%zu", n));
+    cut_assert_equal_int(0, aer[n].failures, cut_message("Failures on reader #%zu", n));
+  }
+
+  // A silent device times the request out, the next one goes through
+  struct event_reader *per = &aer[0];
+  pn532_sim_drop_first_frame_at(per->sim, pn532_sim_speed(per->sim));
+  per->completed = EVENT_ROUNDS - 1;
+  per->failures = 0;
+  cut_assert_equal_int(0, event_submit(per->device, per, 100));
+  event_loop(per, 1);
+  cut_assert_equal_int(NFC_ETIMEOUT, per->last_res, cut_message("request to a silent device"));
+  per->completed = EVENT_ROUNDS - 1;
+  cut_assert_equal_int(0, event_submit(per->device, per, 500));
+  event_loop(per, 1);
+  cut_assert_equal_int((int) sizeof(per->abtTx), per->last_res, cut_message("request after a timeout"));
+
+  for (size_t n = 0; n < EVENT_READERS_COUNT; n++) {
+    nfc_close(aer[n].device);
+    pn532_sim_free(aer[n].sim);
+  }
+  nfc_exit(context);
+}
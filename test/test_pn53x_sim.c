@@ -0,0 +1,611 @@
+#define _XOPEN_SOURCE 600
+
+#include <cutter.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nfc/nfc.h>
+#include <nfc/nfc-sim.h>
+
+#define ARRIVAL_DELAY_MS 50
+#define ABORT_DELAY_MS 50
+#define TARGET_COUNT 10
+#define APDU_DATA_LEN 4096
+#define DEP_DATA_LEN 1000
+#define READ_COUNT 1000
+#define THROUGHPUT_COUNT 20
+// Far below what the simulator does, even under sanitizers or valgrind: only
+// a regression by an order of magnitude or more goes below
+#define READ_RATE_MIN 5000
+#define APDU_RATE_MIN 100
+#define LATENCY_COUNT 20
+#define LATENCY_WIRE_SPEED 115200
+
+void test_pn53x_sim_ultralight(void);
+void test_pn53x_sim_classic(void);
+void test_pn53x_sim_felica(void);
+void test_pn53x_sim_apdu(void);
+void test_pn53x_sim_dep(void);
+void test_pn53x_sim_target(void);
+void test_pn53x_sim_two_targets(void);
+void test_pn53x_sim_arrival(void);
+void test_pn53x_sim_abort(void);
+void test_pn53x_sim_throughput(void);
+void test_pn53x_sim_latency(void);
+
+static double
+elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void
+sleep_ms(const long ms)
+{
+  const struct timespec delay = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+  nanosleep(&delay, NULL);
+}
+
+static nfc_device *
+open_sim(nfc_context *context)
+{
+  const nfc_connstring connstring = "pn53x_sim";
+  nfc_device *device = nfc_open(context, connstring);
+  if (!device) {
+    nfc_exit(context);
+    cut_omit("pn53x_sim driver not available");
+  }
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false), cut_message("infinite select off"));
+  return device;
+}
+
+static const nfc_modulation nmMifare = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+
+// MIFARE Ultralight, 16 pages
+static nfc_target ntUltralight = {
+  .nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 },
+  .nti.nai = {
+    .abtAtqa = { 0x00, 0x44 },
+    .btSak = 0x00,
+    .szUidLen = 7,
+    .abtUid = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 },
+  },
+};
+
+static void
+add_ultralight(nfc_device *device, struct nfc_emulator *emulator, struct nfc_sim_memory *memory, nfc_target *pnt, uint8_t *pbtData,
+               const size_t szData)
+{
+  for (size_t n = 0; n < szData; n++)
+    pbtData[n] = (uint8_t) n;
+  cut_assert_equal_int(0, nfc_sim_memory_init(emulator, memory, pnt, pbtData, szData), cut_message("nfc_sim_memory_init"));
+  cut_assert_equal_int(0, nfc_sim_add_target(device, emulator), cut_message("nfc_sim_add_target"));
+}
+
+// An ISO14443-4 card echoing the APDUs it gets
+static int
+echo_io(struct nfc_emulator *emulator, const uint8_t *data_in, const size_t data_in_len, uint8_t *data_out, const size_t data_out_len)
+{
+  (void) emulator;
+  if (data_in_len > data_out_len)
+    return NFC_EOVFLOW;
+  memcpy(data_out, data_in, data_in_len);
+  return (int) data_in_len;
+}
+
+static struct nfc_emulation_state_machine smEcho = { .io = echo_io };
+
+// ATS T0 0x78: the card accepts 256 bytes frames
+static nfc_target ntIsoDep = {
+  .nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 },
+  .nti.nai = {
+    .abtAtqa = { 0x00, 0x04 },
+    .btSak = 0x20,
+    .szUidLen = 4,
+    .abtUid = { 0x08, 0xa1, 0xb2, 0xc3 },
+    .szAtsLen = 4,
+    .abtAts = { 0x78, 0x77, 0x94, 0x02 },
+  },
+};
+
+static uint8_t abtTx[APDU_DATA_LEN];
+static uint8_t abtRx[APDU_DATA_LEN];
+
+void
+test_pn53x_sim_ultralight(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  struct nfc_emulator emulator;
+  struct nfc_sim_memory memory;
+  uint8_t abtMemory[64];
+  add_ultralight(device, &emulator, &memory, &ntUltralight, abtMemory, sizeof(abtMemory));
+
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("tag selected"));
+  cut_assert_equal_memory(ntUltralight.nti.nai.abtUid, 7, nt.nti.nai.abtUid, nt.nti.nai.szUidLen, cut_message("UID"));
+  cut_assert_equal_int(0x00, nt.nti.nai.btSak, cut_message("SAK"));
+
+  // READ wraps around the last page
+  const uint8_t abtRead[] = { 0x30, 0x0e };
+  uint8_t abtPages[16];
+  cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0), cut_message("READ"));
+  cut_assert_equal_memory(abtMemory + 56, 8, abtPages, 8, cut_message("last pages"));
+  cut_assert_equal_memory(abtMemory, 8, abtPages + 8, 8, cut_message("first pages"));
+
+  const uint8_t abtWrite[] = { 0xa2, 0x05, 0xde, 0xad, 0xbe, 0xef };
+  cut_assert_equal_int(0, nfc_initiator_transceive_bytes(device, abtWrite, sizeof(abtWrite), abtPages, sizeof(abtPages), 0), cut_message("WRITE"));
+  cut_assert_equal_memory(abtWrite + 2, 4, abtMemory + 20, 4, cut_message("page written"));
+
+  // The tag left the field
+  cut_assert_equal_int(0, nfc_sim_remove_target(device, &emulator), cut_message("nfc_sim_remove_target"));
+  cut_assert_true(nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0) < 0, cut_message("READ without tag"));
+  cut_assert_equal_int(0, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("no tag"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_classic(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  // MIFARE Classic 1K, key A FFFFFFFFFFFF and key B A0A1A2A3A4A5 in every trailer
+  nfc_target ntClassic = {
+    .nm = nmMifare,
+    .nti.nai = { .abtAtqa = { 0x00, 0x04 }, .btSak = 0x08, .szUidLen = 4, .abtUid = { 0xde, 0xca, 0xfb, 0xad } },
+  };
+  static const uint8_t abtKeyA[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  static const uint8_t abtKeyB[] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 };
+  uint8_t abtMemory[1024];
+  for (size_t n = 0; n < sizeof(abtMemory); n++)
+    abtMemory[n] = (uint8_t)(n * 3);
+  for (size_t n = 3; n < 64; n += 4) {
+    memcpy(abtMemory + n * 16, abtKeyA, 6);
+    memcpy(abtMemory + n * 16 + 10, abtKeyB, 6);
+  }
+  struct nfc_emulator emulator;
+  struct nfc_sim_memory memory;
+  cut_assert_equal_int(0, nfc_sim_memory_init(&emulator, &memory, &ntClassic, abtMemory, sizeof(abtMemory)), cut_message("nfc_sim_memory_init"));
+  cut_assert_equal_int(0, nfc_sim_add_target(device, &emulator), cut_message("nfc_sim_add_target"));
+
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("tag selected"));
+
+  // Blocks are only read once their sector is authenticated
+  uint8_t abtCmd[12] = { 0x30, 0x05 };
+  uint8_t abtBlock[16];
+  cut_assert_equal_int(NFC_EMFCAUTHFAIL, nfc_initiator_transceive_bytes(device, abtCmd, 2, abtBlock, sizeof(abtBlock), 0), cut_message("READ without AUTH"));
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("tag selected again"));
+
+  abtCmd[0] = 0x61;
+  abtCmd[1] = 0x04;
+  memcpy(abtCmd + 2, abtKeyB, 6);
+  memcpy(abtCmd + 8, nt.nti.nai.abtUid, 4);
+  cut_assert_equal_int(0, nfc_initiator_transceive_bytes(device, abtCmd, 12, abtBlock, sizeof(abtBlock), 0), cut_message("AUTH with key B"));
+  abtCmd[0] = 0x30;
+  abtCmd[1] = 0x05;
+  cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtCmd, 2, abtBlock, sizeof(abtBlock), 0), cut_message("READ"));
+  cut_assert_equal_memory(abtMemory + 5 * 16, 16, abtBlock, 16, cut_message("block read"));
+  abtCmd[1] = 0x07;
+  cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtCmd, 2, abtBlock, sizeof(abtBlock), 0), cut_message("READ trailer"));
+  static const uint8_t abtZeros[6];
+  cut_assert_equal_memory(abtZeros, 6, abtBlock, 6, cut_message("key A hidden"));
+
+  // Another sector, with a wrong key
+  abtCmd[0] = 0x60;
+  abtCmd[1] = 0x08;
+  memcpy(abtCmd + 2, abtKeyB, 6);
+  cut_assert_equal_int(NFC_EMFCAUTHFAIL, nfc_initiator_transceive_bytes(device, abtCmd, 12, abtBlock, sizeof(abtBlock), 0), cut_message("AUTH with a wrong key"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_felica(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  nfc_target ntFelica = {
+    .nm = { .nmt = NMT_FELICA, .nbr = NBR_212 },
+    .nti.nfi = {
+      .szLen = 18,
+      .btResCode = 0x01,
+      .abtId = { 0x01, 0x2e, 0x4c, 0x12, 0x34, 0x56, 0x78, 0x9a },
+      .abtPad = { 0x03, 0x01, 0x4b, 0x02, 0x4f, 0x49, 0x93, 0xff },
+      .abtSysCode = { 0x12, 0xfc },
+    },
+  };
+  uint8_t abtMemory[16 * 16];
+  for (size_t n = 0; n < sizeof(abtMemory); n++)
+    abtMemory[n] = (uint8_t)(n ^ 0x5a);
+  struct nfc_emulator emulator;
+  struct nfc_sim_memory memory;
+  cut_assert_equal_int(0, nfc_sim_memory_init(&emulator, &memory, &ntFelica, abtMemory, sizeof(abtMemory)), cut_message("nfc_sim_memory_init"));
+  cut_assert_equal_int(0, nfc_sim_add_target(device, &emulator), cut_message("nfc_sim_add_target"));
+
+  // Polling with request code 1, for the system code
+  nfc_target nt;
+  const uint8_t abtPolling[] = { 0x00, 0xff, 0xff, 0x01, 0x00 };
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, ntFelica.nm, abtPolling, sizeof(abtPolling), &nt), cut_message("tag selected"));
+  cut_assert_equal_memory(ntFelica.nti.nfi.abtId, 8, nt.nti.nfi.abtId, 8, cut_message("IDm"));
+  cut_assert_equal_memory(ntFelica.nti.nfi.abtSysCode, 2, nt.nti.nfi.abtSysCode, 2, cut_message("system code"));
+
+  // Request Response
+  uint8_t abtCmd[16] = { 10, 0x04 };
+  memcpy(abtCmd + 2, nt.nti.nfi.abtId, 8);
+  uint8_t abtRes[64];
+  cut_assert_equal_int(11, nfc_initiator_transceive_bytes(device, abtCmd, 10, abtRes, sizeof(abtRes), 0), cut_message("Request Response"));
+  cut_assert_equal_int(0x05, abtRes[1], cut_message("response code"));
+
+  // Read Without Encryption of blocks 2 and 3
+  abtCmd[0] = 16;
+  abtCmd[1] = 0x06;
+  abtCmd[10] = 1;
+  abtCmd[11] = 0x0b;
+  abtCmd[12] = 0x00;
+  abtCmd[13] = 2;
+  abtCmd[14] = 0x80;
+  abtCmd[15] = 0x02;
+  uint8_t abtRead[18] = { 0 };
+  memcpy(abtRead, abtCmd, 16);
+  abtRead[0] = 18;
+  abtRead[16] = 0x80;
+  abtRead[17] = 0x03;
+  cut_assert_equal_int(13 + 32, nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtRes, sizeof(abtRes), 0), cut_message("Read"));
+  cut_assert_equal_int(0x00, abtRes[10], cut_message("status flag"));
+  cut_assert_equal_memory(abtMemory + 32, 32, abtRes + 13, 32, cut_message("blocks read"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_apdu(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  struct nfc_emulator emulator = { .target = &ntIsoDep, .state_machine = &smEcho };
+  cut_assert_equal_int(0, nfc_sim_add_target(device, &emulator), cut_message("nfc_sim_add_target"));
+
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("card selected"));
+  cut_assert_equal_memory(ntIsoDep.nti.nai.abtAts, ntIsoDep.nti.nai.szAtsLen, nt.nti.nai.abtAts, nt.nti.nai.szAtsLen, cut_message("ATS"));
+
+  // The chip chains the APDU in I-blocks and the answer back, the host chains both with MI
+  for (size_t n = 0; n < APDU_DATA_LEN; n++)
+    abtTx[n] = (uint8_t)(n * 7);
+  memset(abtRx, 0, sizeof(abtRx));
+  cut_assert_equal_int(APDU_DATA_LEN, nfc_initiator_transceive_bytes(device, abtTx, APDU_DATA_LEN, abtRx, sizeof(abtRx), 0), cut_message("APDU echoed"));
+  cut_assert_equal_memory(abtTx, APDU_DATA_LEN, abtRx, APDU_DATA_LEN, cut_message("data echoed"));
+
+  cut_assert_equal_int(0, nfc_initiator_deselect_target(device), cut_message("card deselected"));
+  cut_assert_equal_int(0, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("card halted"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_dep(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  nfc_target ntPeer = {
+    .nm = { .nmt = NMT_DEP, .nbr = NBR_UNDEFINED },
+    .nti.ndi = {
+      .abtNFCID3 = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa },
+      .btTO = 0x0e,
+      .btPP = 0x32,
+      .szGB = 3,
+      .abtGB = { 0x46, 0x66, 0x6d },
+      .ndm = NDM_UNDEFINED,
+    },
+  };
+  struct nfc_emulator emulator = { .target = &ntPeer, .state_machine = &smEcho };
+  cut_assert_equal_int(0, nfc_sim_add_target(device, &emulator), cut_message("nfc_sim_add_target"));
+
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_dep_target(device, NDM_PASSIVE, NBR_424, NULL, &nt, 1000), cut_message("peer selected"));
+  cut_assert_equal_memory(ntPeer.nti.ndi.abtNFCID3, 10, nt.nti.ndi.abtNFCID3, 10, cut_message("NFCID3"));
+  cut_assert_equal_memory(ntPeer.nti.ndi.abtGB, ntPeer.nti.ndi.szGB, nt.nti.ndi.abtGB, nt.nti.ndi.szGB, cut_message("general bytes"));
+  cut_assert_equal_int(NBR_424, nt.nm.nbr, cut_message("baud rate"));
+
+  for (size_t n = 0; n < DEP_DATA_LEN; n++)
+    abtTx[n] = (uint8_t)(n * 11);
+  cut_assert_equal_int(DEP_DATA_LEN, nfc_initiator_transceive_bytes(device, abtTx, DEP_DATA_LEN, abtRx, sizeof(abtRx), 1000), cut_message("data echoed"));
+  cut_assert_equal_memory(abtTx, DEP_DATA_LEN, abtRx, DEP_DATA_LEN, cut_message("data echoed"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+// A D.E.P. initiator sending numbered commands, then releasing the device
+static int
+initiator_io(struct nfc_emulator *emulator, const uint8_t *data_in, const size_t data_in_len, uint8_t *data_out, const size_t data_out_len)
+{
+  int *piSent = emulator->user_data;
+
+  (void) data_out_len;
+  if (*piSent) {
+    // The device answers the command inverted
+    if ((data_in_len != 2) || (data_in[0] != 0xff) || (data_in[1] != (uint8_t) ~(*piSent)))
+      return NFC_EIO;
+  }
+  if (*piSent == TARGET_COUNT)
+    return NFC_ETGRELEASED;
+  (*piSent)++;
+  data_out[0] = 0x00;
+  data_out[1] = (uint8_t) * piSent;
+  return 2;
+}
+
+void
+test_pn53x_sim_target(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  nfc_target ntInitiator = {
+    .nm = { .nmt = NMT_DEP, .nbr = NBR_212 },
+    .nti.ndi = {
+      .abtNFCID3 = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x00, 0x11 },
+      .ndm = NDM_PASSIVE,
+    },
+  };
+  struct nfc_emulation_state_machine sm = { .io = initiator_io };
+  int iSent = 0;
+  struct nfc_emulator initiator = { .target = &ntInitiator, .state_machine = &sm, .user_data = &iSent };
+  cut_assert_equal_int(0, nfc_sim_set_initiator(device, &initiator), cut_message("nfc_sim_set_initiator"));
+
+  nfc_target nt = {
+    .nm = { .nmt = NMT_DEP, .nbr = NBR_UNDEFINED },
+    .nti.ndi = {
+      .abtNFCID3 = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x00, 0x00 },
+      .ndm = NDM_UNDEFINED,
+    },
+  };
+  uint8_t abtCmd[16];
+  cut_assert_true(nfc_target_init(device, &nt, abtCmd, sizeof(abtCmd), 0) >= 0, cut_message("activated as target"));
+  cut_assert_equal_int(NBR_212, nt.nm.nbr, cut_message("baud rate"));
+  cut_assert_equal_int(NDM_PASSIVE, nt.nti.ndi.ndm, cut_message("passive mode"));
+
+  int res;
+  size_t szAnswered = 0;
+  while ((res = nfc_target_receive_bytes(device, abtCmd, sizeof(abtCmd), 0)) >= 0) {
+    cut_assert_equal_int(2, res, cut_message("command"));
+    const uint8_t abtAnswer[] = { 0xff, (uint8_t) ~abtCmd[1] };
+    cut_assert_equal_int(2, nfc_target_send_bytes(device, abtAnswer, sizeof(abtAnswer), 0), cut_message("answer sent"));
+    szAnswered++;
+  }
+  cut_assert_equal_int(NFC_ETGRELEASED, res, cut_message("released"));
+  cut_assert_equal_size(TARGET_COUNT, szAnswered, cut_message("commands answered"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_two_targets(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  nfc_target ntOther = ntUltralight;
+  ntOther.nti.nai.abtUid[6] = 0x77;
+  struct nfc_emulator emulators[2];
+  struct nfc_sim_memory memories[2];
+  uint8_t abtMemories[2][64];
+  add_ultralight(device, &emulators[0], &memories[0], &ntUltralight, abtMemories[0], sizeof(abtMemories[0]));
+  add_ultralight(device, &emulators[1], &memories[1], &ntOther, abtMemories[1], sizeof(abtMemories[1]));
+  abtMemories[1][16] = 0xaa;
+
+  // The chip activates both, each is talked to as its Tg
+  nfc_target ant[2];
+  cut_assert_equal_int(2, nfc_initiator_list_passive_targets(device, nmMifare, ant, 2), cut_message("two tags listed"));
+  cut_assert_not_equal_int(0, memcmp(ant[0].nti.nai.abtUid, ant[1].nti.nai.abtUid, 7), cut_message("two UIDs"));
+  const uint8_t abtRead[] = { 0x30, 0x04 };
+  uint8_t abtPages[16];
+  for (size_t n = 0; n < 2; n++) {
+    const size_t szTag = (ant[n].nti.nai.abtUid[6] == 0x77) ? 1 : 0;
+    cut_assert_equal_int(16, nfc_initiator_target_transceive_bytes(device, &ant[n], abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0),
+                         cut_message("READ of tag %zu", n));
+    cut_assert_equal_memory(abtMemories[szTag] + 16, 16, abtPages, 16, cut_message("pages of tag %zu", n));
+  }
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+struct arrival_thread_data {
+  nfc_device *device;
+  struct nfc_emulator *emulator;
+};
+
+static void *
+arrival_thread(void *arg)
+{
+  struct arrival_thread_data *thread_data = arg;
+  sleep_ms(ARRIVAL_DELAY_MS);
+  nfc_sim_add_target(thread_data->device, thread_data->emulator);
+  return NULL;
+}
+
+static void *
+abort_thread(void *arg)
+{
+  sleep_ms(ABORT_DELAY_MS);
+  nfc_abort_command(arg);
+  return NULL;
+}
+
+void
+test_pn53x_sim_arrival(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, true), cut_message("infinite select on"));
+  struct nfc_emulator emulator;
+  struct nfc_sim_memory memory;
+  uint8_t abtMemory[64];
+  cut_assert_equal_int(0, nfc_sim_memory_init(&emulator, &memory, &ntUltralight, abtMemory, sizeof(abtMemory)), cut_message("nfc_sim_memory_init"));
+
+  // The chip polls until the tag comes
+  struct arrival_thread_data thread_data = { .device = device, .emulator = &emulator };
+  pthread_t thread;
+  pthread_create(&thread, NULL, arrival_thread, &thread_data);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  nfc_target nt;
+  const int res = nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  pthread_join(thread, NULL);
+
+  cut_assert_equal_int(1, res, cut_message("tag selected"));
+  cut_assert_true(elapsed_us(&start, &end) >= ARRIVAL_DELAY_MS * 1000 * 0.9, cut_message("tag waited for"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_abort(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, true), cut_message("infinite select on"));
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, abort_thread, device);
+  nfc_target nt;
+  const int res = nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt);
+  pthread_join(thread, NULL);
+  cut_assert_equal_int(NFC_EOPABORTED, res, cut_message("polling aborted"));
+
+  // The device is usable afterwards
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false), cut_message("infinite select off"));
+  cut_assert_equal_int(0, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("no tag"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_throughput(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  struct nfc_emulator emulators[2] = {
+    { .target = &ntIsoDep, .state_machine = &smEcho },
+  };
+  struct nfc_sim_memory memory;
+  uint8_t abtMemory[64];
+  add_ultralight(device, &emulators[1], &memory, &ntUltralight, abtMemory, sizeof(abtMemory));
+  cut_assert_equal_int(0, nfc_sim_add_target(device, &emulators[0]), cut_message("nfc_sim_add_target"));
+
+  // Short exchanges: the cost of libnfc and of the chip protocol
+  nfc_target nt = ntUltralight;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, ntUltralight.nti.nai.abtUid, 7, &nt), cut_message("tag selected"));
+  const uint8_t abtRead[] = { 0x30, 0x00 };
+  uint8_t abtPages[16];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < READ_COUNT; n++)
+    cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0), cut_message("READ %zu", n));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double total_us = elapsed_us(&start, &end);
+  cut_notify("READ: %.1f exchanges/s, %.1f us per exchange", READ_COUNT * 1e6 / total_us, total_us / READ_COUNT);
+  cut_assert_operator_double(READ_COUNT * 1e6 / total_us, >=, READ_RATE_MIN, cut_message("READ exchanges/s"));
+
+  // Long exchanges: chaining by the host and the chip
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, ntIsoDep.nti.nai.abtUid, 4, &nt), cut_message("card selected"));
+  for (size_t n = 0; n < APDU_DATA_LEN; n++)
+    abtTx[n] = (uint8_t)(n * 13);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < THROUGHPUT_COUNT; n++)
+    cut_assert_equal_int(APDU_DATA_LEN, nfc_initiator_transceive_bytes(device, abtTx, APDU_DATA_LEN, abtRx, sizeof(abtRx), 0), cut_message("APDU %zu", n));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  total_us = elapsed_us(&start, &end);
+  cut_assert_equal_memory(abtTx, APDU_DATA_LEN, abtRx, APDU_DATA_LEN, cut_message("data echoed"));
+  cut_notify("%d bytes APDU: %.1f us per exchange, %.1f KB/s", APDU_DATA_LEN, total_us / THROUGHPUT_COUNT,
+             2.0 * APDU_DATA_LEN * THROUGHPUT_COUNT * 1e6 / 1024 / total_us);
+  cut_assert_operator_double(THROUGHPUT_COUNT * 1e6 / total_us, >=, APDU_RATE_MIN, cut_message("APDU exchanges/s"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_sim_latency(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  nfc_device *device = open_sim(context);
+  struct nfc_emulator emulator;
+  struct nfc_sim_memory memory;
+  uint8_t abtMemory[64];
+  add_ultralight(device, &emulator, &memory, &ntUltralight, abtMemory, sizeof(abtMemory));
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nmMifare, NULL, 0, &nt), cut_message("tag selected"));
+
+  // A PN532 on a serial link: each READ carries 12 bytes of command, 6 of ACK and 26 of response
+  cut_assert_equal_int(0, nfc_sim_set_latency(device, LATENCY_WIRE_SPEED, true), cut_message("nfc_sim_set_latency"));
+  const double wire_us = (12 + 6 + 26) * 10 * 1e6 / LATENCY_WIRE_SPEED;
+  const uint8_t abtRead[] = { 0x30, 0x00 };
+  uint8_t abtPages[16];
+  nfc_device_reset_stats(device);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < LATENCY_COUNT; n++)
+    cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0), cut_message("READ %zu", n));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double total_us = elapsed_us(&start, &end);
+  cut_assert_true(total_us >= LATENCY_COUNT * wire_us, cut_message("%.1f us per READ, %.1f us on the wire", total_us / LATENCY_COUNT, wire_us));
+
+  nfc_device_stats stats;
+  nfc_device_get_stats(device, &stats);
+  const nfc_latency_stats *pls = NULL;
+  for (size_t n = 0; n < stats.szCommands; n++) {
+    if (stats.command_stats[n].btCommand == 0x40)
+      pls = &stats.command_stats[n].latency;
+  }
+  cut_assert_not_null(pls, cut_message("InDataExchange counted"));
+  cut_assert_equal_int(LATENCY_COUNT, (int) pls->count, cut_message("InDataExchange count"));
+  cut_notify("READ at %d bauds: %.1f us on the wire, InDataExchange p50 %u us, p99 %u us, ACK p50 %u us", LATENCY_WIRE_SPEED, wire_us,
+             pls->p50_us, pls->p99_us, stats.ack_wait.p50_us);
+
+  // Without latency the same exchanges are only bound by the CPU
+  cut_assert_equal_int(0, nfc_sim_set_latency(device, 0, false), cut_message("latency off"));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < LATENCY_COUNT; n++)
+    cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtRead, sizeof(abtRead), abtPages, sizeof(abtPages), 0), cut_message("READ %zu", n));
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cut_assert_true(elapsed_us(&start, &end) < total_us, cut_message("faster without latency"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
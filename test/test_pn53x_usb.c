@@ -0,0 +1,1188 @@
+#define _XOPEN_SOURCE 600
+
+#include <cutter.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libusb.h>
+#include <nfc/nfc.h>
+#include "chips/pn53x.h"
+
+#include "libusb-mock.h"
+
+#define DIAGNOSE_COUNT 100
+#define ABORT_DELAY_MS 1000
+#define LIST_COUNT 10
+#define SELECT_COUNT 10
+#define FIELD_COUNT 10
+#define POLL_COUNT 10
+#define ASYNC_COUNT 100
+#define MONITOR_PERIOD_MS 10
+#define CHAINED_SMALL_LEN 4096
+#define CHAINED_LARGE_LEN 65536
+#define APDU_DATA_LEN 4096
+#define LOG_OVERHEAD_COUNT 1000
+#define TRACE_OVERHEAD_COUNT 1000
+#define STATS_COUNT 100
+
+void test_pn53x_usb_in_transfer_queued(void);
+void test_pn53x_usb_extended_frame(void);
+void test_pn53x_usb_abort_latency(void);
+void test_pn53x_usb_list_devices(void);
+void test_pn53x_usb_register_cache(void);
+void test_pn53x_usb_led_register_cache(void);
+void test_pn53x_usb_property_state(void);
+void test_pn53x_usb_chaining(void);
+void test_pn53x_usb_apdu(void);
+void test_pn53x_usb_pps(void);
+void test_pn53x_usb_list_targets(void);
+void test_pn53x_usb_two_targets(void);
+void test_pn53x_usb_async(void);
+void test_pn53x_usb_pollfd(void);
+void test_pn53x_usb_monitor(void);
+void test_pn53x_usb_presence_timeout(void);
+void test_pn53x_usb_log_overhead(void);
+void test_pn53x_usb_trace(void);
+void test_pn53x_usb_stats(void);
+
+struct abort_thread_data {
+  nfc_device *device;
+  struct timespec aborted_at;
+};
+
+static double
+elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void *
+abort_thread(void *arg)
+{
+  struct abort_thread_data *thread_data = arg;
+  const struct timespec delay = { .tv_sec = ABORT_DELAY_MS / 1000, .tv_nsec = (ABORT_DELAY_MS % 1000) * 1000000L };
+  nanosleep(&delay, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &thread_data->aborted_at);
+  nfc_abort_command(thread_data->device);
+  return NULL;
+}
+
+static nfc_device *
+open_mock(nfc_context *context)
+{
+  nfc_connstring connstrings[1];
+  nfc_device *device = NULL;
+
+  if (nfc_list_devices(context, connstrings, 1) == 1)
+    device = nfc_open(context, connstrings[0]);
+  if (!device) {
+    nfc_exit(context);
+    cut_omit("pn53x_usb driver not available");
+  }
+  cut_assert_equal_string("pn53x_usb:001:002", connstrings[0], cut_message("connstring"));
+  return device;
+}
+
+static uint8_t abtChainedTx[CHAINED_LARGE_LEN];
+static uint8_t abtChainedRx[CHAINED_LARGE_LEN];
+
+static void
+exchange_chained(nfc_device *device, size_t szPayload)
+{
+  for (size_t n = 0; n < szPayload; n++)
+    abtChainedTx[n] = (uint8_t)(n * 7);
+  memset(abtChainedRx, 0, szPayload);
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  const size_t commands = stats->commands;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  const int res = nfc_initiator_transceive_bytes(device, abtChainedTx, szPayload, abtChainedRx, szPayload, 1000);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  cut_assert_equal_int((int) szPayload, res, cut_message("%zu bytes echoed", szPayload));
+  cut_assert_equal_memory(abtChainedTx, szPayload, abtChainedRx, szPayload, cut_message("%zu bytes echoed", szPayload));
+  const double total_us = elapsed_us(&start, &end);
+  cut_notify("%zu bytes each way: %zu frames, %.1f ms, %.1f KB/s", szPayload, stats->commands - commands, total_us / 1e3, 2 * szPayload * 1e6 / 1024 / total_us);
+}
+
+static int
+diagnose(nfc_device *device, size_t szPayload)
+{
+  uint8_t abtCmd[PN53x_EXTENDED_FRAME__DATA_MAX_LEN] = { Diagnose, 0x00 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  for (size_t n = 0; n < szPayload; n++)
+    abtCmd[2 + n] = (uint8_t) n;
+
+  int res = pn53x_transceive(device, abtCmd, 2 + szPayload, abtRx, sizeof(abtRx), 500);
+  if (res < 0)
+    return res;
+  if (((size_t) res != 1 + szPayload) || memcmp(abtRx, abtCmd + 1, res))
+    return NFC_EIO;
+  return res;
+}
+
+/*
+ * Bare transports to the simulated chip, without libnfc on top, to compare
+ * the libusb-0.1 way the driver used to read with the IN transfer kept
+ * queued by the libusb-1.0 driver. Both send frames with a blocking bulk OUT.
+ */
+struct raw_usb {
+  libusb_context *ctx;
+  libusb_device_handle *handle;
+  uint8_t btEndpointIn;
+  uint8_t btEndpointOut;
+  bool bQueued;
+  struct libusb_transfer *in_transfer;
+  uint8_t abtIn[PN53x_EXTENDED_FRAME__DATA_MAX_LEN + PN53x_EXTENDED_FRAME__OVERHEAD];
+  int szIn;
+};
+
+static void LIBUSB_CALL
+raw_usb_in_callback(struct libusb_transfer *transfer)
+{
+  struct raw_usb *raw = transfer->user_data;
+  raw->szIn = (transfer->status == LIBUSB_TRANSFER_COMPLETED) ? transfer->actual_length : LIBUSB_ERROR_IO;
+}
+
+static void
+raw_usb_open(struct raw_usb *raw, bool bQueued)
+{
+  libusb_device **devices;
+  struct libusb_config_descriptor *config;
+
+  memset(raw, 0, sizeof(*raw));
+  raw->bQueued = bQueued;
+  cut_assert_equal_int(LIBUSB_SUCCESS, libusb_init(&raw->ctx), cut_message("libusb_init"));
+  cut_assert_equal_int(1, libusb_get_device_list(raw->ctx, &devices), cut_message("libusb_get_device_list"));
+  cut_assert_equal_int(LIBUSB_SUCCESS, libusb_open(devices[0], &raw->handle), cut_message("libusb_open"));
+  cut_assert_equal_int(LIBUSB_SUCCESS, libusb_get_active_config_descriptor(devices[0], &config), cut_message("config descriptor"));
+  const struct libusb_interface_descriptor *pInterface = &config->interface[0].altsetting[0];
+  for (uint8_t i = 0; i < pInterface->bNumEndpoints; i++) {
+    if ((pInterface->endpoint[i].bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
+      raw->btEndpointIn = pInterface->endpoint[i].bEndpointAddress;
+    else
+      raw->btEndpointOut = pInterface->endpoint[i].bEndpointAddress;
+  }
+  libusb_free_config_descriptor(config);
+  libusb_free_device_list(devices, 1);
+  cut_assert_equal_int(LIBUSB_SUCCESS, libusb_claim_interface(raw->handle, 0), cut_message("libusb_claim_interface"));
+  if (bQueued) {
+    raw->in_transfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(raw->in_transfer, raw->handle, raw->btEndpointIn, raw->abtIn, sizeof(raw->abtIn), raw_usb_in_callback, raw, 0);
+    cut_assert_equal_int(LIBUSB_SUCCESS, libusb_submit_transfer(raw->in_transfer), cut_message("IN transfer"));
+  }
+}
+
+static void
+raw_usb_close(struct raw_usb *raw)
+{
+  if (raw->in_transfer) {
+    libusb_cancel_transfer(raw->in_transfer);
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    libusb_handle_events_timeout_completed(raw->ctx, &tv, NULL);
+    libusb_free_transfer(raw->in_transfer);
+  }
+  libusb_release_interface(raw->handle, 0);
+  libusb_close(raw->handle);
+  libusb_exit(raw->ctx);
+}
+
+// Next packet from the chip, the queued IN transfer is submitted again as soon as it is done
+static int
+raw_usb_read(struct raw_usb *raw, uint8_t *pbtRx, size_t szRx)
+{
+  int res;
+  if (!raw->bQueued) {
+    int transferred;
+    if ((res = libusb_bulk_transfer(raw->handle, raw->btEndpointIn, pbtRx, szRx, &transferred, 500)) < 0)
+      return res;
+    return transferred;
+  }
+  while (!raw->szIn) {
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 500000 };
+    libusb_handle_events_timeout_completed(raw->ctx, &tv, NULL);
+  }
+  if ((res = raw->szIn) > 0)
+    memcpy(pbtRx, raw->abtIn, MIN((size_t) res, szRx));
+  raw->szIn = 0;
+  libusb_submit_transfer(raw->in_transfer);
+  return res;
+}
+
+static int
+raw_usb_diagnose(struct raw_usb *raw, size_t szPayload)
+{
+  static const uint8_t abtAck[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+  uint8_t abtFrame[PN53x_NORMAL_FRAME__DATA_MAX_LEN + PN53x_NORMAL_FRAME__OVERHEAD] = { 0x00, 0x00, 0xff, 3 + szPayload, 256 - (3 + szPayload), 0xd4, Diagnose, 0x00 };
+  uint8_t abtRx[PN53x_NORMAL_FRAME__DATA_MAX_LEN + PN53x_NORMAL_FRAME__OVERHEAD];
+  uint8_t btDcs = 256 - 0xd4 - Diagnose;
+  int transferred;
+  int res;
+
+  for (size_t n = 0; n < szPayload; n++) {
+    abtFrame[8 + n] = (uint8_t) n;
+    btDcs -= (uint8_t) n;
+  }
+  abtFrame[8 + szPayload] = btDcs;
+  abtFrame[9 + szPayload] = 0x00;
+  if (libusb_bulk_transfer(raw->handle, raw->btEndpointOut, abtFrame, 10 + szPayload, &transferred, 500) < 0)
+    return NFC_EIO;
+  res = raw_usb_read(raw, abtRx, sizeof(abtRx));
+  if ((res != sizeof(abtAck)) || memcmp(abtRx, abtAck, sizeof(abtAck)))
+    return NFC_EIO;
+  res = raw_usb_read(raw, abtRx, sizeof(abtRx));
+  if ((res < 7) || (abtRx[5] != 0xd5) || (abtRx[6] != Diagnose + 1))
+    return NFC_EIO;
+  return abtRx[3] - 2;
+}
+
+static double
+raw_usb_commands_per_second(bool bQueued)
+{
+  struct raw_usb raw;
+  struct timespec start, end;
+
+  raw_usb_open(&raw, bQueued);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    cut_assert_equal_int(17, raw_usb_diagnose(&raw, 16), cut_message("bare Diagnose #%d", i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  raw_usb_close(&raw);
+  return DIAGNOSE_COUNT * 1e6 / elapsed_us(&start, &end);
+}
+
+void
+test_pn53x_usb_in_transfer_queued(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  // SCM Micro / SCL3711-NFC&RW
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+
+  // The first command also flushes the register write-back cache
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("first Diagnose"));
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  size_t commands = stats->commands;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < DIAGNOSE_COUNT; i++) {
+    cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose #%d", i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double total_us = elapsed_us(&start, &end);
+
+  cut_assert_equal_size(DIAGNOSE_COUNT, stats->commands - commands, cut_message("commands seen by the chip"));
+  // The response must never have to wait for an IN transfer to be submitted
+  cut_assert_equal_size(0, stats->out_without_in_pending, cut_message("OUT transfers without IN transfer pending"));
+  cut_assert_equal_size(0, stats->sync_in_transfers, cut_message("blocking IN transfers"));
+
+  nfc_close(device);
+  nfc_exit(context);
+
+  // The same commands through the same simulated chip, without libnfc, read
+  // the libusb-0.1 way then with the IN transfer kept queued
+  libusb_mock_reset(0x04e6, 0x5591);
+  const double legacy_rate = raw_usb_commands_per_second(false);
+  cut_assert_equal_size(DIAGNOSE_COUNT, stats->commands, cut_message("libusb-0.1 commands seen by the chip"));
+  cut_assert_equal_size(DIAGNOSE_COUNT, stats->out_without_in_pending, cut_message("libusb-0.1 OUT transfers without IN transfer pending"));
+  cut_assert_equal_size(2 * DIAGNOSE_COUNT, stats->sync_in_transfers, cut_message("libusb-0.1 blocking IN transfers"));
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  const double queued_rate = raw_usb_commands_per_second(true);
+  cut_assert_equal_size(DIAGNOSE_COUNT, stats->commands, cut_message("queued commands seen by the chip"));
+  cut_assert_equal_size(0, stats->out_without_in_pending, cut_message("queued OUT transfers without IN transfer pending"));
+
+  cut_notify("libnfc with libusb-1.0: %.1f commands/s, %.1f us per command; "
+             "bare libusb-0.1 reads: %.1f commands/s, %.1f us per command, 2 IN transfers started after each OUT; "
+             "bare queued IN transfer: %.1f commands/s, %.1f us per command, none started after an OUT",
+             DIAGNOSE_COUNT * 1e6 / total_us, total_us / DIAGNOSE_COUNT, legacy_rate, 1e6 / legacy_rate, queued_rate, 1e6 / queued_rate);
+}
+
+void
+test_pn53x_usb_extended_frame(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+
+  // Larger than a single 64 bytes packet and than a normal frame
+  cut_assert_equal_int(261, diagnose(device, 260), cut_message("extended Diagnose"));
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after extended one"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_abort_latency(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("first Diagnose"));
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  size_t event_handling = stats->event_handling;
+
+  // The simulated chip ACKs TgInitAsTarget but no initiator ever comes
+  struct abort_thread_data thread_data = { .device = device };
+  pthread_t thread;
+  cut_assert_equal_int(0, pthread_create(&thread, NULL, abort_thread, &thread_data), cut_message("pthread_create"));
+
+  const uint8_t abtCmd[] = { TgInitAsTarget, 0x00 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  int res = pn53x_transceive(device, abtCmd, sizeof(abtCmd), abtRx, sizeof(abtRx), 0);
+  struct timespec returned_at;
+  clock_gettime(CLOCK_MONOTONIC, &returned_at);
+  pthread_join(thread, NULL);
+
+  cut_assert_equal_int(NFC_EOPABORTED, res, cut_message("TgInitAsTarget aborted"));
+  double latency_us = elapsed_us(&thread_data.aborted_at, &returned_at);
+  cut_notify("Aborted in %.1f us", latency_us);
+  cut_assert_operator(latency_us, <, 20000, cut_message("abort latency"));
+  // An idle wait must not wake up until something happens
+  cut_assert_operator_size(stats->event_handling - event_handling, <, 3, cut_message("event loop runs while waiting"));
+
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after abort"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_list_devices(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  nfc_connstring connstrings[1];
+
+  if (nfc_list_devices(context, connstrings, 1) != 1) {
+    nfc_exit(context);
+    cut_omit("pn53x_usb driver not available");
+  }
+  for (int i = 0; i < LIST_COUNT; i++) {
+    cut_assert_equal_size(1, nfc_list_devices(context, connstrings, 1), cut_message("nfc_list_devices #%d", i));
+  }
+  cut_assert_equal_string("pn53x_usb:001:002", connstrings[0], cut_message("connstring"));
+  // Hotplug keeps the registry current, the bus is neither walked again nor are devices opened
+  cut_assert_equal_size(0, stats->device_lists, cut_message("USB bus enumerations"));
+  cut_assert_equal_size(0, stats->opens, cut_message("USB devices opened"));
+
+  libusb_mock_unplug();
+  cut_assert_equal_size(0, nfc_list_devices(context, connstrings, 1), cut_message("nfc_list_devices after unplug"));
+  libusb_mock_reset(0x04e6, 0x5591);
+  cut_assert_equal_size(1, nfc_list_devices(context, connstrings, 1), cut_message("nfc_list_devices after replug"));
+
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_register_cache(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+
+  // ISO14443-B is selected by hand: CIU framing, speed and CRC are set before each attempt
+  const nfc_modulation nm = { .nmt = NMT_ISO14443BI, .nbr = NBR_106 };
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  size_t register_reads = stats->register_reads;
+  size_t register_writes = stats->register_writes;
+  cut_assert_operator_int(0, <=, nfc_initiator_select_passive_target(device, nm, NULL, 0, NULL), cut_message("first select"));
+  cut_notify("First select: %zu ReadRegister, %zu WriteRegister", stats->register_reads - register_reads, stats->register_writes - register_writes);
+
+  register_reads = stats->register_reads;
+  register_writes = stats->register_writes;
+  for (int i = 0; i < SELECT_COUNT; i++) {
+    cut_assert_operator_int(0, <=, nfc_initiator_select_passive_target(device, nm, NULL, 0, NULL), cut_message("select #%d", i));
+  }
+  // Registers already hold the requested values, neither read nor written again
+  cut_assert_equal_size(0, stats->register_reads - register_reads, cut_message("ReadRegister commands"));
+  cut_assert_equal_size(0, stats->register_writes - register_writes, cut_message("WriteRegister commands"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_led_register_cache(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  // SCL3711 LED follows the field through a masked write of P3
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, true), cut_message("field on"));
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  size_t register_reads = stats->register_reads;
+  size_t register_writes = stats->register_writes;
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, i % 2), cut_message("field switch #%d", i));
+  }
+  // P3 also holds input pins, it is read again before each masked write
+  cut_assert_equal_size(FIELD_COUNT, stats->register_reads - register_reads, cut_message("ReadRegister commands"));
+  cut_assert_equal_size(FIELD_COUNT, stats->register_writes - register_writes, cut_message("WriteRegister commands"));
+
+  register_writes = stats->register_writes;
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, true), cut_message("field on again"));
+  cut_assert_equal_size(0, stats->register_writes - register_writes, cut_message("WriteRegister commands when LED is already on"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_property_state(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  // Polling for a card: each listing disables infinite select again
+  const nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  nfc_target ant[1];
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  size_t rf_configurations = stats->rf_configurations;
+  for (int i = 0; i < POLL_COUNT; i++) {
+    cut_assert_equal_int(0, nfc_initiator_list_passive_targets(device, nm, ant, 1), cut_message("nfc_initiator_list_passive_targets #%d", i));
+  }
+  cut_assert_equal_size(1, stats->rf_configurations - rf_configurations, cut_message("RFConfiguration commands"));
+
+  // Field is switched on by InListPassiveTarget, its state is unknown now
+  rf_configurations = stats->rf_configurations;
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false), cut_message("field off"));
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_ACTIVATE_FIELD, false), cut_message("field off again"));
+  cut_assert_equal_size(1, stats->rf_configurations - rf_configurations, cut_message("RFConfiguration commands to switch field off"));
+
+  // Target mode does not keep RF settings
+  const uint8_t abtCmd[] = { TgInitAsTarget, 0x00 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  cut_assert_equal_int(NFC_ETIMEOUT, pn53x_transceive(device, abtCmd, sizeof(abtCmd), abtRx, sizeof(abtRx), 10), cut_message("TgInitAsTarget"));
+  rf_configurations = stats->rf_configurations;
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false), cut_message("infinite select off after target mode"));
+  cut_assert_equal_size(1, stats->rf_configurations - rf_configurations, cut_message("RFConfiguration commands after target mode"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_chaining(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("first Diagnose"));
+
+  // The simulated target echoes the data, more than one frame is needed both ways
+  exchange_chained(device, CHAINED_SMALL_LEN);
+  exchange_chained(device, CHAINED_LARGE_LEN);
+
+  // A receive buffer too short is reported once the whole response is drained
+  cut_assert_equal_int(NFC_EOVFLOW, nfc_initiator_transceive_bytes(device, abtChainedTx, CHAINED_SMALL_LEN, abtChainedRx, CHAINED_SMALL_LEN / 2, 1000), cut_message("short receive buffer"));
+  cut_assert_equal_int(16, nfc_initiator_transceive_bytes(device, abtChainedTx, 16, abtChainedRx, 16, 1000), cut_message("exchange after overflow"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+static int
+exchange_apdu(nfc_device *device, const nfc_target *pnt, const nfc_iovec aiov[], size_t szIov, size_t *pszFrames)
+{
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  // The register writes left pending by nfc_initiator_init() go with the first frame, they are not blocks
+  const size_t commands = stats->commands - stats->register_reads - stats->register_writes;
+  const int res = nfc_initiator_transceive_apdu(device, pnt, aiov, szIov, abtChainedRx, sizeof(abtChainedRx), 1000);
+  *pszFrames = stats->commands - stats->register_reads - stats->register_writes - commands;
+  return res;
+}
+
+void
+test_pn53x_usb_apdu(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+  // libnfc runs the block protocol, the chip sends the blocks as they are
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_EASY_FRAMING, false), cut_message("easy framing off"));
+
+  // Extended length APDU: header, data and Le given apart
+  static const uint8_t abtHeader[] = { 0x00, 0xda, 0x01, 0x02, 0x00, APDU_DATA_LEN >> 8, APDU_DATA_LEN & 0xff };
+  static const uint8_t abtLe[] = { 0x00, 0x00 };
+  for (size_t n = 0; n < APDU_DATA_LEN; n++)
+    abtChainedTx[n] = (uint8_t)(n * 7);
+  const nfc_iovec aiov[] = {
+    { .pbtData = abtHeader, .szData = sizeof(abtHeader) },
+    { .pbtData = abtChainedTx, .szData = APDU_DATA_LEN },
+    { .pbtData = abtLe, .szData = sizeof(abtLe) },
+  };
+  const size_t szApdu = sizeof(abtHeader) + APDU_DATA_LEN + sizeof(abtLe);
+  // The simulated card echoes the APDU in 61 bytes blocks, each one but the first is asked with R(ACK)
+  const size_t szResponseFrames = (szApdu + 60) / 61 - 1;
+
+  // ATS T0 0x78: the card accepts 256 bytes frames, 253 bytes of data each
+  nfc_target nt = { .nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 } };
+  const uint8_t abtAts[] = { 0x78, 0x77, 0x94, 0x02 };
+  memcpy(nt.nti.nai.abtAts, abtAts, sizeof(abtAts));
+  nt.nti.nai.szAtsLen = sizeof(abtAts);
+  size_t szFrames;
+  cut_assert_equal_int((int) szApdu, exchange_apdu(device, &nt, aiov, 3, &szFrames), cut_message("APDU echoed"));
+  cut_assert_equal_memory(abtHeader, sizeof(abtHeader), abtChainedRx, sizeof(abtHeader), cut_message("header echoed"));
+  cut_assert_equal_memory(abtChainedTx, APDU_DATA_LEN, abtChainedRx + sizeof(abtHeader), APDU_DATA_LEN, cut_message("data echoed"));
+  cut_assert_equal_size((szApdu + 252) / 253 + szResponseFrames, szFrames, cut_message("frames with FSC 256"));
+  const size_t szLargeFrames = szFrames;
+
+  // Without ATS the card is assumed to accept 32 bytes frames only
+  nt.nti.nai.szAtsLen = 0;
+  cut_assert_equal_int((int) szApdu, exchange_apdu(device, &nt, aiov, 3, &szFrames), cut_message("APDU echoed with default FSC"));
+  cut_assert_equal_size((szApdu + 28) / 29 + szResponseFrames, szFrames, cut_message("frames with FSC 32"));
+  cut_notify("%zu bytes APDU: %zu frames with FSC 256, %zu frames with FSC 32", szApdu, szLargeFrames, szFrames);
+
+  // The card asks for three times longer before answering, the next wait is that long
+  libusb_mock_card_wtx(3);
+  cut_assert_equal_int((int) szApdu, exchange_apdu(device, &nt, aiov, 3, &szFrames), cut_message("APDU echoed after WTX"));
+  cut_assert_equal_uint(3000, libusb_mock_stats()->wtx_timeout, cut_message("wait extended by WTXM"));
+  cut_assert_equal_size((szApdu + 28) / 29 + szResponseFrames + 1, szFrames, cut_message("frames with S(WTX)"));
+
+  // Without a target there is no frame size to go by
+  cut_assert_equal_int(NFC_EINVARG, nfc_initiator_transceive_apdu(device, NULL, aiov, 3, abtChainedRx, sizeof(abtChainedRx), 1000), cut_message("NULL target"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_pps(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false), cut_message("infinite select off"));
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_AUTO_PPS, true), cut_message("PPS on"));
+
+  // The card takes 212 and 424 kbps both ways
+  libusb_mock_cards(1, 0x33);
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nm, NULL, 0, &nt), cut_message("select"));
+  cut_assert_equal_int(NBR_424, nt.nm.nbr, cut_message("negotiated rate"));
+  cut_assert_equal_size(1, stats->psl_requests, cut_message("InPSL commands"));
+  cut_assert_equal_int(0, nfc_initiator_deselect_target(device), cut_message("deselect"));
+  libusb_mock_cards(1, 0x33);
+
+  // A higher rate asked by the caller caps the negotiated one
+  nm.nbr = NBR_212;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nm, NULL, 0, &nt), cut_message("select with 212 kbps"));
+  cut_assert_equal_int(NBR_212, nt.nm.nbr, cut_message("rate capped"));
+  cut_assert_equal_int(0, nfc_initiator_deselect_target(device), cut_message("deselect"));
+  libusb_mock_cards(1, 0x33);
+
+  // Without PPS, the target stays at 106 kbps
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_AUTO_PPS, false), cut_message("PPS off"));
+  const size_t psl_requests = stats->psl_requests;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nm, NULL, 0, &nt), cut_message("select without PPS"));
+  cut_assert_equal_int(NBR_106, nt.nm.nbr, cut_message("rate without PPS"));
+  cut_assert_equal_size(psl_requests, stats->psl_requests, cut_message("InPSL commands without PPS"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_list_targets(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  const nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  nfc_target ant[8];
+  for (size_t cards = 1; cards <= 4; cards++) {
+    libusb_mock_cards(cards, 0x00);
+    const size_t list_requests = stats->list_requests;
+    const size_t commands = stats->commands;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const int res = nfc_initiator_list_passive_targets(device, nm, ant, 8);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cut_assert_equal_int((int) cards, res, cut_message("%zu cards listed", cards));
+    cut_notify("%zu cards: %zu InListPassiveTarget, %zu commands, %.1f us", cards, stats->list_requests - list_requests, stats->commands - commands, elapsed_us(&start, &end));
+    // Two cards per round trip, a round with a single card or none is the last one
+    cut_assert_equal_size(cards / 2 + 1, stats->list_requests - list_requests, cut_message("InListPassiveTarget for %zu cards", cards));
+    for (size_t n = 0; n < cards; n++) {
+      cut_assert_equal_size(4, ant[n].nti.nai.szUidLen, cut_message("UID length of card %zu", n));
+      cut_assert_equal_int((int) n, ant[n].nti.nai.abtUid[3], cut_message("UID of card %zu", n));
+      cut_assert_equal_size(4, ant[n].nti.nai.szAtsLen, cut_message("ATS length of card %zu", n));
+    }
+  }
+
+  // The listing stops when the array is full
+  libusb_mock_cards(4, 0x00);
+  cut_assert_equal_int(3, nfc_initiator_list_passive_targets(device, nm, ant, 3), cut_message("3 of 4 cards listed"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_two_targets(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  // A phone and a card, both left activated by the listing
+  libusb_mock_cards(2, 0x00);
+  const nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  nfc_target ant[2];
+  cut_assert_equal_int(2, nfc_initiator_list_passive_targets(device, nm, ant, 2), cut_message("2 targets listed"));
+
+  const struct libusb_mock_stats *stats = libusb_mock_stats();
+  const size_t list_requests = stats->list_requests;
+  const uint8_t abtTx[] = { 0x00, 0xa4, 0x04, 0x00 };
+  uint8_t abtRx[1];
+  for (int i = 0; i < 4; i++) {
+    const size_t n = i % 2;
+    cut_assert_equal_int(1, nfc_initiator_target_transceive_bytes(device, &(ant[n]), abtTx, sizeof(abtTx), abtRx, sizeof(abtRx), 0),
+                         cut_message("exchange #%d", i));
+    cut_assert_equal_int((int) n, abtRx[0], cut_message("exchange #%d answered by target %zu", i, n));
+  }
+  cut_assert_equal_size(list_requests, stats->list_requests, cut_message("no selection between exchanges"));
+
+  // Deselecting one target leaves the other one activated
+  cut_assert_equal_int(0, nfc_initiator_target_deselect(device, &(ant[0])), cut_message("deselect target 0"));
+  cut_assert_equal_int(NFC_ETGRELEASED, nfc_initiator_target_transceive_bytes(device, &(ant[0]), abtTx, sizeof(abtTx), abtRx, sizeof(abtRx), 0),
+                       cut_message("exchange with deselected target"));
+  cut_assert_equal_int(1, nfc_initiator_target_transceive_bytes(device, &(ant[1]), abtTx, sizeof(abtTx), abtRx, sizeof(abtRx), 0),
+                       cut_message("exchange with the other target"));
+  cut_assert_equal_int(1, abtRx[0], cut_message("answered by target 1"));
+  cut_assert_equal_int(0, nfc_initiator_target_release(device, &(ant[1])), cut_message("release target 1"));
+  cut_assert_equal_int(NFC_ETGRELEASED, nfc_initiator_target_release(device, &(ant[1])), cut_message("release target 1 again"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+struct async_callback_data {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t calls;
+  int res;
+};
+
+static void
+async_callback(nfc_device *pnd, const nfc_completion *pc)
+{
+  (void) pnd;
+  struct async_callback_data *data = pc->user_data;
+  pthread_mutex_lock(&data->mutex);
+  data->calls++;
+  data->res = pc->res;
+  pthread_cond_signal(&data->cond);
+  pthread_mutex_unlock(&data->mutex);
+}
+
+void
+test_pn53x_usb_async(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  // All the requests are queued at once, their outcomes come back in order
+  static uint8_t abtRx[ASYNC_COUNT][8];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < ASYNC_COUNT; n++) {
+    const uint8_t abtTx[] = { 0xd4, 0x00, n, n >> 8 };
+    cut_assert_equal_int(0, nfc_initiator_transceive_bytes_async(device, abtTx, sizeof(abtTx), abtRx[n], sizeof(abtRx[n]), 1000, NULL, &(abtRx[n])),
+                         cut_message("request #%zu queued", n));
+  }
+  for (size_t n = 0; n < ASYNC_COUNT; n++) {
+    nfc_completion completion;
+    cut_assert_equal_int(1, nfc_device_get_completion(device, &completion, 1000), cut_message("request #%zu completed", n));
+    cut_assert_equal_int(4, completion.res, cut_message("request #%zu answer", n));
+    cut_assert_equal_pointer(abtRx[n], completion.user_data, cut_message("request #%zu in order", n));
+    cut_assert_equal_int((int)(n & 0xff), completion.pbtRx[2], cut_message("request #%zu echoed", n));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cut_notify("%d queued requests: %.1f us per request", ASYNC_COUNT, elapsed_us(&start, &end) / ASYNC_COUNT);
+  nfc_completion completion;
+  cut_assert_equal_int(0, nfc_device_get_completion(device, &completion, -1), cut_message("no more completion"));
+
+  // A callback gets the outcome instead of the completion queue
+  struct async_callback_data data = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+  const uint8_t abtTx[] = { 0xd4, 0x00 };
+  cut_assert_equal_int(0, nfc_initiator_transceive_bytes_async(device, abtTx, sizeof(abtTx), abtRx[0], sizeof(abtRx[0]), 1000, async_callback, &data),
+                       cut_message("request with callback queued"));
+  pthread_mutex_lock(&data.mutex);
+  while (data.calls == 0)
+    pthread_cond_wait(&data.cond, &data.mutex);
+  pthread_mutex_unlock(&data.mutex);
+  cut_assert_equal_int(2, data.res, cut_message("callback answer"));
+  cut_assert_equal_int(0, nfc_device_get_completion(device, &completion, -1), cut_message("nothing in the completion queue"));
+
+  // A request still pending when the device is closed is completed anyway
+  cut_assert_equal_int(0, nfc_initiator_transceive_bytes_async(device, abtTx, sizeof(abtTx), abtRx[0], sizeof(abtRx[0]), 1000, async_callback, &data),
+                       cut_message("request before close queued"));
+  nfc_close(device);
+  cut_assert_equal_size(2, data.calls, cut_message("callback called before close returned"));
+  nfc_exit(context);
+}
+
+static void
+pollfd_callback(nfc_device *pnd, const nfc_completion *pc)
+{
+  (void) pnd;
+  size_t *pszCalls = pc->user_data;
+  (*pszCalls)++;
+}
+
+void
+test_pn53x_usb_pollfd(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  struct pollfd pfd = { .fd = nfc_device_get_pollfd(device), .events = POLLIN };
+  cut_assert_operator_int(pfd.fd, >=, 0, cut_message("nfc_device_get_pollfd"));
+  cut_assert_equal_int(0, poll(&pfd, 1, 0), cut_message("idle fd is not readable"));
+
+  // Completions are dispatched on this thread once the fd says so
+  static uint8_t abtRx[ASYNC_COUNT][8];
+  const uint8_t abtTx[] = { 0xd4, 0x00 };
+  size_t szCalls = 0;
+  for (size_t n = 0; n < ASYNC_COUNT; n++)
+    cut_assert_equal_int(0, nfc_initiator_transceive_bytes_async(device, abtTx, sizeof(abtTx), abtRx[n], sizeof(abtRx[n]), 1000, NULL, &szCalls),
+                         cut_message("request #%zu queued", n));
+  while (szCalls < ASYNC_COUNT) {
+    cut_assert_equal_int(1, poll(&pfd, 1, 1000), cut_message("fd readable after %zu completions", szCalls));
+    cut_assert_operator_int(nfc_device_process_events(device, pollfd_callback), >, 0, cut_message("events processed"));
+  }
+  cut_assert_equal_size(ASYNC_COUNT, szCalls, cut_message("every completion processed once"));
+  cut_assert_equal_int(0, poll(&pfd, 1, 0), cut_message("fd drained"));
+  cut_assert_equal_int(0, nfc_device_process_events(device, pollfd_callback), cut_message("nothing left to process"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+struct monitor_events {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t arrivals;
+  size_t removals;
+  struct timespec removed;
+};
+
+static void
+monitor_callback(nfc_device *pnd, nfc_presence_event event, const nfc_target *pnt, void *user_data)
+{
+  (void) pnd;
+  (void) pnt;
+  struct monitor_events *events = user_data;
+  pthread_mutex_lock(&events->mutex);
+  if (event == NFC_TARGET_ARRIVED) {
+    events->arrivals++;
+  } else {
+    events->removals++;
+    clock_gettime(CLOCK_MONOTONIC, &events->removed);
+  }
+  pthread_cond_signal(&events->cond);
+  pthread_mutex_unlock(&events->mutex);
+}
+
+// Wait up to a second for *pszCount to reach count
+static size_t
+monitor_wait(struct monitor_events *events, const size_t *pszCount, const size_t count)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec++;
+  pthread_mutex_lock(&events->mutex);
+  while ((*pszCount < count) && (pthread_cond_timedwait(&events->cond, &events->mutex, &deadline) == 0))
+    ;
+  const size_t res = *pszCount;
+  pthread_mutex_unlock(&events->mutex);
+  return res;
+}
+
+void
+test_pn53x_usb_monitor(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  libusb_mock_cards(1, 0x00);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+
+  // The statistics are only read while the monitor does not run
+  const size_t probes = libusb_mock_stats()->presence_probes;
+  struct monitor_events events = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+  const nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  cut_assert_equal_int(0, nfc_initiator_monitor_start(device, &nm, 1, MONITOR_PERIOD_MS, monitor_callback, &events),
+                       cut_message("nfc_initiator_monitor_start"));
+  cut_assert_equal_size(1, monitor_wait(&events, &events.arrivals, 1), cut_message("card arrival"));
+
+  // The card stays there while it answers the probes
+  struct timespec wait = { .tv_sec = 0, .tv_nsec = 5 * MONITOR_PERIOD_MS * 1000000L };
+  nanosleep(&wait, NULL);
+  cut_assert_equal_size(0, monitor_wait(&events, &events.removals, 0), cut_message("no removal while the card answers"));
+
+  // Taking it away is noticed within a few periods
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  libusb_mock_cards(0, 0x00);
+  cut_assert_equal_size(1, monitor_wait(&events, &events.removals, 1), cut_message("card removal"));
+  const double latency_us = elapsed_us(&start, &events.removed);
+  cut_notify("Removal noticed after %.1f ms", latency_us / 1000);
+  cut_assert_operator_int(latency_us, <, 10 * MONITOR_PERIOD_MS * 1000, cut_message("removal latency"));
+
+  // Another card is another arrival
+  libusb_mock_cards(1, 0x00);
+  cut_assert_equal_size(2, monitor_wait(&events, &events.arrivals, 2), cut_message("card arrival again"));
+
+  cut_assert_equal_int(0, nfc_initiator_monitor_stop(device), cut_message("nfc_initiator_monitor_stop"));
+  cut_assert_operator_int(libusb_mock_stats()->presence_probes, >, probes, cut_message("presence checked with R(NAK)"));
+  cut_assert_equal_int(NFC_EINVARG, nfc_initiator_monitor_stop(device), cut_message("monitor already stopped"));
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+void
+test_pn53x_usb_presence_timeout(void)
+{
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  libusb_mock_cards(1, 0x00);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(0, nfc_initiator_init(device), cut_message("nfc_initiator_init"));
+  cut_assert_equal_int(0, nfc_device_set_property_bool(device, NP_INFINITE_SELECT, false), cut_message("infinite select off"));
+  const nfc_modulation nm = { .nmt = NMT_ISO14443A, .nbr = NBR_106 };
+  nfc_target nt;
+  cut_assert_equal_int(1, nfc_initiator_select_passive_target(device, nm, NULL, 0, &nt), cut_message("select"));
+  cut_assert_equal_int(0, nfc_initiator_target_is_present(device, nt), cut_message("card present"));
+
+  // Answers which do not come in time tell nothing about the card
+  libusb_mock_mute(2);
+  cut_assert_equal_int(NFC_ETIMEOUT, nfc_initiator_target_is_present(device, nt), cut_message("probes not answered"));
+  cut_assert_equal_int(0, nfc_initiator_target_is_present(device, nt), cut_message("card kept"));
+
+  // The chip telling the card does not answer anymore does
+  libusb_mock_cards(0, 0x00);
+  cut_assert_equal_int(NFC_ETGRELEASED, nfc_initiator_target_is_present(device, nt), cut_message("card gone"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+// us per 262 bytes Diagnose, with LIBNFC_LOG_LEVEL set to log_level
+static double
+timed_diagnose(const char *log_level)
+{
+  setenv("LIBNFC_LOG_LEVEL", log_level, 1);
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("first Diagnose"));
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < LOG_OVERHEAD_COUNT; i++) {
+    cut_assert_equal_int(263, diagnose(device, 262), cut_message("Diagnose #%d", i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  nfc_close(device);
+  nfc_exit(context);
+  return elapsed_us(&start, &end) / LOG_OVERHEAD_COUNT;
+}
+
+void
+test_pn53x_usb_log_overhead(void)
+{
+  const char *env_log_level = getenv("LIBNFC_LOG_LEVEL");
+  char *old_log_level = env_log_level ? strdup(env_log_level) : NULL;
+
+  const double off_us = timed_diagnose("0");
+  // Everything at debug level, thrown away
+  fflush(stderr);
+  int stderr_fd = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  const double debug_us = timed_diagnose("3");
+  fflush(stderr);
+  dup2(stderr_fd, STDERR_FILENO);
+  close(null_fd);
+  close(stderr_fd);
+
+  if (old_log_level) {
+    setenv("LIBNFC_LOG_LEVEL", old_log_level, 1);
+    free(old_log_level);
+  } else {
+    unsetenv("LIBNFC_LOG_LEVEL");
+  }
+
+  cut_notify("%.1f us per 262 bytes Diagnose with logging off, %.1f us with debug messages", off_us, debug_us);
+  // Nothing is formatted when logging is off
+  cut_assert_operator_double(off_us, <, debug_us, cut_message("logging off is cheaper"));
+}
+
+struct trace_thread_data {
+  nfc_device *device;
+  bool bStop;
+  size_t snapshots;
+  size_t torn;
+};
+
+// Snapshot the trace while the device is used, every record has to be whole
+static void *
+trace_thread(void *arg)
+{
+  struct trace_thread_data *thread_data = arg;
+  static nfc_trace_record records[16];
+
+  while (!__atomic_load_n(&thread_data->bStop, __ATOMIC_RELAXED)) {
+    const size_t szRecords = nfc_device_get_trace(thread_data->device, records, 16);
+    for (size_t n = 0; n < szRecords; n++) {
+      // Earlier commands may still be there, only the 262 bytes Diagnose are checked
+      if ((records[n].layer != NFC_TRACE_CHIP) || (records[n].direction != NFC_TRACE_TX) || (records[n].szFrame != 264))
+        continue;
+      bool bWhole = (records[n].szData == 264) && (records[n].abtData[0] == Diagnose);
+      for (size_t i = 0; bWhole && (i < 262); i++)
+        bWhole = records[n].abtData[2 + i] == (uint8_t) i;
+      if (!bWhole)
+        thread_data->torn++;
+    }
+    thread_data->snapshots++;
+  }
+  return NULL;
+}
+
+void
+test_pn53x_usb_trace(void)
+{
+  static nfc_trace_record records[8];
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose"));
+
+  // The last exchange: the command, its frame, the ACK, the response frame and the response
+  const size_t szRecords = nfc_device_get_trace(device, records, 5);
+  cut_assert_equal_size(5, szRecords, cut_message("records of a command"));
+  const struct {
+    nfc_trace_layer layer;
+    nfc_trace_direction direction;
+    size_t szFrame;
+  } expected[] = {
+    { NFC_TRACE_CHIP, NFC_TRACE_TX, 18 },
+    { NFC_TRACE_BUS, NFC_TRACE_TX, 18 + 8 },
+    { NFC_TRACE_BUS, NFC_TRACE_RX, 6 },
+    { NFC_TRACE_BUS, NFC_TRACE_RX, 17 + 9 },
+    { NFC_TRACE_CHIP, NFC_TRACE_RX, 17 },
+  };
+  for (size_t n = 0; n < szRecords; n++) {
+    cut_assert_equal_int(expected[n].layer, records[n].layer, cut_message("record #%zu layer", n));
+    cut_assert_equal_int(expected[n].direction, records[n].direction, cut_message("record #%zu direction", n));
+    cut_assert_equal_size(expected[n].szFrame, records[n].szFrame, cut_message("record #%zu length", n));
+    cut_assert_equal_size(expected[n].szFrame, records[n].szData, cut_message("record #%zu kept bytes", n));
+    cut_assert_equal_int(Diagnose, records[n].btCommand, cut_message("record #%zu command", n));
+    if (n)
+      cut_assert_true(records[n].timestamp >= records[n - 1].timestamp, cut_message("record #%zu timestamp", n));
+  }
+  cut_assert_equal_int(Diagnose, records[0].abtData[0], cut_message("command traced"));
+  cut_assert_equal_int(0x00, records[4].abtData[0], cut_message("response traced"));
+
+  // The ring only keeps the last frames
+  cut_assert_equal_size(8, nfc_device_get_trace(device, records, 8), cut_message("ring is larger than 8 records"));
+
+  FILE *capture = tmpfile();
+  cut_assert_not_null(capture);
+  cut_assert_equal_int(0, nfc_trace_write_pcapng(capture, records, szRecords), cut_message("capture written"));
+  // Section header, interface description, then 32 bytes + padded frame per record
+  size_t szCapture = 28 + 32;
+  for (size_t n = 0; n < szRecords; n++)
+    szCapture += 32 + ((4 + records[n].szData + 3) & ~3);
+  cut_assert_equal_int((int) szCapture, (int) ftell(capture), cut_message("capture length"));
+  uint8_t abtHeaders[28 + 32];
+  uint32_t abtMagic[3];
+  uint16_t uiField;
+  rewind(capture);
+  cut_assert_equal_size(1, fread(abtHeaders, sizeof(abtHeaders), 1, capture));
+  memcpy(abtMagic, abtHeaders, sizeof(abtMagic));
+  cut_assert_equal_uint(0x0a0d0d0a, abtMagic[0], cut_message("section header block"));
+  cut_assert_equal_uint(0x1a2b3c4d, abtMagic[2], cut_message("byte order magic"));
+  // 16 bit fields are in the byte order of the host too
+  memcpy(&uiField, abtHeaders + 12, sizeof(uiField));
+  cut_assert_equal_uint(1, uiField, cut_message("major version"));
+  memcpy(&uiField, abtHeaders + 28 + 8, sizeof(uiField));
+  cut_assert_equal_uint(147, uiField, cut_message("link type"));
+  memcpy(&uiField, abtHeaders + 28 + 16, sizeof(uiField));
+  cut_assert_equal_uint(9, uiField, cut_message("if_tsresol option"));
+  cut_assert_equal_uint(9, abtHeaders[28 + 20], cut_message("nanosecond resolution"));
+  fclose(capture);
+
+  // Commands go on while another thread reads the trace
+  struct trace_thread_data thread_data = { .device = device, .bStop = false, .snapshots = 0, .torn = 0 };
+  pthread_t thread;
+  struct timespec start, end;
+  pthread_create(&thread, NULL, trace_thread, &thread_data);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < TRACE_OVERHEAD_COUNT; i++) {
+    cut_assert_equal_int(263, diagnose(device, 262), cut_message("Diagnose #%d", i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  __atomic_store_n(&thread_data.bStop, true, __ATOMIC_RELAXED);
+  pthread_join(thread, NULL);
+  const double command_us = elapsed_us(&start, &end) / TRACE_OVERHEAD_COUNT;
+  cut_assert_equal_size(0, thread_data.torn, cut_message("torn records in %zu snapshots", thread_data.snapshots));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < TRACE_OVERHEAD_COUNT; i++)
+    nfc_device_get_trace(device, records, 1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double snapshot_us = elapsed_us(&start, &end) / TRACE_OVERHEAD_COUNT;
+  cut_notify("%.1f us per 262 bytes Diagnose with 5 records each, %.2f us to copy one record", command_us, snapshot_us);
+
+  nfc_close(device);
+  nfc_exit(context);
+}
+
+static const nfc_command_stats *
+command_stats(const nfc_device_stats *stats, uint8_t btCommand)
+{
+  for (size_t n = 0; n < stats->szCommands; n++) {
+    if (stats->command_stats[n].btCommand == btCommand)
+      return &stats->command_stats[n];
+  }
+  return NULL;
+}
+
+void
+test_pn53x_usb_stats(void)
+{
+  static nfc_device_stats stats;
+  nfc_context *context;
+  nfc_init(&context);
+
+  libusb_mock_reset(0x04e6, 0x5591);
+  nfc_device *device = open_mock(context);
+  // Whatever nfc_open() sent is forgotten
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("first Diagnose"));
+  nfc_device_reset_stats(device);
+
+  for (int i = 0; i < STATS_COUNT; i++) {
+    cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose #%d", i));
+  }
+  // A card is there but none is activated, R(NAK) gets a timeout status
+  libusb_mock_cards(1, 0x80);
+  const uint8_t abtProbe[] = { InCommunicateThru, 0xb2 };
+  uint8_t abtRx[PN53x_EXTENDED_FRAME__DATA_MAX_LEN];
+  cut_assert_equal_int(NFC_ERFTRANS, pn53x_transceive(device, abtProbe, sizeof(abtProbe), abtRx, sizeof(abtRx), 500), cut_message("R(NAK) without card"));
+  // The simulated chip ACKs TgInitAsTarget but no initiator ever comes
+  const uint8_t abtInit[] = { TgInitAsTarget, 0x00 };
+  cut_assert_equal_int(NFC_ETIMEOUT, pn53x_transceive(device, abtInit, sizeof(abtInit), abtRx, sizeof(abtRx), 20), cut_message("TgInitAsTarget"));
+
+  nfc_device_get_stats(device, &stats);
+  cut_assert_equal_int(STATS_COUNT + 2, stats.commands, cut_message("commands sent"));
+  cut_assert_equal_int(1, stats.timeouts, cut_message("timeouts"));
+  cut_assert_equal_int(0, stats.io_errors, cut_message("I/O errors"));
+  cut_assert_equal_int(1, stats.status_errors[0x01], cut_message("timeout status"));
+  // Each command and response comes with its 2 bytes TFI and command code, then a normal frame
+  cut_assert_equal_int(STATS_COUNT * 18 + 2 + 2, (int) stats.payload_tx_bytes, cut_message("payload sent"));
+  cut_assert_equal_int(STATS_COUNT * (18 + 8) + (2 + 8) + (2 + 8) + 6, (int) stats.wire_tx_bytes, cut_message("bytes written, ACK included"));
+  cut_assert_operator(stats.wire_rx_bytes, >, stats.payload_rx_bytes + (STATS_COUNT + 1) * (6 + 8), cut_message("bytes read, ACK included"));
+  cut_assert_equal_int(STATS_COUNT + 2, stats.ack_wait.count, cut_message("ACKs"));
+
+  const nfc_command_stats *pcs = command_stats(&stats, Diagnose);
+  cut_assert_not_null(pcs);
+  cut_assert_equal_int(STATS_COUNT, pcs->latency.count, cut_message("Diagnose latencies"));
+  cut_assert_equal_int(0, pcs->errors, cut_message("Diagnose errors"));
+  cut_assert_true(pcs->latency.min_us <= pcs->latency.p50_us, cut_message("min <= p50"));
+  cut_assert_true(pcs->latency.p50_us <= pcs->latency.p90_us, cut_message("p50 <= p90"));
+  cut_assert_true(pcs->latency.p90_us <= pcs->latency.p99_us, cut_message("p90 <= p99"));
+  cut_assert_true(pcs->latency.p99_us <= pcs->latency.max_us, cut_message("p99 <= max"));
+  uint32_t buckets = 0;
+  for (size_t n = 0; n < NFC_STATS_BUCKETS; n++)
+    buckets += pcs->latency.buckets[n];
+  cut_assert_equal_int(STATS_COUNT, buckets, cut_message("histogram samples"));
+  cut_notify("Diagnose: p50 %u us, p90 %u us, p99 %u us, max %u us; ACK wait p50 %u us",
+             pcs->latency.p50_us, pcs->latency.p90_us, pcs->latency.p99_us, pcs->latency.max_us, stats.ack_wait.p50_us);
+
+  pcs = command_stats(&stats, InCommunicateThru);
+  cut_assert_not_null(pcs);
+  cut_assert_equal_int(1, pcs->errors, cut_message("InCommunicateThru errors"));
+  cut_assert_equal_int(1, pcs->latency.count, cut_message("InCommunicateThru latencies"));
+  pcs = command_stats(&stats, TgInitAsTarget);
+  cut_assert_not_null(pcs);
+  cut_assert_equal_int(1, pcs->timeouts, cut_message("TgInitAsTarget timeouts"));
+  cut_assert_equal_int(0, pcs->latency.count, cut_message("TgInitAsTarget latencies"));
+
+  nfc_device_reset_stats(device);
+  nfc_device_get_stats(device, &stats);
+  cut_assert_equal_int(0, stats.commands, cut_message("commands after reset"));
+  cut_assert_equal_int(0, (int) stats.wire_rx_bytes, cut_message("bytes after reset"));
+  cut_assert_equal_int(0, command_stats(&stats, Diagnose)->latency.count, cut_message("Diagnose latencies after reset"));
+  cut_assert_equal_int(17, diagnose(device, 16), cut_message("Diagnose after reset"));
+  nfc_device_get_stats(device, &stats);
+  cut_assert_equal_int(1, command_stats(&stats, Diagnose)->latency.count, cut_message("Diagnose after reset"));
+
+  nfc_close(device);
+  nfc_exit(context);
+}